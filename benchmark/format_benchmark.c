@@ -0,0 +1,186 @@
+/*
+* Copyright (c) 2016 Saferbytes s.r.l.s.
+*
+* You can redistribute it and/or modify it under the terms of the MIT license.
+* See LICENSE for details.
+*/
+
+/*
+* Size, encoding and decoding speed of the result formats (see deepviz_result_format_set()).
+* Usage: format-benchmark [JSON file]
+* The file holds the "data" of a response, for instance a saved report; without it a synthetic report
+* is used. "encode" goes from the parsed tree to the result, as parse_deepviz_response() does, and
+* "decode" from the result back to a tree. The private helpers are not exported by the Windows DLL:
+* the benchmark is meant for the Linux build.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "c-deepviz.h"
+#include "c-deepviz_private.h"
+
+#define     BENCHMARK_RUNS              5
+#define     BENCHMARK_EVENTS            20000
+
+
+static double benchmark_time(void){
+
+#ifdef _WIN32
+    LARGE_INTEGER   counter;
+    LARGE_INTEGER   frequency;
+
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+    return (double)counter.QuadPart / (double)frequency.QuadPart;
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+}
+
+
+static json_t* benchmark_hex(unsigned int seed, size_t len){
+
+    char    hex[65];
+    size_t  i;
+
+    for (i = 0; i < len && i < sizeof(hex) - 1; i++){
+        seed = seed * 1103515245 + 12345;
+        hex[i] = "0123456789abcdef"[(seed >> 16) & 0x0F];
+    }
+    hex[i] = 0;
+
+    return json_string(hex);
+}
+
+
+/* Shaped like a sample report: hashes, a long behavioural trace, network indicators and strings */
+static json_t* benchmark_report(void){
+
+    static const char   *apis[] = { "CreateFileW", "RegSetValueExW", "WriteProcessMemory", "connect", "NtCreateSection" };
+    json_t              *report;
+    json_t              *events;
+    json_t              *ips;
+    json_t              *domains;
+    json_t              *strings;
+    char                text[64];
+    unsigned int        i;
+
+    report = json_object();
+    events = json_array();
+    ips = json_array();
+    domains = json_array();
+    strings = json_array();
+
+    json_object_set_new(report, "md5", benchmark_hex(1, 32));
+    json_object_set_new(report, "sha1", benchmark_hex(2, 40));
+    json_object_set_new(report, "sha256", benchmark_hex(3, 64));
+    json_object_set_new(report, "classification", json_pack("{sssisb}", "result", "malicious", "score", 87, "packed", 1));
+
+    for (i = 0; i < BENCHMARK_EVENTS; i++){
+        snprintf(text, sizeof(text), "C:\\Users\\user\\AppData\\Local\\Temp\\%08x.tmp", i * 2654435761u);
+        json_array_append_new(events, json_pack("{sisssisfs[si]}",
+                                                "pid", 1000 + i % 7,
+                                                "api", apis[i % 5],
+                                                "return", (int)(i % 3) - 1,
+                                                "time", i * 0.015625,
+                                                "args", text, i * 4096));
+    }
+    json_object_set_new(report, "behavioural", events);
+
+    for (i = 0; i < 500; i++){
+        snprintf(text, sizeof(text), "%u.%u.%u.%u", 10 + i % 200, i % 256, (i * 7) % 256, (i * 13) % 256);
+        json_array_append_new(ips, json_string(text));
+        snprintf(text, sizeof(text), "host%u.example%u.com", i, i % 17);
+        json_array_append_new(domains, json_string(text));
+    }
+    json_object_set_new(report, "network", json_pack("{soso}", "ip", ips, "domain", domains));
+
+    for (i = 0; i < 5000; i++){
+        snprintf(text, sizeof(text), "string-%u-%08x", i, i * 40503u);
+        json_array_append_new(strings, json_string(text));
+    }
+    json_object_set_new(report, "strings", strings);
+
+    return report;
+}
+
+
+int main(int argc, char** argv){
+
+    static const DEEPVIZ_RESULT_FORMAT  formats[] = { DEEPVIZ_FORMAT_JSON, DEEPVIZ_FORMAT_MSGPACK, DEEPVIZ_FORMAT_CBOR };
+    static const char                   *names[] = { "json", "msgpack", "cbor" };
+    json_t                              *data;
+    json_t                              *decoded;
+    json_error_t                        jsonError;
+    PDEEPVIZ_RESULT                     result;
+    double                              start, encodeTime, decodeTime, elapsed;
+    size_t                              jsonLen = 0;
+    size_t                              i;
+    int                                 run;
+    int                                 ret = 0;
+
+    if (argc > 1){
+        data = json_load_file(argv[1], JSON_DECODE_ANY, &jsonError);
+        if (!data){
+            printf("Cannot load \"%s\": %s\n", argv[1], jsonError.text);
+            return 1;
+        }
+    }
+    else{
+        data = benchmark_report();
+    }
+
+    printf("%-8s %12s %8s %14s %14s\n", "format", "bytes", "ratio", "encode MB/s", "decode MB/s");
+
+    for (i = 0; i < sizeof(formats) / sizeof(formats[0]); i++){
+
+        deepviz_result_format_set(formats[i]);
+        result = NULL;
+        encodeTime = decodeTime = 0;
+
+        for (run = 0; run < BENCHMARK_RUNS; run++){
+
+            if (result) deepviz_result_free(&result);
+
+            start = benchmark_time();
+            result = dvz_result_from_json(data, JSON_ENCODE_ANY);
+            elapsed = benchmark_time() - start;
+            if (!run || elapsed < encodeTime) encodeTime = elapsed;
+
+            start = benchmark_time();
+            decoded = dvz_result_to_json(result);
+            elapsed = benchmark_time() - start;
+            if (!run || elapsed < decodeTime) decodeTime = elapsed;
+
+            if (!decoded || !json_equal(decoded, data)){
+                printf("%s: the decoded data differs\n", names[i]);
+                ret = 1;
+            }
+            if (decoded) json_decref(decoded);
+        }
+
+        if (!result || !result->msg){
+            printf("%s: encoding failed\n", names[i]);
+            return 1;
+        }
+
+        /* Speeds are relative to the size of the JSON text, the same data for every format */
+        if (formats[i] == DEEPVIZ_FORMAT_JSON){
+            jsonLen = result->msgLen;
+        }
+
+        printf("%-8s %12u %8.2f %14.1f %14.1f\n", names[i], (unsigned int)result->msgLen,
+                (double)result->msgLen / jsonLen, jsonLen / encodeTime / 1e6, jsonLen / decodeTime / 1e6);
+
+        deepviz_result_free(&result);
+    }
+
+    json_decref(data);
+
+    return ret;
+}
@@ -0,0 +1,150 @@
+/*
+* Copyright (c) 2016 Saferbytes s.r.l.s.
+*
+* You can redistribute it and/or modify it under the terms of the MIT license.
+* See LICENSE for details.
+*/
+
+/*
+* MD5 throughput of deepviz_md5_files() with every engine supported by the CPU.
+* Usage: md5-benchmark [directory] [file number] [file size MB]
+* The files are created in "directory" and read once before measuring, so that the page cache
+* holds them and the figures are the hashing speed. "GB/s per core" divides by the CPU time used.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "c-deepviz.h"
+
+#define     BENCHMARK_DEFAULT_FILES     64
+#define     BENCHMARK_DEFAULT_SIZE_MB   16
+#define     BENCHMARK_RUNS              3
+
+
+/* Wall and CPU time in seconds */
+static void benchmark_time(double* wall, double* cpu){
+
+#ifdef _WIN32
+    LARGE_INTEGER   counter;
+    LARGE_INTEGER   frequency;
+    FILETIME        creation, exit, kernel, user;
+
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+    (*wall) = (double)counter.QuadPart / (double)frequency.QuadPart;
+
+    GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user);
+    (*cpu) = ((double)(((unsigned long long)kernel.dwHighDateTime << 32) | kernel.dwLowDateTime) +
+              (double)(((unsigned long long)user.dwHighDateTime << 32) | user.dwLowDateTime)) / 1e7;
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    (*wall) = ts.tv_sec + ts.tv_nsec / 1e9;
+
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    (*cpu) = ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+}
+
+
+int main(int argc, char** argv){
+
+    static const char   *engines[] = { "avx512", "avx2", "sse2", "scalar" };
+    const char          *directory = argc > 1 ? argv[1] : ".";
+    size_t              fileNumber = argc > 2 ? (size_t)atoi(argv[2]) : BENCHMARK_DEFAULT_FILES;
+    size_t              fileSize = (argc > 3 ? (size_t)atoi(argv[3]) : BENCHMARK_DEFAULT_SIZE_MB) * 1024 * 1024;
+    const char          **paths;
+    char                (*md5)[DEEPVIZ_MD5_HEX_LEN];
+    char                (*reference)[DEEPVIZ_MD5_HEX_LEN];
+    unsigned char       *data;
+    PDEEPVIZ_RESULT     result;
+    FILE                *file;
+    double              wallStart, wallEnd, cpuStart, cpuEnd, gb;
+    size_t              i, j, len;
+    int                 run;
+    int                 ret = 0;
+
+    if (!fileNumber || !fileSize){
+        printf("Usage: %s [directory] [file number] [file size MB]\n", argv[0]);
+        return 1;
+    }
+
+    paths = (const char**)calloc(fileNumber, sizeof(char*));
+    md5 = (char(*)[DEEPVIZ_MD5_HEX_LEN])malloc(fileNumber * DEEPVIZ_MD5_HEX_LEN);
+    reference = (char(*)[DEEPVIZ_MD5_HEX_LEN])malloc(fileNumber * DEEPVIZ_MD5_HEX_LEN);
+    data = (unsigned char*)malloc(fileSize);
+    if (!paths || !md5 || !reference || !data){
+        printf("Memory allocation error\n");
+        return 1;
+    }
+
+    /* Different contents, and sizes not multiple of the block size */
+    srand(1);
+    for (i = 0; i < fileNumber; i++){
+
+        len = strlen(directory) + 32;
+        paths[i] = (char*)malloc(len);
+        snprintf((char*)paths[i], len, "%s/md5-benchmark-%u.bin", directory, (unsigned int)i);
+
+        for (j = 0; j < fileSize; j++){
+            data[j] = (unsigned char)rand();
+        }
+
+        file = fopen(paths[i], "wb");
+        if (!file || fwrite(data, 1, fileSize - i % 64, file) != fileSize - i % 64){
+            printf("Cannot write \"%s\"\n", paths[i]);
+            return 1;
+        }
+        fclose(file);
+    }
+
+    gb = (double)fileNumber * fileSize / 1e9;
+    printf("%u files, %.2f GB, default engine: %s\n\n", (unsigned int)fileNumber, gb, deepviz_md5_engine());
+
+    /* Warm the page cache, and compute the reference digests */
+    deepviz_md5_set_engine("scalar");
+    result = deepviz_md5_files(paths, fileNumber, reference);
+    deepviz_result_free(&result);
+
+    printf("%-8s %12s %16s\n", "engine", "GB/s", "GB/s per core");
+
+    for (i = 0; i < sizeof(engines) / sizeof(engines[0]); i++){
+
+        if (!deepviz_md5_set_engine(engines[i])){
+            printf("%-8s %12s\n", engines[i], "unsupported");
+            continue;
+        }
+
+        for (run = 0; run < BENCHMARK_RUNS; run++){
+
+            benchmark_time(&wallStart, &cpuStart);
+            result = deepviz_md5_files(paths, fileNumber, md5);
+            benchmark_time(&wallEnd, &cpuEnd);
+            deepviz_result_free(&result);
+
+            for (j = 0; j < fileNumber; j++){
+                if (strcmp(md5[j], reference[j])){
+                    printf("%s: wrong MD5 for \"%s\"\n", engines[i], paths[j]);
+                    ret = 1;
+                    break;
+                }
+            }
+
+            printf("%-8s %12.2f %16.2f\n", engines[i], gb / (wallEnd - wallStart), gb / (cpuEnd - cpuStart));
+        }
+    }
+
+    for (i = 0; i < fileNumber; i++){
+        remove(paths[i]);
+        free((char*)paths[i]);
+    }
+
+    free(paths);
+    free(md5);
+    free(reference);
+    free(data);
+
+    return ret;
+}
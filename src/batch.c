@@ -0,0 +1,649 @@
+/*
+* Copyright (c) 2016 Saferbytes s.r.l.s.
+*
+* You can redistribute it and/or modify it under the terms of the MIT license.
+* See LICENSE for details.
+*/
+
+#include "c-deepviz.h"
+#include "c-deepviz_private.h"
+
+#include <ctype.h>
+
+/*
+* Download batching.
+* The first deepviz_sample_download() call of a window becomes the batch leader: it waits for
+* "max_delay_ms" (or until "max_batch_size" samples are collected), sends one bulk download
+* request, extracts the archive into every caller destination and wakes up the other callers.
+* Samples missing from the archive (or the whole batch, if the bulk request fails) are downloaded
+* one by one as before.
+* The shared bulk request runs with no cancel token: each item keeps the token of its caller, a
+* cancelled caller leaves the batch (or has its item skipped, once the batch is being processed)
+* and the polling stops only when every caller has cancelled.
+*/
+
+typedef struct _DEEPVIZ_BATCH_ITEM{
+    const char*                 md5;
+    const char*                 path;
+    PDEEPVIZ_RESULT             result;
+    FILE                        *file;
+    char                        *filePath;
+    PDEEPVIZ_CANCEL_TOKEN       token;              /* Token of the caller */
+    struct _DEEPVIZ_BATCH_ITEM  *twin;              /* Earlier item writing the same file: its result is copied */
+    struct _DEEPVIZ_BATCH_ITEM  *next;
+}DEEPVIZ_BATCH_ITEM, *PDEEPVIZ_BATCH_ITEM;
+
+typedef struct _DEEPVIZ_DOWNLOAD_BATCH{
+    char                *api_key;
+    PDEEPVIZ_BATCH_ITEM firstItem;
+    PDEEPVIZ_BATCH_ITEM lastItem;
+    size_t              itemNumber;
+    size_t              refCount;
+    deepviz_bool        closed;
+    deepviz_bool        done;
+}DEEPVIZ_DOWNLOAD_BATCH, *PDEEPVIZ_DOWNLOAD_BATCH;
+
+typedef struct _DEEPVIZ_BATCH_FALLBACK{
+    PDEEPVIZ_BATCH_ITEM *items;
+    const char*         api_key;
+}DEEPVIZ_BATCH_FALLBACK, *PDEEPVIZ_BATCH_FALLBACK;
+
+
+static DEEPVIZ_MUTEX            batchLock;
+static DEEPVIZ_COND             batchCond;
+static DEEPVIZ_ONCE             batchOnce = DEEPVIZ_ONCE_INIT;
+static volatile deepviz_bool    batchEnabled = deepviz_false;
+static unsigned int             batchMaxDelay = 0;
+static size_t                   batchMaxSize = 0;
+static PDEEPVIZ_DOWNLOAD_BATCH  openBatch = NULL;
+
+
+/* Check if an archive entry name refers to the given MD5 ("<md5>" or "<md5>.<ext>", any folder) */
+static deepviz_bool batch_entry_match(const char* entryName, const char* md5){
+
+    const char  *baseName = entryName;
+    const char  *p;
+    size_t      i;
+
+    for (p = entryName; *p; p++){
+        if (*p == '/' || *p == '\\'){
+            baseName = p + 1;
+        }
+    }
+
+    for (i = 0; md5[i]; i++){
+        if (tolower((unsigned char)baseName[i]) != tolower((unsigned char)md5[i])){
+            return deepviz_false;
+        }
+    }
+
+    return (baseName[i] == '\0' || baseName[i] == '.') ? deepviz_true : deepviz_false;
+}
+
+
+static deepviz_bool batch_entry_begin(void* context, const char* name){
+
+    PDEEPVIZ_DOWNLOAD_BATCH batch = (PDEEPVIZ_DOWNLOAD_BATCH)context;
+    PDEEPVIZ_BATCH_ITEM     item;
+    size_t                  filePathLen;
+    deepviz_bool            wanted = deepviz_false;
+
+    for (item = batch->firstItem; item; item = item->next){
+
+        if (item->twin || item->result || !batch_entry_match(name, item->md5)){
+            continue;
+        }
+
+        filePathLen = strlen(item->path) + strlen(item->md5) + 2;
+        item->filePath = (char*)malloc(filePathLen);
+        if (!item->filePath){
+            continue;
+        }
+
+        /* Build final file path */
+#ifdef _WIN32
+        sprintf_s(item->filePath, filePathLen, "%s\\%s", item->path, item->md5);
+#else
+        snprintf(item->filePath, filePathLen, "%s/%s", item->path, item->md5);
+#endif
+
+        item->file = fopen(item->filePath, "wb");
+        if (!item->file){
+            free(item->filePath);
+            item->filePath = NULL;
+            continue;
+        }
+
+        wanted = deepviz_true;
+    }
+
+    return wanted;
+}
+
+
+static deepviz_bool batch_entry_data(void* context, const void* data, size_t dataLen){
+
+    PDEEPVIZ_DOWNLOAD_BATCH batch = (PDEEPVIZ_DOWNLOAD_BATCH)context;
+    PDEEPVIZ_BATCH_ITEM     item;
+
+    for (item = batch->firstItem; item; item = item->next){
+        if (item->file && !fwrite(data, dataLen, 1, item->file)){
+            return deepviz_false;
+        }
+    }
+
+    return deepviz_true;
+}
+
+
+static void batch_entry_end(void* context, deepviz_bool success){
+
+    PDEEPVIZ_DOWNLOAD_BATCH batch = (PDEEPVIZ_DOWNLOAD_BATCH)context;
+    PDEEPVIZ_BATCH_ITEM     item;
+    char                    *retMsg;
+
+    for (item = batch->firstItem; item; item = item->next){
+
+        if (!item->file){
+            continue;
+        }
+
+        fclose(item->file);
+        item->file = NULL;
+
+        retMsg = success ? (char*)malloc(DEEPVIZ_ERROR_MAX_LEN) : NULL;
+        if (retMsg){
+            deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "File downloaded to: %s", item->filePath);
+            item->result = deepviz_result_init(DEEPVIZ_STATUS_SUCCESS, retMsg);
+
+            if (dvz_sample_store_enabled()){
+                dvz_sample_store_import(item->md5, item->filePath);
+            }
+        }
+        else{
+            /* Will be downloaded again by the fallback */
+            remove(item->filePath);
+        }
+
+        free(item->filePath);
+        item->filePath = NULL;
+    }
+}
+
+
+static void batch_fallback_download(void* context, size_t taskIndex){
+
+    PDEEPVIZ_BATCH_FALLBACK fallback = (PDEEPVIZ_BATCH_FALLBACK)context;
+    PDEEPVIZ_BATCH_ITEM     item = fallback->items[taskIndex];
+    PDEEPVIZ_CANCEL_TOKEN   previousToken;
+
+    /* Cancelled along with its caller */
+    previousToken = deepviz_cancel_token_attach(item->token);
+    item->result = dvz_sample_download(item->md5, fallback->api_key, item->path);
+    deepviz_cancel_token_attach(previousToken);
+}
+
+
+static deepviz_bool batch_item_cancelled(PDEEPVIZ_BATCH_ITEM item){
+
+    return deepviz_cancel_token_cancelled(item->token);
+}
+
+
+static PDEEPVIZ_RESULT batch_cancelled_result(void){
+
+    char    *retMsg;
+
+    retMsg = (char*)malloc(DEEPVIZ_ERROR_MAX_LEN);
+    if (retMsg){
+        deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Request cancelled");
+    }
+
+    return deepviz_result_init(DEEPVIZ_STATUS_CANCELLED, retMsg);
+}
+
+
+/* The twins of an item leaving the batch: the first one writes the file for the others */
+static void batch_release_twins(PDEEPVIZ_DOWNLOAD_BATCH batch, PDEEPVIZ_BATCH_ITEM item){
+
+    PDEEPVIZ_BATCH_ITEM     other;
+    PDEEPVIZ_BATCH_ITEM     newTwin = NULL;
+
+    for (other = batch->firstItem; other; other = other->next){
+        if (other->twin != item){
+            continue;
+        }
+
+        other->twin = newTwin;
+        if (!newTwin){
+            newTwin = other;
+        }
+    }
+}
+
+
+/* Some caller still waits for the batch */
+static deepviz_bool batch_live(PDEEPVIZ_DOWNLOAD_BATCH batch){
+
+    PDEEPVIZ_BATCH_ITEM     item;
+
+    for (item = batch->firstItem; item; item = item->next){
+        if (!batch_item_cancelled(item)){
+            return deepviz_true;
+        }
+    }
+
+    return deepviz_false;
+}
+
+
+static void batch_cancel_wakeup(void* param){
+
+    dvz_mutex_lock(&batchLock);
+    dvz_cond_broadcast(&batchCond);
+    dvz_mutex_unlock(&batchLock);
+}
+
+
+/* Wait before the next poll. Returns deepviz_false if every caller has cancelled meanwhile */
+static deepviz_bool batch_wait(PDEEPVIZ_DOWNLOAD_BATCH batch, unsigned int delayMs){
+
+    unsigned long long  deadline = dvz_time_ms() + delayMs;
+    unsigned long long  now;
+    deepviz_bool        live;
+
+    dvz_mutex_lock(&batchLock);
+
+    /* batchCond is shared by every batch: wait for the whole delay */
+    while ((live = batch_live(batch)) && (now = dvz_time_ms()) < deadline){
+        dvz_cond_timedwait(&batchCond, &batchLock, (unsigned int)(deadline - now));
+    }
+
+    dvz_mutex_unlock(&batchLock);
+
+    return live;
+}
+
+
+/* Download the whole batch through a bulk download request. Runs on the leader thread, without holding the batch lock */
+/* Folder of the temporary archive: the system one, the callers of a batch may download into different folders */
+static char* batch_temp_dir(void){
+
+#ifdef _WIN32
+    char        path[MAX_PATH + 1];
+    DWORD       len;
+
+    len = GetTempPathA(sizeof(path), path);
+    if (!len || len >= sizeof(path)){
+        return NULL;
+    }
+
+    /* No trailing separator, like the download paths */
+    if (path[len - 1] == '\\'){
+        path[len - 1] = 0;
+    }
+
+    return _strdup(path);
+#else
+    const char  *dir = getenv("TMPDIR");
+
+    return strdup(dir && dir[0] ? dir : "/tmp");
+#endif
+}
+
+
+static void batch_process(PDEEPVIZ_DOWNLOAD_BATCH batch){
+
+    PDEEPVIZ_LIST           md5List = NULL;
+    PDEEPVIZ_RESULT         requestResult = NULL;
+    PDEEPVIZ_RESULT         retrieveResult = NULL;
+    PDEEPVIZ_BATCH_ITEM     item;
+    DEEPVIZ_ZIP_HANDLER     handler;
+    DEEPVIZ_BATCH_FALLBACK  fallback;
+    char                    errorMsg[DEEPVIZ_ERROR_MAX_LEN] = { 0 };
+    char                    *zipPath = NULL;
+    char                    *tempDir = NULL;
+    size_t                  zipPathLen;
+    size_t                  missing = 0;
+    size_t                  i;
+    unsigned long long      startTime;
+    unsigned int            pollDelay = DEEPVIZ_BATCH_POLL_MIN_MS;
+
+    if (batch->itemNumber > 1 && batch_live(batch)){
+        md5List = deepviz_list_init(batch->itemNumber);
+    }
+
+    if (md5List){
+
+        for (item = batch->firstItem; item; item = item->next){
+            if (batch_item_cancelled(item)){
+                continue;
+            }
+            /* The same sample may be requested by more callers */
+            for (i = 0; i < md5List->maxEntryNumber && md5List->entry[i][0]; i++){
+                if (batch_entry_match(md5List->entry[i], item->md5)){
+                    break;
+                }
+            }
+            if (i == md5List->maxEntryNumber || !md5List->entry[i][0]){
+                deepviz_list_add(md5List, item->md5);
+            }
+        }
+
+        requestResult = deepviz_bulk_download_request(md5List, batch->api_key);
+        deepviz_list_free(&md5List);
+    }
+
+    if (requestResult && requestResult->status == DEEPVIZ_STATUS_SUCCESS){
+        tempDir = batch_temp_dir();
+    }
+
+    if (tempDir){
+
+        /* Wait for the archive, "msg" contains request ID on success */
+        startTime = dvz_time_ms();
+        for (;;){
+            retrieveResult = deepviz_bulk_download_retrieve(requestResult->msg, tempDir, batch->api_key);
+            if (!retrieveResult || retrieveResult->status != DEEPVIZ_STATUS_PROCESSING){
+                break;
+            }
+            if (dvz_time_ms() - startTime > DEEPVIZ_BATCH_TIMEOUT_MS){
+                break;
+            }
+
+            deepviz_result_free(&retrieveResult);
+
+            if (!batch_wait(batch, pollDelay)){
+                break;
+            }
+            pollDelay = pollDelay * 2 > DEEPVIZ_BATCH_POLL_MAX_MS ? DEEPVIZ_BATCH_POLL_MAX_MS : pollDelay * 2;
+        }
+
+        zipPathLen = strlen(tempDir) + strlen(requestResult->msg) + 50;
+        zipPath = (char*)malloc(zipPathLen);
+        if (zipPath){
+#ifdef _WIN32
+            sprintf_s(zipPath, zipPathLen, "%s\\bulk_request_%s.zip", tempDir, requestResult->msg);
+#else
+            snprintf(zipPath, zipPathLen, "%s/bulk_request_%s.zip", tempDir, requestResult->msg);
+#endif
+            if (retrieveResult && retrieveResult->status == DEEPVIZ_STATUS_SUCCESS){
+
+                /* Fan out the archive entries to every caller */
+                handler.entryBegin = batch_entry_begin;
+                handler.entryData = batch_entry_data;
+                handler.entryEnd = batch_entry_end;
+                handler.context = batch;
+
+                dvz_zip_extract_file(zipPath, &handler, errorMsg);
+            }
+
+            /* The archive is created even if the request fails */
+            remove(zipPath);
+            free(zipPath);
+        }
+
+        free(tempDir);
+    }
+
+    if (requestResult) deepviz_result_free(&requestResult);
+    if (retrieveResult) deepviz_result_free(&retrieveResult);
+
+    /* Skip the cancelled callers, their twins download the file instead */
+    for (item = batch->firstItem; item; item = item->next){
+        if (!item->result && !item->twin && batch_item_cancelled(item)){
+            item->result = batch_cancelled_result();
+            batch_release_twins(batch, item);
+        }
+    }
+
+    /* Download one by one whatever the archive did not provide */
+    for (item = batch->firstItem; item; item = item->next){
+        if (!item->result && !item->twin){
+            missing++;
+        }
+    }
+
+    if (missing == 0){
+        return;
+    }
+
+    fallback.api_key = batch->api_key;
+    fallback.items = (PDEEPVIZ_BATCH_ITEM*)malloc(sizeof(PDEEPVIZ_BATCH_ITEM) * missing);
+    if (!fallback.items){
+        return;
+    }
+
+    i = 0;
+    for (item = batch->firstItem; item; item = item->next){
+        if (!item->result && !item->twin){
+            fallback.items[i++] = item;
+        }
+    }
+
+    dvz_parallel_run(missing, DEEPVIZ_DEFAULT_THREADS, batch_fallback_download, &fallback);
+
+    free(fallback.items);
+}
+
+
+/* Callers asking for the same file get a copy of the result of the first one */
+static void batch_copy_twins(PDEEPVIZ_DOWNLOAD_BATCH batch){
+
+    PDEEPVIZ_BATCH_ITEM     item;
+    char                    *retMsg;
+
+    for (item = batch->firstItem; item; item = item->next){
+
+        if (!item->twin || !item->twin->result){
+            continue;
+        }
+
+        retMsg = (char*)malloc(DEEPVIZ_ERROR_MAX_LEN);
+        if (retMsg){
+            deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "%s", item->twin->result->msg ? item->twin->result->msg : "");
+            item->result = deepviz_result_init(item->twin->result->status, retMsg);
+        }
+    }
+}
+
+
+static void batch_init_once(void){
+
+    dvz_mutex_init(&batchLock);
+    dvz_cond_init(&batchCond);
+}
+
+
+deepviz_bool dvz_download_batching_enabled(void){
+
+    return batchEnabled;
+}
+
+
+PDEEPVIZ_RESULT dvz_batch_sample_download(const char* md5, const char* api_key, const char* path){
+
+    PDEEPVIZ_DOWNLOAD_BATCH batch;
+    DEEPVIZ_BATCH_ITEM      item;
+    PDEEPVIZ_BATCH_ITEM     other;
+    PDEEPVIZ_BATCH_ITEM     *link;
+    PDEEPVIZ_RESULT         result;
+    PDEEPVIZ_CANCEL_TOKEN   previousToken;
+    DEEPVIZ_CANCEL_WAITER   waiter;
+    deepviz_bool            leader = deepviz_false;
+    deepviz_bool            lastRef;
+    unsigned long long      deadline;
+    unsigned long long      now;
+    char                    *retMsg;
+
+    memset(&item, 0, sizeof(DEEPVIZ_BATCH_ITEM));
+    item.md5 = md5;
+    item.path = path;
+    item.token = dvz_cancel_token_current();
+
+    /* Registered out of the batch lock, the wakeup takes it */
+    if (item.token && !dvz_cancel_register(item.token, &waiter, batch_cancel_wakeup, NULL)){
+        return batch_cancelled_result();
+    }
+
+    dvz_mutex_lock(&batchLock);
+
+    if (!batchEnabled || (openBatch && strcmp(openBatch->api_key, api_key))){
+        /* Batching disabled meanwhile, or the open batch belongs to another API key */
+        dvz_mutex_unlock(&batchLock);
+        if (item.token) dvz_cancel_unregister(item.token, &waiter);
+        return dvz_sample_download(md5, api_key, path);
+    }
+
+    if (!openBatch){
+
+        /* First request of a new window */
+        batch = (PDEEPVIZ_DOWNLOAD_BATCH)malloc(sizeof(DEEPVIZ_DOWNLOAD_BATCH));
+        if (batch){
+            memset(batch, 0, sizeof(DEEPVIZ_DOWNLOAD_BATCH));
+            batch->api_key = (char*)malloc(strlen(api_key) + 1);
+        }
+        if (!batch || !batch->api_key){
+            if (batch) free(batch);
+            dvz_mutex_unlock(&batchLock);
+            if (item.token) dvz_cancel_unregister(item.token, &waiter);
+            return dvz_sample_download(md5, api_key, path);
+        }
+
+        memcpy(batch->api_key, api_key, strlen(api_key) + 1);
+        openBatch = batch;
+        leader = deepviz_true;
+    }
+
+    batch = openBatch;
+
+    /* Two writers of the same file would clobber each other: the first one writes it for both */
+    for (other = batch->firstItem; other; other = other->next){
+        if (!other->twin && !strcmp(other->md5, md5) && !strcmp(other->path, path)){
+            item.twin = other;
+            break;
+        }
+    }
+
+    if (batch->lastItem){
+        batch->lastItem->next = &item;
+    }
+    else{
+        batch->firstItem = &item;
+    }
+    batch->lastItem = &item;
+    batch->itemNumber++;
+    batch->refCount++;
+
+    if (batch->itemNumber >= batchMaxSize){
+        /* Batch full, wake up the leader */
+        batch->closed = deepviz_true;
+        openBatch = NULL;
+        dvz_cond_broadcast(&batchCond);
+    }
+
+    if (leader){
+
+        deadline = dvz_time_ms() + batchMaxDelay;
+        while (!batch->closed){
+            now = dvz_time_ms();
+            if (now >= deadline){
+                break;
+            }
+            dvz_cond_timedwait(&batchCond, &batchLock, (unsigned int)(deadline - now));
+        }
+
+        if (!batch->closed){
+            batch->closed = deepviz_true;
+            if (openBatch == batch){
+                openBatch = NULL;
+            }
+        }
+
+        dvz_mutex_unlock(&batchLock);
+
+        /* Shared by every caller of the batch, see batch_process() */
+        previousToken = deepviz_cancel_token_attach(NULL);
+        batch_process(batch);
+        deepviz_cancel_token_attach(previousToken);
+        batch_copy_twins(batch);
+
+        dvz_mutex_lock(&batchLock);
+        batch->done = deepviz_true;
+        dvz_cond_broadcast(&batchCond);
+    }
+    else{
+        while (!batch->done){
+
+            if (!batch->closed && batch_item_cancelled(&item)){
+
+                /* Not processed yet: leave the batch */
+                for (link = &batch->firstItem; (*link) != &item; link = &(*link)->next);
+                (*link) = item.next;
+                if (batch->lastItem == &item){
+                    for (other = batch->firstItem; other && other->next; other = other->next);
+                    batch->lastItem = other;
+                }
+                batch->itemNumber--;
+                batch_release_twins(batch, &item);
+
+                item.result = batch_cancelled_result();
+                break;
+            }
+
+            dvz_cond_wait(&batchCond, &batchLock);
+        }
+    }
+
+    result = item.result;
+    batch->refCount--;
+    lastRef = (batch->refCount == 0) ? deepviz_true : deepviz_false;
+
+    dvz_mutex_unlock(&batchLock);
+
+    if (item.token) dvz_cancel_unregister(item.token, &waiter);
+
+    if (lastRef){
+        free(batch->api_key);
+        free(batch);
+    }
+
+    if (!result){
+        retMsg = (char*)malloc(DEEPVIZ_ERROR_MAX_LEN);
+        if (retMsg){
+            deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Memory allocation error");
+        }
+        result = deepviz_result_init(DEEPVIZ_STATUS_INTERNAL_ERROR, retMsg);
+    }
+
+    return result;
+}
+
+
+EXPORT deepviz_bool deepviz_download_batching_enable(   unsigned int max_delay_ms,
+                                                        size_t max_batch_size){
+
+    if (max_batch_size < 2){
+        return deepviz_false;
+    }
+
+    dvz_once(&batchOnce, batch_init_once);
+
+    dvz_mutex_lock(&batchLock);
+    batchMaxDelay = max_delay_ms;
+    batchMaxSize = max_batch_size;
+    batchEnabled = deepviz_true;
+    dvz_mutex_unlock(&batchLock);
+
+    return deepviz_true;
+}
+
+
+EXPORT void deepviz_download_batching_disable(void){
+
+    dvz_once(&batchOnce, batch_init_once);
+
+    dvz_mutex_lock(&batchLock);
+    batchEnabled = deepviz_false;
+    dvz_mutex_unlock(&batchLock);
+}
@@ -0,0 +1,481 @@
+/*
+* Copyright (c) 2016 Saferbytes s.r.l.s.
+*
+* You can redistribute it and/or modify it under the terms of the MIT license.
+* See LICENSE for details.
+*/
+
+#include "c-deepviz.h"
+#include "c-deepviz_private.h"
+
+#include <ctype.h>
+
+/*
+* Bulk download pipeline.
+* deepviz_bulk_download_run() sends the bulk request, polls for the archive with backoff and
+* downloads it through the streaming HTTP layer: the archive bytes go straight into the streaming
+* ZIP reader while they arrive, and every entry is written to its sample file (or into the sample
+* store) as it is inflated. The archive itself never touches the disk.
+*/
+
+typedef struct _BULK_RUN_SAMPLE{
+    char                    key[DEEPVIZ_MD5_HEX_LEN];   /* Lowercase MD5 */
+    const char              *md5;                       /* As requested */
+    deepviz_bool            extracted;
+}BULK_RUN_SAMPLE, *PBULK_RUN_SAMPLE;
+
+typedef struct _BULK_RUN{
+    const char              *path;                      /* NULL: sample store only */
+    PBULK_RUN_SAMPLE        samples;
+    size_t                  sampleNumber;
+    size_t                  extracted;
+    PDEEPVIZ_ZIP_READER     reader;
+    deepviz_bool            zipFailed;
+    char                    zipError[DEEPVIZ_ERROR_MAX_LEN];
+    PBULK_RUN_SAMPLE        current;                    /* Entry being extracted */
+    FILE                    *file;
+    char                    *filePath;                  /* Sample file, or temporary file of the store */
+    DEEPVIZ_MUTEX           lock;
+    DEEPVIZ_COND            cond;                       /* Signalled on cancellation */
+}BULK_RUN, *PBULK_RUN;
+
+
+static int bulkrun_sample_compare(const void* a, const void* b){
+
+    return strcmp(((PBULK_RUN_SAMPLE)a)->key, ((PBULK_RUN_SAMPLE)b)->key);
+}
+
+
+/* Lowercase MD5 of an entry name ("<md5>" or "<md5>.<ext>", any folder), deepviz_false if it is not one */
+static deepviz_bool bulkrun_entry_key(const char* name, char key[DEEPVIZ_MD5_HEX_LEN]){
+
+    const char  *baseName = name;
+    const char  *p;
+    size_t      i;
+
+    for (p = name; *p; p++){
+        if (*p == '/' || *p == '\\'){
+            baseName = p + 1;
+        }
+    }
+
+    for (i = 0; i < DEEPVIZ_MD5_HEX_LEN - 1; i++){
+        if (!isxdigit((unsigned char)baseName[i])){
+            return deepviz_false;
+        }
+        key[i] = (char)tolower((unsigned char)baseName[i]);
+    }
+    key[i] = 0;
+
+    return baseName[i] == '\0' || baseName[i] == '.';
+}
+
+
+static deepviz_bool bulkrun_entry_begin(void* context, const char* name){
+
+    PBULK_RUN           run = (PBULK_RUN)context;
+    BULK_RUN_SAMPLE     wanted;
+    PBULK_RUN_SAMPLE    sample;
+    size_t              filePathLen;
+
+    if (!bulkrun_entry_key(name, wanted.key)){
+        return deepviz_false;
+    }
+
+    sample = (PBULK_RUN_SAMPLE)bsearch(&wanted, run->samples, run->sampleNumber, sizeof(BULK_RUN_SAMPLE), bulkrun_sample_compare);
+    if (!sample || sample->extracted){
+        return deepviz_false;
+    }
+
+    if (run->path){
+
+        filePathLen = strlen(run->path) + strlen(sample->md5) + 2;
+        run->filePath = (char*)malloc(filePathLen);
+        if (!run->filePath){
+            return deepviz_false;
+        }
+
+#ifdef _WIN32
+        sprintf_s(run->filePath, filePathLen, "%s\\%s", run->path, sample->md5);
+#else
+        snprintf(run->filePath, filePathLen, "%s/%s", run->path, sample->md5);
+#endif
+
+        run->file = fopen(run->filePath, "wb");
+        if (!run->file){
+            free(run->filePath);
+            run->filePath = NULL;
+            return deepviz_false;
+        }
+    }
+    else{
+        run->file = dvz_sample_store_create(sample->key, &run->filePath);
+        if (!run->file){
+            return deepviz_false;
+        }
+    }
+
+    run->current = sample;
+
+    return deepviz_true;
+}
+
+
+static deepviz_bool bulkrun_entry_data(void* context, const void* data, size_t dataLen){
+
+    PBULK_RUN   run = (PBULK_RUN)context;
+
+    return fwrite(data, dataLen, 1, run->file) == 1;
+}
+
+
+static void bulkrun_entry_end(void* context, deepviz_bool success){
+
+    PBULK_RUN   run = (PBULK_RUN)context;
+
+    if (!run->current){
+        return;
+    }
+
+    if (run->path){
+        success = !fclose(run->file) && success;
+        if (success){
+            if (dvz_sample_store_enabled()){
+                dvz_sample_store_import(run->current->key, run->filePath);
+            }
+        }
+        else{
+            remove(run->filePath);
+        }
+        free(run->filePath);
+    }
+    else{
+        success = dvz_sample_store_commit(run->current->key, run->file, run->filePath, success);
+    }
+
+    if (success){
+        run->current->extracted = deepviz_true;
+        run->extracted++;
+    }
+
+    run->current = NULL;
+    run->file = NULL;
+    run->filePath = NULL;
+}
+
+
+/* HTTP sink: the archive is extracted while it arrives */
+static deepviz_bool bulkrun_sink(void* context, const void* data, size_t dataLen){
+
+    PBULK_RUN   run = (PBULK_RUN)context;
+
+    if (!dvz_zip_reader_feed(run->reader, data, dataLen, run->zipError)){
+        run->zipFailed = deepviz_true;
+        return deepviz_false;
+    }
+
+    return deepviz_true;
+}
+
+
+/* Download and extract the archive of "id_request". The message of the result goes to "retMsg" */
+static DEEPVIZ_RESULT_STATUS bulkrun_retrieve(PBULK_RUN run, const char* id_request, const char* api_key, char* retMsg){
+
+    DEEPVIZ_ZIP_HANDLER     handler;
+    DEEPVIZ_RESULT_STATUS   status;
+    PDEEPVIZ_RESULT         result;
+    json_t                  *jsonObj;
+    char                    *jsonRequestString;
+    void                    *responseOut = NULL;
+    size_t                  responseOutLen = 0;
+    char                    statusCode[DEEPVIZ_STATUS_CODE_MAX_LEN] = { 0 };
+    deepviz_bool            bRet = deepviz_false;
+#ifdef _WIN32
+    char                    HTTPheader[DEEPVIZ_HTTP_HEADER_MAX_LEN] = { 0 };
+#endif
+
+    jsonObj = json_pack("{ssss}",
+                        "api_key", api_key,
+                        "id_request", id_request);
+
+    jsonRequestString = json_dumps(jsonObj, 0);
+
+    json_decref(jsonObj);
+
+    if (!jsonRequestString){
+        deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Error creating HTTP request");
+        return DEEPVIZ_STATUS_INTERNAL_ERROR;
+    }
+
+    handler.entryBegin = bulkrun_entry_begin;
+    handler.entryData = bulkrun_entry_data;
+    handler.entryEnd = bulkrun_entry_end;
+    handler.context = run;
+
+    run->reader = dvz_zip_reader_init(&handler);
+    run->zipFailed = deepviz_false;
+    if (!run->reader){
+        free(jsonRequestString);
+        deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Memory allocation error");
+        return DEEPVIZ_STATUS_INTERNAL_ERROR;
+    }
+
+#ifdef _WIN32
+    sprintf_s(HTTPheader, DEEPVIZ_HTTP_HEADER_MAX_LEN, "%s\r\n%s\r\n%s\r\n", DEEPVIZ_HTTP_HEADER_CTJ, DEEPVIZ_HTTP_HEADER_A, DEEPVIZ_HTTP_HEADER_AE);
+
+    bRet = win_sendHTTPrequestStream(   DEEPVIZ_SERVER,
+                                        URL_DOWNLOAD_BULK,
+                                        INTERNET_DEFAULT_HTTPS_PORT,
+                                        HTTPheader,
+                                        INTERNET_FLAG_SECURE,
+                                        jsonRequestString,
+                                        strlen(jsonRequestString),
+                                        bulkrun_sink,
+                                        run,
+                                        statusCode,
+                                        DEEPVIZ_STATUS_CODE_MAX_LEN,
+                                        &responseOut,
+                                        &responseOutLen,
+                                        retMsg);
+#elif defined(__linux__)
+    bRet = linux_sendHTTPrequestStream( DEEPVIZ_SERVER,
+                                        URL_DOWNLOAD_BULK,
+                                        jsonRequestString,
+                                        bulkrun_sink,
+                                        run,
+                                        statusCode,
+                                        DEEPVIZ_STATUS_CODE_MAX_LEN,
+                                        &responseOut,
+                                        &responseOutLen,
+                                        retMsg);
+#endif
+
+    free(jsonRequestString);
+
+    if (bRet == deepviz_false){
+        if (run->zipFailed){
+            deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Invalid archive: %s", run->zipError);
+            status = DEEPVIZ_STATUS_INTERNAL_ERROR;
+        }
+        else{
+            status = dvz_transfer_error_status();
+        }
+    }
+    else if (strcmp(statusCode, "200")){
+        /* Not ready yet (428) or error */
+        result = parse_deepviz_response(statusCode, responseOut, responseOutLen);
+        if (result){
+            status = result->status;
+            deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "%s", result->msg ? result->msg : "");
+            deepviz_result_free(&result);
+        }
+        else{
+            deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Memory allocation error");
+            status = DEEPVIZ_STATUS_INTERNAL_ERROR;
+        }
+    }
+    else if (!dvz_zip_reader_finish(run->reader, run->zipError)){
+        deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Invalid archive: %s", run->zipError);
+        status = DEEPVIZ_STATUS_INTERNAL_ERROR;
+    }
+    else{
+        status = DEEPVIZ_STATUS_SUCCESS;
+    }
+
+    if (responseOut) free(responseOut);
+
+    /* An entry cut by a failed transfer is dropped */
+    dvz_zip_reader_free(&run->reader);
+
+    return status;
+}
+
+
+static void bulkrun_cancel_wakeup(void* param){
+
+    PBULK_RUN   run = (PBULK_RUN)param;
+
+    dvz_mutex_lock(&run->lock);
+    dvz_cond_signal(&run->cond);
+    dvz_mutex_unlock(&run->lock);
+}
+
+
+/* Wait before the next poll. Returns deepviz_false if the call is cancelled meanwhile */
+static deepviz_bool bulkrun_wait(PBULK_RUN run, unsigned int delayMs){
+
+    PDEEPVIZ_CANCEL_TOKEN   token = dvz_cancel_token_current();
+    DEEPVIZ_CANCEL_WAITER   waiter;
+
+    if (token && !dvz_cancel_register(token, &waiter, bulkrun_cancel_wakeup, run)){
+        return deepviz_false;
+    }
+
+    dvz_mutex_lock(&run->lock);
+    if (!dvz_cancel_requested()){
+        dvz_cond_timedwait(&run->cond, &run->lock, delayMs);
+    }
+    dvz_mutex_unlock(&run->lock);
+
+    if (token) dvz_cancel_unregister(token, &waiter);
+
+    return !dvz_cancel_requested();
+}
+
+
+/* Sorted, distinct MD5s of the list */
+static deepviz_bool bulkrun_samples_init(PBULK_RUN run, PDEEPVIZ_LIST md5_list){
+
+    size_t  i;
+    size_t  j;
+
+    run->samples = (PBULK_RUN_SAMPLE)calloc(md5_list->maxEntryNumber ? md5_list->maxEntryNumber : 1, sizeof(BULK_RUN_SAMPLE));
+    if (!run->samples){
+        return deepviz_false;
+    }
+
+    for (i = 0; i < md5_list->maxEntryNumber && md5_list->entry[i][0]; i++){
+        if (strlen(md5_list->entry[i]) == DEEPVIZ_MD5_HEX_LEN - 1 &&
+            bulkrun_entry_key(md5_list->entry[i], run->samples[run->sampleNumber].key)){
+            run->samples[run->sampleNumber++].md5 = md5_list->entry[i];
+        }
+    }
+
+    qsort(run->samples, run->sampleNumber, sizeof(BULK_RUN_SAMPLE), bulkrun_sample_compare);
+
+    for (i = 0, j = 0; i < run->sampleNumber; i++){
+        if (!j || strcmp(run->samples[i].key, run->samples[j - 1].key)){
+            run->samples[j++] = run->samples[i];
+        }
+    }
+    run->sampleNumber = j;
+
+    return deepviz_true;
+}
+
+
+EXPORT PDEEPVIZ_RESULT deepviz_bulk_download_run(   PDEEPVIZ_LIST md5_list,
+                                                    const char* path,
+                                                    const char* api_key,
+                                                    PDEEPVIZ_POLL_SCHEDULE schedule,
+                                                    PDEEPVIZ_BULK_RUN_SUMMARY summary){
+
+    BULK_RUN                run;
+    DEEPVIZ_POLL_SCHEDULE   defaultSchedule;
+    DEEPVIZ_RESULT_STATUS   status;
+    PDEEPVIZ_RESULT         requestResult;
+    char                    idRequest[DEEPVIZ_ID_REQUEST_MAX_LEN];
+    char                    *retMsg;
+    unsigned long long      startTime;
+    unsigned long long      elapsed;
+    double                  delayMs;
+    size_t                  i;
+
+    retMsg = (char*)malloc(DEEPVIZ_ERROR_MAX_LEN);
+    if (!retMsg){
+        return deepviz_result_init(DEEPVIZ_STATUS_INTERNAL_ERROR, NULL);
+    }
+
+    if (summary){
+        memset(summary, 0, sizeof(DEEPVIZ_BULK_RUN_SUMMARY));
+    }
+
+    if (!md5_list || !api_key || (!path && !dvz_sample_store_enabled())){
+        deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Invalid or missing parameters. Please try again!");
+        return deepviz_result_init(DEEPVIZ_STATUS_INPUT_ERROR, retMsg);
+    }
+
+    if (!schedule){
+        defaultSchedule.initialDelayMs = DEEPVIZ_POLL_DEFAULT_INITIAL_MS;
+        defaultSchedule.maxDelayMs = DEEPVIZ_POLL_DEFAULT_MAX_MS;
+        defaultSchedule.backoff = DEEPVIZ_POLL_DEFAULT_BACKOFF;
+        defaultSchedule.timeoutMs = 0;
+        schedule = &defaultSchedule;
+    }
+
+    memset(&run, 0, sizeof(BULK_RUN));
+    run.path = path;
+
+    if (!bulkrun_samples_init(&run, md5_list)){
+        deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Memory allocation error");
+        return deepviz_result_init(DEEPVIZ_STATUS_INTERNAL_ERROR, retMsg);
+    }
+
+    if (!run.sampleNumber){
+        free(run.samples);
+        deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "No valid MD5 in the list");
+        return deepviz_result_init(DEEPVIZ_STATUS_INPUT_ERROR, retMsg);
+    }
+
+    if (summary){
+        summary->requested = run.sampleNumber;
+    }
+
+    /* Request */
+    requestResult = deepviz_bulk_download_request(md5_list, api_key);
+    if (!requestResult || requestResult->status != DEEPVIZ_STATUS_SUCCESS){
+        if (summary) summary->missing = run.sampleNumber;
+        free(run.samples);
+        free(retMsg);
+        return requestResult;
+    }
+
+    deepviz_sprintf(idRequest, sizeof(idRequest), "%s", requestResult->msg);
+    deepviz_result_free(&requestResult);
+
+    dvz_mutex_init(&run.lock);
+    dvz_cond_init(&run.cond);
+
+    /* Wait and retrieve */
+    startTime = dvz_time_ms();
+    delayMs = schedule->initialDelayMs;
+
+    for (;;){
+
+        elapsed = dvz_time_ms() - startTime;
+        if (schedule->timeoutMs && elapsed + (unsigned long long)delayMs > schedule->timeoutMs){
+            delayMs = elapsed < schedule->timeoutMs ? (double)(schedule->timeoutMs - elapsed) : 0;
+        }
+
+        if (!bulkrun_wait(&run, (unsigned int)delayMs)){
+            deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Request cancelled");
+            status = DEEPVIZ_STATUS_CANCELLED;
+            break;
+        }
+
+        status = bulkrun_retrieve(&run, idRequest, api_key, retMsg);
+        if (status != DEEPVIZ_STATUS_PROCESSING){
+            break;
+        }
+
+        if (schedule->timeoutMs && dvz_time_ms() - startTime >= schedule->timeoutMs){
+            deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Archive of request %s not ready yet", idRequest);
+            break;
+        }
+
+        delayMs *= schedule->backoff > 1.0 ? schedule->backoff : 1.0;
+        if (delayMs > schedule->maxDelayMs){
+            delayMs = schedule->maxDelayMs;
+        }
+    }
+
+    if (status == DEEPVIZ_STATUS_SUCCESS){
+        deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "%u of %u samples extracted to: %s",
+            (unsigned int)run.extracted, (unsigned int)run.sampleNumber, path ? path : "the sample store");
+    }
+
+    if (summary){
+        summary->extracted = run.extracted;
+        for (i = 0; i < run.sampleNumber; i++){
+            if (!run.samples[i].extracted){
+                summary->missing++;
+            }
+        }
+    }
+
+    dvz_cond_destroy(&run.cond);
+    dvz_mutex_destroy(&run.lock);
+    free(run.samples);
+
+    return deepviz_result_init(status, retMsg);
+}
@@ -122,6 +122,7 @@ PDEEPVIZ_RESULT parse_deepviz_response(const char* statusCode, void* response, s
     json_t					*jsonData = NULL;
     json_error_t			jsonError;
     DEEPVIZ_RESULT_STATUS	currStatus;
+    PDEEPVIZ_RESULT         result;
     char			        *retMsg = NULL;
 
     retMsg = (char*)malloc(DEEPVIZ_ERROR_MAX_LEN);
@@ -203,15 +204,14 @@ PDEEPVIZ_RESULT parse_deepviz_response(const char* statusCode, void* response, s
     }
 
     free(retMsg);
-    retMsg = NULL;
 
-    /* Convert JSON object data to string */
-    retMsg = json_dumps(jsonData, 0);
+    /* Encode JSON object data in the requested format */
+    result = dvz_result_from_json(jsonData, 0);
 
     /* Free response object */
     json_decref(jsonObj);
 
-    return deepviz_result_init(DEEPVIZ_STATUS_SUCCESS, retMsg);
+    return result;
 
 }
 
@@ -227,11 +227,326 @@ PDEEPVIZ_RESULT deepviz_result_init(DEEPVIZ_RESULT_STATUS status, char* msg){
 
     result->status = status;
     result->msg = msg;
+    result->stale = deepviz_false;
+    result->msgLen = msg ? strlen(msg) : 0;
+    result->format = DEEPVIZ_FORMAT_JSON;
 
     return result;
 
 }
 
+
+/* ============================ threading helpers ============================ */
+
+typedef struct _DEEPVIZ_THREAD_START{
+    DEEPVIZ_THREAD_ROUTINE  routine;
+    void*                   param;
+    PDEEPVIZ_CANCEL_TOKEN   token;                  /* Inherited from the creating thread */
+}DEEPVIZ_THREAD_START, *PDEEPVIZ_THREAD_START;
+
+typedef struct _DEEPVIZ_PARALLEL_CONTEXT{
+    DEEPVIZ_MUTEX           lock;
+    size_t                  nextTask;
+    size_t                  taskNumber;
+    DEEPVIZ_TASK_ROUTINE    routine;
+    void*                   context;
+}DEEPVIZ_PARALLEL_CONTEXT, *PDEEPVIZ_PARALLEL_CONTEXT;
+
+
+#ifdef _WIN32
+static DWORD WINAPI thread_trampoline(LPVOID param){
+#else
+static void* thread_trampoline(void* param){
+#endif
+
+    DEEPVIZ_THREAD_START    start;
+
+    start = *(PDEEPVIZ_THREAD_START)param;
+    free(param);
+
+    deepviz_cancel_token_attach(start.token);
+
+    start.routine(start.param);
+
+#ifdef _WIN32
+    return 0;
+#else
+    return NULL;
+#endif
+}
+
+
+deepviz_bool dvz_thread_create(DEEPVIZ_THREAD *thread, DEEPVIZ_THREAD_ROUTINE routine, void* param){
+
+    PDEEPVIZ_THREAD_START   start;
+
+    start = (PDEEPVIZ_THREAD_START)malloc(sizeof(DEEPVIZ_THREAD_START));
+    if (!start){
+        return deepviz_false;
+    }
+
+    start->routine = routine;
+    start->param = param;
+    start->token = dvz_cancel_token_current();
+
+#ifdef _WIN32
+    (*thread) = CreateThread(NULL, 0, thread_trampoline, start, 0, NULL);
+    if ((*thread) == NULL){
+        free(start);
+        return deepviz_false;
+    }
+#elif defined(__linux__)
+    if (pthread_create(thread, NULL, thread_trampoline, start)){
+        free(start);
+        return deepviz_false;
+    }
+#endif
+
+    return deepviz_true;
+}
+
+
+void dvz_thread_join(DEEPVIZ_THREAD thread){
+
+#ifdef _WIN32
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+#elif defined(__linux__)
+    pthread_join(thread, NULL);
+#endif
+}
+
+
+#ifdef _WIN32
+static BOOL CALLBACK once_callback(PINIT_ONCE once, PVOID param, PVOID* context){
+
+    (*(DEEPVIZ_ONCE_ROUTINE*)param)();
+    return TRUE;
+}
+#endif
+
+
+void dvz_once(DEEPVIZ_ONCE *once, DEEPVIZ_ONCE_ROUTINE routine){
+
+#ifdef _WIN32
+    InitOnceExecuteOnce(once, once_callback, &routine, NULL);
+#elif defined(__linux__)
+    pthread_once(once, routine);
+#endif
+}
+
+
+void dvz_mutex_init(DEEPVIZ_MUTEX *mutex){
+
+#ifdef _WIN32
+    InitializeCriticalSection(mutex);
+#elif defined(__linux__)
+    pthread_mutex_init(mutex, NULL);
+#endif
+}
+
+
+void dvz_mutex_destroy(DEEPVIZ_MUTEX *mutex){
+
+#ifdef _WIN32
+    DeleteCriticalSection(mutex);
+#elif defined(__linux__)
+    pthread_mutex_destroy(mutex);
+#endif
+}
+
+
+void dvz_mutex_lock(DEEPVIZ_MUTEX *mutex){
+
+#ifdef _WIN32
+    EnterCriticalSection(mutex);
+#elif defined(__linux__)
+    pthread_mutex_lock(mutex);
+#endif
+}
+
+
+void dvz_mutex_unlock(DEEPVIZ_MUTEX *mutex){
+
+#ifdef _WIN32
+    LeaveCriticalSection(mutex);
+#elif defined(__linux__)
+    pthread_mutex_unlock(mutex);
+#endif
+}
+
+
+void dvz_cond_init(DEEPVIZ_COND *cond){
+
+#ifdef _WIN32
+    InitializeConditionVariable(cond);
+#elif defined(__linux__)
+    pthread_condattr_t  attr;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+#endif
+}
+
+
+void dvz_cond_destroy(DEEPVIZ_COND *cond){
+
+#ifdef _WIN32
+    /* Nothing to release */
+    (void)cond;
+#elif defined(__linux__)
+    pthread_cond_destroy(cond);
+#endif
+}
+
+
+void dvz_cond_wait(DEEPVIZ_COND *cond, DEEPVIZ_MUTEX *mutex){
+
+#ifdef _WIN32
+    SleepConditionVariableCS(cond, mutex, INFINITE);
+#elif defined(__linux__)
+    pthread_cond_wait(cond, mutex);
+#endif
+}
+
+
+deepviz_bool dvz_cond_timedwait(DEEPVIZ_COND *cond, DEEPVIZ_MUTEX *mutex, unsigned int timeoutMs){
+
+#ifdef _WIN32
+    return SleepConditionVariableCS(cond, mutex, timeoutMs) ? deepviz_true : deepviz_false;
+#elif defined(__linux__)
+    struct timespec     deadline;
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeoutMs / 1000;
+    deadline.tv_nsec += (long)(timeoutMs % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L){
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    return pthread_cond_timedwait(cond, mutex, &deadline) ? deepviz_false : deepviz_true;
+#endif
+}
+
+
+void dvz_cond_signal(DEEPVIZ_COND *cond){
+
+#ifdef _WIN32
+    WakeConditionVariable(cond);
+#elif defined(__linux__)
+    pthread_cond_signal(cond);
+#endif
+}
+
+
+void dvz_cond_broadcast(DEEPVIZ_COND *cond){
+
+#ifdef _WIN32
+    WakeAllConditionVariable(cond);
+#elif defined(__linux__)
+    pthread_cond_broadcast(cond);
+#endif
+}
+
+
+void dvz_sleep(unsigned int ms){
+
+#ifdef _WIN32
+    Sleep(ms);
+#elif defined(__linux__)
+    struct timespec     ts;
+
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (long)(ms % 1000) * 1000000L;
+    while (nanosleep(&ts, &ts) && errno == EINTR);
+#endif
+}
+
+
+unsigned long long dvz_time_ms(void){
+
+#ifdef _WIN32
+    return GetTickCount64();
+#elif defined(__linux__)
+    struct timespec     ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000ULL + (unsigned long long)ts.tv_nsec / 1000000ULL;
+#endif
+}
+
+
+static void parallel_worker(void* param){
+
+    PDEEPVIZ_PARALLEL_CONTEXT   ctx = (PDEEPVIZ_PARALLEL_CONTEXT)param;
+    size_t                      taskIndex;
+
+    for (;;){
+
+        /* Pick the next free task */
+        dvz_mutex_lock(&ctx->lock);
+        taskIndex = ctx->nextTask;
+        if (taskIndex < ctx->taskNumber){
+            ctx->nextTask++;
+        }
+        dvz_mutex_unlock(&ctx->lock);
+
+        if (taskIndex >= ctx->taskNumber){
+            break;
+        }
+
+        ctx->routine(ctx->context, taskIndex);
+    }
+}
+
+
+void dvz_parallel_run(size_t taskNumber, size_t maxThreads, DEEPVIZ_TASK_ROUTINE routine, void* context){
+
+    DEEPVIZ_PARALLEL_CONTEXT    ctx;
+    DEEPVIZ_THREAD              *threads = NULL;
+    size_t                      threadNumber = 0;
+    size_t                      i;
+
+    if (taskNumber == 0){
+        return;
+    }
+
+    if (maxThreads > taskNumber){
+        maxThreads = taskNumber;
+    }
+
+    ctx.nextTask = 0;
+    ctx.taskNumber = taskNumber;
+    ctx.routine = routine;
+    ctx.context = context;
+    dvz_mutex_init(&ctx.lock);
+
+    /* The calling thread is a worker too */
+    if (maxThreads > 1){
+        threads = (DEEPVIZ_THREAD*)malloc(sizeof(DEEPVIZ_THREAD) * (maxThreads - 1));
+        if (threads){
+            for (i = 0; i < maxThreads - 1; i++){
+                if (!dvz_thread_create(&threads[threadNumber], parallel_worker, &ctx)){
+                    break;
+                }
+                threadNumber++;
+            }
+        }
+    }
+
+    parallel_worker(&ctx);
+
+    for (i = 0; i < threadNumber; i++){
+        dvz_thread_join(threads[i]);
+    }
+
+    if (threads) free(threads);
+    dvz_mutex_destroy(&ctx.lock);
+}
+
 #ifdef _WIN32
 /* Microsoft */
 
@@ -248,6 +563,25 @@ deepviz_bool	win_sendHTTPrequest(const char* httpServerName,
                                     size_t *responseOutLen,
                                     char* errorMsg){
 
+    return win_sendHTTPrequestStream(httpServerName, httpPage, connectionFlags, HTTPheader, requestFlags, requestBuffer,
+        requestBufferLen, NULL, NULL, statusCodeOut, statusCodeOutLen, responseOut, responseOutLen, errorMsg);
+}
+
+deepviz_bool	win_sendHTTPrequestStream(const char* httpServerName,
+                                            const char* httpPage,
+                                            DWORD connectionFlags,
+                                            const char* HTTPheader,
+                                            DWORD requestFlags,
+                                            PVOID requestBuffer,
+                                            size_t requestBufferLen,
+                                            DEEPVIZ_HTTP_SINK sink,
+                                            void* sinkContext,
+                                            char* statusCodeOut,
+                                            size_t statusCodeOutLen,
+                                            PVOID *responseOut,
+                                            size_t *responseOutLen,
+                                            char* errorMsg){
+
     HINTERNET       hOpen = NULL;
     HINTERNET       hConnect = NULL;
     HINTERNET       hRequest = NULL;
@@ -256,6 +590,15 @@ deepviz_bool	win_sendHTTPrequest(const char* httpServerName,
     PVOID			tmpData = NULL;
     BOOL            decoding = TRUE;
     DWORD           rec_timeout = 3600000;
+    DWORD           contentLength = 0;
+    size_t          received = 0;
+    BOOL            streamed;
+    DEEPVIZ_PROGRESS_STATE progress;
+
+    if (dvz_cancel_requested()){
+        sprintf_s(errorMsg, DEEPVIZ_ERROR_MAX_LEN, "Request cancelled\n");
+        return deepviz_false;
+    }
 
     hOpen = InternetOpenA(NULL, INTERNET_OPEN_TYPE_PRECONFIG, NULL, NULL, 0);
     if (hOpen == NULL){
@@ -285,7 +628,10 @@ deepviz_bool	win_sendHTTPrequest(const char* httpServerName,
     /* Enable HTTP reply buffer decoding */
     InternetSetOptionA(hRequest, INTERNET_OPTION_HTTP_DECODING, &decoding, sizeof(decoding));
 
+    dvz_progress_begin(&progress, httpPage, NULL);
+
     if (!HttpSendRequestA(hRequest, HTTPheader, (DWORD)strlen(HTTPheader), requestBuffer, requestBufferLen)){
+        dvz_progress_end(&progress, deepviz_false);
         sprintf_s(errorMsg, DEEPVIZ_ERROR_MAX_LEN, "Error sending HTTP request: %d\n", GetLastError());
         InternetCloseHandle(hRequest);
         InternetCloseHandle(hConnect);
@@ -293,9 +639,13 @@ deepviz_bool	win_sendHTTPrequest(const char* httpServerName,
         return deepviz_false;
     }
 
+    numberOfBytes = sizeof(contentLength);
+    HttpQueryInfoA(hRequest, HTTP_QUERY_CONTENT_LENGTH | HTTP_QUERY_FLAG_NUMBER, &contentLength, &numberOfBytes, 0);
+
     numberOfBytes = statusCodeOutLen;
 
     if (!HttpQueryInfoA(hRequest, HTTP_QUERY_STATUS_CODE, statusCodeOut, &numberOfBytes, 0)){
+        dvz_progress_end(&progress, deepviz_false);
         sprintf_s(errorMsg, DEEPVIZ_ERROR_MAX_LEN, "Error getting request info: %d\n", GetLastError());
         InternetCloseHandle(hRequest);
         InternetCloseHandle(hConnect);
@@ -303,6 +653,9 @@ deepviz_bool	win_sendHTTPrequest(const char* httpServerName,
         return deepviz_false;
     }
 
+    /* The body of a successful answer goes to the sink, error answers are buffered */
+    streamed = sink && !strcmp(statusCodeOut, "200");
+
     /* Read HTTP response */
     if (responseOut){
 
@@ -319,7 +672,17 @@ deepviz_bool	win_sendHTTPrequest(const char* httpServerName,
                     break;
                 }
 
-                if ((*responseOutLen) == 0){	
+                if (streamed){
+                    if (!sink(sinkContext, data, numberOfBytes)){
+                        sprintf_s(errorMsg, DEEPVIZ_ERROR_MAX_LEN, "Error processing the response data\n");
+                        dvz_progress_end(&progress, deepviz_false);
+                        InternetCloseHandle(hRequest);
+                        InternetCloseHandle(hConnect);
+                        InternetCloseHandle(hOpen);
+                        return deepviz_false;
+                    }
+                }
+                else if ((*responseOutLen) == 0){	
                 /* First iteration */
 
                     (*responseOut) = malloc(numberOfBytes + 1);
@@ -346,10 +709,24 @@ deepviz_bool	win_sendHTTPrequest(const char* httpServerName,
                     (*responseOut) = tmpData;
                 }
 
-                (*responseOutLen) += numberOfBytes;
-
+                if (!streamed){
+                    (*responseOutLen) += numberOfBytes;
+                }
+                received += numberOfBytes;
+
+                if (dvz_cancel_requested() ||
+                    !dvz_progress_update(&progress, requestBufferLen, requestBufferLen, received, contentLength)){
+                    sprintf_s(errorMsg, DEEPVIZ_ERROR_MAX_LEN, dvz_cancel_requested() ? "Request cancelled\n" :
+                        "Transfer aborted by the progress callback\n");
+                    dvz_progress_end(&progress, deepviz_false);
+                    InternetCloseHandle(hRequest);
+                    InternetCloseHandle(hConnect);
+                    InternetCloseHandle(hOpen);
+                    return deepviz_false;
+                }
             }
             else{
+                dvz_progress_end(&progress, deepviz_false);
                 sprintf_s(errorMsg, DEEPVIZ_ERROR_MAX_LEN, "Error InternetReadFile: %d\n", GetLastError());
                 InternetCloseHandle(hRequest);
                 InternetCloseHandle(hConnect);
@@ -360,6 +737,9 @@ deepviz_bool	win_sendHTTPrequest(const char* httpServerName,
         } while (numberOfBytes != 0);
     }
 
+    dvz_progress_update(&progress, requestBufferLen, requestBufferLen, received, contentLength);
+    dvz_progress_end(&progress, deepviz_true);
+
     InternetCloseHandle(hRequest);
     InternetCloseHandle(hConnect);
     InternetCloseHandle(hOpen);
@@ -370,6 +750,180 @@ deepviz_bool	win_sendHTTPrequest(const char* httpServerName,
 #elif defined(__linux__)
 /* Linux */
 
+static pthread_once_t curlInitOnce = PTHREAD_ONCE_INIT;
+
+static pthread_key_t curlHandleKey;
+
+/* Handles of a thread: transfers run on "multi", which keeps the live connections */
+typedef struct _CURL_THREAD_HANDLES{
+    CURL                    *curl;
+    CURLM                   *multi;
+}CURL_THREAD_HANDLES, *PCURL_THREAD_HANDLES;
+
+static void curl_handle_destroy(void* param){
+
+    PCURL_THREAD_HANDLES    handles = (PCURL_THREAD_HANDLES)param;
+
+    curl_multi_cleanup(handles->multi);
+    curl_easy_cleanup(handles->curl);
+    free(handles);
+}
+
+static void curl_global_init_once(void){
+
+    /* curl_global_init() is not thread safe, run it only once */
+    curl_global_init(CURL_GLOBAL_ALL);
+
+    pthread_key_create(&curlHandleKey, curl_handle_destroy);
+}
+
+/* One handle per thread, kept between requests so that its connection to Deepviz is reused */
+static CURL* curl_handle_acquire(void){
+
+    PCURL_THREAD_HANDLES    handles;
+
+    pthread_once(&curlInitOnce, curl_global_init_once);
+
+    handles = (PCURL_THREAD_HANDLES)pthread_getspecific(curlHandleKey);
+    if (handles){
+        return handles->curl;
+    }
+
+    handles = (PCURL_THREAD_HANDLES)malloc(sizeof(CURL_THREAD_HANDLES));
+    if (!handles){
+        return NULL;
+    }
+
+    handles->curl = curl_easy_init();
+    handles->multi = curl_multi_init();
+    if (!handles->curl || !handles->multi || pthread_setspecific(curlHandleKey, handles)){
+        if (handles->multi) curl_multi_cleanup(handles->multi);
+        if (handles->curl) curl_easy_cleanup(handles->curl);
+        free(handles);
+        return NULL;
+    }
+
+    return handles->curl;
+}
+
+/* Clear the options of the request. Live connections, DNS and TLS session caches are kept */
+static void curl_handle_release(CURL* curl){
+
+    curl_easy_reset(curl);
+}
+
+/* curl_multi_poll() and curl_multi_wakeup() need libcurl 7.68: older versions wait in short steps instead, so that a
+cancellation is seen within CURL_WAIT_STEP_MS */
+#if LIBCURL_VERSION_NUM >= 0x074400
+#define     CURL_HAVE_WAKEUP
+#endif
+#define     CURL_WAIT_STEP_MS       100
+
+static void curl_cancel_wakeup(void* param){
+
+#ifdef CURL_HAVE_WAKEUP
+    curl_multi_wakeup((CURLM*)param);
+#endif
+}
+
+/* Run the request on the thread's multi handle: unlike curl_easy_perform(), its wait can be interrupted by a
+cancellation at once. Same result codes as curl_easy_perform() */
+static CURLcode curl_perform(CURL* curl){
+
+    PCURL_THREAD_HANDLES    handles = (PCURL_THREAD_HANDLES)pthread_getspecific(curlHandleKey);
+    PDEEPVIZ_CANCEL_TOKEN   token = dvz_cancel_token_current();
+    DEEPVIZ_CANCEL_WAITER   waiter;
+    CURLcode                res = CURLE_OK;
+    CURLMsg                 *msg;
+    int                     running = 1;
+    int                     left;
+#ifndef CURL_HAVE_WAKEUP
+    int                     numfds;
+    int                     idle = 0;
+#endif
+
+    if (token && !dvz_cancel_register(token, &waiter, curl_cancel_wakeup, handles->multi)){
+        return CURLE_ABORTED_BY_CALLBACK;
+    }
+
+    if (curl_multi_add_handle(handles->multi, curl) != CURLM_OK){
+        if (token) dvz_cancel_unregister(token, &waiter);
+        return CURLE_FAILED_INIT;
+    }
+
+    for (;;){
+
+        if (curl_multi_perform(handles->multi, &running) != CURLM_OK){
+            res = CURLE_FAILED_INIT;
+            break;
+        }
+
+        if (!running){
+            break;
+        }
+
+        if (token && deepviz_cancel_token_cancelled(token)){
+            res = CURLE_ABORTED_BY_CALLBACK;
+            break;
+        }
+
+#ifdef CURL_HAVE_WAKEUP
+        curl_multi_poll(handles->multi, NULL, 0, 1000, NULL);
+#else
+        /* Nothing to wait on (e.g. resolving) makes curl_multi_wait() return at once: sleep instead */
+        if (curl_multi_wait(handles->multi, NULL, 0, CURL_WAIT_STEP_MS, &numfds) != CURLM_OK){
+            res = CURLE_FAILED_INIT;
+            break;
+        }
+        idle = numfds ? 0 : idle + 1;
+        if (idle > 1){
+            dvz_sleep(CURL_WAIT_STEP_MS);
+        }
+#endif
+    }
+
+    if (token) dvz_cancel_unregister(token, &waiter);
+
+    if (!running){
+        while ((msg = curl_multi_info_read(handles->multi, &left))){
+            if (msg->msg == CURLMSG_DONE && msg->easy_handle == curl){
+                res = msg->data.result;
+            }
+        }
+    }
+
+    /* An unfinished transfer closes its connection */
+    curl_multi_remove_handle(handles->multi, curl);
+
+    return res;
+}
+
+static const char* curl_error_string(CURLcode res){
+
+    if (res == CURLE_ABORTED_BY_CALLBACK){
+        return dvz_cancel_requested() ? "request cancelled" : "transfer aborted by the progress callback";
+    }
+
+    return curl_easy_strerror(res);
+}
+
+/* Transfer-info hook: non-zero aborts the transfer */
+static int curl_progress(void* clientp, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow){
+
+    return dvz_progress_update((PDEEPVIZ_PROGRESS_STATE)clientp, (unsigned long long)ulnow, (unsigned long long)ultotal,
+        (unsigned long long)dlnow, (unsigned long long)dltotal) ? 0 : 1;
+}
+
+/* Follow the progress of the transfer if a callback is set */
+static void curl_progress_begin(CURL* curl, PDEEPVIZ_PROGRESS_STATE progress, const char* httpPage, const char* filePath){
+
+    if (dvz_progress_begin(progress, httpPage, filePath)){
+        curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+        curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, curl_progress);
+        curl_easy_setopt(curl, CURLOPT_XFERINFODATA, progress);
+    }
+}
+
 static size_t WriteMemoryCallback(void *contents, size_t size, size_t nmemb, void *userp){
 
     size_t realsize = size * nmemb;
@@ -388,6 +942,36 @@ static size_t WriteMemoryCallback(void *contents, size_t size, size_t nmemb, voi
     return realsize;
 }
 
+/* Streamed response: the body of a successful answer goes to the sink, error answers are buffered */
+typedef struct _CURL_STREAM{
+    CURL                    *curl;
+    DEEPVIZ_HTTP_SINK       sink;
+    void                    *context;
+    long                    statusCode;             /* 0 until the first data */
+    deepviz_bool            sinkFailed;
+    struct MemoryStruct     data;
+}CURL_STREAM, *PCURL_STREAM;
+
+static size_t WriteStreamCallback(void *contents, size_t size, size_t nmemb, void *userp){
+
+    PCURL_STREAM    stream = (PCURL_STREAM)userp;
+
+    if (!stream->statusCode){
+        curl_easy_getinfo(stream->curl, CURLINFO_RESPONSE_CODE, &stream->statusCode);
+    }
+
+    if (!stream->sink || stream->statusCode != 200){
+        return WriteMemoryCallback(contents, size, nmemb, &stream->data);
+    }
+
+    if (!stream->sink(stream->context, contents, size * nmemb)){
+        stream->sinkFailed = deepviz_true;
+        return 0;
+    }
+
+    return size * nmemb;
+}
+
 deepviz_bool linux_sendHTTPrequest(	  const char* serverName,
                                       const char* httpPage,
                                       const char* requestBuffer,
@@ -397,25 +981,43 @@ deepviz_bool linux_sendHTTPrequest(	  const char* serverName,
                                       size_t *responseOutLen,
                                       char* errorMsg){
 
+    return linux_sendHTTPrequestStream(serverName, httpPage, requestBuffer, NULL, NULL, statusCodeOut, statusCodeOutLen,
+        responseOut, responseOutLen, errorMsg);
+}
+
+deepviz_bool linux_sendHTTPrequestStream(   const char* serverName,
+                                            const char* httpPage,
+                                            const char* requestBuffer,
+                                            DEEPVIZ_HTTP_SINK sink,
+                                            void* sinkContext,
+                                            char* statusCodeOut,
+                                            size_t statusCodeOutLen,
+                                            void** responseOut,
+                                            size_t *responseOutLen,
+                                            char* errorMsg){
+
     CURL 		        *curl;
     CURLcode 	        res;
     char		        requestString[1024];
     struct curl_slist   *chunk = NULL;
-    struct MemoryStruct data;
+    CURL_STREAM         stream;
     long		        statusCode;
+    DEEPVIZ_PROGRESS_STATE  progress;
 
     memset(requestString, 0, 1024);
 
-    curl_global_init(CURL_GLOBAL_DEFAULT);
-
-    curl = curl_easy_init();
+    curl = curl_handle_acquire();
     if (!curl) {
         snprintf(errorMsg, DEEPVIZ_ERROR_MAX_LEN, "Error while connecting to Deepviz\n");
         return deepviz_false;
     }
 
-    data.memory = malloc(1);  	/* will be grown as needed by realloc above */
-    data.size = 0;    			/* no data at this point */
+    memset(&stream, 0, sizeof(CURL_STREAM));
+    stream.curl = curl;
+    stream.sink = sink;
+    stream.context = sinkContext;
+    stream.data.memory = malloc(1);  	/* will be grown as needed by realloc above */
+    stream.data.size = 0;    			/* no data at this point */
     
     /* Build URL */
     snprintf(requestString, 1024, "https://%s/%s", serverName, httpPage);
@@ -429,23 +1031,31 @@ deepviz_bool linux_sendHTTPrequest(	  const char* serverName,
     curl_easy_setopt(curl, CURLOPT_HTTPHEADER, chunk);
 
     /* Save Response data buffer */
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteMemoryCallback);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&data);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteStreamCallback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&stream);
 
     /* Set POST data */
     curl_easy_setopt(curl, CURLOPT_POSTFIELDS, requestBuffer);
 
     /*curl_easy_setopt(curl, CURLOPT_VERBOSE, 1L);*/
 
+    curl_progress_begin(curl, &progress, httpPage, NULL);
+
     /* Perform the request */
-    res = curl_easy_perform(curl);
+    res = curl_perform(curl);
+    dvz_progress_end(&progress, res == CURLE_OK);
     if (res != CURLE_OK) {
         /* Error during request */
 
-        free(data.memory);
-        curl_easy_cleanup(curl);
+        free(stream.data.memory);
+        curl_handle_release(curl);
 
-        snprintf(errorMsg, DEEPVIZ_ERROR_MAX_LEN, "Error while connecting to Deepviz: %s\n", curl_easy_strerror(res));
+        if (stream.sinkFailed){
+            snprintf(errorMsg, DEEPVIZ_ERROR_MAX_LEN, "Error processing the response data\n");
+        }
+        else{
+            snprintf(errorMsg, DEEPVIZ_ERROR_MAX_LEN, "Error while connecting to Deepviz: %s\n", curl_error_string(res));
+        }
         return deepviz_false;
     }
 
@@ -454,17 +1064,17 @@ deepviz_bool linux_sendHTTPrequest(	  const char* serverName,
     snprintf(statusCodeOut, statusCodeOutLen, "%ld", statusCode);
 
     /* Save response data */
-    (*responseOut) = malloc(data.size + 1);
+    (*responseOut) = malloc(stream.data.size + 1);
     if((*responseOut)){
-        memset((*responseOut), 0, data.size + 1 );
-        (*responseOutLen) = data.size;
-        memcpy((*responseOut), data.memory, data.size);
+        memset((*responseOut), 0, stream.data.size + 1 );
+        (*responseOutLen) = stream.data.size;
+        memcpy((*responseOut), stream.data.memory, stream.data.size);
     }
 
-    free(data.memory);
+    free(stream.data.memory);
 
-    /* Curl cleanup */
-    curl_easy_cleanup(curl);
+    /* Keep the handle, and its connection, for the next request */
+    curl_handle_release(curl);
     return deepviz_true;
 
 }
@@ -487,10 +1097,15 @@ deepviz_bool linux_sendHTTPrequestMultipart(	const char* serverName,
     struct curl_httppost    *formpost = NULL;
     struct curl_httppost    *lastptr = NULL;
     struct curl_slist       *headerlist = NULL;
+    DEEPVIZ_PROGRESS_STATE  progress;
 
     memset(requestString, 0, 1024);
 
-    curl_global_init(CURL_GLOBAL_ALL);
+    curl = curl_handle_acquire();
+    if (!curl) {
+        snprintf(errorMsg, DEEPVIZ_ERROR_MAX_LEN, "Error while connecting to Deepviz\n");
+        return deepviz_false;
+    }
 
     /* Build multipart form post */
     curl_formadd(&formpost,
@@ -512,12 +1127,6 @@ deepviz_bool linux_sendHTTPrequestMultipart(	const char* serverName,
                  CURLFORM_CONTENTTYPE, "application/x-msdownload",
                  CURLFORM_END);
 
-    curl = curl_easy_init();
-    if (!curl) {
-        snprintf(errorMsg, DEEPVIZ_ERROR_MAX_LEN, "Error while connecting to Deepviz\n");
-        return deepviz_false;
-    }
-    
     data.memory = malloc(1);  	/* will be grown as needed by realloc above */
     data.size = 0;    			/* no data at this point */
 
@@ -536,17 +1145,20 @@ deepviz_bool linux_sendHTTPrequestMultipart(	const char* serverName,
     curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteMemoryCallback);
     curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&data);
     
+    curl_progress_begin(curl, &progress, httpPage, filePath);
+
     /* Perform the request */
-    res = curl_easy_perform(curl);
+    res = curl_perform(curl);
+    dvz_progress_end(&progress, res == CURLE_OK);
     if (res != CURLE_OK) {
         /* Error during request */
 
         free(data.memory);
-        curl_easy_cleanup(curl);
+        curl_handle_release(curl);
         curl_formfree(formpost);
         curl_slist_free_all (headerlist);
 
-        snprintf(errorMsg, DEEPVIZ_ERROR_MAX_LEN, "Error while connecting to Deepviz: %s\n", curl_easy_strerror(res));
+        snprintf(errorMsg, DEEPVIZ_ERROR_MAX_LEN, "Error while connecting to Deepviz: %s\n", curl_error_string(res));
         return deepviz_false;
     }
 
@@ -564,8 +1176,8 @@ deepviz_bool linux_sendHTTPrequestMultipart(	const char* serverName,
 
     free(data.memory);
 
-    /* Curl cleanup */
-    curl_easy_cleanup(curl);
+    /* Keep the handle, and its connection, for the next request */
+    curl_handle_release(curl);
     curl_formfree(formpost);
     curl_slist_free_all (headerlist);
 
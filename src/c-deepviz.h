@@ -81,12 +81,23 @@ typedef enum _DEEPVIZ_RESULT_STATUS {
     DEEPVIZ_STATUS_SERVER_ERROR,
     DEEPVIZ_STATUS_INTERNAL_ERROR,
     DEEPVIZ_STATUS_PROCESSING,
+    DEEPVIZ_STATUS_CANCELLED,
 } DEEPVIZ_RESULT_STATUS;
 
+/* Encoding of the data of successful results, see deepviz_result_format_set() */
+typedef enum _DEEPVIZ_RESULT_FORMAT {
+    DEEPVIZ_FORMAT_JSON,                    /* JSON text */
+    DEEPVIZ_FORMAT_MSGPACK,                 /* MessagePack */
+    DEEPVIZ_FORMAT_CBOR,                    /* CBOR (RFC 7049) */
+} DEEPVIZ_RESULT_FORMAT;
+
 /* c-deepviz result data structure */
 typedef struct _DEEPVIZ_RESULT{
     DEEPVIZ_RESULT_STATUS   status;
     char*                   msg;
+    deepviz_bool            stale;          /* Expired result served by the cache */
+    size_t                  msgLen;         /* Bytes in "msg": binary formats may contain NUL bytes */
+    DEEPVIZ_RESULT_FORMAT   format;         /* Encoding of "msg"; error messages are always text */
 }DEEPVIZ_RESULT, *PDEEPVIZ_RESULT;
 
 typedef struct _DEEPVIZ_LIST{
@@ -94,6 +105,266 @@ typedef struct _DEEPVIZ_LIST{
     char        entry[1][DEEPVIZ_ENTRY_MAX_LEN];			/* Will be allocated correctly by the deepviz_list_init() API */
 }DEEPVIZ_LIST, *PDEEPVIZ_LIST;
 
+/* Bulk download jobs */
+
+#define     DEEPVIZ_BULK_DEFAULT_CHUNK_SIZE 500
+#define     DEEPVIZ_DEFAULT_THREADS         4
+#define     DEEPVIZ_ID_REQUEST_MAX_LEN      64
+
+typedef enum _DEEPVIZ_BULK_CHUNK_STATE {
+    DEEPVIZ_BULK_CHUNK_NEW,             /* Not submitted yet or submission failed */
+    DEEPVIZ_BULK_CHUNK_REQUESTED,       /* Request accepted, "id_request" is valid */
+    DEEPVIZ_BULK_CHUNK_DOWNLOADED,      /* Archive downloaded */
+} DEEPVIZ_BULK_CHUNK_STATE;
+
+typedef struct _DEEPVIZ_BULK_CHUNK{
+    PDEEPVIZ_LIST               md5_list;                               /* MD5 subset handled by this chunk */
+    DEEPVIZ_BULK_CHUNK_STATE    state;
+    DEEPVIZ_RESULT_STATUS       status;                                 /* Status of the last operation on this chunk */
+    char                        id_request[DEEPVIZ_ID_REQUEST_MAX_LEN];
+    char                        msg[DEEPVIZ_ENTRY_MAX_LEN];             /* Message of the last operation on this chunk */
+}DEEPVIZ_BULK_CHUNK, *PDEEPVIZ_BULK_CHUNK;
+
+typedef struct _DEEPVIZ_BULK_JOB{
+    size_t              chunkNumber;
+    DEEPVIZ_BULK_CHUNK  chunk[1];                                       /* Will be allocated correctly by the deepviz_bulk_job_init() API */
+}DEEPVIZ_BULK_JOB, *PDEEPVIZ_BULK_JOB;
+
+typedef struct _DEEPVIZ_BULK_RUN_SUMMARY{
+    size_t                      requested;                              /* Distinct MD5s requested */
+    size_t                      extracted;                              /* Samples extracted from the archive */
+    size_t                      missing;                                /* Samples not extracted */
+}DEEPVIZ_BULK_RUN_SUMMARY, *PDEEPVIZ_BULK_RUN_SUMMARY;
+
+
+/* Folder upload */
+
+#define     DEEPVIZ_UPLOAD_DEFAULT_QUEUE    1024
+
+typedef enum _DEEPVIZ_SYMLINK_POLICY{
+    DEEPVIZ_SYMLINK_SKIP = 0,                           /* Ignore symbolic links */
+    DEEPVIZ_SYMLINK_FILES,                              /* Follow the links to files only */
+    DEEPVIZ_SYMLINK_FOLLOW                              /* Follow the links to files and folders */
+}DEEPVIZ_SYMLINK_POLICY;
+
+/* File types recognized by the upload triage (first bytes of the file) */
+#define     DEEPVIZ_FILETYPE_PE             0x00000001
+#define     DEEPVIZ_FILETYPE_ELF            0x00000002
+#define     DEEPVIZ_FILETYPE_MACHO          0x00000004
+#define     DEEPVIZ_FILETYPE_OFFICE         0x00000008      /* OLE (doc, xls, ppt, msi) and OOXML */
+#define     DEEPVIZ_FILETYPE_PDF            0x00000010
+#define     DEEPVIZ_FILETYPE_ARCHIVE        0x00000020      /* zip, rar, 7z, gzip, bzip2, xz, cab, tar */
+#define     DEEPVIZ_FILETYPE_ANALYZABLE     0x0000003f
+
+/* Called by deepviz_upload_folder_parallel() for every file, from the uploader threads. "result" is freed on return */
+typedef void (*DEEPVIZ_UPLOAD_CALLBACK)(void* context, const char* path, PDEEPVIZ_RESULT result);
+
+typedef struct _DEEPVIZ_UPLOAD_CONFIG{
+    size_t                      threads;                /* Concurrent uploads */
+    size_t                      queueSize;              /* Files found and waiting for an uploader */
+    deepviz_bool                stopOnError;            /* Stop at the first failed upload */
+    DEEPVIZ_SYMLINK_POLICY      symlinks;
+    deepviz_bool                crossDevice;            /* Walk into the filesystems mounted below the folder */
+    const char                  *journalPath;           /* Optional: skip the files uploaded by a previous run */
+    unsigned long long          minSize;                /* Triage: smaller files are not uploaded */
+    unsigned long long          maxSize;                /* Triage: larger files are not uploaded (0 = no limit) */
+    const char                  **include;              /* Triage: NULL terminated globs ("*", "?") of the files to upload (NULL = all).
+                                                           Globs with a path separator match the whole path, the others the name */
+    const char                  **exclude;              /* Triage: NULL terminated globs of the files not to upload */
+    unsigned int                fileTypes;              /* Triage: DEEPVIZ_FILETYPE_* of the files to upload (0 = all) */
+    DEEPVIZ_UPLOAD_CALLBACK     callback;               /* Optional */
+    void                        *context;               /* Passed to "callback" */
+}DEEPVIZ_UPLOAD_CONFIG, *PDEEPVIZ_UPLOAD_CONFIG;
+
+typedef struct _DEEPVIZ_UPLOAD_SUMMARY{
+    size_t                      files;                  /* Files found */
+    size_t                      uploaded;               /* Uploaded, or skipped as already known */
+    size_t                      skipped;                /* Already uploaded according to the journal */
+    size_t                      filtered;               /* Rejected by the triage filters */
+    size_t                      failed;
+}DEEPVIZ_UPLOAD_SUMMARY, *PDEEPVIZ_UPLOAD_SUMMARY;
+
+
+/* Folder watch */
+
+#define     DEEPVIZ_WATCH_DEFAULT_SETTLE_MS     2000
+
+typedef struct _DEEPVIZ_WATCH DEEPVIZ_WATCH, *PDEEPVIZ_WATCH;
+
+typedef struct _DEEPVIZ_WATCH_CONFIG{
+    DEEPVIZ_UPLOAD_CONFIG       upload;                 /* Uploaders, journal and callback. Symbolic links are not uploaded */
+    unsigned int                settleMs;               /* Quiet time after a file is closed before it is uploaded */
+    deepviz_bool                wholeMount;             /* Linux: fanotify on the folder's filesystem, for very large trees. Needs
+                                                           CAP_SYS_ADMIN (else inotify is used). Before Linux 5.9 it watches the
+                                                           mount and sees only the files written, not the ones moved into the folder */
+}DEEPVIZ_WATCH_CONFIG, *PDEEPVIZ_WATCH_CONFIG;
+
+
+/* MD5 */
+
+#define     DEEPVIZ_MD5_LEN                 16
+#define     DEEPVIZ_MD5_HEX_LEN             33          /* 32 hex digits + '\0' */
+
+/* Upload deduplication */
+
+#define     DEEPVIZ_DEDUP_DEFAULT_ENTRIES   1000000
+
+
+/* Sample store */
+
+typedef enum _DEEPVIZ_SAMPLE_STORE_MODE {
+    DEEPVIZ_SAMPLE_STORE_HARDLINK,      /* Hard link stored samples into the download path (clone or copy across filesystems) */
+    DEEPVIZ_SAMPLE_STORE_REFLINK,       /* Copy on write clone where supported, plain copy otherwise */
+} DEEPVIZ_SAMPLE_STORE_MODE;
+
+
+/* Result cache */
+
+typedef enum _DEEPVIZ_CACHE_ENDPOINT {
+    DEEPVIZ_CACHE_SAMPLE_RESULT,        /* deepviz_sample_result() */
+    DEEPVIZ_CACHE_SAMPLE_INFO,          /* deepviz_sample_info() */
+    DEEPVIZ_CACHE_IP_INFO,              /* deepviz_ip_info() */
+    DEEPVIZ_CACHE_DOMAIN_INFO,          /* deepviz_domain_info() */
+    DEEPVIZ_CACHE_ENDPOINT_NUMBER,
+} DEEPVIZ_CACHE_ENDPOINT;
+
+#define     DEEPVIZ_CACHE_DEFAULT_SHARDS        16
+#define     DEEPVIZ_CACHE_DEFAULT_MEMORY        (64 * 1024 * 1024)
+#define     DEEPVIZ_CACHE_DEFAULT_TTL           3600
+#define     DEEPVIZ_CACHE_DEFAULT_NEGATIVE_TTL  300
+#define     DEEPVIZ_CACHE_DEFAULT_INDEX_SLOTS   (1024 * 1024)
+
+typedef struct _DEEPVIZ_CACHE_CONFIG{
+    size_t          shardNumber;                                    /* Number of independently locked shards */
+    size_t          maxMemory;                                      /* Memory budget in bytes, least recently used entries are evicted */
+    unsigned int    ttl[DEEPVIZ_CACHE_ENDPOINT_NUMBER];             /* Seconds, 0 = endpoint not cached */
+    unsigned int    negativeTtl[DEEPVIZ_CACHE_ENDPOINT_NUMBER];     /* Seconds for "not found" and empty answers, 0 = not cached */
+    unsigned int    staleWhileRevalidate[DEEPVIZ_CACHE_ENDPOINT_NUMBER];    /* Seconds after expiration the entry is still served while refreshed in background */
+    unsigned int    staleIfError[DEEPVIZ_CACHE_ENDPOINT_NUMBER];            /* Seconds after expiration the entry is still served if the refresh fails */
+}DEEPVIZ_CACHE_CONFIG, *PDEEPVIZ_CACHE_CONFIG;
+
+typedef struct _DEEPVIZ_CACHE_STATS{
+    unsigned long long  hits;
+    unsigned long long  misses;
+    unsigned long long  evictions;
+    unsigned long long  expirations;
+    unsigned long long  stale;                                      /* Expired entries served */
+    unsigned long long  entries;
+    unsigned long long  memory;
+}DEEPVIZ_CACHE_STATS, *PDEEPVIZ_CACHE_STATS;
+
+/* Transfer progress */
+
+typedef struct _DEEPVIZ_PROGRESS{
+    const char                  *page;                  /* API page of the request, e.g. URL_UPLOAD_SAMPLE */
+    const char                  *filePath;              /* File being uploaded, or NULL */
+    unsigned long long          uploaded;               /* Bytes sent */
+    unsigned long long          uploadTotal;            /* 0 if not known yet */
+    unsigned long long          downloaded;             /* Bytes received */
+    unsigned long long          downloadTotal;          /* 0 if not known yet */
+    double                      rate;                   /* Bytes per second, both directions, since the previous call */
+    double                      averageRate;            /* Bytes per second, both directions, since the start of the transfer */
+    unsigned long long          elapsedMs;
+    deepviz_bool                done;                   /* Last call, the transfer is over */
+    deepviz_bool                failed;                 /* Last call only: the transfer failed or was aborted */
+    deepviz_bool                cancelled;              /* Last call only: aborted by a cancellation token or by the callback */
+}DEEPVIZ_PROGRESS, *PDEEPVIZ_PROGRESS;
+
+/* Called from the thread running the transfer, about 4 times per second (at least once per second on a stalled transfer
+with curl). Return deepviz_false to abort the transfer: the API call fails with DEEPVIZ_STATUS_NETWORK_ERROR. A last call
+with "done" set is always made, with "failed" (and "cancelled") set if the transfer did not complete; an HTTP error answer
+is a completed transfer */
+typedef deepviz_bool (*DEEPVIZ_PROGRESS_CALLBACK)(void* context, PDEEPVIZ_PROGRESS progress);
+
+/* Cancellation */
+
+typedef struct _DEEPVIZ_CANCEL_TOKEN DEEPVIZ_CANCEL_TOKEN, *PDEEPVIZ_CANCEL_TOKEN;
+
+/* Result polling */
+
+#define     DEEPVIZ_POLL_DEFAULT_INITIAL_MS     5000
+#define     DEEPVIZ_POLL_DEFAULT_MAX_MS         (5 * 60 * 1000)
+#define     DEEPVIZ_POLL_DEFAULT_BACKOFF        2.0
+
+typedef struct _DEEPVIZ_POLLER DEEPVIZ_POLLER, *PDEEPVIZ_POLLER;
+
+typedef enum _DEEPVIZ_POLL_TYPE {
+    DEEPVIZ_POLL_SAMPLE_RESULT,         /* deepviz_sample_result() of an MD5 */
+    DEEPVIZ_POLL_SAMPLE_REPORT,         /* deepviz_sample_report() of an MD5 */
+    DEEPVIZ_POLL_BULK_DOWNLOAD,         /* deepviz_bulk_download_retrieve() of a request ID */
+} DEEPVIZ_POLL_TYPE;
+
+typedef struct _DEEPVIZ_POLL_SCHEDULE{
+    unsigned int                initialDelayMs;         /* Before the first poll */
+    unsigned int                maxDelayMs;             /* Longest delay between two polls */
+    double                      backoff;                /* Delay multiplier after every DEEPVIZ_STATUS_PROCESSING answer */
+    unsigned int                timeoutMs;              /* Give up after this time (0 = never) */
+}DEEPVIZ_POLL_SCHEDULE, *PDEEPVIZ_POLL_SCHEDULE;
+
+/* Called from the poller threads with the final result of an item: any answer but DEEPVIZ_STATUS_PROCESSING, or the last
+DEEPVIZ_STATUS_PROCESSING answer once the item timed out. "result" is freed on return */
+typedef void (*DEEPVIZ_POLL_CALLBACK)(void* context, DEEPVIZ_POLL_TYPE type, const char* id, PDEEPVIZ_RESULT result);
+
+typedef struct _DEEPVIZ_POLLER_CONFIG{
+    size_t                      threads;                /* Concurrent polls */
+    DEEPVIZ_POLL_SCHEDULE       schedule;               /* Schedule of the items added without one */
+    DEEPVIZ_POLL_CALLBACK       callback;
+    void                        *context;               /* Passed to "callback" */
+}DEEPVIZ_POLLER_CONFIG, *PDEEPVIZ_POLLER_CONFIG;
+
+/* Search cursors */
+
+#define     DEEPVIZ_SEARCH_DEFAULT_PAGE_SIZE    100
+#define     DEEPVIZ_SEARCH_MAX_PAGE_SIZE        1000
+
+typedef struct _DEEPVIZ_SEARCH_CURSOR DEEPVIZ_SEARCH_CURSOR, *PDEEPVIZ_SEARCH_CURSOR;
+
+/* Receives the hits of a search in order, once each. "category" is the group of the hit ("md5", "ip", "domain"...,
+NULL if the results are a plain list), "hit" its string value or, for a structured hit, its JSON text. Return
+deepviz_false to stop the search */
+typedef deepviz_bool (*DEEPVIZ_SEARCH_SINK)(void* context, const char* category, const char* hit);
+
+typedef struct _DEEPVIZ_SEARCH_FANOUT{
+    size_t                      threads;                /* Pages requested at once (0 = DEEPVIZ_DEFAULT_THREADS) */
+    int                         pageSize;               /* Rows per request (0 = DEEPVIZ_SEARCH_MAX_PAGE_SIZE) */
+    int                         maxRows;                /* Rows to retrieve, when the size of the results is known (0 = all) */
+    DEEPVIZ_SEARCH_SINK         sink;
+    void                        *context;               /* Passed to "sink" */
+}DEEPVIZ_SEARCH_FANOUT, *PDEEPVIZ_SEARCH_FANOUT;
+
+/* Compiled advanced search queries */
+
+typedef struct _DEEPVIZ_QUERY DEEPVIZ_QUERY, *PDEEPVIZ_QUERY;
+
+typedef enum _DEEPVIZ_QUERY_FIELD {
+    /* Lists: every value added is appended */
+    DEEPVIZ_QUERY_SIM_HASH,
+    DEEPVIZ_QUERY_CREATED_FILES,
+    DEEPVIZ_QUERY_IMP_HASH,
+    DEEPVIZ_QUERY_URL,
+    DEEPVIZ_QUERY_STRINGS,
+    DEEPVIZ_QUERY_IP,
+    DEEPVIZ_QUERY_ASN,
+    DEEPVIZ_QUERY_RULES,
+    DEEPVIZ_QUERY_COUNTRY,
+    DEEPVIZ_QUERY_DOMAIN,
+    /* Single values: the last value added is kept */
+    DEEPVIZ_QUERY_CLASSIFICATION,
+    DEEPVIZ_QUERY_NEVER_SEEN,           /* "true" or "false" (default) */
+    DEEPVIZ_QUERY_TIME_DELTA,           /* Default time window, can be changed at every run */
+    DEEPVIZ_QUERY_IP_RANGE,
+} DEEPVIZ_QUERY_FIELD;
+
+/* NDJSON output */
+
+typedef struct _DEEPVIZ_NDJSON_WRITER DEEPVIZ_NDJSON_WRITER, *PDEEPVIZ_NDJSON_WRITER;
+
+/* Lazy sample reports */
+
+#define     DEEPVIZ_REPORT_DEFAULT_SECTION  "classification"
+
+typedef struct _DEEPVIZ_REPORT DEEPVIZ_REPORT, *PDEEPVIZ_REPORT;
+
 
 /* ******************** Exported APIs ******************** */
 
@@ -106,6 +377,13 @@ EXPORT deepviz_bool     deepviz_list_add(PDEEPVIZ_LIST list, const char* newFilt
 /* Free the allocated memory for a DEEPVIZ_RESULT */
 EXPORT void             deepviz_result_free(PDEEPVIZ_RESULT *result);
 
+/* Encoding of the results of the calls made by the calling thread from now on (JSON by default). The data is
+encoded straight from the parsed response. Returns the previous format */
+EXPORT DEEPVIZ_RESULT_FORMAT deepviz_result_format_set(DEEPVIZ_RESULT_FORMAT format);
+
+/* Re-encode the data of a successful result in place */
+EXPORT deepviz_bool     deepviz_result_convert(PDEEPVIZ_RESULT result, DEEPVIZ_RESULT_FORMAT format);
+
 /* Free the allocated memory for a DEEPVIZ_LIST */
 EXPORT void             deepviz_list_free(PDEEPVIZ_LIST *list);
 
@@ -126,12 +404,52 @@ EXPORT PDEEPVIZ_RESULT  deepviz_upload_folder(
     const char* api_key, 
     const char* folder);
 
+/* Upload all the files in a folder with a pool of "config->threads" uploaders (NULL = default config). Unless
+"config->stopOnError" is set, failed files do not stop the upload: they are reported to "config->callback" and counted
+in "summary" (optional). With "config->journalPath", every uploaded file is recorded there and skipped by the next runs
+on the same folder path, unless modified */
+EXPORT PDEEPVIZ_RESULT  deepviz_upload_folder_parallel(
+    const char* api_key,
+    const char* folder,
+    PDEEPVIZ_UPLOAD_CONFIG config,
+    PDEEPVIZ_UPLOAD_SUMMARY summary);
+
+/* Fill a DEEPVIZ_UPLOAD_CONFIG with the default values */
+EXPORT void             deepviz_upload_default_config(PDEEPVIZ_UPLOAD_CONFIG config);
+
+/* Watch a folder tree and upload, in the background, every file written or moved into it once it has been closed and
+left untouched for "config->settleMs" (NULL = default config). The files already in the folder are not uploaded. Every
+upload is reported to "config->upload.callback" */
+EXPORT PDEEPVIZ_RESULT  deepviz_watch_start(
+    const char* api_key,
+    const char* folder,
+    PDEEPVIZ_WATCH_CONFIG config,
+    PDEEPVIZ_WATCH* watch);
+
+/* Stop watching: the files completely written are uploaded at once, then the uploads are waited for. "summary"
+(optional) counts all the files uploaded by the watch */
+EXPORT PDEEPVIZ_RESULT  deepviz_watch_stop(
+    PDEEPVIZ_WATCH* watch,
+    PDEEPVIZ_UPLOAD_SUMMARY summary);
+
+/* Fill a DEEPVIZ_WATCH_CONFIG with the default values */
+EXPORT void             deepviz_watch_default_config(PDEEPVIZ_WATCH_CONFIG config);
+
 /* Download a sample */
 EXPORT PDEEPVIZ_RESULT  deepviz_sample_download(
     const char* md5, 
     const char* api_key, 
     const char* path);
 
+/* Enable the download batching window: deepviz_sample_download() calls issued concurrently within "max_delay_ms"
+are grouped (at most "max_batch_size" samples) into a single bulk download request. */
+EXPORT deepviz_bool     deepviz_download_batching_enable(
+    unsigned int max_delay_ms,
+    size_t max_batch_size);
+
+/* Disable the download batching window. Batches already collected are completed. */
+EXPORT void             deepviz_download_batching_disable(void);
+
 /* Send a bulk download request and retrieve the related request ID */
 EXPORT PDEEPVIZ_RESULT  deepviz_bulk_download_request(   
     PDEEPVIZ_LIST md5_list,
@@ -144,6 +462,193 @@ EXPORT PDEEPVIZ_RESULT deepviz_bulk_download_retrieve(
     const char* path,
     const char* api_key);
 
+/* Split a MD5 list into a bulk download job made of chunks of at most "chunk_size" MD5 (0 = default size) */
+EXPORT PDEEPVIZ_BULK_JOB deepviz_bulk_job_init(
+    PDEEPVIZ_LIST md5_list,
+    size_t chunk_size);
+
+/* Send a bulk download request for every chunk not yet accepted, using at most "max_threads" concurrent requests (0 = default).
+Call it again to retry the failed chunks only. */
+EXPORT PDEEPVIZ_RESULT deepviz_bulk_job_submit(
+    PDEEPVIZ_BULK_JOB job,
+    const char* api_key,
+    size_t max_threads);
+
+/* Download the archives of every accepted chunk not yet downloaded, using at most "max_threads" concurrent requests (0 = default).
+Returns DEEPVIZ_STATUS_PROCESSING while one or more archives are not ready yet. */
+EXPORT PDEEPVIZ_RESULT deepviz_bulk_job_retrieve(
+    PDEEPVIZ_BULK_JOB job,
+    const char* path,
+    const char* api_key,
+    size_t max_threads);
+
+/* Free the allocated memory for a DEEPVIZ_BULK_JOB */
+EXPORT void deepviz_bulk_job_free(PDEEPVIZ_BULK_JOB *job);
+
+/* Request the samples of "md5_list", wait for the archive following "schedule" (NULL = default polling schedule) and
+extract it while it is downloaded into "path/<md5>" files (NULL = into the sample store only, see deepviz_sample_store_enable()).
+No archive is written to disk; the samples extracted before an error are kept. Returns DEEPVIZ_STATUS_PROCESSING if
+"schedule->timeoutMs" expires first. "summary" is optional. Deflated archives need a build with zlib (not found by default
+on Windows): without it the call fails with DEEPVIZ_STATUS_INTERNAL_ERROR, use deepviz_bulk_download_retrieve() instead */
+EXPORT PDEEPVIZ_RESULT deepviz_bulk_download_run(
+    PDEEPVIZ_LIST md5_list,
+    const char* path,
+    const char* api_key,
+    PDEEPVIZ_POLL_SCHEDULE schedule,
+    PDEEPVIZ_BULK_RUN_SUMMARY summary);
+
+/* MD5 */
+
+/* Compute the MD5 of "pathNumber" files. Several files are hashed at once on the SIMD lanes of the CPU (SSE2, AVX2 or
+AVX-512, picked at runtime), while the next chunks are read ahead. "md5" receives one MD5 per path, empty if the file could
+not be read */
+EXPORT PDEEPVIZ_RESULT  deepviz_md5_files(
+    const char** paths,
+    size_t pathNumber,
+    char md5[][DEEPVIZ_MD5_HEX_LEN]);
+
+/* Name of the MD5 engine used by deepviz_md5_files(): "avx512", "avx2", "sse2" or "scalar" */
+EXPORT const char*      deepviz_md5_engine(void);
+
+/* Force an MD5 engine, e.g. to compare them. Returns deepviz_false if not supported by the CPU */
+EXPORT deepviz_bool     deepviz_md5_set_engine(const char* name);
+
+/* Upload deduplication */
+
+/* Enable upload deduplication: deepviz_upload_sample() and deepviz_upload_folder() hash every file and upload only the samples
+not known to Deepviz. Known MD5s are kept in a Bloom filter sized for "expected_entries" (0 = default), loaded from and saved
+to "filter_path" if not NULL. */
+EXPORT deepviz_bool     deepviz_upload_dedup_enable(
+    const char* filter_path,
+    size_t expected_entries);
+
+/* Mark an MD5 as known to Deepviz */
+EXPORT deepviz_bool     deepviz_upload_dedup_add(const char* md5);
+
+/* Save the known MD5s to the filter file */
+EXPORT deepviz_bool     deepviz_upload_dedup_save(void);
+
+/* Disable upload deduplication. Uploads already in progress keep using the filter, which is saved to the filter file and
+freed once the last one finishes */
+EXPORT void             deepviz_upload_dedup_disable(void);
+
+/* Sample store */
+
+/* Enable the content-addressed sample store in "directory": deepviz_sample_download() looks for the sample there before
+downloading it, and keeps every new download there */
+EXPORT deepviz_bool     deepviz_sample_store_enable(
+    const char* directory,
+    DEEPVIZ_SAMPLE_STORE_MODE mode);
+
+/* Disable the sample store. The stored samples are kept on disk. */
+EXPORT void             deepviz_sample_store_disable(void);
+
+/* Result cache */
+
+/* Fill a DEEPVIZ_CACHE_CONFIG with the default values */
+EXPORT void             deepviz_cache_default_config(PDEEPVIZ_CACHE_CONFIG config);
+
+/* Enable the in-memory result cache for deepviz_sample_result(), deepviz_sample_info(), deepviz_ip_info() and deepviz_domain_info()
+("config" = NULL for default values). Must not be called while other threads are using the library. */
+EXPORT deepviz_bool     deepviz_cache_enable(PDEEPVIZ_CACHE_CONFIG config);
+
+/* Disable the result cache and free its memory. Must not be called while other threads are using the library. */
+EXPORT void             deepviz_cache_disable(void);
+
+/* Remove every entry from the result cache */
+EXPORT void             deepviz_cache_clear(void);
+
+/* Retrieve the result cache counters */
+EXPORT void             deepviz_cache_get_stats(PDEEPVIZ_CACHE_STATS stats);
+
+/* Open (or create) the persistent result cache stored in "directory". Several processes can share the same directory.
+Entries are looked up after the in-memory cache. "index_slots" = 0 for default size. Linux only. */
+EXPORT deepviz_bool     deepviz_cache_persistent_open(
+    const char* directory,
+    size_t index_slots);
+
+/* Close the persistent result cache */
+EXPORT void             deepviz_cache_persistent_close(void);
+
+/* Rewrite the persistent result cache keeping only the entries not expired yet */
+EXPORT deepviz_bool     deepviz_cache_persistent_compact(void);
+
+/* Attach to (or create) the shared memory result cache "name", so that every process using the same name (e.g. pre-forked workers)
+shares the cached entries. "max_memory" is the segment size in bytes (0 = default), used only by the first process. Linux only. */
+EXPORT deepviz_bool     deepviz_cache_shared_open(
+    const char* name,
+    size_t max_memory);
+
+/* Detach from the shared memory result cache, once the lookups in progress are over. The segment is kept for the other processes. */
+EXPORT void             deepviz_cache_shared_close(void);
+
+/* Remove the shared memory segment "name". Processes still attached keep using it. */
+EXPORT void             deepviz_cache_shared_unlink(const char* name);
+
+/* Retrieve the shared memory result cache counters (summed over every attached process) */
+EXPORT void             deepviz_cache_shared_get_stats(PDEEPVIZ_CACHE_STATS stats);
+
+/* Transfer progress */
+
+/* Report the progress of every request (uploads, downloads and API calls) to "callback" (NULL = disabled). On Windows
+the upload side is reported once the request is sent */
+EXPORT void             deepviz_progress_callback_set(
+    DEEPVIZ_PROGRESS_CALLBACK callback,
+    void* context);
+
+/* Cancellation */
+
+/* Create a cancellation token */
+EXPORT PDEEPVIZ_CANCEL_TOKEN deepviz_cancel_token_init(void);
+
+/* Attach "token" to the calling thread (NULL = detach) and return the token previously attached. Every call made by the
+thread, and by the threads the call starts (e.g. the uploaders of deepviz_upload_folder_parallel()), can then be cancelled
+with deepviz_cancel(): it returns DEEPVIZ_STATUS_CANCELLED */
+EXPORT PDEEPVIZ_CANCEL_TOKEN deepviz_cancel_token_attach(PDEEPVIZ_CANCEL_TOKEN token);
+
+/* Cancel the calls running under "token", from any thread. The transfers in progress are aborted at once (on Windows, at
+the next block received) and the calls started later fail immediately. A cancelled token stays cancelled */
+EXPORT void             deepviz_cancel(PDEEPVIZ_CANCEL_TOKEN token);
+
+/* deepviz_true once deepviz_cancel() has been called on "token" */
+EXPORT deepviz_bool     deepviz_cancel_token_cancelled(PDEEPVIZ_CANCEL_TOKEN token);
+
+/* Free a cancellation token. No call may be running under it */
+EXPORT void             deepviz_cancel_token_free(PDEEPVIZ_CANCEL_TOKEN *token);
+
+/* Result polling */
+
+/* Fill a DEEPVIZ_POLLER_CONFIG with the default values */
+EXPORT void             deepviz_poller_default_config(PDEEPVIZ_POLLER_CONFIG config);
+
+/* Start a poller ("config" = NULL for default values): the items added are polled in the background by a pool of
+"config->threads" threads until their result is ready, then reported to "config->callback". "api_key" must stay valid
+until deepviz_poller_stop() */
+EXPORT PDEEPVIZ_RESULT  deepviz_poller_start(
+    const char* api_key,
+    PDEEPVIZ_POLLER_CONFIG config,
+    PDEEPVIZ_POLLER* poller);
+
+/* Poll "id" (an MD5, or a bulk request ID to download into the "path" folder) with "schedule" (NULL = the poller's one).
+Thousands of items can be pending at once */
+EXPORT deepviz_bool     deepviz_poller_add(
+    PDEEPVIZ_POLLER poller,
+    DEEPVIZ_POLL_TYPE type,
+    const char* id,
+    const char* path,
+    PDEEPVIZ_POLL_SCHEDULE schedule);
+
+/* Number of items whose final result has not been reported yet */
+EXPORT size_t           deepviz_poller_pending(PDEEPVIZ_POLLER poller);
+
+/* Wait until every item has been reported, at most "timeoutMs" (0 = no limit). Returns deepviz_false on timeout */
+EXPORT deepviz_bool     deepviz_poller_wait(
+    PDEEPVIZ_POLLER poller,
+    unsigned int timeoutMs);
+
+/* Stop the poller: the polls in progress are aborted and the items not reported yet are dropped */
+EXPORT void             deepviz_poller_stop(PDEEPVIZ_POLLER* poller);
+
 /* Threat Intelligence */
 
 /* Retrieve the analysis result of a sample */
@@ -151,7 +656,8 @@ EXPORT PDEEPVIZ_RESULT  deepviz_sample_result(
 	const char* md5,
 	const char* api_key);
 
-/* Retrieve the report of a sample according to the given filters */
+/* Retrieve the report of a sample according to the given filters.
+More than DEEPVIZ_MAX_FILTERS filters are split in concurrent requests and the results merged. */
 EXPORT PDEEPVIZ_RESULT  deepviz_sample_info(
 	const char* md5,
 	const char* api_key,
@@ -196,6 +702,166 @@ EXPORT PDEEPVIZ_RESULT  deepviz_advanced_search(
     int start_offset,
     int elements);
 
+/* Open a cursor on the results of deepviz_search(), from "start_offset". The first page is requested at once, and
+every page returned by deepviz_search_next() triggers the request of the following one in the background.
+"page_size" (0 = DEEPVIZ_SEARCH_DEFAULT_PAGE_SIZE) is the initial number of rows per page: it then adapts to the
+latency and the size of the pages, up to DEEPVIZ_SEARCH_MAX_PAGE_SIZE */
+EXPORT PDEEPVIZ_RESULT  deepviz_search_open(
+    const char* api_key,
+    const char* search_string,
+    int start_offset,
+    int page_size,
+    PDEEPVIZ_SEARCH_CURSOR* cursor);
+
+/* Open a cursor on the results of deepviz_advanced_search(), same as deepviz_search_open() */
+EXPORT PDEEPVIZ_RESULT  deepviz_advanced_search_open(
+    const char* api_key,
+    PDEEPVIZ_LIST sim_hash,
+    PDEEPVIZ_LIST created_files,
+    PDEEPVIZ_LIST imp_hash,
+    PDEEPVIZ_LIST url,
+    PDEEPVIZ_LIST strings,
+    PDEEPVIZ_LIST ip,
+    PDEEPVIZ_LIST asn,
+    const char* classification,
+    PDEEPVIZ_LIST rules,
+    PDEEPVIZ_LIST country,
+    deepviz_bool never_seen,
+    const char* time_delta,
+    const char* ip_range,
+    PDEEPVIZ_LIST domain,
+    int start_offset,
+    int page_size,
+    PDEEPVIZ_SEARCH_CURSOR* cursor);
+
+/* Next page of results, NULL once the last page has been returned. A failed page is requested again by the next call */
+EXPORT PDEEPVIZ_RESULT  deepviz_search_next(PDEEPVIZ_SEARCH_CURSOR cursor);
+
+/* Offset of the first row of the next page, to open a new cursor where this one stopped */
+EXPORT int              deepviz_search_offset(PDEEPVIZ_SEARCH_CURSOR cursor);
+
+/* Close a cursor, aborting the request in progress */
+EXPORT void             deepviz_search_close(PDEEPVIZ_SEARCH_CURSOR* cursor);
+
+/* Retrieve all the results of deepviz_search() from "start_offset", "fanout->threads" pages at once, and stream them to
+"fanout->sink" from the calling thread, in order and without duplicates */
+EXPORT PDEEPVIZ_RESULT  deepviz_search_fanout(
+    const char* api_key,
+    const char* search_string,
+    int start_offset,
+    PDEEPVIZ_SEARCH_FANOUT fanout);
+
+/* Retrieve all the results of deepviz_advanced_search(), same as deepviz_search_fanout() */
+EXPORT PDEEPVIZ_RESULT  deepviz_advanced_search_fanout(
+    const char* api_key,
+    PDEEPVIZ_LIST sim_hash,
+    PDEEPVIZ_LIST created_files,
+    PDEEPVIZ_LIST imp_hash,
+    PDEEPVIZ_LIST url,
+    PDEEPVIZ_LIST strings,
+    PDEEPVIZ_LIST ip,
+    PDEEPVIZ_LIST asn,
+    const char* classification,
+    PDEEPVIZ_LIST rules,
+    PDEEPVIZ_LIST country,
+    deepviz_bool never_seen,
+    const char* time_delta,
+    const char* ip_range,
+    PDEEPVIZ_LIST domain,
+    int start_offset,
+    PDEEPVIZ_SEARCH_FANOUT fanout);
+
+/* Start building an advanced search query: add its filters with deepviz_query_add(), then compile it once with
+deepviz_query_compile() and run it as many times as needed */
+EXPORT PDEEPVIZ_QUERY   deepviz_query_init(const char* api_key);
+
+/* Add a filter value to a query not compiled yet */
+EXPORT deepviz_bool     deepviz_query_add(
+    PDEEPVIZ_QUERY query,
+    DEEPVIZ_QUERY_FIELD field,
+    const char* value);
+
+/* Add all the values of a DEEPVIZ_LIST to a query not compiled yet */
+EXPORT deepviz_bool     deepviz_query_add_list(
+    PDEEPVIZ_QUERY query,
+    DEEPVIZ_QUERY_FIELD field,
+    PDEEPVIZ_LIST list);
+
+/* Serialize the query. No filter can be added afterwards; a compiled query can be run by several threads at once */
+EXPORT deepviz_bool     deepviz_query_compile(PDEEPVIZ_QUERY query);
+
+/* Run a compiled query, same as deepviz_advanced_search(). "time_delta" = NULL for the one of the query */
+EXPORT PDEEPVIZ_RESULT  deepviz_query_run(
+    PDEEPVIZ_QUERY query,
+    const char* time_delta,
+    int start_offset,
+    int elements);
+
+/* Open a cursor on the results of a compiled query, same as deepviz_search_open() */
+EXPORT PDEEPVIZ_RESULT  deepviz_query_open(
+    PDEEPVIZ_QUERY query,
+    const char* time_delta,
+    int start_offset,
+    int page_size,
+    PDEEPVIZ_SEARCH_CURSOR* cursor);
+
+/* Retrieve all the results of a compiled query, same as deepviz_search_fanout() */
+EXPORT PDEEPVIZ_RESULT  deepviz_query_fanout(
+    PDEEPVIZ_QUERY query,
+    const char* time_delta,
+    int start_offset,
+    PDEEPVIZ_SEARCH_FANOUT fanout);
+
+/* Free a query */
+EXPORT void             deepviz_query_free(PDEEPVIZ_QUERY* query);
+
+/* NDJSON output */
+
+/* Create (or truncate) the file "path" and write NDJSON records to it, gzip-compressed if "compress" (requires zlib,
+NULL otherwise) */
+EXPORT PDEEPVIZ_NDJSON_WRITER   deepviz_ndjson_open(const char* path, deepviz_bool compress);
+
+/* Same as deepviz_ndjson_open(), to an open file descriptor (left open by deepviz_ndjson_close()) */
+EXPORT PDEEPVIZ_NDJSON_WRITER   deepviz_ndjson_open_fd(int fd, deepviz_bool compress);
+
+/* Write the data of a result as one record per hit (search results) or per indicator (intel results):
+{"source": "<source>", "category": "<member of the data>", "hit": <value>}. A failed result is written as
+{"source": "<source>", "status": <status>, "msg": "<msg>"}. "source" (the MD5, IP, domain... queried) can be NULL */
+EXPORT deepviz_bool     deepviz_ndjson_write_result(
+    PDEEPVIZ_NDJSON_WRITER writer,
+    const char* source,
+    PDEEPVIZ_RESULT result);
+
+/* DEEPVIZ_SEARCH_SINK writing every hit as a record: set "fanout->sink" to it and "fanout->context" to the writer.
+The structured hits of a fan-out are written as JSON values, any other "hit" as a string */
+EXPORT deepviz_bool     deepviz_ndjson_search_sink(void* context, const char* category, const char* hit);
+
+/* Write the records buffered so far */
+EXPORT deepviz_bool     deepviz_ndjson_flush(PDEEPVIZ_NDJSON_WRITER writer);
+
+/* Write the buffered records and free the writer. The result reports the number of records or the first write error */
+EXPORT PDEEPVIZ_RESULT  deepviz_ndjson_close(PDEEPVIZ_NDJSON_WRITER* writer);
+
+/* Open a report of the MD5 scan, fetching the "sections" (deepviz_sample_info() filters) right away; NULL fetches
+DEEPVIZ_REPORT_DEFAULT_SECTION only. "lazy" (optional) lists the sections likely to be read later: they are fetched
+along with the first missing section read. Fails like deepviz_sample_info(), e.g. while the analysis is running */
+EXPORT PDEEPVIZ_RESULT  deepviz_report_open(
+    const char* api_key,
+    const char* md5,
+    PDEEPVIZ_LIST sections,
+    PDEEPVIZ_LIST lazy,
+    PDEEPVIZ_REPORT* report);
+
+/* Data of a section, fetched on first access (with up to DEEPVIZ_MAX_FILTERS - 1 lazy sections) and then kept.
+DEEPVIZ_STATUS_CLIENT_ERROR if the report has no such section */
+EXPORT PDEEPVIZ_RESULT  deepviz_report_section(PDEEPVIZ_REPORT report, const char* section);
+
+/* Fetch the sections not loaded yet, in concurrent requests of up to DEEPVIZ_MAX_FILTERS sections */
+EXPORT PDEEPVIZ_RESULT  deepviz_report_prefetch(PDEEPVIZ_REPORT report, PDEEPVIZ_LIST sections);
+
+/* Free the report */
+EXPORT void             deepviz_report_close(PDEEPVIZ_REPORT* report);
+
 
 #ifdef __cplusplus
 }
@@ -49,6 +49,10 @@
 
 #define     DEEPVIZ_MULTIPART_SOURCE        "c_deepviz"
 
+#define     DEEPVIZ_BATCH_POLL_MIN_MS       500
+#define     DEEPVIZ_BATCH_POLL_MAX_MS       5000
+#define     DEEPVIZ_BATCH_TIMEOUT_MS        600000
+
 
 /* ============================ private functions ============================ */
 
@@ -57,6 +61,235 @@ int                 deepviz_sprintf(char *outBuf, size_t size, const char *forma
 PDEEPVIZ_RESULT     deepviz_result_init(DEEPVIZ_RESULT_STATUS status, char* msg);
 PDEEPVIZ_RESULT     parse_deepviz_response(const char* statusCode, void* response, size_t responseLen);
 
+/* Result formats: successful result encoded in the format of the calling thread, and decoded back */
+DEEPVIZ_RESULT_FORMAT dvz_result_format_current(void);
+PDEEPVIZ_RESULT     dvz_result_from_json(json_t* json, size_t jsonFlags);
+json_t*             dvz_result_to_json(PDEEPVIZ_RESULT result);
+
+/* Sample download without batching */
+PDEEPVIZ_RESULT     dvz_sample_download(const char* md5, const char* api_key, const char* path);
+
+/* Result cache */
+typedef PDEEPVIZ_RESULT (*DEEPVIZ_FETCH_ROUTINE)(const char* api_key, const char* arg, PDEEPVIZ_LIST filters);
+
+/* Serve the request from the result cache, or call "fetch" and cache its result */
+PDEEPVIZ_RESULT     dvz_cache_call(DEEPVIZ_CACHE_ENDPOINT endpoint, const char* api_key, const char* arg, PDEEPVIZ_LIST filters, DEEPVIZ_FETCH_ROUTINE fetch);
+unsigned long long  dvz_hash(const void* data, size_t dataLen);
+
+/* Persistent result cache */
+deepviz_bool        dvz_disk_cache_enabled(void);
+PDEEPVIZ_RESULT     dvz_disk_cache_lookup(const char* key, size_t keyLen, unsigned int* ttlLeft);
+void                dvz_disk_cache_store(const char* key, size_t keyLen, PDEEPVIZ_RESULT result, unsigned int ttl);
+
+/* Shared memory result cache */
+deepviz_bool        dvz_shm_cache_enabled(void);
+PDEEPVIZ_RESULT     dvz_shm_cache_lookup(const char* key, size_t keyLen, unsigned int* ttlLeft);
+void                dvz_shm_cache_store(const char* key, size_t keyLen, PDEEPVIZ_RESULT result, unsigned int ttl);
+
+/* Sample upload without deduplication */
+PDEEPVIZ_RESULT     dvz_upload_sample(const char* api_key, const char* path);
+
+/* MD5 */
+typedef struct _DEEPVIZ_MD5_CONTEXT{
+    unsigned int        state[4];
+    unsigned long long  length;
+    unsigned char       buffer[64];
+}DEEPVIZ_MD5_CONTEXT, *PDEEPVIZ_MD5_CONTEXT;
+
+void                dvz_md5_transform(unsigned int state[4], const unsigned char block[64]);
+void                dvz_md5_init(PDEEPVIZ_MD5_CONTEXT ctx);
+void                dvz_md5_update(PDEEPVIZ_MD5_CONTEXT ctx, const void* data, size_t dataLen);
+void                dvz_md5_final(PDEEPVIZ_MD5_CONTEXT ctx, unsigned char digest[DEEPVIZ_MD5_LEN]);
+void                dvz_md5_to_hex(const unsigned char digest[DEEPVIZ_MD5_LEN], char hex[DEEPVIZ_MD5_HEX_LEN]);
+deepviz_bool        dvz_md5_file(const char* path, unsigned char digest[DEEPVIZ_MD5_LEN]);
+/* Hash many files at once on the SIMD lanes. errors[i] is set if paths[i] could not be read */
+void                dvz_md5_files(const char** paths, size_t pathNumber, unsigned char (*digests)[DEEPVIZ_MD5_LEN], deepviz_bool* errors);
+
+/* Folder walk. Returning deepviz_false from the routine stops the walk */
+typedef deepviz_bool (*DEEPVIZ_WALK_ROUTINE)(void* context, const char* path);
+
+/* Call "routine" once for every file in "folder" and its subfolders, following the links as told by "symlinks" and
+entering other filesystems only if "crossDevice". Returns deepviz_false if "folder" cannot be opened */
+deepviz_bool        dvz_walk_folder(const char* folder, DEEPVIZ_SYMLINK_POLICY symlinks, deepviz_bool crossDevice,
+                                    DEEPVIZ_WALK_ROUTINE routine, void* context);
+
+/* Upload pipeline: files pushed are uploaded by a pool of "config->threads" uploaders */
+typedef struct _DEEPVIZ_UPLOAD_JOB DEEPVIZ_UPLOAD_JOB, *PDEEPVIZ_UPLOAD_JOB;
+
+PDEEPVIZ_UPLOAD_JOB     dvz_upload_job_start(const char* api_key, PDEEPVIZ_UPLOAD_CONFIG config, DEEPVIZ_RESULT_STATUS* status, char* errorMsg);
+deepviz_bool            dvz_upload_job_push(PDEEPVIZ_UPLOAD_JOB job, const char* path);
+/* Same without waiting: "full" is set, and the file not queued, when the queue has no room */
+deepviz_bool            dvz_upload_job_try_push(PDEEPVIZ_UPLOAD_JOB job, const char* path, deepviz_bool* full);
+DEEPVIZ_RESULT_STATUS   dvz_upload_job_finish(PDEEPVIZ_UPLOAD_JOB job, PDEEPVIZ_UPLOAD_SUMMARY summary, char* errorMsg);
+
+/* Cancellation */
+typedef void (*DEEPVIZ_CANCEL_WAKEUP)(void* param);
+
+/* A transfer waiting for the cancellation of its token */
+typedef struct _DEEPVIZ_CANCEL_WAITER{
+    struct _DEEPVIZ_CANCEL_WAITER   *next;
+    DEEPVIZ_CANCEL_WAKEUP           wakeup;
+    void                            *param;
+}DEEPVIZ_CANCEL_WAITER, *PDEEPVIZ_CANCEL_WAITER;
+
+/* Token attached to the calling thread, or NULL */
+PDEEPVIZ_CANCEL_TOKEN   dvz_cancel_token_current(void);
+deepviz_bool            dvz_cancel_requested(void);
+/* Status of a failed request: DEEPVIZ_STATUS_CANCELLED if the calling thread's token was cancelled */
+DEEPVIZ_RESULT_STATUS   dvz_transfer_error_status(void);
+deepviz_bool            dvz_cancel_register(PDEEPVIZ_CANCEL_TOKEN token, PDEEPVIZ_CANCEL_WAITER waiter,
+                                            DEEPVIZ_CANCEL_WAKEUP wakeup, void* param);
+void                    dvz_cancel_unregister(PDEEPVIZ_CANCEL_TOKEN token, PDEEPVIZ_CANCEL_WAITER waiter);
+
+/* Transfer progress */
+typedef struct _DEEPVIZ_PROGRESS_STATE{
+    DEEPVIZ_PROGRESS_CALLBACK   callback;
+    void                        *context;
+    DEEPVIZ_PROGRESS            progress;
+    unsigned long long          startTime;
+    unsigned long long          lastTime;               /* Last rate sample */
+    unsigned long long          lastBytes;
+    deepviz_bool                aborted;                /* The callback asked to abort */
+}DEEPVIZ_PROGRESS_STATE, *PDEEPVIZ_PROGRESS_STATE;
+
+/* deepviz_false if no callback is set: the transfer does not need to be followed */
+deepviz_bool            dvz_progress_begin(PDEEPVIZ_PROGRESS_STATE state, const char* page, const char* filePath);
+/* deepviz_false to abort the transfer */
+deepviz_bool            dvz_progress_update(PDEEPVIZ_PROGRESS_STATE state, unsigned long long uploaded, unsigned long long uploadTotal,
+                                            unsigned long long downloaded, unsigned long long downloadTotal);
+/* Last call, "succeeded" is deepviz_false if the transfer failed or was aborted */
+void                    dvz_progress_end(PDEEPVIZ_PROGRESS_STATE state, deepviz_bool succeeded);
+
+/* Upload triage: deepviz_false if "path" is rejected by the filters of "config" */
+deepviz_bool            dvz_triage_file(PDEEPVIZ_UPLOAD_CONFIG config, const char* path);
+
+/* Upload journal */
+typedef struct _DEEPVIZ_JOURNAL DEEPVIZ_JOURNAL, *PDEEPVIZ_JOURNAL;
+
+typedef struct _DEEPVIZ_JOURNAL_FILE{
+    unsigned long long  size;
+    long long           mtime;                      /* Nanoseconds */
+    unsigned char       md5[DEEPVIZ_MD5_LEN];
+    deepviz_bool        md5Done;
+}DEEPVIZ_JOURNAL_FILE, *PDEEPVIZ_JOURNAL_FILE;
+
+PDEEPVIZ_JOURNAL    dvz_journal_open(const char* path);
+/* deepviz_true if "path" was uploaded and has not changed since. Fills "file" for dvz_journal_record() */
+deepviz_bool        dvz_journal_check(PDEEPVIZ_JOURNAL journal, const char* path, PDEEPVIZ_JOURNAL_FILE file);
+void                dvz_journal_record(PDEEPVIZ_JOURNAL journal, const char* path, PDEEPVIZ_JOURNAL_FILE file);
+void                dvz_journal_close(PDEEPVIZ_JOURNAL journal);
+
+/* Upload deduplication */
+deepviz_bool        dvz_upload_dedup_enabled(void);
+PDEEPVIZ_RESULT     dvz_dedup_upload_sample(const char* api_key, const char* path);
+
+/* Sample store */
+deepviz_bool        dvz_sample_store_enabled(void);
+PDEEPVIZ_RESULT     dvz_sample_store_fetch(const char* md5, const char* path);
+deepviz_bool        dvz_sample_store_write(const char* md5, const void* data, size_t dataLen, const char* filePath);
+void                dvz_sample_store_import(const char* md5, const char* filePath);
+/* Streamed write into the store: dvz_sample_store_commit() closes the file and moves it into place if "success" */
+FILE*               dvz_sample_store_create(const char* md5, char** tempPath);
+deepviz_bool        dvz_sample_store_commit(const char* md5, FILE* file, char* tempPath, deepviz_bool success);
+
+/* Download batching */
+deepviz_bool        dvz_download_batching_enabled(void);
+PDEEPVIZ_RESULT     dvz_batch_sample_download(const char* md5, const char* api_key, const char* path);
+
+/* Search queries: the request without its "result_set", compiled once by dvz_search_compile() and run a page at a time
+by dvz_search_page() */
+json_t*             dvz_search_query(const char* api_key, const char* search_string);
+json_t*             dvz_advanced_search_query(const char* api_key, PDEEPVIZ_LIST sim_hash, PDEEPVIZ_LIST created_files,
+                                                PDEEPVIZ_LIST imp_hash, PDEEPVIZ_LIST url, PDEEPVIZ_LIST strings, PDEEPVIZ_LIST ip,
+                                                PDEEPVIZ_LIST asn, const char* classification, PDEEPVIZ_LIST rules,
+                                                PDEEPVIZ_LIST country, int never_seen, const char* time_delta,
+                                                const char* ip_range, PDEEPVIZ_LIST domain);
+char*               dvz_search_compile(json_t* query);
+PDEEPVIZ_RESULT     dvz_search_page(const char* httpPage, const char* request, const char* time_delta, int start_offset, int elements);
+/* Cursor and fan-out over a compiled query: "request" and "timeDelta" are taken over and freed by the callee */
+PDEEPVIZ_RESULT     dvz_search_open(const char* httpPage, char* request, char* timeDelta, int start_offset, int page_size,
+                                    PDEEPVIZ_SEARCH_CURSOR* cursor, char* retMsg);
+PDEEPVIZ_RESULT     dvz_search_fanout(const char* httpPage, char* request, char* timeDelta, int start_offset,
+                                        PDEEPVIZ_SEARCH_FANOUT fanout, char* retMsg);
+/* From a sink called by dvz_search_fanout(): the JSON value of "hit", NULL if "hit" does not come from the fan-out */
+json_t*             dvz_search_sink_json(const char* hit);
+
+
+/* ============================ threading helpers ============================ */
+
+#if defined(_WIN32)
+/*  Microsoft */
+
+typedef HANDLE                  DEEPVIZ_THREAD;
+typedef CRITICAL_SECTION        DEEPVIZ_MUTEX;
+typedef CONDITION_VARIABLE      DEEPVIZ_COND;
+typedef INIT_ONCE               DEEPVIZ_ONCE;
+
+#define     DEEPVIZ_ONCE_INIT           INIT_ONCE_STATIC_INIT
+
+#elif defined(__linux__)
+/* linux */
+
+#include <pthread.h>
+#include <time.h>
+
+typedef pthread_t               DEEPVIZ_THREAD;
+typedef pthread_mutex_t         DEEPVIZ_MUTEX;
+typedef pthread_cond_t          DEEPVIZ_COND;
+typedef pthread_once_t          DEEPVIZ_ONCE;
+
+#define     DEEPVIZ_ONCE_INIT           PTHREAD_ONCE_INIT
+
+#endif
+
+typedef void (*DEEPVIZ_THREAD_ROUTINE)(void* param);
+typedef void (*DEEPVIZ_ONCE_ROUTINE)(void);
+typedef void (*DEEPVIZ_TASK_ROUTINE)(void* context, size_t taskIndex);
+
+deepviz_bool        dvz_thread_create(DEEPVIZ_THREAD *thread, DEEPVIZ_THREAD_ROUTINE routine, void* param);
+void                dvz_thread_join(DEEPVIZ_THREAD thread);
+/* Run "routine" exactly once, whatever the number of threads calling it at the same time */
+void                dvz_once(DEEPVIZ_ONCE *once, DEEPVIZ_ONCE_ROUTINE routine);
+void                dvz_mutex_init(DEEPVIZ_MUTEX *mutex);
+void                dvz_mutex_destroy(DEEPVIZ_MUTEX *mutex);
+void                dvz_mutex_lock(DEEPVIZ_MUTEX *mutex);
+void                dvz_mutex_unlock(DEEPVIZ_MUTEX *mutex);
+void                dvz_cond_init(DEEPVIZ_COND *cond);
+void                dvz_cond_destroy(DEEPVIZ_COND *cond);
+void                dvz_cond_wait(DEEPVIZ_COND *cond, DEEPVIZ_MUTEX *mutex);
+/* Returns deepviz_false on timeout */
+deepviz_bool        dvz_cond_timedwait(DEEPVIZ_COND *cond, DEEPVIZ_MUTEX *mutex, unsigned int timeoutMs);
+void                dvz_cond_signal(DEEPVIZ_COND *cond);
+void                dvz_cond_broadcast(DEEPVIZ_COND *cond);
+void                dvz_sleep(unsigned int ms);
+/* Monotonic clock in milliseconds */
+unsigned long long  dvz_time_ms(void);
+
+/* Run "taskNumber" tasks on at most "maxThreads" threads. Returns when all the tasks are completed */
+void                dvz_parallel_run(size_t taskNumber, size_t maxThreads, DEEPVIZ_TASK_ROUTINE routine, void* context);
+
+
+/* ============================ ZIP extraction ============================ */
+
+typedef struct _DEEPVIZ_ZIP_HANDLER{
+    deepviz_bool    (*entryBegin)(void* context, const char* name);                  /* Return deepviz_false to skip the entry */
+    deepviz_bool    (*entryData)(void* context, const void* data, size_t dataLen);    /* Return deepviz_false to abort extraction */
+    void            (*entryEnd)(void* context, deepviz_bool success);
+    void*           context;
+}DEEPVIZ_ZIP_HANDLER, *PDEEPVIZ_ZIP_HANDLER;
+
+typedef struct _DEEPVIZ_ZIP_READER DEEPVIZ_ZIP_READER, *PDEEPVIZ_ZIP_READER;
+
+/* Streaming ZIP reader: the archive can be fed in chunks of any size while it is still arriving */
+PDEEPVIZ_ZIP_READER dvz_zip_reader_init(PDEEPVIZ_ZIP_HANDLER handler);
+deepviz_bool        dvz_zip_reader_feed(PDEEPVIZ_ZIP_READER reader, const void* data, size_t dataLen, char* errorMsg);
+deepviz_bool        dvz_zip_reader_finish(PDEEPVIZ_ZIP_READER reader, char* errorMsg);
+void                dvz_zip_reader_free(PDEEPVIZ_ZIP_READER *reader);
+deepviz_bool        dvz_zip_extract_file(const char* zipPath, PDEEPVIZ_ZIP_HANDLER handler, char* errorMsg);
+
+
+/* Receives the body of a successful (200) answer while it arrives. Return deepviz_false to abort the transfer */
+typedef deepviz_bool (*DEEPVIZ_HTTP_SINK)(void* context, const void* data, size_t dataLen);
 
 #if defined(_WIN32)
 /*  Microsoft */
@@ -74,6 +307,22 @@ deepviz_bool	win_sendHTTPrequest(const char* httpServerName,
 									size_t *responseOutLen,
 									char* errorMsg);
 
+/* Same as win_sendHTTPrequest(), the body of a successful answer goes to "sink" instead of "responseOut" */
+deepviz_bool	win_sendHTTPrequestStream(const char* httpServerName,
+										const char* httpPage,
+										DWORD connectionFlags,
+										const char* HTTPheader,
+										DWORD requestFlags,
+										PVOID requestBuffer,
+										size_t requestBufferLen,
+										DEEPVIZ_HTTP_SINK sink,
+										void* sinkContext,
+										char* statusCodeOut,
+										size_t statusCodeOutLen,
+										PVOID *responseOut,
+										size_t *responseOutLen,
+										char* errorMsg);
+
 #elif defined(__linux__)
 /* linux */
 
@@ -91,6 +340,18 @@ deepviz_bool linux_sendHTTPrequest(	  const char* serverName,
 									  size_t *responseOutLen,
 									  char* errorMsg);
 
+/* Same as linux_sendHTTPrequest(), the body of a successful answer goes to "sink" instead of "responseOut" */
+deepviz_bool linux_sendHTTPrequestStream(  const char* serverName,
+										   const char* httpPage,
+										   const char* requestBuffer,
+										   DEEPVIZ_HTTP_SINK sink,
+										   void* sinkContext,
+										   char* statusCodeOut,
+										   size_t statusCodeOutLen,
+										   void** responseOut,
+										   size_t *responseOutLen,
+										   char* errorMsg);
+
 deepviz_bool linux_sendHTTPrequestMultipart(   const char* serverName,
 											   const char* httpPage,
 											   const char* apikey,
@@ -0,0 +1,890 @@
+/*
+* Copyright (c) 2016 Saferbytes s.r.l.s.
+*
+* You can redistribute it and/or modify it under the terms of the MIT license.
+* See LICENSE for details.
+*/
+
+#include "c-deepviz.h"
+#include "c-deepviz_private.h"
+
+#include <ctype.h>
+
+/*
+* In-memory result cache.
+* Entries are keyed on endpoint + normalized argument + sorted filters and spread over shards,
+* each one with its own lock, hash table and LRU list. Every shard gets an equal slice of the
+* memory budget.
+* Expired entries can still be served (flagged as stale) for a configurable window while a
+* background thread refreshes them, or when the refresh fails.
+*/
+
+#define     CACHE_INITIAL_BUCKETS       256
+#define     CACHE_MAX_PENDING_REFRESH   256
+
+typedef enum _CACHE_FRESHNESS {
+    CACHE_FRESH,
+    CACHE_STALE,                        /* Serve at once, refresh in background */
+    CACHE_STALE_IF_ERROR,               /* Serve only if a new request fails */
+} CACHE_FRESHNESS;
+
+typedef struct _DEEPVIZ_CACHE_ENTRY{
+    struct _DEEPVIZ_CACHE_ENTRY *hashNext;
+    struct _DEEPVIZ_CACHE_ENTRY *lruPrev;
+    struct _DEEPVIZ_CACHE_ENTRY *lruNext;
+    unsigned long long          hash;
+    unsigned long long          expireTime;
+    DEEPVIZ_RESULT_STATUS       status;
+    DEEPVIZ_CACHE_ENDPOINT      endpoint;
+    deepviz_bool                refreshPending;
+    deepviz_bool                refreshFailed;
+    size_t                      keyLen;
+    size_t                      msgLen;
+    size_t                      size;
+    char                        data[1];        /* Key + '\0' + msg + '\0' */
+}DEEPVIZ_CACHE_ENTRY, *PDEEPVIZ_CACHE_ENTRY;
+
+typedef struct _DEEPVIZ_CACHE_SHARD{
+    DEEPVIZ_MUTEX           lock;
+    PDEEPVIZ_CACHE_ENTRY    *buckets;
+    size_t                  bucketNumber;
+    PDEEPVIZ_CACHE_ENTRY    lruHead;            /* Most recently used */
+    PDEEPVIZ_CACHE_ENTRY    lruTail;            /* Least recently used */
+    size_t                  memory;
+    size_t                  maxMemory;
+    DEEPVIZ_CACHE_STATS     stats;
+}DEEPVIZ_CACHE_SHARD, *PDEEPVIZ_CACHE_SHARD;
+
+typedef struct _DEEPVIZ_CACHE_REFRESH{
+    DEEPVIZ_CACHE_ENDPOINT          endpoint;
+    DEEPVIZ_FETCH_ROUTINE           fetch;
+    char                            *apiKey;
+    char                            *arg;
+    PDEEPVIZ_LIST                   filters;
+    char                            *key;
+    size_t                          keyLen;
+    struct _DEEPVIZ_CACHE_REFRESH   *next;
+}DEEPVIZ_CACHE_REFRESH, *PDEEPVIZ_CACHE_REFRESH;
+
+typedef struct _DEEPVIZ_CACHE{
+    DEEPVIZ_CACHE_CONFIG    config;
+    DEEPVIZ_MUTEX           refreshLock;
+    DEEPVIZ_COND            refreshCond;
+    DEEPVIZ_THREAD          refreshThread;
+    deepviz_bool            refreshStarted;
+    deepviz_bool            refreshStop;
+    PDEEPVIZ_CACHE_REFRESH  refreshHead;
+    PDEEPVIZ_CACHE_REFRESH  refreshTail;
+    size_t                  refreshNumber;
+    size_t                  shardNumber;
+    DEEPVIZ_CACHE_SHARD     shard[1];
+}DEEPVIZ_CACHE, *PDEEPVIZ_CACHE;
+
+static PDEEPVIZ_CACHE   cache = NULL;
+
+
+unsigned long long dvz_hash(const void* data, size_t dataLen){
+
+    /* FNV-1a */
+    unsigned long long  hash = 0xcbf29ce484222325ULL;
+    size_t              i;
+
+    for (i = 0; i < dataLen; i++){
+        hash ^= ((const unsigned char*)data)[i];
+        hash *= 0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
+
+static int cache_compare_filters(const void* a, const void* b){
+
+    return strcmp(*(const char* const*)a, *(const char* const*)b);
+}
+
+
+/* Build "<endpoint>\n<lowercase argument>\n<sorted filters>" */
+static char* cache_build_key(DEEPVIZ_CACHE_ENDPOINT endpoint, const char* arg, PDEEPVIZ_LIST filters, size_t* keyLen){
+
+    const char  **sorted = NULL;
+    size_t      filterNumber = 0;
+    size_t      len;
+    size_t      i;
+    char        *key;
+    char        *p;
+
+    len = strlen(arg) + 16;
+
+    if (filters){
+        sorted = (const char**)malloc(sizeof(char*) * filters->maxEntryNumber);
+        if (!sorted){
+            return NULL;
+        }
+        for (i = 0; i < filters->maxEntryNumber; i++){
+            if (filters->entry[i][0]){
+                sorted[filterNumber++] = filters->entry[i];
+                len += strlen(filters->entry[i]) + 1;
+            }
+        }
+        qsort(sorted, filterNumber, sizeof(char*), cache_compare_filters);
+    }
+
+    key = (char*)malloc(len);
+    if (!key){
+        if (sorted) free(sorted);
+        return NULL;
+    }
+
+    p = key + deepviz_sprintf(key, len, "%d\n", (int)endpoint);
+
+    /* Trim and lowercase the argument (MD5, IP or domain) */
+    while (*arg && isspace((unsigned char)*arg)){
+        arg++;
+    }
+    for (i = 0; arg[i]; i++){
+        *p++ = (char)tolower((unsigned char)arg[i]);
+    }
+    while (p > key && isspace((unsigned char)p[-1])){
+        p--;
+    }
+
+    for (i = 0; i < filterNumber; i++){
+        if (i > 0 && !strcmp(sorted[i], sorted[i - 1])){
+            /* Duplicated filter */
+            continue;
+        }
+        *p++ = '\n';
+        len = strlen(sorted[i]);
+        memcpy(p, sorted[i], len);
+        p += len;
+    }
+
+    *p = 0;
+    (*keyLen) = p - key;
+
+    if (sorted) free(sorted);
+
+    return key;
+}
+
+
+/* Returns the TTL (seconds) to use for the given result, 0 if it must not be cached */
+static unsigned int cache_result_ttl(PDEEPVIZ_CACHE_CONFIG config, DEEPVIZ_CACHE_ENDPOINT endpoint, PDEEPVIZ_RESULT result){
+
+    const char  *msg;
+
+    if (!result || !result->msg){
+        return 0;
+    }
+
+    msg = result->msg;
+
+    if (result->status == DEEPVIZ_STATUS_SUCCESS){
+        if (!strcmp(msg, "{}") || !strcmp(msg, "[]") || !strcmp(msg, "null") || !strcmp(msg, "\"\"")){
+            /* Empty answer */
+            return config->negativeTtl[endpoint];
+        }
+        return config->ttl[endpoint];
+    }
+
+    if (result->status == DEEPVIZ_STATUS_CLIENT_ERROR && !strncmp(msg, "Error: 404", 10)){
+        /* Not found */
+        return config->negativeTtl[endpoint];
+    }
+
+    return 0;
+}
+
+
+static void cache_lru_unlink(PDEEPVIZ_CACHE_SHARD shard, PDEEPVIZ_CACHE_ENTRY entry){
+
+    if (entry->lruPrev) entry->lruPrev->lruNext = entry->lruNext;
+    else shard->lruHead = entry->lruNext;
+
+    if (entry->lruNext) entry->lruNext->lruPrev = entry->lruPrev;
+    else shard->lruTail = entry->lruPrev;
+
+    entry->lruPrev = NULL;
+    entry->lruNext = NULL;
+}
+
+
+static void cache_lru_push(PDEEPVIZ_CACHE_SHARD shard, PDEEPVIZ_CACHE_ENTRY entry){
+
+    entry->lruPrev = NULL;
+    entry->lruNext = shard->lruHead;
+
+    if (shard->lruHead) shard->lruHead->lruPrev = entry;
+    else shard->lruTail = entry;
+
+    shard->lruHead = entry;
+}
+
+
+static void cache_remove_entry(PDEEPVIZ_CACHE_SHARD shard, PDEEPVIZ_CACHE_ENTRY entry){
+
+    PDEEPVIZ_CACHE_ENTRY    *link;
+
+    link = &shard->buckets[entry->hash & (shard->bucketNumber - 1)];
+    while (*link && *link != entry){
+        link = &(*link)->hashNext;
+    }
+    if (*link){
+        (*link) = entry->hashNext;
+    }
+
+    cache_lru_unlink(shard, entry);
+
+    shard->memory -= entry->size;
+    shard->stats.entries--;
+
+    free(entry);
+}
+
+
+static PDEEPVIZ_CACHE_ENTRY cache_find_entry(PDEEPVIZ_CACHE_SHARD shard, unsigned long long hash, const char* key, size_t keyLen){
+
+    PDEEPVIZ_CACHE_ENTRY    entry;
+
+    for (entry = shard->buckets[hash & (shard->bucketNumber - 1)]; entry; entry = entry->hashNext){
+        if (entry->hash == hash && entry->keyLen == keyLen && !memcmp(entry->data, key, keyLen)){
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+
+static void cache_grow_buckets(PDEEPVIZ_CACHE_SHARD shard){
+
+    PDEEPVIZ_CACHE_ENTRY    *buckets;
+    PDEEPVIZ_CACHE_ENTRY    entry;
+    PDEEPVIZ_CACHE_ENTRY    next;
+    size_t                  bucketNumber = shard->bucketNumber * 2;
+    size_t                  i;
+
+    buckets = (PDEEPVIZ_CACHE_ENTRY*)calloc(bucketNumber, sizeof(PDEEPVIZ_CACHE_ENTRY));
+    if (!buckets){
+        /* Keep the current table, chains will be longer */
+        return;
+    }
+
+    for (i = 0; i < shard->bucketNumber; i++){
+        for (entry = shard->buckets[i]; entry; entry = next){
+            next = entry->hashNext;
+            entry->hashNext = buckets[entry->hash & (bucketNumber - 1)];
+            buckets[entry->hash & (bucketNumber - 1)] = entry;
+        }
+    }
+
+    free(shard->buckets);
+    shard->buckets = buckets;
+    shard->bucketNumber = bucketNumber;
+}
+
+
+static PDEEPVIZ_RESULT cache_lookup(const char* key, size_t keyLen, CACHE_FRESHNESS* freshness, deepviz_bool* refresh){
+
+    PDEEPVIZ_CACHE_SHARD    shard;
+    PDEEPVIZ_CACHE_ENTRY    entry;
+    unsigned long long      hash;
+    unsigned long long      now;
+    unsigned long long      staleAge;
+    DEEPVIZ_RESULT_STATUS   status = DEEPVIZ_STATUS_SUCCESS;
+    char                    *msg = NULL;
+
+    (*freshness) = CACHE_FRESH;
+    (*refresh) = deepviz_false;
+
+    hash = dvz_hash(key, keyLen);
+    shard = &cache->shard[hash % cache->shardNumber];
+
+    dvz_mutex_lock(&shard->lock);
+
+    entry = cache_find_entry(shard, hash, key, keyLen);
+    now = dvz_time_ms();
+    if (entry && entry->expireTime <= now){
+
+        staleAge = now - entry->expireTime;
+
+        if (staleAge < cache->config.staleWhileRevalidate[entry->endpoint] * 1000ULL ||
+            (entry->refreshFailed && staleAge < cache->config.staleIfError[entry->endpoint] * 1000ULL)){
+            /* Serve it and refresh it in background, unless a refresh is already running */
+            (*freshness) = CACHE_STALE;
+            if (!entry->refreshPending){
+                entry->refreshPending = deepviz_true;
+                (*refresh) = deepviz_true;
+            }
+        }
+        else if (staleAge < cache->config.staleIfError[entry->endpoint] * 1000ULL){
+            (*freshness) = CACHE_STALE_IF_ERROR;
+        }
+        else{
+            /* Expired */
+            cache_remove_entry(shard, entry);
+            shard->stats.expirations++;
+            entry = NULL;
+        }
+    }
+
+    if (entry){
+        msg = (char*)malloc(entry->msgLen + 1);
+        if (msg){
+            memcpy(msg, entry->data + entry->keyLen + 1, entry->msgLen + 1);
+            status = entry->status;
+
+            /* Move to the LRU head */
+            cache_lru_unlink(shard, entry);
+            cache_lru_push(shard, entry);
+        }
+        else if (*refresh){
+            entry->refreshPending = deepviz_false;
+            (*refresh) = deepviz_false;
+        }
+    }
+
+    if (msg && (*freshness) == CACHE_FRESH) shard->stats.hits++;
+    else if (msg && (*freshness) == CACHE_STALE) shard->stats.stale++;
+    else shard->stats.misses++;
+
+    dvz_mutex_unlock(&shard->lock);
+
+    return msg ? deepviz_result_init(status, msg) : NULL;
+}
+
+
+/* Update the refresh state of an entry after a failed or dropped refresh */
+static void cache_refresh_done(const char* key, size_t keyLen, deepviz_bool failed){
+
+    PDEEPVIZ_CACHE_SHARD    shard;
+    PDEEPVIZ_CACHE_ENTRY    entry;
+    unsigned long long      hash;
+
+    hash = dvz_hash(key, keyLen);
+    shard = &cache->shard[hash % cache->shardNumber];
+
+    dvz_mutex_lock(&shard->lock);
+
+    entry = cache_find_entry(shard, hash, key, keyLen);
+    if (entry){
+        entry->refreshPending = deepviz_false;
+        entry->refreshFailed = failed;
+    }
+
+    dvz_mutex_unlock(&shard->lock);
+}
+
+
+static void cache_store(DEEPVIZ_CACHE_ENDPOINT endpoint, const char* key, size_t keyLen, PDEEPVIZ_RESULT result, unsigned int ttl){
+
+    PDEEPVIZ_CACHE_SHARD    shard;
+    PDEEPVIZ_CACHE_ENTRY    entry;
+    PDEEPVIZ_CACHE_ENTRY    oldEntry;
+    unsigned long long      hash;
+    size_t                  msgLen;
+    size_t                  size;
+
+    msgLen = strlen(result->msg);
+    size = sizeof(DEEPVIZ_CACHE_ENTRY) + keyLen + msgLen + 1;
+
+    hash = dvz_hash(key, keyLen);
+    shard = &cache->shard[hash % cache->shardNumber];
+
+    if (size > shard->maxMemory){
+        return;
+    }
+
+    entry = (PDEEPVIZ_CACHE_ENTRY)malloc(size);
+    if (!entry){
+        return;
+    }
+
+    memset(entry, 0, sizeof(DEEPVIZ_CACHE_ENTRY));
+    entry->hash = hash;
+    entry->expireTime = dvz_time_ms() + (unsigned long long)ttl * 1000ULL;
+    entry->status = result->status;
+    entry->endpoint = endpoint;
+    entry->keyLen = keyLen;
+    entry->msgLen = msgLen;
+    entry->size = size;
+    memcpy(entry->data, key, keyLen);
+    entry->data[keyLen] = 0;
+    memcpy(entry->data + keyLen + 1, result->msg, msgLen + 1);
+
+    dvz_mutex_lock(&shard->lock);
+
+    oldEntry = cache_find_entry(shard, hash, key, keyLen);
+    if (oldEntry){
+        cache_remove_entry(shard, oldEntry);
+    }
+
+    /* Evict least recently used entries to stay within the budget */
+    while (shard->lruTail && shard->memory + size > shard->maxMemory){
+        cache_remove_entry(shard, shard->lruTail);
+        shard->stats.evictions++;
+    }
+
+    if (shard->stats.entries >= shard->bucketNumber){
+        cache_grow_buckets(shard);
+    }
+
+    entry->hashNext = shard->buckets[hash & (shard->bucketNumber - 1)];
+    shard->buckets[hash & (shard->bucketNumber - 1)] = entry;
+    cache_lru_push(shard, entry);
+
+    shard->memory += size;
+    shard->stats.entries++;
+
+    dvz_mutex_unlock(&shard->lock);
+}
+
+
+static void cache_clear_shard(PDEEPVIZ_CACHE_SHARD shard){
+
+    while (shard->lruHead){
+        cache_remove_entry(shard, shard->lruHead);
+    }
+}
+
+
+static void cache_store_tiers(DEEPVIZ_CACHE_ENDPOINT endpoint, const char* key, size_t keyLen, PDEEPVIZ_RESULT result, unsigned int ttl){
+
+    if (cache) cache_store(endpoint, key, keyLen, result, ttl);
+    if (dvz_shm_cache_enabled()) dvz_shm_cache_store(key, keyLen, result, ttl);
+    if (dvz_disk_cache_enabled()) dvz_disk_cache_store(key, keyLen, result, ttl);
+}
+
+
+static void cache_free_refresh(PDEEPVIZ_CACHE_REFRESH refresh){
+
+    if (refresh->apiKey) free(refresh->apiKey);
+    if (refresh->arg) free(refresh->arg);
+    if (refresh->key) free(refresh->key);
+    if (refresh->filters) deepviz_list_free(&refresh->filters);
+    free(refresh);
+}
+
+
+static void cache_refresh_routine(void* param){
+
+    PDEEPVIZ_CACHE_REFRESH  refresh;
+    PDEEPVIZ_RESULT         result;
+    unsigned int            ttl;
+
+    /* Refreshes are shared by every caller: do not inherit the token of the one that started the thread */
+    deepviz_cancel_token_attach(NULL);
+
+    dvz_mutex_lock(&cache->refreshLock);
+
+    for (;;){
+
+        while (!cache->refreshHead && !cache->refreshStop){
+            dvz_cond_wait(&cache->refreshCond, &cache->refreshLock);
+        }
+
+        if (cache->refreshStop){
+            break;
+        }
+
+        refresh = cache->refreshHead;
+        cache->refreshHead = refresh->next;
+        if (!cache->refreshHead) cache->refreshTail = NULL;
+        cache->refreshNumber--;
+
+        dvz_mutex_unlock(&cache->refreshLock);
+
+        result = refresh->fetch(refresh->apiKey, refresh->arg, refresh->filters);
+
+        ttl = cache_result_ttl(&cache->config, refresh->endpoint, result);
+        if (ttl){
+            /* The new entry replaces the stale one */
+            cache_store_tiers(refresh->endpoint, refresh->key, refresh->keyLen, result, ttl);
+        }
+        else{
+            cache_refresh_done(refresh->key, refresh->keyLen, deepviz_true);
+        }
+
+        if (result) deepviz_result_free(&result);
+        cache_free_refresh(refresh);
+
+        dvz_mutex_lock(&cache->refreshLock);
+    }
+
+    dvz_mutex_unlock(&cache->refreshLock);
+}
+
+
+/* Queue a background refresh of a stale entry */
+static void cache_schedule_refresh( DEEPVIZ_CACHE_ENDPOINT endpoint,
+                                    const char* api_key,
+                                    const char* arg,
+                                    PDEEPVIZ_LIST filters,
+                                    DEEPVIZ_FETCH_ROUTINE fetch,
+                                    const char* key,
+                                    size_t keyLen){
+
+    PDEEPVIZ_CACHE_REFRESH  refresh;
+    size_t                  i;
+    deepviz_bool            queued = deepviz_false;
+
+    refresh = (PDEEPVIZ_CACHE_REFRESH)malloc(sizeof(DEEPVIZ_CACHE_REFRESH));
+    if (!refresh){
+        cache_refresh_done(key, keyLen, deepviz_false);
+        return;
+    }
+
+    memset(refresh, 0, sizeof(DEEPVIZ_CACHE_REFRESH));
+    refresh->endpoint = endpoint;
+    refresh->fetch = fetch;
+    refresh->keyLen = keyLen;
+    refresh->apiKey = strdup(api_key);
+    refresh->arg = strdup(arg);
+    refresh->key = (char*)malloc(keyLen + 1);
+    if (refresh->key){
+        memcpy(refresh->key, key, keyLen + 1);
+    }
+    if (filters){
+        refresh->filters = deepviz_list_init(filters->maxEntryNumber);
+        if (refresh->filters){
+            for (i = 0; i < filters->maxEntryNumber; i++){
+                if (filters->entry[i][0]) deepviz_list_add(refresh->filters, filters->entry[i]);
+            }
+        }
+    }
+
+    if (refresh->apiKey && refresh->arg && refresh->key && (!filters || refresh->filters)){
+
+        dvz_mutex_lock(&cache->refreshLock);
+
+        if (!cache->refreshStarted){
+            cache->refreshStarted = dvz_thread_create(&cache->refreshThread, cache_refresh_routine, NULL);
+        }
+
+        if (cache->refreshStarted && cache->refreshNumber < CACHE_MAX_PENDING_REFRESH){
+            if (cache->refreshTail) cache->refreshTail->next = refresh;
+            else cache->refreshHead = refresh;
+            cache->refreshTail = refresh;
+            cache->refreshNumber++;
+            queued = deepviz_true;
+            dvz_cond_signal(&cache->refreshCond);
+        }
+
+        dvz_mutex_unlock(&cache->refreshLock);
+    }
+
+    if (!queued){
+        /* Try again on a later request */
+        cache_refresh_done(key, keyLen, deepviz_false);
+        cache_free_refresh(refresh);
+    }
+}
+
+
+/* The shared and persistent caches alone use the default TTLs */
+static PDEEPVIZ_CACHE_CONFIG cache_config(PDEEPVIZ_CACHE_CONFIG defaultConfig){
+
+    if (cache){
+        return &cache->config;
+    }
+
+    deepviz_cache_default_config(defaultConfig);
+    return defaultConfig;
+}
+
+
+static deepviz_bool cache_endpoint_enabled(DEEPVIZ_CACHE_ENDPOINT endpoint){
+
+    DEEPVIZ_CACHE_CONFIG    defaultConfig;
+    PDEEPVIZ_CACHE_CONFIG   config;
+
+    if (!cache && !dvz_shm_cache_enabled() && !dvz_disk_cache_enabled()){
+        return deepviz_false;
+    }
+
+    config = cache_config(&defaultConfig);
+
+    return config->ttl[endpoint] != 0 || config->negativeTtl[endpoint] != 0;
+}
+
+
+static PDEEPVIZ_RESULT cache_call(  DEEPVIZ_CACHE_ENDPOINT endpoint,
+                                    const char* api_key,
+                                    const char* arg,
+                                    PDEEPVIZ_LIST filters,
+                                    DEEPVIZ_FETCH_ROUTINE fetch){
+
+    DEEPVIZ_CACHE_CONFIG    defaultConfig;
+    PDEEPVIZ_CACHE_CONFIG   config;
+    PDEEPVIZ_RESULT         result = NULL;
+    PDEEPVIZ_RESULT         staleResult = NULL;
+    CACHE_FRESHNESS         freshness;
+    deepviz_bool            refresh;
+    char                    *key;
+    size_t                  keyLen = 0;
+    unsigned int            ttl;
+    deepviz_bool            shmCache;
+    deepviz_bool            diskCache;
+
+    if (!api_key || !arg || !cache_endpoint_enabled(endpoint)){
+        return fetch(api_key, arg, filters);
+    }
+
+    shmCache = dvz_shm_cache_enabled();
+    diskCache = dvz_disk_cache_enabled();
+    config = cache_config(&defaultConfig);
+
+    key = cache_build_key(endpoint, arg, filters, &keyLen);
+    if (!key){
+        return fetch(api_key, arg, filters);
+    }
+
+    if (cache){
+        result = cache_lookup(key, keyLen, &freshness, &refresh);
+
+        if (result && freshness == CACHE_STALE){
+            result->stale = deepviz_true;
+            if (refresh){
+                cache_schedule_refresh(endpoint, api_key, arg, filters, fetch, key, keyLen);
+            }
+            free(key);
+            return result;
+        }
+
+        if (result && freshness == CACHE_STALE_IF_ERROR){
+            /* Kept in case the new request fails */
+            staleResult = result;
+            result = NULL;
+        }
+    }
+
+    if (!result && shmCache){
+        result = dvz_shm_cache_lookup(key, keyLen, &ttl);
+        if (result && cache){
+            /* Promote to the in-memory cache */
+            cache_store(endpoint, key, keyLen, result, ttl);
+        }
+    }
+
+    if (!result && diskCache){
+        result = dvz_disk_cache_lookup(key, keyLen, &ttl);
+        if (result){
+            /* Promote to the faster caches */
+            if (cache) cache_store(endpoint, key, keyLen, result, ttl);
+            if (shmCache) dvz_shm_cache_store(key, keyLen, result, ttl);
+        }
+    }
+
+    if (!result){
+
+        result = fetch(api_key, arg, filters);
+
+        if (staleResult && (!result || result->status == DEEPVIZ_STATUS_NETWORK_ERROR || result->status == DEEPVIZ_STATUS_SERVER_ERROR)){
+            /* Serve the stale entry, next requests will not wait for the API */
+            cache_refresh_done(key, keyLen, deepviz_true);
+            if (result) deepviz_result_free(&result);
+            result = staleResult;
+            result->stale = deepviz_true;
+            staleResult = NULL;
+        }
+        else{
+            ttl = cache_result_ttl(config, endpoint, result);
+            if (ttl){
+                cache_store_tiers(endpoint, key, keyLen, result, ttl);
+            }
+        }
+    }
+
+    if (staleResult) deepviz_result_free(&staleResult);
+    free(key);
+
+    return result;
+}
+
+
+PDEEPVIZ_RESULT dvz_cache_call( DEEPVIZ_CACHE_ENDPOINT endpoint,
+                                const char* api_key,
+                                const char* arg,
+                                PDEEPVIZ_LIST filters,
+                                DEEPVIZ_FETCH_ROUTINE fetch){
+
+    DEEPVIZ_RESULT_FORMAT   format;
+    PDEEPVIZ_RESULT         result;
+
+    format = dvz_result_format_current();
+    if (format == DEEPVIZ_FORMAT_JSON || !cache_endpoint_enabled(endpoint)){
+        return cache_call(endpoint, api_key, arg, filters, fetch);
+    }
+
+    /* The caches hold JSON text: cached calls are encoded in the binary format on the way out */
+    deepviz_result_format_set(DEEPVIZ_FORMAT_JSON);
+    result = cache_call(endpoint, api_key, arg, filters, fetch);
+    deepviz_result_format_set(format);
+
+    if (result){
+        deepviz_result_convert(result, format);
+    }
+
+    return result;
+}
+
+
+EXPORT void deepviz_cache_default_config(PDEEPVIZ_CACHE_CONFIG config){
+
+    size_t i;
+
+    if (!config){
+        return;
+    }
+
+    config->shardNumber = DEEPVIZ_CACHE_DEFAULT_SHARDS;
+    config->maxMemory = DEEPVIZ_CACHE_DEFAULT_MEMORY;
+
+    for (i = 0; i < DEEPVIZ_CACHE_ENDPOINT_NUMBER; i++){
+        config->ttl[i] = DEEPVIZ_CACHE_DEFAULT_TTL;
+        config->negativeTtl[i] = DEEPVIZ_CACHE_DEFAULT_NEGATIVE_TTL;
+        config->staleWhileRevalidate[i] = 0;
+        config->staleIfError[i] = 0;
+    }
+}
+
+
+EXPORT deepviz_bool deepviz_cache_enable(PDEEPVIZ_CACHE_CONFIG config){
+
+    DEEPVIZ_CACHE_CONFIG    currConfig;
+    PDEEPVIZ_CACHE          newCache;
+    size_t                  i;
+
+    if (config){
+        currConfig = *config;
+    }
+    else{
+        deepviz_cache_default_config(&currConfig);
+    }
+
+    if (currConfig.shardNumber == 0){
+        currConfig.shardNumber = DEEPVIZ_CACHE_DEFAULT_SHARDS;
+    }
+    if (currConfig.maxMemory == 0){
+        currConfig.maxMemory = DEEPVIZ_CACHE_DEFAULT_MEMORY;
+    }
+
+    newCache = (PDEEPVIZ_CACHE)malloc(sizeof(DEEPVIZ_CACHE) + currConfig.shardNumber * sizeof(DEEPVIZ_CACHE_SHARD));
+    if (!newCache){
+        return deepviz_false;
+    }
+
+    memset(newCache, 0, sizeof(DEEPVIZ_CACHE) + currConfig.shardNumber * sizeof(DEEPVIZ_CACHE_SHARD));
+    newCache->config = currConfig;
+    newCache->shardNumber = currConfig.shardNumber;
+    dvz_mutex_init(&newCache->refreshLock);
+    dvz_cond_init(&newCache->refreshCond);
+
+    for (i = 0; i < newCache->shardNumber; i++){
+
+        newCache->shard[i].buckets = (PDEEPVIZ_CACHE_ENTRY*)calloc(CACHE_INITIAL_BUCKETS, sizeof(PDEEPVIZ_CACHE_ENTRY));
+        if (!newCache->shard[i].buckets){
+            while (i-- > 0){
+                free(newCache->shard[i].buckets);
+                dvz_mutex_destroy(&newCache->shard[i].lock);
+            }
+            dvz_cond_destroy(&newCache->refreshCond);
+            dvz_mutex_destroy(&newCache->refreshLock);
+            free(newCache);
+            return deepviz_false;
+        }
+
+        newCache->shard[i].bucketNumber = CACHE_INITIAL_BUCKETS;
+        newCache->shard[i].maxMemory = currConfig.maxMemory / currConfig.shardNumber;
+        dvz_mutex_init(&newCache->shard[i].lock);
+    }
+
+    deepviz_cache_disable();
+    cache = newCache;
+
+    return deepviz_true;
+}
+
+
+EXPORT void deepviz_cache_disable(void){
+
+    PDEEPVIZ_CACHE_REFRESH  refresh;
+    size_t                  i;
+
+    if (!cache){
+        return;
+    }
+
+    /* Stop the refresh thread, waiting for the running refresh */
+    dvz_mutex_lock(&cache->refreshLock);
+    cache->refreshStop = deepviz_true;
+    dvz_cond_broadcast(&cache->refreshCond);
+    dvz_mutex_unlock(&cache->refreshLock);
+
+    if (cache->refreshStarted){
+        dvz_thread_join(cache->refreshThread);
+    }
+
+    while (cache->refreshHead){
+        refresh = cache->refreshHead;
+        cache->refreshHead = refresh->next;
+        cache_free_refresh(refresh);
+    }
+
+    dvz_cond_destroy(&cache->refreshCond);
+    dvz_mutex_destroy(&cache->refreshLock);
+
+    for (i = 0; i < cache->shardNumber; i++){
+        cache_clear_shard(&cache->shard[i]);
+        free(cache->shard[i].buckets);
+        dvz_mutex_destroy(&cache->shard[i].lock);
+    }
+
+    free(cache);
+    cache = NULL;
+}
+
+
+EXPORT void deepviz_cache_clear(void){
+
+    size_t i;
+
+    if (!cache){
+        return;
+    }
+
+    for (i = 0; i < cache->shardNumber; i++){
+        dvz_mutex_lock(&cache->shard[i].lock);
+        cache_clear_shard(&cache->shard[i]);
+        dvz_mutex_unlock(&cache->shard[i].lock);
+    }
+}
+
+
+EXPORT void deepviz_cache_get_stats(PDEEPVIZ_CACHE_STATS stats){
+
+    size_t i;
+
+    if (!stats){
+        return;
+    }
+
+    memset(stats, 0, sizeof(DEEPVIZ_CACHE_STATS));
+
+    if (!cache){
+        return;
+    }
+
+    for (i = 0; i < cache->shardNumber; i++){
+        dvz_mutex_lock(&cache->shard[i].lock);
+        stats->hits += cache->shard[i].stats.hits;
+        stats->misses += cache->shard[i].stats.misses;
+        stats->evictions += cache->shard[i].stats.evictions;
+        stats->expirations += cache->shard[i].stats.expirations;
+        stats->stale += cache->shard[i].stats.stale;
+        stats->entries += cache->shard[i].stats.entries;
+        stats->memory += cache->shard[i].memory;
+        dvz_mutex_unlock(&cache->shard[i].lock);
+    }
+}
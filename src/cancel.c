@@ -0,0 +1,158 @@
+/*
+* Copyright (c) 2016 Saferbytes s.r.l.s.
+*
+* You can redistribute it and/or modify it under the terms of the MIT license.
+* See LICENSE for details.
+*/
+
+#include "c-deepviz.h"
+#include "c-deepviz_private.h"
+
+/*
+* Cancellation tokens.
+* A token is attached to a thread; the threads created by the library (uploaders, parallel requests)
+* inherit the token of their creator (see dvz_thread_create()). The background threads owned by the
+* library (cache refresh, watch, poller) run with no token or their own. Every transfer running under
+* a token registers a waiter, so that deepviz_cancel() wakes it up at once instead of waiting for its
+* next progress tick.
+*/
+
+#ifdef _WIN32
+#define     CANCEL_THREAD_LOCAL         __declspec(thread)
+#else
+#define     CANCEL_THREAD_LOCAL         __thread
+#endif
+
+struct _DEEPVIZ_CANCEL_TOKEN{
+    DEEPVIZ_MUTEX           lock;
+    volatile deepviz_bool   cancelled;
+    PDEEPVIZ_CANCEL_WAITER  waiters;
+};
+
+static CANCEL_THREAD_LOCAL PDEEPVIZ_CANCEL_TOKEN    currentToken = NULL;
+
+
+EXPORT PDEEPVIZ_CANCEL_TOKEN deepviz_cancel_token_init(void){
+
+    PDEEPVIZ_CANCEL_TOKEN   token;
+
+    token = (PDEEPVIZ_CANCEL_TOKEN)malloc(sizeof(DEEPVIZ_CANCEL_TOKEN));
+    if (!token){
+        return NULL;
+    }
+
+    memset(token, 0, sizeof(DEEPVIZ_CANCEL_TOKEN));
+    dvz_mutex_init(&token->lock);
+
+    return token;
+}
+
+
+EXPORT PDEEPVIZ_CANCEL_TOKEN deepviz_cancel_token_attach(PDEEPVIZ_CANCEL_TOKEN token){
+
+    PDEEPVIZ_CANCEL_TOKEN   previous = currentToken;
+
+    currentToken = token;
+
+    return previous;
+}
+
+
+EXPORT void deepviz_cancel(PDEEPVIZ_CANCEL_TOKEN token){
+
+    PDEEPVIZ_CANCEL_WAITER  waiter;
+
+    if (!token){
+        return;
+    }
+
+    dvz_mutex_lock(&token->lock);
+
+    token->cancelled = deepviz_true;
+
+    for (waiter = token->waiters; waiter; waiter = waiter->next){
+        waiter->wakeup(waiter->param);
+    }
+
+    dvz_mutex_unlock(&token->lock);
+}
+
+
+EXPORT deepviz_bool deepviz_cancel_token_cancelled(PDEEPVIZ_CANCEL_TOKEN token){
+
+    return token && token->cancelled;
+}
+
+
+EXPORT void deepviz_cancel_token_free(PDEEPVIZ_CANCEL_TOKEN *token){
+
+    if (!token || !(*token)){
+        return;
+    }
+
+    if (currentToken == (*token)){
+        currentToken = NULL;
+    }
+
+    dvz_mutex_destroy(&(*token)->lock);
+    free((*token));
+    (*token) = NULL;
+}
+
+
+PDEEPVIZ_CANCEL_TOKEN dvz_cancel_token_current(void){
+
+    return currentToken;
+}
+
+
+deepviz_bool dvz_cancel_requested(void){
+
+    return currentToken && currentToken->cancelled;
+}
+
+
+DEEPVIZ_RESULT_STATUS dvz_transfer_error_status(void){
+
+    return dvz_cancel_requested() ? DEEPVIZ_STATUS_CANCELLED : DEEPVIZ_STATUS_NETWORK_ERROR;
+}
+
+
+/* deepviz_false if already cancelled: the waiter is not registered */
+deepviz_bool dvz_cancel_register(PDEEPVIZ_CANCEL_TOKEN token, PDEEPVIZ_CANCEL_WAITER waiter,
+                                    DEEPVIZ_CANCEL_WAKEUP wakeup, void* param){
+
+    deepviz_bool    ret;
+
+    waiter->wakeup = wakeup;
+    waiter->param = param;
+
+    dvz_mutex_lock(&token->lock);
+
+    ret = !token->cancelled;
+    if (ret){
+        waiter->next = token->waiters;
+        token->waiters = waiter;
+    }
+
+    dvz_mutex_unlock(&token->lock);
+
+    return ret;
+}
+
+
+void dvz_cancel_unregister(PDEEPVIZ_CANCEL_TOKEN token, PDEEPVIZ_CANCEL_WAITER waiter){
+
+    PDEEPVIZ_CANCEL_WAITER  *link;
+
+    dvz_mutex_lock(&token->lock);
+
+    for (link = &token->waiters; *link; link = &(*link)->next){
+        if ((*link) == waiter){
+            (*link) = waiter->next;
+            break;
+        }
+    }
+
+    dvz_mutex_unlock(&token->lock);
+}
@@ -0,0 +1,515 @@
+/*
+* Copyright (c) 2016 Saferbytes s.r.l.s.
+*
+* You can redistribute it and/or modify it under the terms of the MIT license.
+* See LICENSE for details.
+*/
+
+#include "c-deepviz.h"
+#include "c-deepviz_private.h"
+
+/*
+* Upload deduplication.
+* Every file is hashed before the upload. MD5s known to Deepviz (already uploaded, or found by
+* deepviz_sample_result()) are kept in a Bloom filter, optionally persisted to disk, so that the
+* same sample is never uploaded twice, whatever its path.
+* MD5s being checked or uploaded are kept in an in-flight list: a worker hashing the same content
+* waits for the first one, then skips the upload if it succeeded.
+* Uploads hold a reference on the filter: disabling (or replacing) it only detaches it, and the last
+* reference saves and frees it.
+*/
+
+#define     DEDUP_MAGIC                 0x42565a44      /* "DZVB" */
+#define     DEDUP_VERSION               1
+
+/* 1 false positive in a million: ~29 bits and 20 probes per entry */
+#define     DEDUP_BITS_PER_ENTRY        29
+#define     DEDUP_HASH_NUMBER           20
+
+typedef struct _DEDUP_FILE_HEADER{
+    unsigned int        magic;
+    unsigned int        version;
+    unsigned long long  bitNumber;
+    unsigned long long  entries;
+    unsigned int        hashNumber;
+    unsigned int        reserved;
+}DEDUP_FILE_HEADER, *PDEDUP_FILE_HEADER;
+
+typedef struct _DEDUP_PENDING{
+    unsigned char           digest[DEEPVIZ_MD5_LEN];
+    struct _DEDUP_PENDING   *next;
+}DEDUP_PENDING, *PDEDUP_PENDING;
+
+typedef struct _DEDUP_FILTER{
+    DEEPVIZ_MUTEX       lock;
+    DEEPVIZ_COND        pendingCond;        /* Broadcast when an in-flight MD5 is done */
+    PDEDUP_PENDING      pending;
+    unsigned char       *bits;
+    unsigned long long  bitNumber;
+    unsigned long long  entries;
+    unsigned int        hashNumber;
+    char                *path;
+    size_t              refCount;           /* The "dedup" pointer and every upload using the filter */
+}DEDUP_FILTER, *PDEDUP_FILTER;
+
+static PDEDUP_FILTER    dedup = NULL;
+static DEEPVIZ_MUTEX    dedupLock;          /* Guards "dedup" and the reference counts */
+static DEEPVIZ_ONCE     dedupOnce = DEEPVIZ_ONCE_INIT;
+
+
+/* Double hashing over the two halves of the MD5, which is already uniformly distributed */
+static void dedup_probes(const unsigned char digest[DEEPVIZ_MD5_LEN], unsigned long long* h1, unsigned long long* h2){
+
+    int     i;
+
+    (*h1) = 0;
+    (*h2) = 0;
+
+    for (i = 0; i < 8; i++){
+        (*h1) |= (unsigned long long)digest[i] << (i * 8);
+        (*h2) |= (unsigned long long)digest[i + 8] << (i * 8);
+    }
+
+    (*h2) |= 1;
+}
+
+
+/* The caller holds the lock */
+static deepviz_bool dedup_contains(PDEDUP_FILTER filter, const unsigned char digest[DEEPVIZ_MD5_LEN]){
+
+    unsigned long long  h1;
+    unsigned long long  h2;
+    unsigned long long  bit;
+    unsigned int        i;
+    deepviz_bool        found = deepviz_true;
+
+    dedup_probes(digest, &h1, &h2);
+
+    for (i = 0; i < filter->hashNumber && found; i++){
+        bit = (h1 + i * h2) % filter->bitNumber;
+        found = (filter->bits[bit >> 3] >> (bit & 7)) & 1;
+    }
+
+    return found;
+}
+
+
+/* The caller holds the lock */
+static void dedup_add(PDEDUP_FILTER filter, const unsigned char digest[DEEPVIZ_MD5_LEN]){
+
+    unsigned long long  h1;
+    unsigned long long  h2;
+    unsigned long long  bit;
+    unsigned int        i;
+
+    dedup_probes(digest, &h1, &h2);
+
+    for (i = 0; i < filter->hashNumber; i++){
+        bit = (h1 + i * h2) % filter->bitNumber;
+        filter->bits[bit >> 3] |= (unsigned char)(1 << (bit & 7));
+    }
+    filter->entries++;
+}
+
+
+/* Returns deepviz_true if "digest" is known. Otherwise waits for the worker handling the same MD5, if any,
+and registers "pending" as the in-flight entry: the caller must then call dedup_pending_end(). */
+static deepviz_bool dedup_pending_begin(PDEDUP_FILTER filter, const unsigned char digest[DEEPVIZ_MD5_LEN], PDEDUP_PENDING pending){
+
+    PDEDUP_PENDING  other;
+    deepviz_bool    known;
+
+    dvz_mutex_lock(&filter->lock);
+
+    for (;;){
+
+        known = dedup_contains(filter, digest);
+        if (known){
+            break;
+        }
+
+        for (other = filter->pending; other; other = other->next){
+            if (!memcmp(other->digest, digest, DEEPVIZ_MD5_LEN)){
+                break;
+            }
+        }
+
+        if (!other){
+            memcpy(pending->digest, digest, DEEPVIZ_MD5_LEN);
+            pending->next = filter->pending;
+            filter->pending = pending;
+            break;
+        }
+
+        /* Same content on its way: check again once it is done */
+        dvz_cond_wait(&filter->pendingCond, &filter->lock);
+    }
+
+    dvz_mutex_unlock(&filter->lock);
+
+    return known;
+}
+
+
+/* Remove the in-flight entry, adding its MD5 to the filter if "known", and wake up the waiting workers */
+static void dedup_pending_end(PDEDUP_FILTER filter, PDEDUP_PENDING pending, deepviz_bool known){
+
+    PDEDUP_PENDING  *link;
+
+    dvz_mutex_lock(&filter->lock);
+
+    if (known){
+        dedup_add(filter, pending->digest);
+    }
+
+    for (link = &filter->pending; *link; link = &(*link)->next){
+        if (*link == pending){
+            (*link) = pending->next;
+            break;
+        }
+    }
+
+    dvz_cond_broadcast(&filter->pendingCond);
+    dvz_mutex_unlock(&filter->lock);
+}
+
+
+static deepviz_bool dedup_parse_md5(const char* md5, unsigned char digest[DEEPVIZ_MD5_LEN]){
+
+    int     i;
+    int     value;
+    char    c;
+
+    if (strlen(md5) != DEEPVIZ_MD5_LEN * 2){
+        return deepviz_false;
+    }
+
+    for (i = 0; i < DEEPVIZ_MD5_LEN * 2; i++){
+
+        c = md5[i];
+        if (c >= '0' && c <= '9') value = c - '0';
+        else if (c >= 'a' && c <= 'f') value = c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F') value = c - 'A' + 10;
+        else return deepviz_false;
+
+        if (i & 1) digest[i / 2] |= (unsigned char)value;
+        else digest[i / 2] = (unsigned char)(value << 4);
+    }
+
+    return deepviz_true;
+}
+
+
+/* Load a filter saved by dedup_save(). Returns deepviz_false if missing or invalid. */
+static deepviz_bool dedup_load(PDEDUP_FILTER filter, const char* path){
+
+    DEDUP_FILE_HEADER   header;
+    FILE                *file;
+    size_t              len;
+
+    file = fopen(path, "rb");
+    if (!file){
+        return deepviz_false;
+    }
+
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+        header.magic != DEDUP_MAGIC ||
+        header.version != DEDUP_VERSION ||
+        header.bitNumber == 0 ||
+        header.hashNumber == 0){
+        fclose(file);
+        return deepviz_false;
+    }
+
+    len = (size_t)((header.bitNumber + 7) / 8);
+    filter->bits = (unsigned char*)malloc(len);
+    if (!filter->bits || fread(filter->bits, len, 1, file) != 1){
+        if (filter->bits) free(filter->bits);
+        filter->bits = NULL;
+        fclose(file);
+        return deepviz_false;
+    }
+
+    fclose(file);
+
+    filter->bitNumber = header.bitNumber;
+    filter->entries = header.entries;
+    filter->hashNumber = header.hashNumber;
+
+    return deepviz_true;
+}
+
+
+static deepviz_bool dedup_save(PDEDUP_FILTER filter){
+
+    DEDUP_FILE_HEADER   header;
+    FILE                *file;
+    size_t              tempPathLen;
+    char                *tempPath;
+    deepviz_bool        ret;
+
+    tempPathLen = strlen(filter->path) + 5;
+    tempPath = (char*)malloc(tempPathLen);
+    if (!tempPath){
+        return deepviz_false;
+    }
+    deepviz_sprintf(tempPath, tempPathLen, "%s.tmp", filter->path);
+
+    file = fopen(tempPath, "wb");
+    if (!file){
+        free(tempPath);
+        return deepviz_false;
+    }
+
+    memset(&header, 0, sizeof(header));
+    header.magic = DEDUP_MAGIC;
+    header.version = DEDUP_VERSION;
+
+    dvz_mutex_lock(&filter->lock);
+    header.bitNumber = filter->bitNumber;
+    header.entries = filter->entries;
+    header.hashNumber = filter->hashNumber;
+    ret = fwrite(&header, sizeof(header), 1, file) == 1 &&
+          fwrite(filter->bits, (size_t)((filter->bitNumber + 7) / 8), 1, file) == 1;
+    dvz_mutex_unlock(&filter->lock);
+
+    ret = !fclose(file) && ret;
+
+    /* Replace the previous file only once complete */
+#ifdef _WIN32
+    ret = ret && MoveFileExA(tempPath, filter->path, MOVEFILE_REPLACE_EXISTING);
+#else
+    ret = ret && !rename(tempPath, filter->path);
+#endif
+    if (!ret){
+        remove(tempPath);
+    }
+
+    free(tempPath);
+
+    return ret;
+}
+
+
+static void dedup_init_once(void){
+
+    dvz_mutex_init(&dedupLock);
+}
+
+
+/* Take a reference on the current filter, NULL if disabled */
+static PDEDUP_FILTER dedup_acquire(void){
+
+    PDEDUP_FILTER   filter;
+
+    dvz_once(&dedupOnce, dedup_init_once);
+
+    dvz_mutex_lock(&dedupLock);
+    filter = dedup;
+    if (filter){
+        filter->refCount++;
+    }
+    dvz_mutex_unlock(&dedupLock);
+
+    return filter;
+}
+
+
+/* Drop a reference: the last one saves the filter to its file and frees it */
+static void dedup_release(PDEDUP_FILTER filter){
+
+    deepviz_bool    last;
+
+    dvz_mutex_lock(&dedupLock);
+    last = --filter->refCount == 0;
+    dvz_mutex_unlock(&dedupLock);
+
+    if (!last){
+        return;
+    }
+
+    if (filter->path){
+        dedup_save(filter);
+        free(filter->path);
+    }
+
+    dvz_cond_destroy(&filter->pendingCond);
+    dvz_mutex_destroy(&filter->lock);
+    free(filter->bits);
+    free(filter);
+}
+
+
+/* Install "filter" (NULL to disable), releasing the previous one */
+static void dedup_replace(PDEDUP_FILTER filter){
+
+    PDEDUP_FILTER   oldFilter;
+
+    dvz_once(&dedupOnce, dedup_init_once);
+
+    dvz_mutex_lock(&dedupLock);
+    oldFilter = dedup;
+    dedup = filter;
+    dvz_mutex_unlock(&dedupLock);
+
+    if (oldFilter){
+        dedup_release(oldFilter);
+    }
+}
+
+
+deepviz_bool dvz_upload_dedup_enabled(void){
+
+    return dedup != NULL;
+}
+
+
+PDEEPVIZ_RESULT dvz_dedup_upload_sample(const char* api_key, const char* path){
+
+    PDEEPVIZ_RESULT     result;
+    PDEDUP_FILTER       filter;
+    DEDUP_PENDING       pending;
+    unsigned char       digest[DEEPVIZ_MD5_LEN];
+    char                md5[DEEPVIZ_MD5_HEX_LEN];
+    char                *retMsg;
+    deepviz_bool        known;
+
+    if (!dvz_md5_file(path, digest)){
+        /* Let the upload report the error */
+        return dvz_upload_sample(api_key, path);
+    }
+
+    dvz_md5_to_hex(digest, md5);
+
+    filter = dedup_acquire();
+    if (!filter){
+        /* Disabled meanwhile */
+        return dvz_upload_sample(api_key, path);
+    }
+
+    known = dedup_pending_begin(filter, digest, &pending);
+    if (!known){
+
+        /* Not seen locally: ask Deepviz */
+        result = deepviz_sample_result(md5, api_key);
+        known = result && (result->status == DEEPVIZ_STATUS_SUCCESS || result->status == DEEPVIZ_STATUS_PROCESSING);
+        if (result) deepviz_result_free(&result);
+
+        if (!known){
+            result = dvz_upload_sample(api_key, path);
+            dedup_pending_end(filter, &pending, result && result->status == DEEPVIZ_STATUS_SUCCESS);
+            dedup_release(filter);
+            return result;
+        }
+
+        dedup_pending_end(filter, &pending, deepviz_true);
+    }
+
+    dedup_release(filter);
+
+    retMsg = (char*)malloc(DEEPVIZ_ERROR_MAX_LEN);
+    if (!retMsg){
+        return deepviz_result_init(DEEPVIZ_STATUS_INTERNAL_ERROR, NULL);
+    }
+
+    deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Sample already known to Deepviz, upload skipped. MD5: %s", md5);
+    return deepviz_result_init(DEEPVIZ_STATUS_SUCCESS, retMsg);
+}
+
+
+EXPORT deepviz_bool deepviz_upload_dedup_enable(const char* filter_path, size_t expected_entries){
+
+    PDEDUP_FILTER   filter;
+    size_t          len;
+
+    filter = (PDEDUP_FILTER)malloc(sizeof(DEDUP_FILTER));
+    if (!filter){
+        return deepviz_false;
+    }
+
+    memset(filter, 0, sizeof(DEDUP_FILTER));
+
+    if (filter_path){
+        filter->path = (char*)malloc(strlen(filter_path) + 1);
+        if (!filter->path){
+            free(filter);
+            return deepviz_false;
+        }
+        memcpy(filter->path, filter_path, strlen(filter_path) + 1);
+    }
+
+    if (!filter->path || !dedup_load(filter, filter->path)){
+
+        /* New empty filter */
+        if (expected_entries == 0){
+            expected_entries = DEEPVIZ_DEDUP_DEFAULT_ENTRIES;
+        }
+
+        filter->bitNumber = (unsigned long long)expected_entries * DEDUP_BITS_PER_ENTRY;
+        filter->hashNumber = DEDUP_HASH_NUMBER;
+
+        len = (size_t)((filter->bitNumber + 7) / 8);
+        filter->bits = (unsigned char*)calloc(len, 1);
+        if (!filter->bits){
+            if (filter->path) free(filter->path);
+            free(filter);
+            return deepviz_false;
+        }
+    }
+
+    dvz_mutex_init(&filter->lock);
+    dvz_cond_init(&filter->pendingCond);
+    filter->refCount = 1;
+
+    dedup_replace(filter);
+
+    return deepviz_true;
+}
+
+
+EXPORT deepviz_bool deepviz_upload_dedup_add(const char* md5){
+
+    PDEDUP_FILTER   filter;
+    unsigned char   digest[DEEPVIZ_MD5_LEN];
+
+    if (!md5 || !dedup_parse_md5(md5, digest)){
+        return deepviz_false;
+    }
+
+    filter = dedup_acquire();
+    if (!filter){
+        return deepviz_false;
+    }
+
+    dvz_mutex_lock(&filter->lock);
+    dedup_add(filter, digest);
+    dvz_mutex_unlock(&filter->lock);
+
+    dedup_release(filter);
+
+    return deepviz_true;
+}
+
+
+EXPORT deepviz_bool deepviz_upload_dedup_save(void){
+
+    PDEDUP_FILTER   filter;
+    deepviz_bool    ret;
+
+    filter = dedup_acquire();
+    if (!filter){
+        return deepviz_false;
+    }
+
+    ret = filter->path && dedup_save(filter);
+
+    dedup_release(filter);
+
+    return ret;
+}
+
+
+EXPORT void deepviz_upload_dedup_disable(void){
+
+    dedup_replace(NULL);
+}
@@ -0,0 +1,773 @@
+/*
+* Copyright (c) 2016 Saferbytes s.r.l.s.
+*
+* You can redistribute it and/or modify it under the terms of the MIT license.
+* See LICENSE for details.
+*/
+
+#include "c-deepviz.h"
+#include "c-deepviz_private.h"
+
+/*
+* Persistent result cache.
+* Results are appended to "deepviz-cache.log" and located through an open addressing hash table
+* stored in "deepviz-cache.idx", which is memory mapped and shared by every process using the
+* same directory. Readers never lock: a slot location is published before its hash with 8 bytes
+* atomic stores, and the key stored in the log record is always verified. Writers serialize on
+* "deepviz-cache.lock" (flock) and only append.
+* Compaction rebuilds both files, renames them over the old ones and flags the old index as stale
+* so that other processes reopen the cache on their next access.
+*/
+
+#ifndef _WIN32
+
+#include <errno.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef DEEPVIZ_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#define     DISK_CACHE_MAGIC            0x5a564444      /* "DDVZ" */
+#define     DISK_CACHE_RECORD_MAGIC     0x52564444      /* "DDVR" */
+#define     DISK_CACHE_VERSION          1
+#define     DISK_CACHE_HEADER_LEN       4096
+
+#define     DISK_CACHE_INDEX_NAME       "deepviz-cache.idx"
+#define     DISK_CACHE_LOG_NAME         "deepviz-cache.log"
+#define     DISK_CACHE_LOCK_NAME        "deepviz-cache.lock"
+
+/* Slot location: 40 bits log offset, 24 bits record length */
+#define     DISK_CACHE_LEN_BITS         24
+#define     DISK_CACHE_MAX_RECORD_LEN   ((1ULL << DISK_CACHE_LEN_BITS) - 1)
+#define     DISK_CACHE_MAX_OFFSET       ((1ULL << (64 - DISK_CACHE_LEN_BITS)) - 1)
+
+/* Compact when the index is 70% full or when most of the log is garbage */
+#define     DISK_CACHE_MAX_LOAD(n)      (((n) * 7) / 10)
+#define     DISK_CACHE_MIN_GARBAGE      (16 * 1024 * 1024)
+
+#define     DISK_CACHE_FLAG_COMPRESSED  0x00000001
+
+typedef struct _DISK_CACHE_HEADER{
+    unsigned int        magic;
+    unsigned int        version;
+    unsigned long long  slotNumber;
+    unsigned int        stale;              /* Set once the files have been replaced by a compaction */
+    unsigned int        reserved;
+    unsigned long long  used;
+    unsigned long long  liveBytes;
+}DISK_CACHE_HEADER, *PDISK_CACHE_HEADER;
+
+typedef struct _DISK_CACHE_SLOT{
+    unsigned long long  hash;               /* 0 = empty */
+    unsigned long long  loc;
+}DISK_CACHE_SLOT, *PDISK_CACHE_SLOT;
+
+typedef struct _DISK_CACHE_RECORD{
+    unsigned int        magic;
+    unsigned int        status;
+    unsigned long long  expireTime;         /* Seconds since the epoch */
+    unsigned int        keyLen;
+    unsigned int        rawLen;             /* Uncompressed value length */
+    unsigned int        valueLen;
+    unsigned int        flags;
+}DISK_CACHE_RECORD, *PDISK_CACHE_RECORD;
+
+typedef struct _DISK_CACHE{
+    char                *directory;
+    int                 indexFd;
+    int                 logFd;
+    int                 lockFd;
+    void                *map;
+    size_t              mapLen;
+    PDISK_CACHE_HEADER  header;
+    PDISK_CACHE_SLOT    slot;
+    unsigned long long  slotNumber;
+}DISK_CACHE, *PDISK_CACHE;
+
+static PDISK_CACHE      diskCache = NULL;
+static pthread_rwlock_t diskCacheLock = PTHREAD_RWLOCK_INITIALIZER;
+
+
+static unsigned long long disk_cache_slot_hash(const char* key, size_t keyLen){
+
+    unsigned long long  hash = dvz_hash(key, keyLen);
+
+    /* 0 marks empty slots */
+    return hash ? hash : 1;
+}
+
+
+static char* disk_cache_path(const char* directory, const char* name, const char* suffix){
+
+    size_t  len = strlen(directory) + strlen(name) + strlen(suffix) + 2;
+    char    *path;
+
+    path = (char*)malloc(len);
+    if (path){
+        deepviz_sprintf(path, len, "%s/%s%s", directory, name, suffix);
+    }
+
+    return path;
+}
+
+
+static void disk_cache_unmap(PDISK_CACHE dc){
+
+    if (dc->map) munmap(dc->map, dc->mapLen);
+    if (dc->indexFd >= 0) close(dc->indexFd);
+    if (dc->logFd >= 0) close(dc->logFd);
+
+    dc->map = NULL;
+    dc->header = NULL;
+    dc->slot = NULL;
+    dc->indexFd = -1;
+    dc->logFd = -1;
+}
+
+
+/* Create a new empty index file. The caller holds the file lock. */
+static int disk_cache_create_index(const char* path, unsigned long long slotNumber){
+
+    DISK_CACHE_HEADER   header;
+    int                 fd;
+
+    fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0){
+        return -1;
+    }
+
+    memset(&header, 0, sizeof(header));
+    header.magic = DISK_CACHE_MAGIC;
+    header.version = DISK_CACHE_VERSION;
+    header.slotNumber = slotNumber;
+
+    if (ftruncate(fd, DISK_CACHE_HEADER_LEN + slotNumber * sizeof(DISK_CACHE_SLOT)) ||
+        pwrite(fd, &header, sizeof(header), 0) != sizeof(header)){
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+
+/* Open and map the cache files. The caller holds the file lock. */
+static deepviz_bool disk_cache_map(PDISK_CACHE dc, unsigned long long slotNumber){
+
+    DISK_CACHE_HEADER   header;
+    struct stat         st;
+    char                *indexPath = NULL;
+    char                *logPath = NULL;
+    deepviz_bool        ret = deepviz_false;
+
+    indexPath = disk_cache_path(dc->directory, DISK_CACHE_INDEX_NAME, "");
+    logPath = disk_cache_path(dc->directory, DISK_CACHE_LOG_NAME, "");
+    if (!indexPath || !logPath){
+        goto cleanup;
+    }
+
+    dc->indexFd = open(indexPath, O_RDWR | O_CREAT, 0644);
+    if (dc->indexFd < 0 || fstat(dc->indexFd, &st)){
+        goto cleanup;
+    }
+
+    if (st.st_size == 0){
+        close(dc->indexFd);
+        dc->indexFd = disk_cache_create_index(indexPath, slotNumber);
+        if (dc->indexFd < 0 || fstat(dc->indexFd, &st)){
+            goto cleanup;
+        }
+    }
+
+    if (pread(dc->indexFd, &header, sizeof(header), 0) != sizeof(header) ||
+        header.magic != DISK_CACHE_MAGIC ||
+        header.version != DISK_CACHE_VERSION ||
+        header.slotNumber == 0 ||
+        (unsigned long long)st.st_size < DISK_CACHE_HEADER_LEN + header.slotNumber * sizeof(DISK_CACHE_SLOT)){
+        goto cleanup;
+    }
+
+    dc->logFd = open(logPath, O_RDWR | O_CREAT, 0644);
+    if (dc->logFd < 0){
+        goto cleanup;
+    }
+
+    dc->mapLen = (size_t)(DISK_CACHE_HEADER_LEN + header.slotNumber * sizeof(DISK_CACHE_SLOT));
+    dc->map = mmap(NULL, dc->mapLen, PROT_READ | PROT_WRITE, MAP_SHARED, dc->indexFd, 0);
+    if (dc->map == MAP_FAILED){
+        dc->map = NULL;
+        goto cleanup;
+    }
+
+    dc->header = (PDISK_CACHE_HEADER)dc->map;
+    dc->slot = (PDISK_CACHE_SLOT)((char*)dc->map + DISK_CACHE_HEADER_LEN);
+    dc->slotNumber = header.slotNumber;
+
+    ret = deepviz_true;
+
+cleanup:
+    if (!ret) disk_cache_unmap(dc);
+    if (indexPath) free(indexPath);
+    if (logPath) free(logPath);
+
+    return ret;
+}
+
+
+/* Reopen the files if another process compacted them. The caller holds the write lock. */
+static deepviz_bool disk_cache_refresh(PDISK_CACHE dc){
+
+    deepviz_bool    ret;
+
+    if (dc->header && !__atomic_load_n(&dc->header->stale, __ATOMIC_ACQUIRE)){
+        return deepviz_true;
+    }
+
+    disk_cache_unmap(dc);
+
+    flock(dc->lockFd, LOCK_EX);
+    ret = disk_cache_map(dc, DEEPVIZ_CACHE_DEFAULT_INDEX_SLOTS);
+    flock(dc->lockFd, LOCK_UN);
+
+    return ret;
+}
+
+
+/* Read the record stored at "loc". Returns NULL if it is invalid or does not match "key". */
+static PDISK_CACHE_RECORD disk_cache_read_record(PDISK_CACHE dc, unsigned long long loc, const char* key, size_t keyLen){
+
+    PDISK_CACHE_RECORD  record;
+    size_t              len = (size_t)(loc & DISK_CACHE_MAX_RECORD_LEN);
+    off_t               offset = (off_t)(loc >> DISK_CACHE_LEN_BITS);
+
+    if (len < sizeof(DISK_CACHE_RECORD)){
+        return NULL;
+    }
+
+    record = (PDISK_CACHE_RECORD)malloc(len + 1);
+    if (!record){
+        return NULL;
+    }
+
+    if (pread(dc->logFd, record, len, offset) != (ssize_t)len ||
+        record->magic != DISK_CACHE_RECORD_MAGIC ||
+        sizeof(DISK_CACHE_RECORD) + (size_t)record->keyLen + record->valueLen != len ||
+        (key && (record->keyLen != keyLen || memcmp(record + 1, key, keyLen)))){
+        free(record);
+        return NULL;
+    }
+
+    return record;
+}
+
+
+static char* disk_cache_decode_value(PDISK_CACHE_RECORD record){
+
+    const char  *value = (const char*)(record + 1) + record->keyLen;
+    char        *msg;
+
+    msg = (char*)malloc((size_t)record->rawLen + 1);
+    if (!msg){
+        return NULL;
+    }
+
+    if (record->flags & DISK_CACHE_FLAG_COMPRESSED){
+#ifdef DEEPVIZ_HAVE_ZLIB
+        uLongf  rawLen = record->rawLen;
+
+        if (uncompress((Bytef*)msg, &rawLen, (const Bytef*)value, record->valueLen) != Z_OK || rawLen != record->rawLen){
+            free(msg);
+            return NULL;
+        }
+#else
+        free(msg);
+        return NULL;
+#endif
+    }
+    else{
+        if (record->valueLen != record->rawLen){
+            free(msg);
+            return NULL;
+        }
+        memcpy(msg, value, record->rawLen);
+    }
+
+    msg[record->rawLen] = 0;
+
+    return msg;
+}
+
+
+/* Find the slot for "key": the matching one (its record is returned in "record") or the first empty one.
+Returns NULL if the table is full. */
+static PDISK_CACHE_SLOT disk_cache_find_slot(PDISK_CACHE dc, unsigned long long hash, const char* key, size_t keyLen, PDISK_CACHE_RECORD* record){
+
+    PDISK_CACHE_SLOT    slot;
+    unsigned long long  slotHash;
+    unsigned long long  i;
+
+    (*record) = NULL;
+
+    for (i = 0; i < dc->slotNumber; i++){
+
+        slot = &dc->slot[(hash + i) % dc->slotNumber];
+
+        slotHash = __atomic_load_n(&slot->hash, __ATOMIC_ACQUIRE);
+        if (slotHash == 0){
+            return slot;
+        }
+
+        if (slotHash == hash){
+            (*record) = disk_cache_read_record(dc, __atomic_load_n(&slot->loc, __ATOMIC_ACQUIRE), key, keyLen);
+            if (*record){
+                return slot;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+
+/* Rewrite the live entries into new files. The caller holds the write lock and the file lock. */
+static deepviz_bool disk_cache_rebuild(PDISK_CACHE dc){
+
+    DISK_CACHE_SLOT     *newSlot = NULL;
+    PDISK_CACHE_RECORD  record;
+    unsigned long long  newSlotNumber;
+    unsigned long long  live = 0;
+    unsigned long long  liveBytes = 0;
+    unsigned long long  offset = 0;
+    unsigned long long  now = (unsigned long long)time(NULL);
+    unsigned long long  loc;
+    unsigned long long  i;
+    unsigned long long  j;
+    size_t              len;
+    char                *indexPath = NULL;
+    char                *logPath = NULL;
+    char                *newIndexPath = NULL;
+    char                *newLogPath = NULL;
+    int                 indexFd = -1;
+    int                 logFd = -1;
+    deepviz_bool        ret = deepviz_false;
+
+    for (i = 0; i < dc->slotNumber; i++){
+        if (dc->slot[i].hash) live++;
+    }
+
+    /* Keep the load under 50% after the rebuild */
+    newSlotNumber = dc->slotNumber;
+    while (live * 2 > newSlotNumber){
+        newSlotNumber *= 2;
+    }
+
+    indexPath = disk_cache_path(dc->directory, DISK_CACHE_INDEX_NAME, "");
+    logPath = disk_cache_path(dc->directory, DISK_CACHE_LOG_NAME, "");
+    newIndexPath = disk_cache_path(dc->directory, DISK_CACHE_INDEX_NAME, ".tmp");
+    newLogPath = disk_cache_path(dc->directory, DISK_CACHE_LOG_NAME, ".tmp");
+    newSlot = (DISK_CACHE_SLOT*)calloc((size_t)newSlotNumber, sizeof(DISK_CACHE_SLOT));
+    if (!indexPath || !logPath || !newIndexPath || !newLogPath || !newSlot){
+        goto cleanup;
+    }
+
+    indexFd = disk_cache_create_index(newIndexPath, newSlotNumber);
+    logFd = open(newLogPath, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (indexFd < 0 || logFd < 0){
+        goto cleanup;
+    }
+
+    for (i = 0; i < dc->slotNumber; i++){
+
+        if (!dc->slot[i].hash){
+            continue;
+        }
+
+        record = disk_cache_read_record(dc, dc->slot[i].loc, NULL, 0);
+        if (!record){
+            continue;
+        }
+
+        if (record->expireTime > now){
+
+            len = (size_t)(dc->slot[i].loc & DISK_CACHE_MAX_RECORD_LEN);
+            if (pwrite(logFd, record, len, (off_t)offset) != (ssize_t)len){
+                free(record);
+                goto cleanup;
+            }
+
+            loc = (offset << DISK_CACHE_LEN_BITS) | len;
+            for (j = dc->slot[i].hash % newSlotNumber; newSlot[j].hash; j = (j + 1) % newSlotNumber);
+            newSlot[j].hash = dc->slot[i].hash;
+            newSlot[j].loc = loc;
+
+            offset += len;
+            liveBytes += len;
+        }
+
+        free(record);
+    }
+
+    if (pwrite(indexFd, newSlot, (size_t)newSlotNumber * sizeof(DISK_CACHE_SLOT), DISK_CACHE_HEADER_LEN) != (ssize_t)(newSlotNumber * sizeof(DISK_CACHE_SLOT))){
+        goto cleanup;
+    }
+
+    for (i = 0, live = 0; i < newSlotNumber; i++){
+        if (newSlot[i].hash) live++;
+    }
+
+    if (pwrite(indexFd, &live, sizeof(live), offsetof(DISK_CACHE_HEADER, used)) != sizeof(live) ||
+        pwrite(indexFd, &liveBytes, sizeof(liveBytes), offsetof(DISK_CACHE_HEADER, liveBytes)) != sizeof(liveBytes) ||
+        fsync(logFd) || fsync(indexFd)){
+        goto cleanup;
+    }
+
+    /* Log first: a new index must never point into an old log */
+    if (rename(newLogPath, logPath) || rename(newIndexPath, indexPath)){
+        goto cleanup;
+    }
+
+    __atomic_store_n(&dc->header->stale, 1, __ATOMIC_RELEASE);
+
+    disk_cache_unmap(dc);
+    ret = disk_cache_map(dc, newSlotNumber);
+
+cleanup:
+    if (indexFd >= 0) close(indexFd);
+    if (logFd >= 0) close(logFd);
+    if (!ret && newIndexPath) unlink(newIndexPath);
+    if (!ret && newLogPath) unlink(newLogPath);
+    if (newSlot) free(newSlot);
+    if (indexPath) free(indexPath);
+    if (logPath) free(logPath);
+    if (newIndexPath) free(newIndexPath);
+    if (newLogPath) free(newLogPath);
+
+    return ret;
+}
+
+
+/* Check the compaction thresholds. The caller holds the write lock and the file lock. */
+static void disk_cache_auto_compact(PDISK_CACHE dc){
+
+    struct stat st;
+
+    if (dc->header->used + 1 > DISK_CACHE_MAX_LOAD(dc->slotNumber)){
+        disk_cache_rebuild(dc);
+        return;
+    }
+
+    if (!fstat(dc->logFd, &st) &&
+        (unsigned long long)st.st_size > DISK_CACHE_MIN_GARBAGE &&
+        (unsigned long long)st.st_size > dc->header->liveBytes * 2){
+        disk_cache_rebuild(dc);
+    }
+}
+
+
+deepviz_bool dvz_disk_cache_enabled(void){
+
+    return diskCache != NULL;
+}
+
+
+PDEEPVIZ_RESULT dvz_disk_cache_lookup(const char* key, size_t keyLen, unsigned int* ttlLeft){
+
+    PDISK_CACHE_RECORD      record = NULL;
+    unsigned long long      hash;
+    unsigned long long      now;
+    DEEPVIZ_RESULT_STATUS   status;
+    char                    *msg = NULL;
+
+    hash = disk_cache_slot_hash(key, keyLen);
+
+    pthread_rwlock_rdlock(&diskCacheLock);
+
+    if (diskCache && (!diskCache->header || __atomic_load_n(&diskCache->header->stale, __ATOMIC_ACQUIRE))){
+        pthread_rwlock_unlock(&diskCacheLock);
+        pthread_rwlock_wrlock(&diskCacheLock);
+        if (diskCache && !disk_cache_refresh(diskCache)){
+            pthread_rwlock_unlock(&diskCacheLock);
+            return NULL;
+        }
+    }
+
+    if (diskCache && diskCache->map){
+        disk_cache_find_slot(diskCache, hash, key, keyLen, &record);
+    }
+
+    pthread_rwlock_unlock(&diskCacheLock);
+
+    if (!record){
+        return NULL;
+    }
+
+    now = (unsigned long long)time(NULL);
+    if (record->expireTime > now){
+        msg = disk_cache_decode_value(record);
+        if (ttlLeft){
+            (*ttlLeft) = (unsigned int)(record->expireTime - now);
+        }
+    }
+    status = (DEEPVIZ_RESULT_STATUS)record->status;
+
+    free(record);
+
+    return msg ? deepviz_result_init(status, msg) : NULL;
+}
+
+
+void dvz_disk_cache_store(const char* key, size_t keyLen, PDEEPVIZ_RESULT result, unsigned int ttl){
+
+    PDISK_CACHE_RECORD  record;
+    PDISK_CACHE_RECORD  oldRecord = NULL;
+    PDISK_CACHE_SLOT    slot;
+    unsigned long long  hash;
+    unsigned long long  loc;
+    size_t              msgLen;
+    size_t              valueLen;
+    size_t              len;
+    struct stat         st;
+
+    msgLen = strlen(result->msg);
+    hash = disk_cache_slot_hash(key, keyLen);
+
+    record = (PDISK_CACHE_RECORD)malloc(sizeof(DISK_CACHE_RECORD) + keyLen + msgLen);
+    if (!record){
+        return;
+    }
+
+    memset(record, 0, sizeof(DISK_CACHE_RECORD));
+    record->magic = DISK_CACHE_RECORD_MAGIC;
+    record->status = (unsigned int)result->status;
+    record->expireTime = (unsigned long long)time(NULL) + ttl;
+    record->keyLen = (unsigned int)keyLen;
+    record->rawLen = (unsigned int)msgLen;
+    memcpy(record + 1, key, keyLen);
+
+    valueLen = msgLen;
+#ifdef DEEPVIZ_HAVE_ZLIB
+    {
+        uLongf  compressedLen = (uLongf)msgLen;
+
+        /* Only keep the compressed value if it is smaller */
+        if (compress2((Bytef*)(record + 1) + keyLen, &compressedLen, (const Bytef*)result->msg, (uLong)msgLen, Z_BEST_SPEED) == Z_OK &&
+            compressedLen < msgLen){
+            valueLen = compressedLen;
+            record->flags |= DISK_CACHE_FLAG_COMPRESSED;
+        }
+    }
+#endif
+    if (!(record->flags & DISK_CACHE_FLAG_COMPRESSED)){
+        memcpy((char*)(record + 1) + keyLen, result->msg, msgLen);
+    }
+    record->valueLen = (unsigned int)valueLen;
+
+    len = sizeof(DISK_CACHE_RECORD) + keyLen + valueLen;
+    if (len > DISK_CACHE_MAX_RECORD_LEN){
+        free(record);
+        return;
+    }
+
+    pthread_rwlock_wrlock(&diskCacheLock);
+
+    if (!diskCache || !disk_cache_refresh(diskCache)){
+        goto cleanup;
+    }
+
+    flock(diskCache->lockFd, LOCK_EX);
+
+    /* Another process may have compacted while we were waiting for the lock */
+    if (__atomic_load_n(&diskCache->header->stale, __ATOMIC_ACQUIRE)){
+        disk_cache_unmap(diskCache);
+        if (!disk_cache_map(diskCache, DEEPVIZ_CACHE_DEFAULT_INDEX_SLOTS)){
+            goto unlock;
+        }
+    }
+
+    disk_cache_auto_compact(diskCache);
+    if (!diskCache->map){
+        goto unlock;
+    }
+
+    slot = disk_cache_find_slot(diskCache, hash, key, keyLen, &oldRecord);
+    if (!slot || fstat(diskCache->logFd, &st) || (unsigned long long)st.st_size > DISK_CACHE_MAX_OFFSET){
+        goto unlock;
+    }
+
+    if (pwrite(diskCache->logFd, record, len, st.st_size) != (ssize_t)len){
+        goto unlock;
+    }
+
+    loc = ((unsigned long long)st.st_size << DISK_CACHE_LEN_BITS) | len;
+
+    /* Publish the location before the hash, readers check the hash first */
+    __atomic_store_n(&slot->loc, loc, __ATOMIC_RELEASE);
+    if (!oldRecord){
+        __atomic_store_n(&slot->hash, hash, __ATOMIC_RELEASE);
+        diskCache->header->used++;
+    }
+    else{
+        diskCache->header->liveBytes -= sizeof(DISK_CACHE_RECORD) + oldRecord->keyLen + oldRecord->valueLen;
+    }
+    diskCache->header->liveBytes += len;
+
+unlock:
+    flock(diskCache->lockFd, LOCK_UN);
+
+cleanup:
+    pthread_rwlock_unlock(&diskCacheLock);
+
+    if (oldRecord) free(oldRecord);
+    free(record);
+}
+
+
+EXPORT deepviz_bool deepviz_cache_persistent_open(const char* directory, size_t index_slots){
+
+    PDISK_CACHE     dc;
+    char            *lockPath;
+    deepviz_bool    ret;
+
+    if (!directory){
+        return deepviz_false;
+    }
+
+    if (index_slots == 0){
+        index_slots = DEEPVIZ_CACHE_DEFAULT_INDEX_SLOTS;
+    }
+
+    if (mkdir(directory, 0755) && errno != EEXIST){
+        return deepviz_false;
+    }
+
+    dc = (PDISK_CACHE)malloc(sizeof(DISK_CACHE));
+    if (!dc){
+        return deepviz_false;
+    }
+
+    memset(dc, 0, sizeof(DISK_CACHE));
+    dc->indexFd = -1;
+    dc->logFd = -1;
+    dc->directory = strdup(directory);
+
+    lockPath = disk_cache_path(directory, DISK_CACHE_LOCK_NAME, "");
+    if (!dc->directory || !lockPath){
+        if (lockPath) free(lockPath);
+        if (dc->directory) free(dc->directory);
+        free(dc);
+        return deepviz_false;
+    }
+
+    dc->lockFd = open(lockPath, O_RDWR | O_CREAT, 0644);
+    free(lockPath);
+    if (dc->lockFd < 0){
+        free(dc->directory);
+        free(dc);
+        return deepviz_false;
+    }
+
+    flock(dc->lockFd, LOCK_EX);
+    ret = disk_cache_map(dc, index_slots);
+    flock(dc->lockFd, LOCK_UN);
+
+    if (!ret){
+        close(dc->lockFd);
+        free(dc->directory);
+        free(dc);
+        return deepviz_false;
+    }
+
+    deepviz_cache_persistent_close();
+
+    pthread_rwlock_wrlock(&diskCacheLock);
+    diskCache = dc;
+    pthread_rwlock_unlock(&diskCacheLock);
+
+    return deepviz_true;
+}
+
+
+EXPORT void deepviz_cache_persistent_close(void){
+
+    PDISK_CACHE     dc;
+
+    pthread_rwlock_wrlock(&diskCacheLock);
+    dc = diskCache;
+    diskCache = NULL;
+    pthread_rwlock_unlock(&diskCacheLock);
+
+    if (!dc){
+        return;
+    }
+
+    disk_cache_unmap(dc);
+    close(dc->lockFd);
+    free(dc->directory);
+    free(dc);
+}
+
+
+EXPORT deepviz_bool deepviz_cache_persistent_compact(void){
+
+    deepviz_bool    ret = deepviz_false;
+
+    pthread_rwlock_wrlock(&diskCacheLock);
+
+    if (diskCache && disk_cache_refresh(diskCache)){
+        flock(diskCache->lockFd, LOCK_EX);
+        if (__atomic_load_n(&diskCache->header->stale, __ATOMIC_ACQUIRE)){
+            disk_cache_unmap(diskCache);
+            disk_cache_map(diskCache, DEEPVIZ_CACHE_DEFAULT_INDEX_SLOTS);
+        }
+        if (diskCache->map){
+            ret = disk_cache_rebuild(diskCache);
+        }
+        flock(diskCache->lockFd, LOCK_UN);
+    }
+
+    pthread_rwlock_unlock(&diskCacheLock);
+
+    return ret;
+}
+
+#else
+
+deepviz_bool dvz_disk_cache_enabled(void){
+
+    return deepviz_false;
+}
+
+
+PDEEPVIZ_RESULT dvz_disk_cache_lookup(const char* key, size_t keyLen, unsigned int* ttlLeft){
+
+    return NULL;
+}
+
+
+void dvz_disk_cache_store(const char* key, size_t keyLen, PDEEPVIZ_RESULT result, unsigned int ttl){
+}
+
+
+EXPORT deepviz_bool deepviz_cache_persistent_open(const char* directory, size_t index_slots){
+
+    /* Not supported */
+    return deepviz_false;
+}
+
+
+EXPORT void deepviz_cache_persistent_close(void){
+}
+
+
+EXPORT deepviz_bool deepviz_cache_persistent_compact(void){
+
+    return deepviz_false;
+}
+
+#endif
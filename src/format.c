@@ -0,0 +1,681 @@
+/*
+* Copyright (c) 2016 Saferbytes s.r.l.s.
+*
+* You can redistribute it and/or modify it under the terms of the MIT license.
+* See LICENSE for details.
+*/
+
+#include "c-deepviz.h"
+#include "c-deepviz_private.h"
+#include <float.h>
+
+/*
+* Result formats.
+* The "data" of a successful response is handed out as JSON text by default. A thread can ask for
+* MessagePack or CBOR instead (deepviz_result_format_set()): parse_deepviz_response() then encodes the
+* parsed tree straight into the binary format, without going through json_dumps(). The setting is per
+* thread and not inherited by the threads of the library, whose results are consumed internally as JSON.
+* The decoders exist for deepviz_result_convert() and for the internal consumers of binary results;
+* they accept everything the encoders produce plus the common encodings of other writers, and refuse
+* what has no JSON counterpart (byte strings, extensions, non-string map keys).
+*/
+
+#ifdef _WIN32
+#define     FORMAT_THREAD_LOCAL         __declspec(thread)
+#else
+#define     FORMAT_THREAD_LOCAL         __thread
+#endif
+
+#define     FORMAT_INITIAL_SIZE         4096
+#define     FORMAT_MAX_DEPTH            512
+
+typedef struct _FORMAT_BUFFER{
+    unsigned char   *data;
+    size_t          len;
+    size_t          size;
+    deepviz_bool    failed;
+}FORMAT_BUFFER, *PFORMAT_BUFFER;
+
+typedef struct _FORMAT_READER{
+    const unsigned char     *data;
+    size_t                  len;
+    size_t                  pos;
+}FORMAT_READER, *PFORMAT_READER;
+
+static FORMAT_THREAD_LOCAL DEEPVIZ_RESULT_FORMAT    currentFormat = DEEPVIZ_FORMAT_JSON;
+
+
+EXPORT DEEPVIZ_RESULT_FORMAT deepviz_result_format_set(DEEPVIZ_RESULT_FORMAT format){
+
+    DEEPVIZ_RESULT_FORMAT   previous = currentFormat;
+
+    if (format == DEEPVIZ_FORMAT_JSON || format == DEEPVIZ_FORMAT_MSGPACK || format == DEEPVIZ_FORMAT_CBOR){
+        currentFormat = format;
+    }
+
+    return previous;
+}
+
+
+DEEPVIZ_RESULT_FORMAT dvz_result_format_current(void){
+
+    return currentFormat;
+}
+
+
+/* ============================ encoders ============================ */
+
+static unsigned char* format_reserve(PFORMAT_BUFFER buffer, size_t len){
+
+    unsigned char   *data;
+    size_t          size;
+
+    if (buffer->failed){
+        return NULL;
+    }
+
+    if (buffer->len + len > buffer->size){
+        size = buffer->size ? buffer->size : FORMAT_INITIAL_SIZE;
+        while (size < buffer->len + len){
+            size *= 2;
+        }
+
+        /* One more byte for the terminator added by format_encode() */
+        data = (unsigned char*)realloc(buffer->data, size + 1);
+        if (!data){
+            buffer->failed = deepviz_true;
+            return NULL;
+        }
+
+        buffer->data = data;
+        buffer->size = size;
+    }
+
+    data = buffer->data + buffer->len;
+    buffer->len += len;
+
+    return data;
+}
+
+
+static void format_put(PFORMAT_BUFFER buffer, const void* data, size_t len){
+
+    unsigned char   *out;
+
+    out = format_reserve(buffer, len);
+    if (out && len){
+        memcpy(out, data, len);
+    }
+}
+
+
+/* Type byte followed by a "len" bytes big endian value */
+static void format_put_be(PFORMAT_BUFFER buffer, unsigned char type, unsigned long long value, size_t len){
+
+    unsigned char   *out;
+    size_t          i;
+
+    out = format_reserve(buffer, len + 1);
+    if (!out){
+        return;
+    }
+
+    out[0] = type;
+    for (i = len; i > 0; i--){
+        out[i] = (unsigned char)value;
+        value >>= 8;
+    }
+}
+
+
+static unsigned long long format_double_bits(double value){
+
+    unsigned long long  bits;
+
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+
+/* Single precision when it loses nothing */
+static deepviz_bool format_fits_float(double value){
+
+    return value >= -FLT_MAX && value <= FLT_MAX && (double)(float)value == value;
+}
+
+
+static unsigned long long format_float_bits(float value){
+
+    unsigned int    bits;
+
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+
+/* MessagePack integers and headers in their shortest form */
+static void msgpack_put_uint(PFORMAT_BUFFER buffer, unsigned long long value){
+
+    if (value < 0x80)               format_put_be(buffer, (unsigned char)value, 0, 0);
+    else if (value <= 0xFF)         format_put_be(buffer, 0xCC, value, 1);
+    else if (value <= 0xFFFF)       format_put_be(buffer, 0xCD, value, 2);
+    else if (value <= 0xFFFFFFFF)   format_put_be(buffer, 0xCE, value, 4);
+    else                            format_put_be(buffer, 0xCF, value, 8);
+}
+
+
+static void msgpack_put_int(PFORMAT_BUFFER buffer, json_int_t value){
+
+    if (value >= 0)                 msgpack_put_uint(buffer, (unsigned long long)value);
+    else if (value >= -32)          format_put_be(buffer, (unsigned char)value, 0, 0);
+    else if (value >= -128)         format_put_be(buffer, 0xD0, (unsigned long long)value, 1);
+    else if (value >= -32768)       format_put_be(buffer, 0xD1, (unsigned long long)value, 2);
+    else if (value >= -2147483647 - 1) format_put_be(buffer, 0xD2, (unsigned long long)value, 4);
+    else                            format_put_be(buffer, 0xD3, (unsigned long long)value, 8);
+}
+
+
+static void msgpack_put_header(PFORMAT_BUFFER buffer, unsigned char fix, size_t fixMax,
+                                unsigned char type8, unsigned char type16, unsigned char type32, size_t len){
+
+    if (len <= fixMax)              format_put_be(buffer, (unsigned char)(fix | len), 0, 0);
+    else if (type8 && len <= 0xFF)  format_put_be(buffer, type8, len, 1);
+    else if (len <= 0xFFFF)         format_put_be(buffer, type16, len, 2);
+    else                            format_put_be(buffer, type32, len, 4);
+}
+
+
+static void msgpack_put_string(PFORMAT_BUFFER buffer, const char* value, size_t len){
+
+    msgpack_put_header(buffer, 0xA0, 31, 0xD9, 0xDA, 0xDB, len);
+    format_put(buffer, value, len);
+}
+
+
+static void msgpack_encode(PFORMAT_BUFFER buffer, json_t* json){
+
+    const char  *key;
+    json_t      *value;
+    size_t      i;
+    double      real;
+
+    switch (json_typeof(json)){
+    case JSON_OBJECT:
+        msgpack_put_header(buffer, 0x80, 15, 0, 0xDE, 0xDF, json_object_size(json));
+        json_object_foreach(json, key, value){
+            msgpack_put_string(buffer, key, strlen(key));
+            msgpack_encode(buffer, value);
+        }
+        break;
+    case JSON_ARRAY:
+        msgpack_put_header(buffer, 0x90, 15, 0, 0xDC, 0xDD, json_array_size(json));
+        json_array_foreach(json, i, value){
+            msgpack_encode(buffer, value);
+        }
+        break;
+    case JSON_STRING:
+        msgpack_put_string(buffer, json_string_value(json), json_string_length(json));
+        break;
+    case JSON_INTEGER:
+        msgpack_put_int(buffer, json_integer_value(json));
+        break;
+    case JSON_REAL:
+        real = json_real_value(json);
+        if (format_fits_float(real)){
+            format_put_be(buffer, 0xCA, format_float_bits((float)real), 4);
+        }
+        else{
+            format_put_be(buffer, 0xCB, format_double_bits(real), 8);
+        }
+        break;
+    case JSON_TRUE:
+        format_put_be(buffer, 0xC3, 0, 0);
+        break;
+    case JSON_FALSE:
+        format_put_be(buffer, 0xC2, 0, 0);
+        break;
+    default:
+        format_put_be(buffer, 0xC0, 0, 0);
+        break;
+    }
+}
+
+
+/* CBOR major type with its argument in the shortest form */
+static void cbor_put_head(PFORMAT_BUFFER buffer, unsigned char major, unsigned long long value){
+
+    major <<= 5;
+
+    if (value < 24)                 format_put_be(buffer, (unsigned char)(major | value), 0, 0);
+    else if (value <= 0xFF)         format_put_be(buffer, major | 24, value, 1);
+    else if (value <= 0xFFFF)       format_put_be(buffer, major | 25, value, 2);
+    else if (value <= 0xFFFFFFFF)   format_put_be(buffer, major | 26, value, 4);
+    else                            format_put_be(buffer, major | 27, value, 8);
+}
+
+
+static void cbor_encode(PFORMAT_BUFFER buffer, json_t* json){
+
+    const char  *key;
+    json_t      *value;
+    json_int_t  integer;
+    size_t      i;
+    double      real;
+
+    switch (json_typeof(json)){
+    case JSON_OBJECT:
+        cbor_put_head(buffer, 5, json_object_size(json));
+        json_object_foreach(json, key, value){
+            i = strlen(key);
+            cbor_put_head(buffer, 3, i);
+            format_put(buffer, key, i);
+            cbor_encode(buffer, value);
+        }
+        break;
+    case JSON_ARRAY:
+        cbor_put_head(buffer, 4, json_array_size(json));
+        json_array_foreach(json, i, value){
+            cbor_encode(buffer, value);
+        }
+        break;
+    case JSON_STRING:
+        cbor_put_head(buffer, 3, json_string_length(json));
+        format_put(buffer, json_string_value(json), json_string_length(json));
+        break;
+    case JSON_INTEGER:
+        /* Negative integers are stored as -1 - n */
+        integer = json_integer_value(json);
+        if (integer >= 0){
+            cbor_put_head(buffer, 0, (unsigned long long)integer);
+        }
+        else{
+            cbor_put_head(buffer, 1, (unsigned long long)(-1 - integer));
+        }
+        break;
+    case JSON_REAL:
+        real = json_real_value(json);
+        if (format_fits_float(real)){
+            format_put_be(buffer, 0xFA, format_float_bits((float)real), 4);
+        }
+        else{
+            format_put_be(buffer, 0xFB, format_double_bits(real), 8);
+        }
+        break;
+    case JSON_TRUE:
+        format_put_be(buffer, 0xF5, 0, 0);
+        break;
+    case JSON_FALSE:
+        format_put_be(buffer, 0xF4, 0, 0);
+        break;
+    default:
+        format_put_be(buffer, 0xF6, 0, 0);
+        break;
+    }
+}
+
+
+/* Encoded "json", NUL-terminated so that it is still safe to print. "jsonFlags" are the json_dumps() flags of the
+JSON format: without JSON_ENCODE_ANY only objects and arrays are encoded */
+static char* format_encode(json_t* json, DEEPVIZ_RESULT_FORMAT format, size_t jsonFlags, size_t* len){
+
+    FORMAT_BUFFER   buffer;
+
+    if (format == DEEPVIZ_FORMAT_JSON){
+        buffer.data = (unsigned char*)json_dumps(json, jsonFlags);
+        (*len) = buffer.data ? strlen((char*)buffer.data) : 0;
+        return (char*)buffer.data;
+    }
+
+    memset(&buffer, 0, sizeof(buffer));
+
+    if (format == DEEPVIZ_FORMAT_MSGPACK){
+        msgpack_encode(&buffer, json);
+    }
+    else{
+        cbor_encode(&buffer, json);
+    }
+
+    if (buffer.failed){
+        if (buffer.data) free(buffer.data);
+        (*len) = 0;
+        return NULL;
+    }
+
+    buffer.data[buffer.len] = 0;
+    (*len) = buffer.len;
+
+    return (char*)buffer.data;
+}
+
+
+/* ============================ decoders ============================ */
+
+static deepviz_bool format_get_be(PFORMAT_READER reader, size_t len, unsigned long long* value){
+
+    size_t  i;
+
+    if (reader->len - reader->pos < len){
+        return deepviz_false;
+    }
+
+    (*value) = 0;
+    for (i = 0; i < len; i++){
+        (*value) = ((*value) << 8) | reader->data[reader->pos++];
+    }
+
+    return deepviz_true;
+}
+
+
+static double format_double(unsigned long long bits){
+
+    double  value;
+
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+
+static double format_float(unsigned long long bits){
+
+    unsigned int    bits32 = (unsigned int)bits;
+    float           value;
+
+    memcpy(&value, &bits32, sizeof(value));
+    return value;
+}
+
+
+/* IEEE 754 half precision, written by some CBOR encoders */
+static double format_half(unsigned long long bits){
+
+    int     exponent = (int)((bits >> 10) & 0x1F);
+    double  mantissa = (double)(bits & 0x3FF);
+    double  value;
+
+    if (exponent == 0){
+        value = mantissa / 16777216.0;                          /* 2^-24 */
+    }
+    else if (exponent == 31){
+        value = format_double(mantissa ? 0x7FF8000000000000ULL : 0x7FF0000000000000ULL);
+    }
+    else{
+        value = (1024.0 + mantissa) / 1024.0;
+        for (; exponent > 15; exponent--) value *= 2.0;
+        for (; exponent < 15; exponent++) value /= 2.0;
+    }
+
+    return (bits & 0x8000) ? -value : value;
+}
+
+
+static json_t* format_get_string(PFORMAT_READER reader, unsigned long long len){
+
+    json_t  *json;
+
+    if (reader->len - reader->pos < len){
+        return NULL;
+    }
+
+    json = json_stringn((const char*)reader->data + reader->pos, (size_t)len);
+    reader->pos += (size_t)len;
+
+    return json;
+}
+
+
+static json_t* format_get_integer(unsigned long long value, deepviz_bool negative){
+
+    /* json_int_t is signed 64 bit: larger values are kept as reals */
+    if (value > 0x7FFFFFFFFFFFFFFFULL){
+        return json_real(negative ? -1.0 - (double)value : (double)value);
+    }
+
+    return json_integer(negative ? -1 - (json_int_t)value : (json_int_t)value);
+}
+
+
+static json_t* msgpack_decode(PFORMAT_READER reader, int depth);
+static json_t* cbor_decode(PFORMAT_READER reader, int depth);
+
+
+/* Array or map of "count" entries, shared by both decoders */
+static json_t* format_get_container(PFORMAT_READER reader, deepviz_bool map, unsigned long long count, int depth,
+                                    json_t* (*decode)(PFORMAT_READER, int)){
+
+    json_t  *json;
+    json_t  *key;
+    json_t  *value;
+
+    /* Every entry takes at least one byte */
+    if (count > reader->len - reader->pos || depth >= FORMAT_MAX_DEPTH){
+        return NULL;
+    }
+
+    json = map ? json_object() : json_array();
+    if (!json){
+        return NULL;
+    }
+
+    for (; count > 0; count--){
+
+        key = NULL;
+        if (map){
+            key = decode(reader, depth + 1);
+            if (!key || !json_is_string(key)){
+                if (key) json_decref(key);
+                break;
+            }
+        }
+
+        value = decode(reader, depth + 1);
+        if (!value){
+            if (key) json_decref(key);
+            break;
+        }
+
+        if (map){
+            json_object_set_new(json, json_string_value(key), value);
+            json_decref(key);
+        }
+        else{
+            json_array_append_new(json, value);
+        }
+    }
+
+    if (count > 0){
+        json_decref(json);
+        return NULL;
+    }
+
+    return json;
+}
+
+
+static json_t* msgpack_decode(PFORMAT_READER reader, int depth){
+
+    unsigned long long  value;
+    unsigned char       type;
+
+    if (reader->pos >= reader->len){
+        return NULL;
+    }
+
+    type = reader->data[reader->pos++];
+
+    if (type < 0x80) return json_integer(type);
+    if (type >= 0xE0) return json_integer((json_int_t)(signed char)type);
+    if ((type & 0xF0) == 0x80) return format_get_container(reader, deepviz_true, type & 0x0F, depth, msgpack_decode);
+    if ((type & 0xF0) == 0x90) return format_get_container(reader, deepviz_false, type & 0x0F, depth, msgpack_decode);
+    if ((type & 0xE0) == 0xA0) return format_get_string(reader, type & 0x1F);
+
+    switch (type){
+    case 0xC0: return json_null();
+    case 0xC2: return json_false();
+    case 0xC3: return json_true();
+    case 0xCA: return format_get_be(reader, 4, &value) ? json_real(format_float(value)) : NULL;
+    case 0xCB: return format_get_be(reader, 8, &value) ? json_real(format_double(value)) : NULL;
+    case 0xCC: return format_get_be(reader, 1, &value) ? format_get_integer(value, deepviz_false) : NULL;
+    case 0xCD: return format_get_be(reader, 2, &value) ? format_get_integer(value, deepviz_false) : NULL;
+    case 0xCE: return format_get_be(reader, 4, &value) ? format_get_integer(value, deepviz_false) : NULL;
+    case 0xCF: return format_get_be(reader, 8, &value) ? format_get_integer(value, deepviz_false) : NULL;
+    case 0xD0: return format_get_be(reader, 1, &value) ? json_integer((json_int_t)(signed char)value) : NULL;
+    case 0xD1: return format_get_be(reader, 2, &value) ? json_integer((json_int_t)(short)value) : NULL;
+    case 0xD2: return format_get_be(reader, 4, &value) ? json_integer((json_int_t)(int)value) : NULL;
+    case 0xD3: return format_get_be(reader, 8, &value) ? json_integer((json_int_t)value) : NULL;
+    case 0xD9: return format_get_be(reader, 1, &value) ? format_get_string(reader, value) : NULL;
+    case 0xDA: return format_get_be(reader, 2, &value) ? format_get_string(reader, value) : NULL;
+    case 0xDB: return format_get_be(reader, 4, &value) ? format_get_string(reader, value) : NULL;
+    case 0xDC: return format_get_be(reader, 2, &value) ? format_get_container(reader, deepviz_false, value, depth, msgpack_decode) : NULL;
+    case 0xDD: return format_get_be(reader, 4, &value) ? format_get_container(reader, deepviz_false, value, depth, msgpack_decode) : NULL;
+    case 0xDE: return format_get_be(reader, 2, &value) ? format_get_container(reader, deepviz_true, value, depth, msgpack_decode) : NULL;
+    case 0xDF: return format_get_be(reader, 4, &value) ? format_get_container(reader, deepviz_true, value, depth, msgpack_decode) : NULL;
+    default:
+        /* Byte strings and extensions */
+        return NULL;
+    }
+}
+
+
+static json_t* cbor_decode(PFORMAT_READER reader, int depth){
+
+    unsigned long long  value;
+    unsigned char       type;
+    unsigned char       info;
+
+    if (reader->pos >= reader->len){
+        return NULL;
+    }
+
+    type = reader->data[reader->pos] >> 5;
+    info = reader->data[reader->pos] & 0x1F;
+    reader->pos++;
+
+    if (type == 7){
+        switch (info){
+        case 20: return json_false();
+        case 21: return json_true();
+        case 22: return json_null();
+        case 25: return format_get_be(reader, 2, &value) ? json_real(format_half(value)) : NULL;
+        case 26: return format_get_be(reader, 4, &value) ? json_real(format_float(value)) : NULL;
+        case 27: return format_get_be(reader, 8, &value) ? json_real(format_double(value)) : NULL;
+        default: return NULL;
+        }
+    }
+
+    /* Argument; indefinite lengths (31) are not supported */
+    if (info < 24){
+        value = info;
+    }
+    else if (info > 27 || !format_get_be(reader, (size_t)1 << (info - 24), &value)){
+        return NULL;
+    }
+
+    switch (type){
+    case 0: return format_get_integer(value, deepviz_false);
+    case 1: return format_get_integer(value, deepviz_true);
+    case 3: return format_get_string(reader, value);
+    case 4: return format_get_container(reader, deepviz_false, value, depth, cbor_decode);
+    case 5: return format_get_container(reader, deepviz_true, value, depth, cbor_decode);
+    case 6:
+        /* Tags only qualify the item that follows */
+        return depth < FORMAT_MAX_DEPTH ? cbor_decode(reader, depth + 1) : NULL;
+    default:
+        /* Byte strings */
+        return NULL;
+    }
+}
+
+
+/* ============================ results ============================ */
+
+PDEEPVIZ_RESULT dvz_result_from_json(json_t* json, size_t jsonFlags){
+
+    PDEEPVIZ_RESULT         result;
+    DEEPVIZ_RESULT_FORMAT   format = currentFormat;
+    char                    *msg;
+    size_t                  msgLen;
+
+    msg = format_encode(json, format, jsonFlags, &msgLen);
+
+    result = deepviz_result_init(DEEPVIZ_STATUS_SUCCESS, msg);
+    if (!result){
+        if (msg) free(msg);
+        return NULL;
+    }
+
+    result->msgLen = msgLen;
+    result->format = format;
+
+    return result;
+}
+
+
+json_t* dvz_result_to_json(PDEEPVIZ_RESULT result){
+
+    FORMAT_READER   reader;
+    json_t          *json;
+
+    if (!result || result->status != DEEPVIZ_STATUS_SUCCESS || !result->msg){
+        return NULL;
+    }
+
+    if (result->format == DEEPVIZ_FORMAT_JSON){
+        return json_loads(result->msg, JSON_DECODE_ANY, NULL);
+    }
+
+    reader.data = (const unsigned char*)result->msg;
+    reader.len = result->msgLen;
+    reader.pos = 0;
+
+    if (result->format == DEEPVIZ_FORMAT_MSGPACK){
+        json = msgpack_decode(&reader, 0);
+    }
+    else{
+        json = cbor_decode(&reader, 0);
+    }
+
+    /* Trailing bytes: not a single value */
+    if (json && reader.pos != reader.len){
+        json_decref(json);
+        json = NULL;
+    }
+
+    return json;
+}
+
+
+EXPORT deepviz_bool deepviz_result_convert(PDEEPVIZ_RESULT result, DEEPVIZ_RESULT_FORMAT format){
+
+    json_t  *json;
+    char    *msg;
+    size_t  msgLen;
+
+    if (!result || (format != DEEPVIZ_FORMAT_JSON && format != DEEPVIZ_FORMAT_MSGPACK && format != DEEPVIZ_FORMAT_CBOR)){
+        return deepviz_false;
+    }
+
+    /* Error messages are always text */
+    if (result->status != DEEPVIZ_STATUS_SUCCESS || !result->msg || result->format == format){
+        return deepviz_true;
+    }
+
+    json = dvz_result_to_json(result);
+    if (!json){
+        return deepviz_false;
+    }
+
+    msg = format_encode(json, format, JSON_ENCODE_ANY, &msgLen);
+    json_decref(json);
+
+    if (!msg){
+        return deepviz_false;
+    }
+
+    free(result->msg);
+    result->msg = msg;
+    result->msgLen = msgLen;
+    result->format = format;
+
+    return deepviz_true;
+}
@@ -8,9 +8,51 @@
 #include "c-deepviz.h"
 #include "c-deepviz_private.h"
 
+static PDEEPVIZ_RESULT sample_result_fetch(const char* api_key, const char* md5, PDEEPVIZ_LIST filters);
+static PDEEPVIZ_RESULT sample_info_fetch(const char* api_key, const char* md5, PDEEPVIZ_LIST filters);
+static PDEEPVIZ_RESULT ip_info_fetch(const char* api_key, const char* ip, PDEEPVIZ_LIST filters);
+static PDEEPVIZ_RESULT domain_info_fetch(const char* api_key, const char* domain, PDEEPVIZ_LIST filters);
+
+
 EXPORT PDEEPVIZ_RESULT deepviz_sample_result(	const char* md5,
                                                 const char* api_key){
 
+    return dvz_cache_call(DEEPVIZ_CACHE_SAMPLE_RESULT, api_key, md5, NULL, sample_result_fetch);
+
+}
+
+
+EXPORT PDEEPVIZ_RESULT deepviz_sample_info(	const char* md5,
+                                            const char* api_key, 
+                                            PDEEPVIZ_LIST filters){
+
+    return dvz_cache_call(DEEPVIZ_CACHE_SAMPLE_INFO, api_key, md5, filters, sample_info_fetch);
+
+}
+
+
+EXPORT PDEEPVIZ_RESULT deepviz_ip_info( const char* api_key,
+										const char* ip, 
+                                        PDEEPVIZ_LIST filters){
+
+    return dvz_cache_call(DEEPVIZ_CACHE_IP_INFO, api_key, ip, filters, ip_info_fetch);
+
+}
+
+
+EXPORT PDEEPVIZ_RESULT deepviz_domain_info( const char* api_key,
+                                            const char* domain, 
+                                            PDEEPVIZ_LIST filters){
+
+    return dvz_cache_call(DEEPVIZ_CACHE_DOMAIN_INFO, api_key, domain, filters, domain_info_fetch);
+
+}
+
+
+static PDEEPVIZ_RESULT sample_result_fetch(	const char* api_key,
+                                            const char* md5,
+                                            PDEEPVIZ_LIST filters){
+
     PDEEPVIZ_RESULT		result = NULL;
     char				*retMsg = NULL;
     PDEEPVIZ_LIST		list = NULL;
@@ -44,7 +86,7 @@ EXPORT PDEEPVIZ_RESULT deepviz_sample_result(	const char* md5,
     deepviz_list_add(list, "classification");
 
     /* Send API request */
-    result = deepviz_sample_info(md5, api_key, list);
+    result = sample_info_fetch(api_key, md5, list);
 
     deepviz_list_free(&list);
 
@@ -53,7 +95,177 @@ EXPORT PDEEPVIZ_RESULT deepviz_sample_result(	const char* md5,
 }
 
 
-EXPORT PDEEPVIZ_RESULT deepviz_sample_info(	const char* md5,
+typedef struct _DEEPVIZ_FILTER_SPLIT{
+    const char*         md5;
+    const char*         api_key;
+    PDEEPVIZ_LIST       *groups;
+    PDEEPVIZ_RESULT     *results;
+}DEEPVIZ_FILTER_SPLIT, *PDEEPVIZ_FILTER_SPLIT;
+
+
+static PDEEPVIZ_RESULT sample_info_request(const char* md5, const char* api_key, PDEEPVIZ_LIST filters);
+
+
+static void sample_info_group(void* context, size_t taskIndex){
+
+    PDEEPVIZ_FILTER_SPLIT   split = (PDEEPVIZ_FILTER_SPLIT)context;
+
+    split->results[taskIndex] = sample_info_request(split->md5, split->api_key, split->groups[taskIndex]);
+}
+
+
+/* Split the filters in groups of DEEPVIZ_MAX_FILTERS, send the requests concurrently and merge the "data" objects */
+static PDEEPVIZ_RESULT sample_info_split(const char* md5, const char* api_key, PDEEPVIZ_LIST filters, size_t filterNumber){
+
+    DEEPVIZ_FILTER_SPLIT    split;
+    PDEEPVIZ_RESULT         result = NULL;
+    json_t                  *jsonMerged = NULL;
+    json_t                  *jsonData = NULL;
+    char                    *retMsg = NULL;
+    size_t                  groupNumber;
+    size_t                  currGroup = 0;
+    size_t                  i;
+
+    retMsg = (char*)malloc(DEEPVIZ_ERROR_MAX_LEN);
+    if (!retMsg){
+        return deepviz_result_init(DEEPVIZ_STATUS_INTERNAL_ERROR, NULL);
+    }
+
+    groupNumber = (filterNumber + DEEPVIZ_MAX_FILTERS - 1) / DEEPVIZ_MAX_FILTERS;
+
+    split.md5 = md5;
+    split.api_key = api_key;
+    split.groups = (PDEEPVIZ_LIST*)calloc(groupNumber, sizeof(PDEEPVIZ_LIST));
+    split.results = (PDEEPVIZ_RESULT*)calloc(groupNumber, sizeof(PDEEPVIZ_RESULT));
+    if (!split.groups || !split.results){
+        if (split.groups) free(split.groups);
+        if (split.results) free(split.results);
+        deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Memory allocation error");
+        return deepviz_result_init(DEEPVIZ_STATUS_INTERNAL_ERROR, retMsg);
+    }
+
+    /* Build filter groups */
+    for (i = 0; i < groupNumber; i++){
+        split.groups[i] = deepviz_list_init(DEEPVIZ_MAX_FILTERS);
+        if (!split.groups[i]){
+            break;
+        }
+    }
+
+    if (i == groupNumber){
+
+        for (i = 0; i < filters->maxEntryNumber; i++){
+            if (filters->entry[i][0]){
+                if (!deepviz_list_add(split.groups[currGroup], filters->entry[i])){
+                    /* Group full */
+                    currGroup++;
+                    deepviz_list_add(split.groups[currGroup], filters->entry[i]);
+                }
+            }
+        }
+
+        /* One request per group, at most DEEPVIZ_DEFAULT_THREADS in flight at once */
+        dvz_parallel_run(groupNumber, DEEPVIZ_DEFAULT_THREADS, sample_info_group, &split);
+
+        /* Merge "data" objects */
+        jsonMerged = json_object();
+        for (i = 0; i < groupNumber; i++){
+
+            if (!split.results[i]){
+                deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Memory allocation error");
+                result = deepviz_result_init(DEEPVIZ_STATUS_INTERNAL_ERROR, retMsg);
+                break;
+            }
+
+            if (split.results[i]->status != DEEPVIZ_STATUS_SUCCESS){
+                /* Report the first failed request */
+                free(retMsg);
+                result = split.results[i];
+                split.results[i] = NULL;
+                break;
+            }
+
+            jsonData = dvz_result_to_json(split.results[i]);
+            if (!jsonData || !json_is_object(jsonData)){
+                if (jsonData) json_decref(jsonData);
+                deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Error parsing HTTP response");
+                result = deepviz_result_init(DEEPVIZ_STATUS_INTERNAL_ERROR, retMsg);
+                break;
+            }
+
+            json_object_update(jsonMerged, jsonData);
+            json_decref(jsonData);
+        }
+
+        if (!result){
+            free(retMsg);
+            result = dvz_result_from_json(jsonMerged, 0);
+        }
+
+        json_decref(jsonMerged);
+    }
+    else{
+        deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Memory allocation error");
+        result = deepviz_result_init(DEEPVIZ_STATUS_INTERNAL_ERROR, retMsg);
+    }
+
+    for (i = 0; i < groupNumber; i++){
+        if (split.groups[i]) deepviz_list_free(&split.groups[i]);
+        if (split.results[i]) deepviz_result_free(&split.results[i]);
+    }
+
+    free(split.groups);
+    free(split.results);
+
+    return result;
+
+}
+
+
+static PDEEPVIZ_RESULT sample_info_fetch(	const char* api_key,
+                                            const char* md5,
+                                            PDEEPVIZ_LIST filters){
+
+    char            *retMsg = NULL;
+    size_t          filterNumber = 0;
+    size_t          i;
+
+    retMsg = (char*)malloc(DEEPVIZ_ERROR_MAX_LEN);
+    if (!retMsg){
+        return deepviz_result_init(DEEPVIZ_STATUS_INTERNAL_ERROR, NULL);
+    }
+
+#if !defined(_WIN32) && !defined(__linux__)
+    /* TODO */
+    sprintf(retMsg, "Platform not supported");
+    return deepviz_result_init(DEEPVIZ_STATUS_INTERNAL_ERROR, retMsg);
+#endif
+
+	if (!md5 || !api_key || !filters){
+        deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Invalid or missing parameters. Please try again!");
+        return deepviz_result_init(DEEPVIZ_STATUS_INPUT_ERROR, retMsg);
+    }
+
+    for (i = 0; i < filters->maxEntryNumber; i++){
+        if (filters->entry[i][0]){
+            filterNumber++;
+        }
+    }
+
+    if (filterNumber > DEEPVIZ_MAX_FILTERS){
+        /* Too many filters for a single request */
+        free(retMsg);
+        return sample_info_split(md5, api_key, filters, filterNumber);
+    }
+
+    free(retMsg);
+
+    return sample_info_request(md5, api_key, filters);
+
+}
+
+
+static PDEEPVIZ_RESULT sample_info_request(	const char* md5,
                                             const char* api_key, 
                                             PDEEPVIZ_LIST filters){
     PDEEPVIZ_RESULT	result = NULL;
@@ -75,17 +287,6 @@ EXPORT PDEEPVIZ_RESULT deepviz_sample_info(	const char* md5,
         return deepviz_result_init(DEEPVIZ_STATUS_INTERNAL_ERROR, NULL);
     }
 
-#if !defined(_WIN32) && !defined(__linux__)
-    /* TODO */
-    sprintf(retMsg, "Platform not supported");
-    return deepviz_result_init(DEEPVIZ_STATUS_INTERNAL_ERROR, retMsg);
-#endif
-
-	if (!md5 || !api_key || !filters){
-        deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Invalid or missing parameters. Please try again!");
-        return deepviz_result_init(DEEPVIZ_STATUS_INPUT_ERROR, retMsg);
-    }
-
     /* Build SAMPLE REPORT json request */
 
     /* Build filter JSON array (if any) */
@@ -101,10 +302,6 @@ EXPORT PDEEPVIZ_RESULT deepviz_sample_info(	const char* md5,
 		deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "You must provide one or more output filters in a list. Please try again!");
 		return deepviz_result_init(DEEPVIZ_STATUS_INPUT_ERROR, retMsg);
 	}
-	if (json_array_size(jsonFilters) > DEEPVIZ_MAX_FILTERS){
-		deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Parameter 'filters' takes at most %d value(s) (%d given).", DEEPVIZ_MAX_FILTERS, json_array_size(jsonFilters));
-		return deepviz_result_init(DEEPVIZ_STATUS_INPUT_ERROR, retMsg);
-	}
 
     jsonObj = json_pack("{ssssso}",
                         "api_key", api_key,
@@ -159,7 +356,7 @@ EXPORT PDEEPVIZ_RESULT deepviz_sample_info(	const char* md5,
     if (bRet == deepviz_false){
         /* Network Error */
         if (responseOut) free(responseOut);
-        return deepviz_result_init(DEEPVIZ_STATUS_NETWORK_ERROR, retMsg);
+        return deepviz_result_init(dvz_transfer_error_status(), retMsg);
     }
 
     free(retMsg);
@@ -174,7 +371,7 @@ EXPORT PDEEPVIZ_RESULT deepviz_sample_info(	const char* md5,
 }
 
 
-EXPORT PDEEPVIZ_RESULT deepviz_ip_info( const char* api_key,
+static PDEEPVIZ_RESULT ip_info_fetch(   const char* api_key,
 										const char* ip, 
                                         PDEEPVIZ_LIST filters){
     PDEEPVIZ_RESULT     result;
@@ -229,6 +426,9 @@ EXPORT PDEEPVIZ_RESULT deepviz_ip_info( const char* api_key,
 		/* Filters provided, add to request */
 		json_object_set_new(jsonObj, "output_filters", jsonFilters);
 	}
+	else{
+		json_decref(jsonFilters);
+	}
 
     /* Dump JSON string */
     jsonRequestString = json_dumps(jsonObj, 0);
@@ -278,7 +478,7 @@ EXPORT PDEEPVIZ_RESULT deepviz_ip_info( const char* api_key,
     if (bRet == deepviz_false){
         /* Network Error */
         if (responseOut) free(responseOut);
-        return deepviz_result_init(DEEPVIZ_STATUS_NETWORK_ERROR, retMsg);
+        return deepviz_result_init(dvz_transfer_error_status(), retMsg);
     }
 
     free(retMsg);
@@ -294,7 +494,7 @@ EXPORT PDEEPVIZ_RESULT deepviz_ip_info( const char* api_key,
 }
 
 
-EXPORT PDEEPVIZ_RESULT deepviz_domain_info( const char* api_key,
+static PDEEPVIZ_RESULT domain_info_fetch(   const char* api_key,
                                             const char* domain, 
                                             PDEEPVIZ_LIST filters){
 
@@ -352,6 +552,9 @@ EXPORT PDEEPVIZ_RESULT deepviz_domain_info( const char* api_key,
         /* Filters provided, add to request */
         json_object_set_new(jsonObj, "output_filters", jsonFilters);
     }
+    else{
+        json_decref(jsonFilters);
+    }
 
     /* Dump JSON string */
     jsonRequestString = json_dumps(jsonObj, 0);
@@ -401,7 +604,7 @@ EXPORT PDEEPVIZ_RESULT deepviz_domain_info( const char* api_key,
     if (bRet == deepviz_false){
         /* Network Error */
         if (responseOut) free(responseOut);
-        return deepviz_result_init(DEEPVIZ_STATUS_NETWORK_ERROR, retMsg);
+        return deepviz_result_init(dvz_transfer_error_status(), retMsg);
     }
 
     free(retMsg);
@@ -417,21 +620,43 @@ EXPORT PDEEPVIZ_RESULT deepviz_domain_info( const char* api_key,
 }
 
 
-EXPORT PDEEPVIZ_RESULT deepviz_search(const char* api_key,
-                                        const char* search_string, 
-                                        int start_offset, 
-                                        int elements){
+/* Serialize a search query without its closing brace: dvz_search_page() completes it for every page */
+char* dvz_search_compile(json_t* query){
+
+    char    *request;
+    char    *end;
+
+    request = json_dumps(query, 0);
+    if (!request){
+        return NULL;
+    }
+
+    end = strrchr(request, '}');
+    if (!end){
+        free(request);
+        return NULL;
+    }
+    (*end) = 0;
+
+    return request;
+}
+
+
+/* Send one page of a compiled search query, with an optional "time_delta". "request" is left unchanged, so that it can be
+run by several threads at once */
+PDEEPVIZ_RESULT dvz_search_page(const char* httpPage, const char* request, const char* time_delta, int start_offset, int elements){
 
-    PDEEPVIZ_RESULT	result = NULL;
     void*			responseOut = NULL;
     size_t			responseOutLen = 0;
-    json_t			*jsonObj = NULL;
-    json_t			*jsonSet = NULL;
     char			*jsonRequestString = NULL;
+    char			*jsonTimeDelta = NULL;
+    json_t			*jsonValue = NULL;
+    size_t			requestLen;
+    size_t			bufferLen;
     char			*retMsg = NULL;
     deepviz_bool	bRet = deepviz_false;
+    PDEEPVIZ_RESULT	result = NULL;
     char			statusCode[DEEPVIZ_STATUS_CODE_MAX_LEN] = { 0 };
-    char			tmpStr[100] = {0};
 #ifdef _WIN32
     char			HTTPheader[DEEPVIZ_HTTP_HEADER_MAX_LEN] = { 0 };
 #endif
@@ -441,34 +666,32 @@ EXPORT PDEEPVIZ_RESULT deepviz_search(const char* api_key,
         return deepviz_result_init(DEEPVIZ_STATUS_INTERNAL_ERROR, NULL);
     }
 
-#if !defined(_WIN32) && !defined(__linux__)
-    /* TODO */
-    sprintf(retMsg, "Platform not supported");
-    return deepviz_result_init(DEEPVIZ_STATUS_INTERNAL_ERROR, retMsg);
-#endif
-
-    if (!api_key || !search_string){
-        deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Invalid or missing parameters. Please try again!");
-        return deepviz_result_init(DEEPVIZ_STATUS_INPUT_ERROR, retMsg);
+    if (time_delta){
+        jsonValue = json_string(time_delta);
+        if (jsonValue){
+            jsonTimeDelta = json_dumps(jsonValue, JSON_ENCODE_ANY);
+            json_decref(jsonValue);
+        }
     }
 
-    /* Build SEARCH json request */
-
-    jsonSet = json_array();
-    deepviz_sprintf(tmpStr, 100, "start=%d", start_offset);
-    json_array_append_new(jsonSet, json_string(tmpStr));
-    deepviz_sprintf(tmpStr, 100, "rows=%d", elements);
-    json_array_append_new(jsonSet, json_string(tmpStr));
-
-    jsonObj = json_pack("{ssssso}",
-                        "api_key", api_key,
-                        "string", search_string,
-                        "result_set", jsonSet);
+    /* Splice "time_delta" and the result set into the request */
+    requestLen = request ? strlen(request) : 0;
+    bufferLen = requestLen + (jsonTimeDelta ? strlen(jsonTimeDelta) : 0) + 100;
+    if (request && (!time_delta || jsonTimeDelta)){
+        jsonRequestString = (char*)malloc(bufferLen);
+    }
 
-    /* Dump JSON string */
-    jsonRequestString = json_dumps(jsonObj, 0);
+    if (jsonRequestString){
+        memcpy(jsonRequestString, request, requestLen);
+        if (jsonTimeDelta){
+            requestLen += deepviz_sprintf(jsonRequestString + requestLen, bufferLen - requestLen, "%s\"time_delta\": %s",
+                requestLen > 1 ? ", " : "", jsonTimeDelta);
+        }
+        deepviz_sprintf(jsonRequestString + requestLen, bufferLen - requestLen, "%s\"result_set\": [\"start=%d\", \"rows=%d\"]}",
+            requestLen > 1 ? ", " : "", start_offset, elements);
+    }
 
-    json_decref(jsonObj);
+    if (jsonTimeDelta) free(jsonTimeDelta);
 
     if (!jsonRequestString){
         deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Error creating HTTP request");
@@ -482,7 +705,7 @@ EXPORT PDEEPVIZ_RESULT deepviz_search(const char* api_key,
 
     /* Send HTTP request */
     bRet = win_sendHTTPrequest( DEEPVIZ_SERVER,
-                                URL_INTEL_SEARCH,
+                                httpPage,
                                 INTERNET_DEFAULT_HTTPS_PORT,
                                 HTTPheader,
                                 INTERNET_FLAG_SECURE,
@@ -498,7 +721,7 @@ EXPORT PDEEPVIZ_RESULT deepviz_search(const char* api_key,
 /* Linux */
 
     bRet = linux_sendHTTPrequest(   DEEPVIZ_SERVER,
-                                    URL_INTEL_SEARCH,
+                                    httpPage,
                                     jsonRequestString,
                                     statusCode,
                                     DEEPVIZ_STATUS_CODE_MAX_LEN,
@@ -513,7 +736,7 @@ EXPORT PDEEPVIZ_RESULT deepviz_search(const char* api_key,
     if (bRet == deepviz_false){
         /* Network Error */
         if (responseOut) free(responseOut);
-        return deepviz_result_init(DEEPVIZ_STATUS_NETWORK_ERROR, retMsg);
+        return deepviz_result_init(dvz_transfer_error_status(), retMsg);
     }
 
     if (responseOutLen == 0){
@@ -531,31 +754,34 @@ EXPORT PDEEPVIZ_RESULT deepviz_search(const char* api_key,
     if (responseOut) free(responseOut);
 
     return result;
+}
+
+
+json_t* dvz_search_query(const char* api_key, const char* search_string){
 
+    /* Build SEARCH json request */
+    return json_pack("{ssss}",
+                        "api_key", api_key,
+                        "string", search_string);
 }
 
 
-EXPORT PDEEPVIZ_RESULT deepviz_advanced_search(const char* api_key,
-                                                PDEEPVIZ_LIST sim_hash,
-                                                PDEEPVIZ_LIST created_files,
-                                                PDEEPVIZ_LIST imp_hash,
-                                                PDEEPVIZ_LIST url,
-                                                PDEEPVIZ_LIST strings,
-                                                PDEEPVIZ_LIST ip,
-                                                PDEEPVIZ_LIST asn,
-                                                const char* classification,
-                                                PDEEPVIZ_LIST rules,
-                                                PDEEPVIZ_LIST country,
-                                                int never_seen,
-                                                const char* time_delta,
-                                                const char* ip_range,
-                                                PDEEPVIZ_LIST domain,
-                                                int start_offset,
-                                                int elements){
-    
-    PDEEPVIZ_RESULT     result;
-    void*               responseOut = NULL;
-    size_t              responseOutLen = 0;
+json_t* dvz_advanced_search_query(const char* api_key,
+                                    PDEEPVIZ_LIST sim_hash,
+                                    PDEEPVIZ_LIST created_files,
+                                    PDEEPVIZ_LIST imp_hash,
+                                    PDEEPVIZ_LIST url,
+                                    PDEEPVIZ_LIST strings,
+                                    PDEEPVIZ_LIST ip,
+                                    PDEEPVIZ_LIST asn,
+                                    const char* classification,
+                                    PDEEPVIZ_LIST rules,
+                                    PDEEPVIZ_LIST country,
+                                    int never_seen,
+                                    const char* time_delta,
+                                    const char* ip_range,
+                                    PDEEPVIZ_LIST domain){
+
     json_t              *jsonObj = NULL;
     json_t              *jsonSimHash = NULL;
     json_t              *jsonCreatedFiles = NULL;
@@ -567,46 +793,16 @@ EXPORT PDEEPVIZ_RESULT deepviz_advanced_search(const char* api_key,
     json_t              *jsonRules = NULL;
     json_t              *jsonCountry = NULL;
     json_t              *jsonDomain = NULL;
-    json_t              *jsonSet = NULL;
-    char                *jsonRequestString = NULL;
-    char                *retMsg = NULL;
-    deepviz_bool        bRet = deepviz_false;
     size_t              i;
-    char                statusCode[DEEPVIZ_STATUS_CODE_MAX_LEN] = { 0 };
-    char                tmpStr[100] = { 0 };
-#ifdef _WIN32
-    char                HTTPheader[DEEPVIZ_HTTP_HEADER_MAX_LEN] = { 0 };
-#endif
-
-    retMsg = (char*)malloc(DEEPVIZ_ERROR_MAX_LEN);
-    if (!retMsg){
-        return deepviz_result_init(DEEPVIZ_STATUS_INTERNAL_ERROR, NULL);
-    }
-
-#if !defined(_WIN32) && !defined(__linux__)
-    /* TODO */
-    sprintf(retMsg, "Platform not supported");
-    return deepviz_result_init(DEEPVIZ_STATUS_INTERNAL_ERROR, retMsg);
-#endif
-
-    if (!api_key){
-        deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Invalid or missing parameters. Please try again!");
-        return deepviz_result_init(DEEPVIZ_STATUS_INPUT_ERROR, retMsg);
-    }
 
     /* Build ADVANCED SEARCH json request */
 
-    /* Build result set array */
-    jsonSet = json_array();
-    deepviz_sprintf(tmpStr, 100, "start=%d", start_offset);
-    json_array_append_new(jsonSet, json_string(tmpStr));
-    deepviz_sprintf(tmpStr, 100,"rows=%d", elements);
-    json_array_append_new(jsonSet, json_string(tmpStr));
-
     /* Build base json request */
-    jsonObj = json_pack("{ssso}",
-                        "api_key", api_key,
-                        "result_set", jsonSet);
+    jsonObj = json_pack("{ss}",
+                        "api_key", api_key);
+    if (!jsonObj){
+        return NULL;
+    }
 
     /* Append "sim_hash" list */
     jsonSimHash = json_array();
@@ -766,64 +962,104 @@ EXPORT PDEEPVIZ_RESULT deepviz_advanced_search(const char* api_key,
         json_object_set_new(jsonObj, "ip_range", json_string(ip_range));
     }
 
-    /* Dump JSON string */
-    jsonRequestString = json_dumps(jsonObj, 0);
+    return jsonObj;
+}
 
-    json_decref(jsonObj);
 
-    if (!jsonRequestString){
-        deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Error creating HTTP request");
-        return deepviz_result_init(DEEPVIZ_STATUS_INTERNAL_ERROR, retMsg);
+EXPORT PDEEPVIZ_RESULT deepviz_search(const char* api_key,
+                                        const char* search_string, 
+                                        int start_offset, 
+                                        int elements){
+
+    PDEEPVIZ_RESULT	result = NULL;
+    json_t			*jsonQuery = NULL;
+    char			*request = NULL;
+    char			*retMsg = NULL;
+
+#if !defined(_WIN32) && !defined(__linux__)
+    /* TODO */
+    retMsg = (char*)malloc(DEEPVIZ_ERROR_MAX_LEN);
+    if (!retMsg){
+        return deepviz_result_init(DEEPVIZ_STATUS_INTERNAL_ERROR, NULL);
     }
+    sprintf(retMsg, "Platform not supported");
+    return deepviz_result_init(DEEPVIZ_STATUS_INTERNAL_ERROR, retMsg);
+#endif
 
-#ifdef _WIN32
-/* Windows */
+    if (!api_key || !search_string){
+        retMsg = (char*)malloc(DEEPVIZ_ERROR_MAX_LEN);
+        if (!retMsg){
+            return deepviz_result_init(DEEPVIZ_STATUS_INTERNAL_ERROR, NULL);
+        }
+        deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Invalid or missing parameters. Please try again!");
+        return deepviz_result_init(DEEPVIZ_STATUS_INPUT_ERROR, retMsg);
+    }
 
-    sprintf_s(HTTPheader, DEEPVIZ_HTTP_HEADER_MAX_LEN, "%s\r\n%s\r\n%s\r\n", DEEPVIZ_HTTP_HEADER_CTJ, DEEPVIZ_HTTP_HEADER_A, DEEPVIZ_HTTP_HEADER_AE);
+    jsonQuery = dvz_search_query(api_key, search_string);
+    request = jsonQuery ? dvz_search_compile(jsonQuery) : NULL;
+    json_decref(jsonQuery);
 
-    /* Send HTTP request */
-    bRet = win_sendHTTPrequest( DEEPVIZ_SERVER,
-                                URL_INTEL_SEARCH_ADVANCED,
-                                INTERNET_DEFAULT_HTTPS_PORT,
-                                HTTPheader,
-                                INTERNET_FLAG_SECURE,
-                                jsonRequestString,
-                                strlen(jsonRequestString),
-                                statusCode,
-                                DEEPVIZ_STATUS_CODE_MAX_LEN,
-                                &responseOut,
-                                &responseOutLen,
-                                retMsg);
+    result = dvz_search_page(URL_INTEL_SEARCH, request, NULL, start_offset, elements);
 
-#elif defined(__linux__)
-/* Linux */
+    if (request) free(request);
 
-    bRet = linux_sendHTTPrequest(	DEEPVIZ_SERVER,
-                                    URL_INTEL_SEARCH_ADVANCED,
-                                    jsonRequestString,
-                                    statusCode,
-                                    DEEPVIZ_STATUS_CODE_MAX_LEN,
-                                    &responseOut,
-                                    &responseOutLen,
-                                    retMsg);
+    return result;
 
-#endif
+}
 
-    free(jsonRequestString);
 
-    if (bRet == deepviz_false){
-        /* Network Error */
-        if (responseOut) free(responseOut);
-        return deepviz_result_init(DEEPVIZ_STATUS_NETWORK_ERROR, retMsg);
+EXPORT PDEEPVIZ_RESULT deepviz_advanced_search(const char* api_key,
+                                                PDEEPVIZ_LIST sim_hash,
+                                                PDEEPVIZ_LIST created_files,
+                                                PDEEPVIZ_LIST imp_hash,
+                                                PDEEPVIZ_LIST url,
+                                                PDEEPVIZ_LIST strings,
+                                                PDEEPVIZ_LIST ip,
+                                                PDEEPVIZ_LIST asn,
+                                                const char* classification,
+                                                PDEEPVIZ_LIST rules,
+                                                PDEEPVIZ_LIST country,
+                                                int never_seen,
+                                                const char* time_delta,
+                                                const char* ip_range,
+                                                PDEEPVIZ_LIST domain,
+                                                int start_offset,
+                                                int elements){
+    
+    PDEEPVIZ_RESULT     result;
+    json_t              *jsonQuery = NULL;
+    char                *request = NULL;
+    char                *retMsg = NULL;
+
+#if !defined(_WIN32) && !defined(__linux__)
+    /* TODO */
+    retMsg = (char*)malloc(DEEPVIZ_ERROR_MAX_LEN);
+    if (!retMsg){
+        return deepviz_result_init(DEEPVIZ_STATUS_INTERNAL_ERROR, NULL);
     }
+    sprintf(retMsg, "Platform not supported");
+    return deepviz_result_init(DEEPVIZ_STATUS_INTERNAL_ERROR, retMsg);
+#endif
 
-    free(retMsg);
+    if (!api_key){
+        retMsg = (char*)malloc(DEEPVIZ_ERROR_MAX_LEN);
+        if (!retMsg){
+            return deepviz_result_init(DEEPVIZ_STATUS_INTERNAL_ERROR, NULL);
+        }
+        deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Invalid or missing parameters. Please try again!");
+        return deepviz_result_init(DEEPVIZ_STATUS_INPUT_ERROR, retMsg);
+    }
 
-    /* Parse API response and build DEEPVIZ_RESULT return value */
-    result = parse_deepviz_response(statusCode, responseOut, responseOutLen);
+    jsonQuery = dvz_advanced_search_query(api_key, sim_hash, created_files, imp_hash, url, strings, ip, asn,
+        classification, rules, country, never_seen, time_delta, ip_range, domain);
 
-    if (responseOut) free(responseOut);
+    request = jsonQuery ? dvz_search_compile(jsonQuery) : NULL;
+    json_decref(jsonQuery);
+
+    result = dvz_search_page(URL_INTEL_SEARCH_ADVANCED, request, NULL, start_offset, elements);
+
+    if (request) free(request);
 
     return result;
 
-}
\ No newline at end of file
+}
@@ -0,0 +1,368 @@
+/*
+* Copyright (c) 2016 Saferbytes s.r.l.s.
+*
+* You can redistribute it and/or modify it under the terms of the MIT license.
+* See LICENSE for details.
+*/
+
+#include "c-deepviz.h"
+#include "c-deepviz_private.h"
+
+/*
+* Upload journal.
+* Every uploaded file is appended to the journal file as a record (size, mtime, MD5, path) protected by
+* a checksum. Records are written at once and synced to disk every JOURNAL_SYNC_RECORDS records or
+* JOURNAL_SYNC_MS milliseconds, so a crash loses at most the last batch. On open the records are loaded
+* into a hash table, a torn record at the end is truncated, and the files already uploaded and not
+* modified since are skipped.
+*/
+
+#ifdef _WIN32
+#include <io.h>
+#include <sys/stat.h>
+#else
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+
+#define     JOURNAL_RECORD_MAGIC        0x4a565a44      /* "DZVJ" */
+#define     JOURNAL_SYNC_RECORDS        64
+#define     JOURNAL_SYNC_MS             1000
+#define     JOURNAL_INITIAL_BUCKETS     1024
+
+typedef struct _JOURNAL_RECORD{
+    unsigned int        magic;
+    unsigned int        pathLen;
+    unsigned long long  size;
+    long long           mtime;
+    unsigned char       md5[DEEPVIZ_MD5_LEN];
+    unsigned long long  checksum;                   /* dvz_hash() of the record, with checksum = 0, and of the path */
+}JOURNAL_RECORD, *PJOURNAL_RECORD;
+
+typedef struct _JOURNAL_ENTRY{
+    struct _JOURNAL_ENTRY   *next;
+    unsigned long long      hash;
+    unsigned long long      size;
+    long long               mtime;
+    unsigned char           md5[DEEPVIZ_MD5_LEN];
+    char                    path[1];
+}JOURNAL_ENTRY, *PJOURNAL_ENTRY;
+
+struct _DEEPVIZ_JOURNAL{
+    DEEPVIZ_MUTEX           lock;
+    FILE                    *file;
+    PJOURNAL_ENTRY          *bucket;
+    size_t                  bucketNumber;
+    size_t                  entryNumber;
+    size_t                  unsynced;
+    unsigned long long      lastSync;
+};
+
+
+static deepviz_bool journal_stat(const char* path, unsigned long long* size, long long* mtime){
+
+#ifdef _WIN32
+    struct _stat64  st;
+
+    if (_stat64(path, &st)){
+        return deepviz_false;
+    }
+
+    (*size) = (unsigned long long)st.st_size;
+    (*mtime) = (long long)st.st_mtime * 1000000000LL;
+#else
+    struct stat     st;
+
+    if (stat(path, &st)){
+        return deepviz_false;
+    }
+
+    (*size) = (unsigned long long)st.st_size;
+    (*mtime) = (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+#endif
+
+    return deepviz_true;
+}
+
+
+static unsigned long long journal_checksum(PJOURNAL_RECORD record, const char* path){
+
+    JOURNAL_RECORD      copy = (*record);
+    unsigned long long  hashes[2];
+
+    copy.checksum = 0;
+    hashes[0] = dvz_hash(&copy, sizeof(copy));
+    hashes[1] = dvz_hash(path, record->pathLen);
+
+    return dvz_hash(hashes, sizeof(hashes));
+}
+
+
+static PJOURNAL_ENTRY journal_find(PDEEPVIZ_JOURNAL journal, const char* path, unsigned long long hash){
+
+    PJOURNAL_ENTRY  entry;
+
+    for (entry = journal->bucket[hash & (journal->bucketNumber - 1)]; entry; entry = entry->next){
+        if (entry->hash == hash && !strcmp(entry->path, path)){
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+
+/* Insert or update the entry of "path". Called with the lock held. */
+static void journal_insert(PDEEPVIZ_JOURNAL journal, const char* path, unsigned long long size, long long mtime, const unsigned char md5[DEEPVIZ_MD5_LEN]){
+
+    PJOURNAL_ENTRY      entry;
+    PJOURNAL_ENTRY      next;
+    PJOURNAL_ENTRY      *bucket;
+    unsigned long long  hash = dvz_hash(path, strlen(path));
+    size_t              bucketNumber;
+    size_t              i;
+
+    entry = journal_find(journal, path, hash);
+    if (!entry){
+
+        /* Keep about one entry per bucket */
+        if (journal->entryNumber >= journal->bucketNumber){
+
+            bucketNumber = journal->bucketNumber * 2;
+            bucket = (PJOURNAL_ENTRY*)calloc(bucketNumber, sizeof(PJOURNAL_ENTRY));
+            if (bucket){
+                for (i = 0; i < journal->bucketNumber; i++){
+                    for (entry = journal->bucket[i]; entry; entry = next){
+                        next = entry->next;
+                        entry->next = bucket[entry->hash & (bucketNumber - 1)];
+                        bucket[entry->hash & (bucketNumber - 1)] = entry;
+                    }
+                }
+                free(journal->bucket);
+                journal->bucket = bucket;
+                journal->bucketNumber = bucketNumber;
+            }
+        }
+
+        entry = (PJOURNAL_ENTRY)malloc(sizeof(JOURNAL_ENTRY) + strlen(path));
+        if (!entry){
+            return;
+        }
+
+        memcpy(entry->path, path, strlen(path) + 1);
+        entry->hash = hash;
+        entry->next = journal->bucket[hash & (journal->bucketNumber - 1)];
+        journal->bucket[hash & (journal->bucketNumber - 1)] = entry;
+        journal->entryNumber++;
+    }
+
+    entry->size = size;
+    entry->mtime = mtime;
+    memcpy(entry->md5, md5, DEEPVIZ_MD5_LEN);
+}
+
+
+/* Load the valid records. Returns the length of the valid part of the file. */
+static long long journal_load(PDEEPVIZ_JOURNAL journal, FILE* file){
+
+    JOURNAL_RECORD      record;
+    char                *path = NULL;
+    char                *newPath;
+    size_t              pathSize = 0;
+    long long           validLen = 0;
+
+    while (fread(&record, sizeof(record), 1, file) == 1){
+
+        if (record.magic != JOURNAL_RECORD_MAGIC || !record.pathLen || record.pathLen > 1024 * 1024){
+            break;
+        }
+
+        if (record.pathLen + 1 > pathSize){
+            newPath = (char*)realloc(path, record.pathLen + 1);
+            if (!newPath){
+                break;
+            }
+            path = newPath;
+            pathSize = record.pathLen + 1;
+        }
+
+        if (fread(path, record.pathLen, 1, file) != 1 || journal_checksum(&record, path) != record.checksum){
+            break;
+        }
+        path[record.pathLen] = 0;
+
+        journal_insert(journal, path, record.size, record.mtime, record.md5);
+        validLen += sizeof(record) + record.pathLen;
+    }
+
+    if (path) free(path);
+
+    return validLen;
+}
+
+
+static void journal_sync(PDEEPVIZ_JOURNAL journal){
+
+    fflush(journal->file);
+
+#ifdef _WIN32
+    _commit(_fileno(journal->file));
+#else
+    fsync(fileno(journal->file));
+#endif
+
+    journal->unsynced = 0;
+    journal->lastSync = dvz_time_ms();
+}
+
+
+PDEEPVIZ_JOURNAL dvz_journal_open(const char* path){
+
+    PDEEPVIZ_JOURNAL    journal;
+    FILE                *file;
+    long long           validLen = 0;
+
+    journal = (PDEEPVIZ_JOURNAL)malloc(sizeof(DEEPVIZ_JOURNAL));
+    if (!journal){
+        return NULL;
+    }
+
+    memset(journal, 0, sizeof(DEEPVIZ_JOURNAL));
+
+    journal->bucketNumber = JOURNAL_INITIAL_BUCKETS;
+    journal->bucket = (PJOURNAL_ENTRY*)calloc(journal->bucketNumber, sizeof(PJOURNAL_ENTRY));
+    if (!journal->bucket){
+        free(journal);
+        return NULL;
+    }
+
+    dvz_mutex_init(&journal->lock);
+
+    file = fopen(path, "rb");
+    if (file){
+        validLen = journal_load(journal, file);
+        fclose(file);
+    }
+
+    journal->file = fopen(path, "ab");
+    if (!journal->file){
+        dvz_journal_close(journal);
+        return NULL;
+    }
+
+    /* Drop the record torn by a crash, if any */
+    fseek(journal->file, 0, SEEK_END);
+    if (ftell(journal->file) > validLen){
+#ifdef _WIN32
+        _chsize_s(_fileno(journal->file), validLen);
+#else
+        if (ftruncate(fileno(journal->file), (off_t)validLen)){
+            dvz_journal_close(journal);
+            return NULL;
+        }
+#endif
+    }
+
+    journal->lastSync = dvz_time_ms();
+
+    return journal;
+}
+
+
+deepviz_bool dvz_journal_check(PDEEPVIZ_JOURNAL journal, const char* path, PDEEPVIZ_JOURNAL_FILE file){
+
+    PJOURNAL_ENTRY      entry;
+    deepviz_bool        uploaded = deepviz_false;
+    deepviz_bool        sameSize = deepviz_false;
+    unsigned char       md5[DEEPVIZ_MD5_LEN];
+
+    memset(file, 0, sizeof(DEEPVIZ_JOURNAL_FILE));
+
+    if (!journal_stat(path, &file->size, &file->mtime)){
+        return deepviz_false;
+    }
+
+    dvz_mutex_lock(&journal->lock);
+
+    entry = journal_find(journal, path, dvz_hash(path, strlen(path)));
+    if (entry){
+        uploaded = entry->size == file->size && entry->mtime == file->mtime;
+        sameSize = entry->size == file->size;
+        memcpy(md5, entry->md5, DEEPVIZ_MD5_LEN);
+    }
+
+    dvz_mutex_unlock(&journal->lock);
+
+    /* Only touched: same content, recorded with the new mtime */
+    if (!uploaded && sameSize && dvz_md5_file(path, file->md5)){
+        file->md5Done = deepviz_true;
+        if (!memcmp(file->md5, md5, DEEPVIZ_MD5_LEN)){
+            dvz_journal_record(journal, path, file);
+            uploaded = deepviz_true;
+        }
+    }
+
+    return uploaded;
+}
+
+
+void dvz_journal_record(PDEEPVIZ_JOURNAL journal, const char* path, PDEEPVIZ_JOURNAL_FILE file){
+
+    JOURNAL_RECORD  record;
+
+    if (!file->md5Done){
+        if (!dvz_md5_file(path, file->md5)){
+            return;
+        }
+        file->md5Done = deepviz_true;
+    }
+
+    memset(&record, 0, sizeof(record));
+    record.magic = JOURNAL_RECORD_MAGIC;
+    record.pathLen = (unsigned int)strlen(path);
+    record.size = file->size;
+    record.mtime = file->mtime;
+    memcpy(record.md5, file->md5, DEEPVIZ_MD5_LEN);
+    record.checksum = journal_checksum(&record, path);
+
+    dvz_mutex_lock(&journal->lock);
+
+    /* Written at once, synced in batches */
+    if (fwrite(&record, sizeof(record), 1, journal->file) == 1 &&
+        fwrite(path, record.pathLen, 1, journal->file) == 1){
+
+        fflush(journal->file);
+        journal_insert(journal, path, file->size, file->mtime, file->md5);
+
+        if (++journal->unsynced >= JOURNAL_SYNC_RECORDS || dvz_time_ms() - journal->lastSync >= JOURNAL_SYNC_MS){
+            journal_sync(journal);
+        }
+    }
+
+    dvz_mutex_unlock(&journal->lock);
+}
+
+
+void dvz_journal_close(PDEEPVIZ_JOURNAL journal){
+
+    PJOURNAL_ENTRY  entry;
+    PJOURNAL_ENTRY  next;
+    size_t          i;
+
+    if (journal->file){
+        journal_sync(journal);
+        fclose(journal->file);
+    }
+
+    dvz_mutex_destroy(&journal->lock);
+
+    for (i = 0; i < journal->bucketNumber; i++){
+        for (entry = journal->bucket[i]; entry; entry = next){
+            next = entry->next;
+            free(entry);
+        }
+    }
+
+    free(journal->bucket);
+    free(journal);
+}
@@ -0,0 +1,228 @@
+/*
+* Copyright (c) 2016 Saferbytes s.r.l.s.
+*
+* You can redistribute it and/or modify it under the terms of the MIT license.
+* See LICENSE for details.
+*/
+
+#include "c-deepviz.h"
+#include "c-deepviz_private.h"
+
+/* MD5 (RFC 1321) */
+
+#define     MD5_READ_BUFFER_LEN     65536
+
+#define     MD5_F(x, y, z)          ((z) ^ ((x) & ((y) ^ (z))))
+#define     MD5_G(x, y, z)          ((y) ^ ((z) & ((x) ^ (y))))
+#define     MD5_H(x, y, z)          ((x) ^ (y) ^ (z))
+#define     MD5_I(x, y, z)          ((y) ^ ((x) | ~(z)))
+#define     MD5_ROTL(x, n)          (((x) << (n)) | ((x) >> (32 - (n))))
+
+#define     MD5_STEP(f, a, b, c, d, x, t, s) \
+    (a) += f((b), (c), (d)) + (x) + (t); \
+    (a) = MD5_ROTL((a), (s)); \
+    (a) += (b);
+
+
+void dvz_md5_transform(unsigned int state[4], const unsigned char block[64]){
+
+    unsigned int    a = state[0];
+    unsigned int    b = state[1];
+    unsigned int    c = state[2];
+    unsigned int    d = state[3];
+    unsigned int    x[16];
+    int             i;
+
+    for (i = 0; i < 16; i++){
+        x[i] = (unsigned int)block[i * 4] |
+               ((unsigned int)block[i * 4 + 1] << 8) |
+               ((unsigned int)block[i * 4 + 2] << 16) |
+               ((unsigned int)block[i * 4 + 3] << 24);
+    }
+
+    MD5_STEP(MD5_F, a, b, c, d, x[0], 0xd76aa478, 7)
+    MD5_STEP(MD5_F, d, a, b, c, x[1], 0xe8c7b756, 12)
+    MD5_STEP(MD5_F, c, d, a, b, x[2], 0x242070db, 17)
+    MD5_STEP(MD5_F, b, c, d, a, x[3], 0xc1bdceee, 22)
+    MD5_STEP(MD5_F, a, b, c, d, x[4], 0xf57c0faf, 7)
+    MD5_STEP(MD5_F, d, a, b, c, x[5], 0x4787c62a, 12)
+    MD5_STEP(MD5_F, c, d, a, b, x[6], 0xa8304613, 17)
+    MD5_STEP(MD5_F, b, c, d, a, x[7], 0xfd469501, 22)
+    MD5_STEP(MD5_F, a, b, c, d, x[8], 0x698098d8, 7)
+    MD5_STEP(MD5_F, d, a, b, c, x[9], 0x8b44f7af, 12)
+    MD5_STEP(MD5_F, c, d, a, b, x[10], 0xffff5bb1, 17)
+    MD5_STEP(MD5_F, b, c, d, a, x[11], 0x895cd7be, 22)
+    MD5_STEP(MD5_F, a, b, c, d, x[12], 0x6b901122, 7)
+    MD5_STEP(MD5_F, d, a, b, c, x[13], 0xfd987193, 12)
+    MD5_STEP(MD5_F, c, d, a, b, x[14], 0xa679438e, 17)
+    MD5_STEP(MD5_F, b, c, d, a, x[15], 0x49b40821, 22)
+
+    MD5_STEP(MD5_G, a, b, c, d, x[1], 0xf61e2562, 5)
+    MD5_STEP(MD5_G, d, a, b, c, x[6], 0xc040b340, 9)
+    MD5_STEP(MD5_G, c, d, a, b, x[11], 0x265e5a51, 14)
+    MD5_STEP(MD5_G, b, c, d, a, x[0], 0xe9b6c7aa, 20)
+    MD5_STEP(MD5_G, a, b, c, d, x[5], 0xd62f105d, 5)
+    MD5_STEP(MD5_G, d, a, b, c, x[10], 0x02441453, 9)
+    MD5_STEP(MD5_G, c, d, a, b, x[15], 0xd8a1e681, 14)
+    MD5_STEP(MD5_G, b, c, d, a, x[4], 0xe7d3fbc8, 20)
+    MD5_STEP(MD5_G, a, b, c, d, x[9], 0x21e1cde6, 5)
+    MD5_STEP(MD5_G, d, a, b, c, x[14], 0xc33707d6, 9)
+    MD5_STEP(MD5_G, c, d, a, b, x[3], 0xf4d50d87, 14)
+    MD5_STEP(MD5_G, b, c, d, a, x[8], 0x455a14ed, 20)
+    MD5_STEP(MD5_G, a, b, c, d, x[13], 0xa9e3e905, 5)
+    MD5_STEP(MD5_G, d, a, b, c, x[2], 0xfcefa3f8, 9)
+    MD5_STEP(MD5_G, c, d, a, b, x[7], 0x676f02d9, 14)
+    MD5_STEP(MD5_G, b, c, d, a, x[12], 0x8d2a4c8a, 20)
+
+    MD5_STEP(MD5_H, a, b, c, d, x[5], 0xfffa3942, 4)
+    MD5_STEP(MD5_H, d, a, b, c, x[8], 0x8771f681, 11)
+    MD5_STEP(MD5_H, c, d, a, b, x[11], 0x6d9d6122, 16)
+    MD5_STEP(MD5_H, b, c, d, a, x[14], 0xfde5380c, 23)
+    MD5_STEP(MD5_H, a, b, c, d, x[1], 0xa4beea44, 4)
+    MD5_STEP(MD5_H, d, a, b, c, x[4], 0x4bdecfa9, 11)
+    MD5_STEP(MD5_H, c, d, a, b, x[7], 0xf6bb4b60, 16)
+    MD5_STEP(MD5_H, b, c, d, a, x[10], 0xbebfbc70, 23)
+    MD5_STEP(MD5_H, a, b, c, d, x[13], 0x289b7ec6, 4)
+    MD5_STEP(MD5_H, d, a, b, c, x[0], 0xeaa127fa, 11)
+    MD5_STEP(MD5_H, c, d, a, b, x[3], 0xd4ef3085, 16)
+    MD5_STEP(MD5_H, b, c, d, a, x[6], 0x04881d05, 23)
+    MD5_STEP(MD5_H, a, b, c, d, x[9], 0xd9d4d039, 4)
+    MD5_STEP(MD5_H, d, a, b, c, x[12], 0xe6db99e5, 11)
+    MD5_STEP(MD5_H, c, d, a, b, x[15], 0x1fa27cf8, 16)
+    MD5_STEP(MD5_H, b, c, d, a, x[2], 0xc4ac5665, 23)
+
+    MD5_STEP(MD5_I, a, b, c, d, x[0], 0xf4292244, 6)
+    MD5_STEP(MD5_I, d, a, b, c, x[7], 0x432aff97, 10)
+    MD5_STEP(MD5_I, c, d, a, b, x[14], 0xab9423a7, 15)
+    MD5_STEP(MD5_I, b, c, d, a, x[5], 0xfc93a039, 21)
+    MD5_STEP(MD5_I, a, b, c, d, x[12], 0x655b59c3, 6)
+    MD5_STEP(MD5_I, d, a, b, c, x[3], 0x8f0ccc92, 10)
+    MD5_STEP(MD5_I, c, d, a, b, x[10], 0xffeff47d, 15)
+    MD5_STEP(MD5_I, b, c, d, a, x[1], 0x85845dd1, 21)
+    MD5_STEP(MD5_I, a, b, c, d, x[8], 0x6fa87e4f, 6)
+    MD5_STEP(MD5_I, d, a, b, c, x[15], 0xfe2ce6e0, 10)
+    MD5_STEP(MD5_I, c, d, a, b, x[6], 0xa3014314, 15)
+    MD5_STEP(MD5_I, b, c, d, a, x[13], 0x4e0811a1, 21)
+    MD5_STEP(MD5_I, a, b, c, d, x[4], 0xf7537e82, 6)
+    MD5_STEP(MD5_I, d, a, b, c, x[11], 0xbd3af235, 10)
+    MD5_STEP(MD5_I, c, d, a, b, x[2], 0x2ad7d2bb, 15)
+    MD5_STEP(MD5_I, b, c, d, a, x[9], 0xeb86d391, 21)
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+}
+
+
+void dvz_md5_init(PDEEPVIZ_MD5_CONTEXT ctx){
+
+    ctx->state[0] = 0x67452301;
+    ctx->state[1] = 0xefcdab89;
+    ctx->state[2] = 0x98badcfe;
+    ctx->state[3] = 0x10325476;
+    ctx->length = 0;
+}
+
+
+void dvz_md5_update(PDEEPVIZ_MD5_CONTEXT ctx, const void* data, size_t dataLen){
+
+    const unsigned char *p = (const unsigned char*)data;
+    size_t              used = (size_t)(ctx->length & 63);
+    size_t              fill;
+
+    ctx->length += dataLen;
+
+    if (used){
+        fill = 64 - used;
+        if (dataLen < fill){
+            memcpy(ctx->buffer + used, p, dataLen);
+            return;
+        }
+        memcpy(ctx->buffer + used, p, fill);
+        dvz_md5_transform(ctx->state, ctx->buffer);
+        p += fill;
+        dataLen -= fill;
+    }
+
+    while (dataLen >= 64){
+        dvz_md5_transform(ctx->state, p);
+        p += 64;
+        dataLen -= 64;
+    }
+
+    if (dataLen){
+        memcpy(ctx->buffer, p, dataLen);
+    }
+}
+
+
+void dvz_md5_final(PDEEPVIZ_MD5_CONTEXT ctx, unsigned char digest[DEEPVIZ_MD5_LEN]){
+
+    static const unsigned char  padding[64] = { 0x80 };
+    unsigned char               bits[8];
+    unsigned long long          bitLength = ctx->length * 8;
+    size_t                      used = (size_t)(ctx->length & 63);
+    int                         i;
+
+    for (i = 0; i < 8; i++){
+        bits[i] = (unsigned char)(bitLength >> (i * 8));
+    }
+
+    dvz_md5_update(ctx, padding, used < 56 ? 56 - used : 120 - used);
+    dvz_md5_update(ctx, bits, 8);
+
+    for (i = 0; i < 16; i++){
+        digest[i] = (unsigned char)(ctx->state[i / 4] >> ((i % 4) * 8));
+    }
+}
+
+
+void dvz_md5_to_hex(const unsigned char digest[DEEPVIZ_MD5_LEN], char hex[DEEPVIZ_MD5_HEX_LEN]){
+
+    static const char   digits[] = "0123456789abcdef";
+    int                 i;
+
+    for (i = 0; i < DEEPVIZ_MD5_LEN; i++){
+        hex[i * 2] = digits[digest[i] >> 4];
+        hex[i * 2 + 1] = digits[digest[i] & 0x0f];
+    }
+    hex[DEEPVIZ_MD5_LEN * 2] = 0;
+}
+
+
+deepviz_bool dvz_md5_file(const char* path, unsigned char digest[DEEPVIZ_MD5_LEN]){
+
+    DEEPVIZ_MD5_CONTEXT ctx;
+    FILE                *file;
+    unsigned char       *buffer;
+    size_t              readLen;
+    deepviz_bool        ret;
+
+    file = fopen(path, "rb");
+    if (!file){
+        return deepviz_false;
+    }
+
+    buffer = (unsigned char*)malloc(MD5_READ_BUFFER_LEN);
+    if (!buffer){
+        fclose(file);
+        return deepviz_false;
+    }
+
+    dvz_md5_init(&ctx);
+
+    while ((readLen = fread(buffer, 1, MD5_READ_BUFFER_LEN, file)) > 0){
+        dvz_md5_update(&ctx, buffer, readLen);
+    }
+
+    ret = !ferror(file);
+    if (ret){
+        dvz_md5_final(&ctx, digest);
+    }
+
+    free(buffer);
+    fclose(file);
+
+    return ret;
+}
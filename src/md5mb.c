@@ -0,0 +1,787 @@
+/*
+* Copyright (c) 2016 Saferbytes s.r.l.s.
+*
+* You can redistribute it and/or modify it under the terms of the MIT license.
+* See LICENSE for details.
+*/
+
+#include "c-deepviz.h"
+#include "c-deepviz_private.h"
+
+#if defined(__linux__)
+#include <fcntl.h>
+#endif
+
+/*
+* Multi-buffer MD5.
+* A single MD5 stream cannot be vectorized, every step depends on the previous one. Independent files
+* can: each SIMD lane hashes a different file (4 lanes with SSE2, 8 with AVX2, 16 with AVX-512), and a
+* lane takes the next file as soon as its own is done. A reader thread keeps every lane fed, reading
+* ahead MD5_MB_READ_AHEAD chunks per lane while the current ones are hashed.
+*/
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+    #define     MD5_MB_X86
+    #define     MD5_MB_TARGET(isa)      __attribute__((target(isa)))
+    #include <immintrin.h>
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    #define     MD5_MB_X86
+    #define     MD5_MB_TARGET(isa)
+    #include <intrin.h>
+    #include <immintrin.h>
+#endif
+
+#define     MD5_MB_MAX_LANES        16
+#define     MD5_MB_CHUNK_LEN        (256 * 1024)    /* Must be a multiple of 64 */
+#define     MD5_MB_READ_AHEAD       2
+
+typedef void (*MD5_MB_TRANSFORM)(unsigned int* state, const unsigned char* const* blocks);
+
+typedef struct _MD5_MB_ENGINE{
+    const char          *name;
+    unsigned int        lanes;
+    MD5_MB_TRANSFORM    transform;      /* state[word * lanes + lane]. A NULL block is hashed as zeros */
+}MD5_MB_ENGINE, *PMD5_MB_ENGINE;
+
+typedef struct _MD5_MB_CHUNK{
+    unsigned char       *data;
+    size_t              dataLen;        /* Multiple of 64, except for the last chunk of a file */
+    size_t              fileIndex;
+    deepviz_bool        first;
+    deepviz_bool        last;
+    deepviz_bool        error;
+}MD5_MB_CHUNK, *PMD5_MB_CHUNK;
+
+typedef struct _MD5_MB_LANE{
+    MD5_MB_CHUNK        chunk[MD5_MB_READ_AHEAD];
+    size_t              readCount;      /* Chunks released by the hasher */
+    size_t              writeCount;     /* Chunks filled by the reader */
+    deepviz_bool        finished;       /* No more chunks will be filled */
+
+    /* Reader side */
+    FILE                *file;
+    deepviz_bool        hasFile;
+    size_t              fileIndex;
+
+    /* Hasher side */
+    PMD5_MB_CHUNK       current;
+    size_t              offset;
+    unsigned long long  length;
+    unsigned char       tail[128];
+    unsigned int        tailBlocks;
+    unsigned int        tailIndex;
+    size_t              tailFileIndex;
+}MD5_MB_LANE, *PMD5_MB_LANE;
+
+typedef struct _MD5_MB_JOB{
+    const MD5_MB_ENGINE *engine;
+    unsigned int        lanes;
+    const char          **paths;
+    size_t              pathNumber;
+    size_t              nextPath;
+    unsigned char       (*digests)[DEEPVIZ_MD5_LEN];
+    deepviz_bool        *errors;
+    unsigned int        state[4 * MD5_MB_MAX_LANES];
+    DEEPVIZ_MUTEX       lock;
+    DEEPVIZ_COND        readyCond;      /* A chunk was filled */
+    DEEPVIZ_COND        spaceCond;      /* A chunk was released */
+    MD5_MB_LANE         lane[MD5_MB_MAX_LANES];
+}MD5_MB_JOB, *PMD5_MB_JOB;
+
+static const unsigned int md5Iv[4] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476 };
+
+
+/* ============================ transforms ============================ */
+
+/* The 64 steps of RFC 1321, on vectors. VLOAD(i) is the i-th message word of every lane. */
+#define     MD5_MB_STEP(f, a, b, c, d, i, t, s) \
+    a = VADD(a, VADD(f(b, c, d), VADD(VLOAD(i), VSET1(t)))); \
+    a = VROTL(a, s); \
+    a = VADD(a, b);
+
+#define     MD5_MB_ROUNDS \
+    MD5_MB_STEP(VF, a, b, c, d, 0, 0xd76aa478, 7) \
+    MD5_MB_STEP(VF, d, a, b, c, 1, 0xe8c7b756, 12) \
+    MD5_MB_STEP(VF, c, d, a, b, 2, 0x242070db, 17) \
+    MD5_MB_STEP(VF, b, c, d, a, 3, 0xc1bdceee, 22) \
+    MD5_MB_STEP(VF, a, b, c, d, 4, 0xf57c0faf, 7) \
+    MD5_MB_STEP(VF, d, a, b, c, 5, 0x4787c62a, 12) \
+    MD5_MB_STEP(VF, c, d, a, b, 6, 0xa8304613, 17) \
+    MD5_MB_STEP(VF, b, c, d, a, 7, 0xfd469501, 22) \
+    MD5_MB_STEP(VF, a, b, c, d, 8, 0x698098d8, 7) \
+    MD5_MB_STEP(VF, d, a, b, c, 9, 0x8b44f7af, 12) \
+    MD5_MB_STEP(VF, c, d, a, b, 10, 0xffff5bb1, 17) \
+    MD5_MB_STEP(VF, b, c, d, a, 11, 0x895cd7be, 22) \
+    MD5_MB_STEP(VF, a, b, c, d, 12, 0x6b901122, 7) \
+    MD5_MB_STEP(VF, d, a, b, c, 13, 0xfd987193, 12) \
+    MD5_MB_STEP(VF, c, d, a, b, 14, 0xa679438e, 17) \
+    MD5_MB_STEP(VF, b, c, d, a, 15, 0x49b40821, 22) \
+    MD5_MB_STEP(VG, a, b, c, d, 1, 0xf61e2562, 5) \
+    MD5_MB_STEP(VG, d, a, b, c, 6, 0xc040b340, 9) \
+    MD5_MB_STEP(VG, c, d, a, b, 11, 0x265e5a51, 14) \
+    MD5_MB_STEP(VG, b, c, d, a, 0, 0xe9b6c7aa, 20) \
+    MD5_MB_STEP(VG, a, b, c, d, 5, 0xd62f105d, 5) \
+    MD5_MB_STEP(VG, d, a, b, c, 10, 0x02441453, 9) \
+    MD5_MB_STEP(VG, c, d, a, b, 15, 0xd8a1e681, 14) \
+    MD5_MB_STEP(VG, b, c, d, a, 4, 0xe7d3fbc8, 20) \
+    MD5_MB_STEP(VG, a, b, c, d, 9, 0x21e1cde6, 5) \
+    MD5_MB_STEP(VG, d, a, b, c, 14, 0xc33707d6, 9) \
+    MD5_MB_STEP(VG, c, d, a, b, 3, 0xf4d50d87, 14) \
+    MD5_MB_STEP(VG, b, c, d, a, 8, 0x455a14ed, 20) \
+    MD5_MB_STEP(VG, a, b, c, d, 13, 0xa9e3e905, 5) \
+    MD5_MB_STEP(VG, d, a, b, c, 2, 0xfcefa3f8, 9) \
+    MD5_MB_STEP(VG, c, d, a, b, 7, 0x676f02d9, 14) \
+    MD5_MB_STEP(VG, b, c, d, a, 12, 0x8d2a4c8a, 20) \
+    MD5_MB_STEP(VH, a, b, c, d, 5, 0xfffa3942, 4) \
+    MD5_MB_STEP(VH, d, a, b, c, 8, 0x8771f681, 11) \
+    MD5_MB_STEP(VH, c, d, a, b, 11, 0x6d9d6122, 16) \
+    MD5_MB_STEP(VH, b, c, d, a, 14, 0xfde5380c, 23) \
+    MD5_MB_STEP(VH, a, b, c, d, 1, 0xa4beea44, 4) \
+    MD5_MB_STEP(VH, d, a, b, c, 4, 0x4bdecfa9, 11) \
+    MD5_MB_STEP(VH, c, d, a, b, 7, 0xf6bb4b60, 16) \
+    MD5_MB_STEP(VH, b, c, d, a, 10, 0xbebfbc70, 23) \
+    MD5_MB_STEP(VH, a, b, c, d, 13, 0x289b7ec6, 4) \
+    MD5_MB_STEP(VH, d, a, b, c, 0, 0xeaa127fa, 11) \
+    MD5_MB_STEP(VH, c, d, a, b, 3, 0xd4ef3085, 16) \
+    MD5_MB_STEP(VH, b, c, d, a, 6, 0x04881d05, 23) \
+    MD5_MB_STEP(VH, a, b, c, d, 9, 0xd9d4d039, 4) \
+    MD5_MB_STEP(VH, d, a, b, c, 12, 0xe6db99e5, 11) \
+    MD5_MB_STEP(VH, c, d, a, b, 15, 0x1fa27cf8, 16) \
+    MD5_MB_STEP(VH, b, c, d, a, 2, 0xc4ac5665, 23) \
+    MD5_MB_STEP(VI, a, b, c, d, 0, 0xf4292244, 6) \
+    MD5_MB_STEP(VI, d, a, b, c, 7, 0x432aff97, 10) \
+    MD5_MB_STEP(VI, c, d, a, b, 14, 0xab9423a7, 15) \
+    MD5_MB_STEP(VI, b, c, d, a, 5, 0xfc93a039, 21) \
+    MD5_MB_STEP(VI, a, b, c, d, 12, 0x655b59c3, 6) \
+    MD5_MB_STEP(VI, d, a, b, c, 3, 0x8f0ccc92, 10) \
+    MD5_MB_STEP(VI, c, d, a, b, 10, 0xffeff47d, 15) \
+    MD5_MB_STEP(VI, b, c, d, a, 1, 0x85845dd1, 21) \
+    MD5_MB_STEP(VI, a, b, c, d, 8, 0x6fa87e4f, 6) \
+    MD5_MB_STEP(VI, d, a, b, c, 15, 0xfe2ce6e0, 10) \
+    MD5_MB_STEP(VI, c, d, a, b, 6, 0xa3014314, 15) \
+    MD5_MB_STEP(VI, b, c, d, a, 13, 0x4e0811a1, 21) \
+    MD5_MB_STEP(VI, a, b, c, d, 4, 0xf7537e82, 6) \
+    MD5_MB_STEP(VI, d, a, b, c, 11, 0xbd3af235, 10) \
+    MD5_MB_STEP(VI, c, d, a, b, 2, 0x2ad7d2bb, 15) \
+    MD5_MB_STEP(VI, b, c, d, a, 9, 0xeb86d391, 21)
+
+
+static void md5_mb_transform_scalar(unsigned int* state, const unsigned char* const* blocks){
+
+    static const unsigned char  zero[64] = { 0 };
+
+    dvz_md5_transform(state, blocks[0] ? blocks[0] : zero);
+}
+
+
+#ifdef MD5_MB_X86
+
+/* Transpose the blocks: words[i][lane] = i-th little endian word of the lane block */
+static void md5_mb_gather(unsigned int words[16][MD5_MB_MAX_LANES], const unsigned char* const* blocks, unsigned int lanes){
+
+    unsigned int    lane;
+    unsigned int    i;
+
+    for (lane = 0; lane < lanes; lane++){
+        if (blocks[lane]){
+            for (i = 0; i < 16; i++){
+                memcpy(&words[i][lane], blocks[lane] + i * 4, 4);
+            }
+        }
+        else {
+            for (i = 0; i < 16; i++){
+                words[i][lane] = 0;
+            }
+        }
+    }
+}
+
+
+#define     VADD(a, b)      _mm_add_epi32((a), (b))
+#define     VSET1(t)        _mm_set1_epi32((int)(t))
+#define     VLOAD(i)        _mm_loadu_si128((const __m128i*)words[(i)])
+#define     VROTL(a, s)     _mm_or_si128(_mm_slli_epi32((a), (s)), _mm_srli_epi32((a), 32 - (s)))
+#define     VF(x, y, z)     _mm_xor_si128((z), _mm_and_si128((x), _mm_xor_si128((y), (z))))
+#define     VG(x, y, z)     _mm_xor_si128((y), _mm_and_si128((z), _mm_xor_si128((x), (y))))
+#define     VH(x, y, z)     _mm_xor_si128(_mm_xor_si128((x), (y)), (z))
+#define     VI(x, y, z)     _mm_xor_si128(_mm_xor_si128((y), _mm_andnot_si128((x), (z))), ones)
+
+MD5_MB_TARGET("sse2")
+static void md5_mb_transform_sse2(unsigned int* state, const unsigned char* const* blocks){
+
+    unsigned int    words[16][MD5_MB_MAX_LANES];
+    __m128i         ones = _mm_set1_epi32(-1);
+    __m128i         a = _mm_loadu_si128((const __m128i*)(state + 0));
+    __m128i         b = _mm_loadu_si128((const __m128i*)(state + 4));
+    __m128i         c = _mm_loadu_si128((const __m128i*)(state + 8));
+    __m128i         d = _mm_loadu_si128((const __m128i*)(state + 12));
+    __m128i         a0 = a, b0 = b, c0 = c, d0 = d;
+
+    md5_mb_gather(words, blocks, 4);
+
+    MD5_MB_ROUNDS
+
+    _mm_storeu_si128((__m128i*)(state + 0), VADD(a, a0));
+    _mm_storeu_si128((__m128i*)(state + 4), VADD(b, b0));
+    _mm_storeu_si128((__m128i*)(state + 8), VADD(c, c0));
+    _mm_storeu_si128((__m128i*)(state + 12), VADD(d, d0));
+}
+
+#undef      VADD
+#undef      VSET1
+#undef      VLOAD
+#undef      VROTL
+#undef      VF
+#undef      VG
+#undef      VH
+#undef      VI
+
+
+#define     VADD(a, b)      _mm256_add_epi32((a), (b))
+#define     VSET1(t)        _mm256_set1_epi32((int)(t))
+#define     VLOAD(i)        _mm256_loadu_si256((const __m256i*)words[(i)])
+#define     VROTL(a, s)     _mm256_or_si256(_mm256_slli_epi32((a), (s)), _mm256_srli_epi32((a), 32 - (s)))
+#define     VF(x, y, z)     _mm256_xor_si256((z), _mm256_and_si256((x), _mm256_xor_si256((y), (z))))
+#define     VG(x, y, z)     _mm256_xor_si256((y), _mm256_and_si256((z), _mm256_xor_si256((x), (y))))
+#define     VH(x, y, z)     _mm256_xor_si256(_mm256_xor_si256((x), (y)), (z))
+#define     VI(x, y, z)     _mm256_xor_si256(_mm256_xor_si256((y), _mm256_andnot_si256((x), (z))), ones)
+
+MD5_MB_TARGET("avx2")
+static void md5_mb_transform_avx2(unsigned int* state, const unsigned char* const* blocks){
+
+    unsigned int    words[16][MD5_MB_MAX_LANES];
+    __m256i         ones = _mm256_set1_epi32(-1);
+    __m256i         a = _mm256_loadu_si256((const __m256i*)(state + 0));
+    __m256i         b = _mm256_loadu_si256((const __m256i*)(state + 8));
+    __m256i         c = _mm256_loadu_si256((const __m256i*)(state + 16));
+    __m256i         d = _mm256_loadu_si256((const __m256i*)(state + 24));
+    __m256i         a0 = a, b0 = b, c0 = c, d0 = d;
+
+    md5_mb_gather(words, blocks, 8);
+
+    MD5_MB_ROUNDS
+
+    _mm256_storeu_si256((__m256i*)(state + 0), VADD(a, a0));
+    _mm256_storeu_si256((__m256i*)(state + 8), VADD(b, b0));
+    _mm256_storeu_si256((__m256i*)(state + 16), VADD(c, c0));
+    _mm256_storeu_si256((__m256i*)(state + 24), VADD(d, d0));
+}
+
+#undef      VADD
+#undef      VSET1
+#undef      VLOAD
+#undef      VROTL
+#undef      VF
+#undef      VG
+#undef      VH
+#undef      VI
+
+
+/* AVX-512 has native rotates, and a single ternary logic instruction for each round function */
+#define     VADD(a, b)      _mm512_add_epi32((a), (b))
+#define     VSET1(t)        _mm512_set1_epi32((int)(t))
+#define     VLOAD(i)        _mm512_loadu_si512((const void*)words[(i)])
+#define     VROTL(a, s)     _mm512_rol_epi32((a), (s))
+#define     VF(x, y, z)     _mm512_ternarylogic_epi32((x), (y), (z), 0xca)
+#define     VG(x, y, z)     _mm512_ternarylogic_epi32((x), (y), (z), 0xe4)
+#define     VH(x, y, z)     _mm512_ternarylogic_epi32((x), (y), (z), 0x96)
+#define     VI(x, y, z)     _mm512_ternarylogic_epi32((x), (y), (z), 0x39)
+
+MD5_MB_TARGET("avx512f")
+static void md5_mb_transform_avx512(unsigned int* state, const unsigned char* const* blocks){
+
+    unsigned int    words[16][MD5_MB_MAX_LANES];
+    __m512i         a = _mm512_loadu_si512((const void*)(state + 0));
+    __m512i         b = _mm512_loadu_si512((const void*)(state + 16));
+    __m512i         c = _mm512_loadu_si512((const void*)(state + 32));
+    __m512i         d = _mm512_loadu_si512((const void*)(state + 48));
+    __m512i         a0 = a, b0 = b, c0 = c, d0 = d;
+
+    md5_mb_gather(words, blocks, 16);
+
+    MD5_MB_ROUNDS
+
+    _mm512_storeu_si512((void*)(state + 0), VADD(a, a0));
+    _mm512_storeu_si512((void*)(state + 16), VADD(b, b0));
+    _mm512_storeu_si512((void*)(state + 32), VADD(c, c0));
+    _mm512_storeu_si512((void*)(state + 48), VADD(d, d0));
+}
+
+#undef      VADD
+#undef      VSET1
+#undef      VLOAD
+#undef      VROTL
+#undef      VF
+#undef      VG
+#undef      VH
+#undef      VI
+
+#endif
+
+
+/* Best first */
+static const MD5_MB_ENGINE md5MbEngines[] = {
+#ifdef MD5_MB_X86
+    { "avx512", 16, md5_mb_transform_avx512 },
+    { "avx2", 8, md5_mb_transform_avx2 },
+    { "sse2", 4, md5_mb_transform_sse2 },
+#endif
+    { "scalar", 1, md5_mb_transform_scalar }
+};
+
+#define     MD5_MB_ENGINE_NUMBER    (sizeof(md5MbEngines) / sizeof(md5MbEngines[0]))
+
+static const MD5_MB_ENGINE  *md5MbEngine = NULL;
+
+
+static deepviz_bool md5_mb_supported(const MD5_MB_ENGINE* engine){
+
+#if defined(MD5_MB_X86) && defined(_MSC_VER)
+    int                 info[4];
+    unsigned long long  xcr0 = 0;
+#endif
+
+    if (engine->transform == md5_mb_transform_scalar){
+        return deepviz_true;
+    }
+
+#if defined(MD5_MB_X86) && (defined(__GNUC__) || defined(__clang__))
+    __builtin_cpu_init();
+
+    if (engine->transform == md5_mb_transform_avx512) return __builtin_cpu_supports("avx512f") != 0;
+    if (engine->transform == md5_mb_transform_avx2) return __builtin_cpu_supports("avx2") != 0;
+    if (engine->transform == md5_mb_transform_sse2) return __builtin_cpu_supports("sse2") != 0;
+#elif defined(MD5_MB_X86) && defined(_MSC_VER)
+    __cpuid(info, 1);
+    if (engine->transform == md5_mb_transform_sse2) return (info[3] & (1 << 26)) != 0;
+
+    /* AVX registers must also be saved by the OS */
+    if (!(info[2] & (1 << 27))){
+        return deepviz_false;
+    }
+    xcr0 = _xgetbv(0);
+
+    __cpuidex(info, 7, 0);
+    if (engine->transform == md5_mb_transform_avx2) return (xcr0 & 0x06) == 0x06 && (info[1] & (1 << 5));
+    if (engine->transform == md5_mb_transform_avx512) return (xcr0 & 0xe6) == 0xe6 && (info[1] & (1 << 16));
+#endif
+
+    return deepviz_false;
+}
+
+
+static const MD5_MB_ENGINE* md5_mb_engine(void){
+
+    size_t  i;
+
+    if (!md5MbEngine){
+        for (i = 0; i < MD5_MB_ENGINE_NUMBER; i++){
+            if (md5_mb_supported(&md5MbEngines[i])){
+                md5MbEngine = &md5MbEngines[i];
+                break;
+            }
+        }
+    }
+
+    return md5MbEngine;
+}
+
+
+/* ============================ read-ahead ============================ */
+
+static void md5_mb_reader(void* param){
+
+    PMD5_MB_JOB     job = (PMD5_MB_JOB)param;
+    PMD5_MB_LANE    lane;
+    PMD5_MB_LANE    candidate;
+    PMD5_MB_CHUNK   chunk;
+    unsigned int    next = 0;
+    unsigned int    i;
+    deepviz_bool    active;
+    deepviz_bool    first;
+
+    dvz_mutex_lock(&job->lock);
+
+    for (;;){
+
+        /* Round robin over the lanes with a free chunk */
+        lane = NULL;
+        active = deepviz_false;
+
+        for (i = 0; i < job->lanes; i++){
+
+            candidate = &job->lane[(next + i) % job->lanes];
+            if (candidate->finished){
+                continue;
+            }
+
+            if (!candidate->hasFile && job->nextPath >= job->pathNumber){
+                candidate->finished = deepviz_true;
+                dvz_cond_signal(&job->readyCond);
+                continue;
+            }
+
+            active = deepviz_true;
+
+            if (candidate->writeCount - candidate->readCount < MD5_MB_READ_AHEAD){
+                lane = candidate;
+                next = (next + i + 1) % job->lanes;
+                break;
+            }
+        }
+
+        if (!active){
+            break;
+        }
+
+        if (!lane){
+            dvz_cond_wait(&job->spaceCond, &job->lock);
+            continue;
+        }
+
+        first = !lane->hasFile;
+        if (first){
+            lane->hasFile = deepviz_true;
+            lane->fileIndex = job->nextPath++;
+        }
+
+        chunk = &lane->chunk[lane->writeCount % MD5_MB_READ_AHEAD];
+
+        dvz_mutex_unlock(&job->lock);
+
+        if (first){
+            lane->file = fopen(job->paths[lane->fileIndex], "rb");
+#if defined(__linux__)
+            if (lane->file){
+                posix_fadvise(fileno(lane->file), 0, 0, POSIX_FADV_SEQUENTIAL);
+            }
+#endif
+        }
+
+        chunk->fileIndex = lane->fileIndex;
+        chunk->first = first;
+
+        if (!lane->file){
+            chunk->dataLen = 0;
+            chunk->last = deepviz_true;
+            chunk->error = deepviz_true;
+        }
+        else {
+            chunk->dataLen = fread(chunk->data, 1, MD5_MB_CHUNK_LEN, lane->file);
+            chunk->last = chunk->dataLen < MD5_MB_CHUNK_LEN;
+            chunk->error = chunk->last && ferror(lane->file);
+        }
+
+        if (chunk->last){
+            if (lane->file){
+                fclose(lane->file);
+                lane->file = NULL;
+            }
+            lane->hasFile = deepviz_false;
+        }
+
+        dvz_mutex_lock(&job->lock);
+
+        lane->writeCount++;
+        dvz_cond_signal(&job->readyCond);
+    }
+
+    dvz_mutex_unlock(&job->lock);
+}
+
+
+/* ============================ hashing ============================ */
+
+static void md5_mb_release(PMD5_MB_JOB job, PMD5_MB_LANE lane){
+
+    dvz_mutex_lock(&job->lock);
+
+    lane->readCount++;
+    lane->current = NULL;
+    dvz_cond_signal(&job->spaceCond);
+
+    dvz_mutex_unlock(&job->lock);
+}
+
+
+/* Next block of a lane, NULL when the lane has nothing left to hash. "final" is set on the last block of a file. */
+static const unsigned char* md5_mb_next_block(PMD5_MB_JOB job, unsigned int laneIndex, deepviz_bool* final){
+
+    PMD5_MB_LANE        lane = &job->lane[laneIndex];
+    const unsigned char *block;
+    size_t              remaining;
+    unsigned long long  bitLength;
+    deepviz_bool        available;
+    unsigned int        i;
+
+    (*final) = deepviz_false;
+
+    for (;;){
+
+        if (lane->tailIndex < lane->tailBlocks){
+            block = lane->tail + 64 * lane->tailIndex++;
+            (*final) = lane->tailIndex == lane->tailBlocks;
+            return block;
+        }
+
+        if (!lane->current){
+
+            dvz_mutex_lock(&job->lock);
+            while (lane->readCount == lane->writeCount && !lane->finished){
+                dvz_cond_wait(&job->readyCond, &job->lock);
+            }
+            available = lane->readCount != lane->writeCount;
+            dvz_mutex_unlock(&job->lock);
+
+            if (!available){
+                return NULL;
+            }
+
+            lane->current = &lane->chunk[lane->readCount % MD5_MB_READ_AHEAD];
+            lane->offset = 0;
+
+            if (lane->current->first){
+                for (i = 0; i < 4; i++){
+                    job->state[i * job->engine->lanes + laneIndex] = md5Iv[i];
+                }
+                lane->length = 0;
+            }
+
+            if (lane->current->error){
+                job->errors[lane->current->fileIndex] = deepviz_true;
+                md5_mb_release(job, lane);
+                continue;
+            }
+        }
+
+        remaining = lane->current->dataLen - lane->offset;
+
+        /* The chunk is released on the next call, once the block has been hashed */
+        if (remaining >= 64){
+            block = lane->current->data + lane->offset;
+            lane->offset += 64;
+            lane->length += 64;
+            return block;
+        }
+
+        if (!lane->current->last){
+            md5_mb_release(job, lane);
+            continue;
+        }
+
+        /* End of file: pad the remaining bytes */
+        memset(lane->tail, 0, sizeof(lane->tail));
+        memcpy(lane->tail, lane->current->data + lane->offset, remaining);
+        lane->tail[remaining] = 0x80;
+        lane->length += remaining;
+
+        lane->tailBlocks = remaining < 56 ? 1 : 2;
+        lane->tailIndex = 0;
+        lane->tailFileIndex = lane->current->fileIndex;
+
+        bitLength = lane->length * 8;
+        for (i = 0; i < 8; i++){
+            lane->tail[64 * lane->tailBlocks - 8 + i] = (unsigned char)(bitLength >> (i * 8));
+        }
+
+        md5_mb_release(job, lane);
+    }
+}
+
+
+static deepviz_bool md5_mb_run(PMD5_MB_JOB job){
+
+    const unsigned char *blocks[MD5_MB_MAX_LANES];
+    deepviz_bool        final[MD5_MB_MAX_LANES];
+    unsigned char       *buffer;
+    DEEPVIZ_THREAD      reader;
+    unsigned int        lanes = job->engine->lanes;
+    unsigned int        active;
+    unsigned int        i;
+    unsigned int        j;
+    size_t              fileIndex;
+
+    buffer = (unsigned char*)malloc((size_t)job->lanes * MD5_MB_READ_AHEAD * MD5_MB_CHUNK_LEN);
+    if (!buffer){
+        return deepviz_false;
+    }
+
+    for (i = 0; i < job->lanes; i++){
+        for (j = 0; j < MD5_MB_READ_AHEAD; j++){
+            job->lane[i].chunk[j].data = buffer + ((size_t)i * MD5_MB_READ_AHEAD + j) * MD5_MB_CHUNK_LEN;
+        }
+    }
+
+    if (!dvz_thread_create(&reader, md5_mb_reader, job)){
+        free(buffer);
+        return deepviz_false;
+    }
+
+    /* Lanes beyond job->lanes stay idle */
+    for (i = 0; i < lanes; i++){
+        blocks[i] = NULL;
+        final[i] = deepviz_false;
+    }
+
+    for (;;){
+
+        active = 0;
+        for (i = 0; i < job->lanes; i++){
+            blocks[i] = md5_mb_next_block(job, i, &final[i]);
+            if (blocks[i]){
+                active++;
+            }
+        }
+
+        if (!active){
+            break;
+        }
+
+        job->engine->transform(job->state, blocks);
+
+        for (i = 0; i < job->lanes; i++){
+            if (final[i]){
+                fileIndex = job->lane[i].tailFileIndex;
+                for (j = 0; j < DEEPVIZ_MD5_LEN; j++){
+                    job->digests[fileIndex][j] = (unsigned char)(job->state[(j / 4) * lanes + i] >> ((j % 4) * 8));
+                }
+            }
+        }
+    }
+
+    dvz_thread_join(reader);
+    free(buffer);
+
+    return deepviz_true;
+}
+
+
+void dvz_md5_files(const char** paths, size_t pathNumber, unsigned char (*digests)[DEEPVIZ_MD5_LEN], deepviz_bool* errors){
+
+    PMD5_MB_JOB     job;
+    size_t          i;
+    deepviz_bool    ret = deepviz_false;
+
+    if (!pathNumber){
+        return;
+    }
+
+    for (i = 0; i < pathNumber; i++){
+        errors[i] = deepviz_false;
+    }
+
+    job = (PMD5_MB_JOB)malloc(sizeof(MD5_MB_JOB));
+    if (job){
+
+        memset(job, 0, sizeof(MD5_MB_JOB));
+
+        /* A single stream gains nothing from the SIMD lanes */
+        job->engine = pathNumber == 1 ? &md5MbEngines[MD5_MB_ENGINE_NUMBER - 1] : md5_mb_engine();
+        job->lanes = pathNumber < job->engine->lanes ? (unsigned int)pathNumber : job->engine->lanes;
+        job->paths = paths;
+        job->pathNumber = pathNumber;
+        job->digests = digests;
+        job->errors = errors;
+
+        dvz_mutex_init(&job->lock);
+        dvz_cond_init(&job->readyCond);
+        dvz_cond_init(&job->spaceCond);
+
+        ret = md5_mb_run(job);
+
+        dvz_cond_destroy(&job->spaceCond);
+        dvz_cond_destroy(&job->readyCond);
+        dvz_mutex_destroy(&job->lock);
+        free(job);
+    }
+
+    /* No memory or thread for the pipeline: one file at a time */
+    if (!ret){
+        for (i = 0; i < pathNumber; i++){
+            errors[i] = !dvz_md5_file(paths[i], digests[i]);
+        }
+    }
+}
+
+
+EXPORT PDEEPVIZ_RESULT deepviz_md5_files(   const char** paths,
+                                            size_t pathNumber,
+                                            char md5[][DEEPVIZ_MD5_HEX_LEN]){
+
+    unsigned char       (*digests)[DEEPVIZ_MD5_LEN];
+    deepviz_bool        *errors;
+    char                *retMsg;
+    size_t              errorNumber = 0;
+    size_t              firstError = 0;
+    size_t              i;
+
+    retMsg = (char*)malloc(DEEPVIZ_ERROR_MAX_LEN);
+    if (!retMsg){
+        return deepviz_result_init(DEEPVIZ_STATUS_INTERNAL_ERROR, NULL);
+    }
+
+    if (!paths || !md5){
+        deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Invalid or missing parameters. Please try again!");
+        return deepviz_result_init(DEEPVIZ_STATUS_INPUT_ERROR, retMsg);
+    }
+
+    digests = (unsigned char(*)[DEEPVIZ_MD5_LEN])malloc(pathNumber * DEEPVIZ_MD5_LEN + 1);
+    errors = (deepviz_bool*)malloc(pathNumber * sizeof(deepviz_bool) + 1);
+    if (!digests || !errors){
+        if (digests) free(digests);
+        if (errors) free(errors);
+        deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Memory allocation error");
+        return deepviz_result_init(DEEPVIZ_STATUS_INTERNAL_ERROR, retMsg);
+    }
+
+    dvz_md5_files(paths, pathNumber, digests, errors);
+
+    for (i = 0; i < pathNumber; i++){
+        if (errors[i]){
+            if (!errorNumber){
+                firstError = i;
+            }
+            errorNumber++;
+            md5[i][0] = 0;
+        }
+        else {
+            dvz_md5_to_hex(digests[i], md5[i]);
+        }
+    }
+
+    free(digests);
+    free(errors);
+
+    if (errorNumber){
+        deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Error reading %u of %u files, first: \"%s\"",
+            (unsigned int)errorNumber, (unsigned int)pathNumber, paths[firstError]);
+        return deepviz_result_init(DEEPVIZ_STATUS_INPUT_ERROR, retMsg);
+    }
+
+    deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "%u files hashed", (unsigned int)pathNumber);
+    return deepviz_result_init(DEEPVIZ_STATUS_SUCCESS, retMsg);
+}
+
+
+EXPORT const char* deepviz_md5_engine(void){
+
+    return md5_mb_engine()->name;
+}
+
+
+EXPORT deepviz_bool deepviz_md5_set_engine(const char* name){
+
+    size_t  i;
+
+    for (i = 0; i < MD5_MB_ENGINE_NUMBER; i++){
+        if (name && !strcmp(name, md5MbEngines[i].name)){
+            if (!md5_mb_supported(&md5MbEngines[i])){
+                return deepviz_false;
+            }
+            md5MbEngine = &md5MbEngines[i];
+            return deepviz_true;
+        }
+    }
+
+    return deepviz_false;
+}
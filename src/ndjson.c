@@ -0,0 +1,576 @@
+/*
+* Copyright (c) 2016 Saferbytes s.r.l.s.
+*
+* You can redistribute it and/or modify it under the terms of the MIT license.
+* See LICENSE for details.
+*/
+
+#include "c-deepviz.h"
+#include "c-deepviz_private.h"
+
+#ifdef DEEPVIZ_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#include <errno.h>
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#endif
+
+/*
+* NDJSON output.
+* Records are serialized straight into a NDJSON_BUFFER_SIZE output buffer (jansson dumps the values
+* through a callback, strings are escaped in place) and the buffer is written when full. A chunk of at
+* least NDJSON_DIRECT_MIN bytes is not copied: it goes out together with the buffer in a single
+* writev(). With compression the records are staged in a smaller buffer and deflated into the output
+* buffer as a gzip stream, large chunks being deflated in place.
+*/
+
+#define     NDJSON_BUFFER_SIZE          (2 * 1024 * 1024)
+#define     NDJSON_STAGE_SIZE           (64 * 1024)
+#define     NDJSON_DIRECT_MIN           (64 * 1024)
+
+struct _DEEPVIZ_NDJSON_WRITER{
+    DEEPVIZ_MUTEX           lock;
+    int                     fd;
+    deepviz_bool            ownFd;                  /* Opened by deepviz_ndjson_open() */
+    char                    *buffer;                /* Output */
+    size_t                  used;
+    unsigned long long      records;
+    deepviz_bool            failed;
+    char                    errorMsg[DEEPVIZ_ERROR_MAX_LEN];
+#ifdef DEEPVIZ_HAVE_ZLIB
+    deepviz_bool            compress;
+    z_stream                zstream;
+    char                    *stage;                 /* Records not deflated yet */
+    size_t                  staged;
+#endif
+};
+
+
+static void ndjson_fail(PDEEPVIZ_NDJSON_WRITER writer, const char* what){
+
+    if (!writer->failed){
+        deepviz_sprintf(writer->errorMsg, DEEPVIZ_ERROR_MAX_LEN, "%s: %s", what, strerror(errno));
+        writer->failed = deepviz_true;
+    }
+}
+
+
+static deepviz_bool ndjson_write_all(PDEEPVIZ_NDJSON_WRITER writer, const char* data, size_t dataLen){
+
+#ifdef _WIN32
+    int         written;
+#else
+    ssize_t     written;
+#endif
+
+    while (dataLen && !writer->failed){
+#ifdef _WIN32
+        written = _write(writer->fd, data, dataLen > 0x40000000 ? 0x40000000 : (unsigned int)dataLen);
+#else
+        written = write(writer->fd, data, dataLen);
+        if (written < 0 && errno == EINTR){
+            continue;
+        }
+#endif
+        if (written <= 0){
+            ndjson_fail(writer, "Error writing the output");
+            break;
+        }
+        data += written;
+        dataLen -= (size_t)written;
+    }
+
+    return !writer->failed;
+}
+
+
+/* Write the output buffer, followed by "data" if any */
+static deepviz_bool ndjson_flush_buffer(PDEEPVIZ_NDJSON_WRITER writer, const char* data, size_t dataLen){
+
+#ifndef _WIN32
+    struct iovec    iov[2];
+    ssize_t         written;
+
+    if (writer->failed){
+        return deepviz_false;
+    }
+
+    iov[0].iov_base = writer->buffer;
+    iov[0].iov_len = writer->used;
+    iov[1].iov_base = (void*)data;
+    iov[1].iov_len = dataLen;
+
+    do{
+        written = writev(writer->fd, iov, dataLen ? 2 : 1);
+    } while (written < 0 && errno == EINTR);
+
+    if (written < 0){
+        ndjson_fail(writer, "Error writing the output");
+        return deepviz_false;
+    }
+
+    /* Short write: finish the job with write() */
+    if ((size_t)written < writer->used){
+        if (!ndjson_write_all(writer, writer->buffer + written, writer->used - (size_t)written)){
+            return deepviz_false;
+        }
+        written = (ssize_t)writer->used;
+    }
+
+    writer->used = 0;
+
+    return ndjson_write_all(writer, data + ((size_t)written - iov[0].iov_len), dataLen - ((size_t)written - iov[0].iov_len));
+#else
+    if (!ndjson_write_all(writer, writer->buffer, writer->used)){
+        return deepviz_false;
+    }
+
+    writer->used = 0;
+
+    return ndjson_write_all(writer, data, dataLen);
+#endif
+}
+
+
+/* Append to the output */
+static void ndjson_output(PDEEPVIZ_NDJSON_WRITER writer, const char* data, size_t dataLen){
+
+    if (dataLen <= NDJSON_BUFFER_SIZE - writer->used){
+        memcpy(writer->buffer + writer->used, data, dataLen);
+        writer->used += dataLen;
+    }
+    else if (dataLen >= NDJSON_DIRECT_MIN){
+        ndjson_flush_buffer(writer, data, dataLen);
+    }
+    else{
+        ndjson_flush_buffer(writer, NULL, 0);
+        memcpy(writer->buffer, data, dataLen);
+        writer->used = dataLen;
+    }
+}
+
+
+#ifdef DEEPVIZ_HAVE_ZLIB
+/* Deflate "data" into the output buffer */
+static void ndjson_deflate(PDEEPVIZ_NDJSON_WRITER writer, const char* data, size_t dataLen, int flush){
+
+    int     ret;
+
+    writer->zstream.next_in = (Bytef*)data;
+    writer->zstream.avail_in = (uInt)dataLen;
+
+    while (!writer->failed){
+        writer->zstream.next_out = (Bytef*)writer->buffer + writer->used;
+        writer->zstream.avail_out = (uInt)(NDJSON_BUFFER_SIZE - writer->used);
+
+        ret = deflate(&writer->zstream, flush);
+        writer->used = NDJSON_BUFFER_SIZE - writer->zstream.avail_out;
+
+        if (ret == Z_STREAM_ERROR){
+            deepviz_sprintf(writer->errorMsg, DEEPVIZ_ERROR_MAX_LEN, "Error compressing the output");
+            writer->failed = deepviz_true;
+            break;
+        }
+
+        if (writer->used == NDJSON_BUFFER_SIZE){
+            ndjson_flush_buffer(writer, NULL, 0);
+            continue;
+        }
+
+        /* Output space left: all the input has been consumed and flushed */
+        break;
+    }
+}
+#endif
+
+
+/* Append to the record stream */
+static void ndjson_put(PDEEPVIZ_NDJSON_WRITER writer, const char* data, size_t dataLen){
+
+    if (writer->failed){
+        return;
+    }
+
+#ifdef DEEPVIZ_HAVE_ZLIB
+    if (writer->compress){
+        if (dataLen <= NDJSON_STAGE_SIZE - writer->staged){
+            memcpy(writer->stage + writer->staged, data, dataLen);
+            writer->staged += dataLen;
+            return;
+        }
+
+        ndjson_deflate(writer, writer->stage, writer->staged, Z_NO_FLUSH);
+        writer->staged = 0;
+
+        if (dataLen >= NDJSON_DIRECT_MIN){
+            ndjson_deflate(writer, data, dataLen, Z_NO_FLUSH);
+        }
+        else{
+            memcpy(writer->stage, data, dataLen);
+            writer->staged = dataLen;
+        }
+        return;
+    }
+#endif
+
+    ndjson_output(writer, data, dataLen);
+}
+
+
+static void ndjson_put_string(PDEEPVIZ_NDJSON_WRITER writer, const char* str){
+
+    ndjson_put(writer, str, strlen(str));
+}
+
+
+/* Append "str" as a JSON string */
+static void ndjson_put_escaped(PDEEPVIZ_NDJSON_WRITER writer, const char* str){
+
+    static const char   hex[] = "0123456789abcdef";
+    const char          *start;
+    char                escape[6];
+    unsigned char       c;
+
+    ndjson_put(writer, "\"", 1);
+
+    for (start = str; (c = (unsigned char)*str) != 0; str++){
+        if (c >= 0x20 && c != '"' && c != '\\'){
+            continue;
+        }
+
+        ndjson_put(writer, start, str - start);
+        start = str + 1;
+
+        escape[0] = '\\';
+        switch (c){
+            case '"':   ndjson_put(writer, "\\\"", 2);      break;
+            case '\\':  ndjson_put(writer, "\\\\", 2);      break;
+            case '\n':  ndjson_put(writer, "\\n", 2);       break;
+            case '\r':  ndjson_put(writer, "\\r", 2);       break;
+            case '\t':  ndjson_put(writer, "\\t", 2);       break;
+            default:
+                escape[1] = 'u';
+                escape[2] = '0';
+                escape[3] = '0';
+                escape[4] = hex[c >> 4];
+                escape[5] = hex[c & 0xf];
+                ndjson_put(writer, escape, 6);
+                break;
+        }
+    }
+
+    ndjson_put(writer, start, str - start);
+    ndjson_put(writer, "\"", 1);
+}
+
+
+static int ndjson_dump_callback(const char* buffer, size_t size, void* data){
+
+    PDEEPVIZ_NDJSON_WRITER  writer = (PDEEPVIZ_NDJSON_WRITER)data;
+
+    ndjson_put(writer, buffer, size);
+
+    return writer->failed ? -1 : 0;
+}
+
+
+/* One record: {"source": ..., "category": ..., "hit": ...}, the missing members being left out */
+static void ndjson_record(PDEEPVIZ_NDJSON_WRITER writer, const char* source, const char* category, json_t* jsonHit,
+                            const char* hit){
+
+    ndjson_put(writer, "{", 1);
+
+    if (source){
+        ndjson_put_string(writer, "\"source\": ");
+        ndjson_put_escaped(writer, source);
+        ndjson_put(writer, ", ", 2);
+    }
+
+    if (category){
+        ndjson_put_string(writer, "\"category\": ");
+        ndjson_put_escaped(writer, category);
+        ndjson_put(writer, ", ", 2);
+    }
+
+    ndjson_put_string(writer, "\"hit\": ");
+    if (jsonHit){
+        json_dump_callback(jsonHit, ndjson_dump_callback, writer, JSON_ENCODE_ANY | JSON_COMPACT);
+    }
+    else{
+        ndjson_put_escaped(writer, hit);
+    }
+
+    ndjson_put(writer, "}\n", 2);
+
+    writer->records++;
+}
+
+
+static PDEEPVIZ_NDJSON_WRITER ndjson_init(int fd, deepviz_bool compress){
+
+    PDEEPVIZ_NDJSON_WRITER  writer;
+
+#ifndef DEEPVIZ_HAVE_ZLIB
+    if (compress){
+        return NULL;
+    }
+#endif
+
+    writer = (PDEEPVIZ_NDJSON_WRITER)malloc(sizeof(DEEPVIZ_NDJSON_WRITER));
+    if (!writer){
+        return NULL;
+    }
+
+    memset(writer, 0, sizeof(DEEPVIZ_NDJSON_WRITER));
+    writer->fd = fd;
+
+    writer->buffer = (char*)malloc(NDJSON_BUFFER_SIZE);
+    if (!writer->buffer){
+        free(writer);
+        return NULL;
+    }
+
+#ifdef DEEPVIZ_HAVE_ZLIB
+    if (compress){
+        writer->stage = (char*)malloc(NDJSON_STAGE_SIZE);
+
+        /* windowBits + 16: gzip stream */
+        if (!writer->stage ||
+            deflateInit2(&writer->zstream, Z_BEST_SPEED, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK){
+            if (writer->stage) free(writer->stage);
+            free(writer->buffer);
+            free(writer);
+            return NULL;
+        }
+        writer->compress = deepviz_true;
+    }
+#endif
+
+    dvz_mutex_init(&writer->lock);
+
+    return writer;
+}
+
+
+EXPORT PDEEPVIZ_NDJSON_WRITER deepviz_ndjson_open(const char* path, deepviz_bool compress){
+
+    PDEEPVIZ_NDJSON_WRITER  writer;
+    int                     fd;
+
+    if (!path){
+        return NULL;
+    }
+
+#ifdef _WIN32
+    fd = _open(path, _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#endif
+    if (fd < 0){
+        return NULL;
+    }
+
+    writer = ndjson_init(fd, compress);
+    if (!writer){
+#ifdef _WIN32
+        _close(fd);
+#else
+        close(fd);
+#endif
+        return NULL;
+    }
+
+    writer->ownFd = deepviz_true;
+
+    return writer;
+}
+
+
+EXPORT PDEEPVIZ_NDJSON_WRITER deepviz_ndjson_open_fd(int fd, deepviz_bool compress){
+
+    if (fd < 0){
+        return NULL;
+    }
+
+    return ndjson_init(fd, compress);
+}
+
+
+EXPORT deepviz_bool deepviz_ndjson_write_result(PDEEPVIZ_NDJSON_WRITER writer, const char* source, PDEEPVIZ_RESULT result){
+
+    json_t          *jsonData;
+    json_t          *jsonValue;
+    json_t          *jsonHit;
+    const char      *category;
+    size_t          i;
+    char            status[16];
+    deepviz_bool    ret;
+
+    if (!writer || !result){
+        return deepviz_false;
+    }
+
+    /* Successful results in any format */
+    jsonData = dvz_result_to_json(result);
+
+    dvz_mutex_lock(&writer->lock);
+
+    if (!jsonData){
+        /* Failed call, or a message that is not JSON */
+        ndjson_put(writer, "{", 1);
+        if (source){
+            ndjson_put_string(writer, "\"source\": ");
+            ndjson_put_escaped(writer, source);
+            ndjson_put(writer, ", ", 2);
+        }
+        deepviz_sprintf(status, sizeof(status), "%d", (int)result->status);
+        ndjson_put_string(writer, "\"status\": ");
+        ndjson_put_string(writer, status);
+        ndjson_put_string(writer, ", \"msg\": ");
+        ndjson_put_escaped(writer, result->msg && result->format == DEEPVIZ_FORMAT_JSON ? result->msg : "");
+        ndjson_put(writer, "}\n", 2);
+        writer->records++;
+    }
+    else if (json_is_array(jsonData)){
+        json_array_foreach(jsonData, i, jsonHit){
+            ndjson_record(writer, source, NULL, jsonHit, NULL);
+        }
+    }
+    else if (json_is_object(jsonData)){
+        /* One record per hit of each list, one per indicator otherwise */
+        json_object_foreach(jsonData, category, jsonValue){
+            if (json_is_array(jsonValue)){
+                json_array_foreach(jsonValue, i, jsonHit){
+                    ndjson_record(writer, source, category, jsonHit, NULL);
+                }
+            }
+            else{
+                ndjson_record(writer, source, category, jsonValue, NULL);
+            }
+        }
+    }
+    else{
+        ndjson_record(writer, source, NULL, jsonData, NULL);
+    }
+
+    ret = !writer->failed;
+
+    dvz_mutex_unlock(&writer->lock);
+
+    if (jsonData) json_decref(jsonData);
+
+    return ret;
+}
+
+
+EXPORT deepviz_bool deepviz_ndjson_search_sink(void* context, const char* category, const char* hit){
+
+    PDEEPVIZ_NDJSON_WRITER  writer = (PDEEPVIZ_NDJSON_WRITER)context;
+    deepviz_bool            ret;
+
+    if (!writer || !hit){
+        return deepviz_false;
+    }
+
+    dvz_mutex_lock(&writer->lock);
+
+    /* Structured hits are written as they are, not as the string of their JSON text */
+    ndjson_record(writer, NULL, category, dvz_search_sink_json(hit), hit);
+    ret = !writer->failed;
+
+    dvz_mutex_unlock(&writer->lock);
+
+    return ret;
+}
+
+
+EXPORT deepviz_bool deepviz_ndjson_flush(PDEEPVIZ_NDJSON_WRITER writer){
+
+    deepviz_bool    ret;
+
+    if (!writer){
+        return deepviz_false;
+    }
+
+    dvz_mutex_lock(&writer->lock);
+
+#ifdef DEEPVIZ_HAVE_ZLIB
+    if (writer->compress && !writer->failed){
+        /* Everything written so far can be decompressed */
+        ndjson_deflate(writer, writer->stage, writer->staged, Z_SYNC_FLUSH);
+        writer->staged = 0;
+    }
+#endif
+
+    ret = ndjson_flush_buffer(writer, NULL, 0);
+
+    dvz_mutex_unlock(&writer->lock);
+
+    return ret;
+}
+
+
+EXPORT PDEEPVIZ_RESULT deepviz_ndjson_close(PDEEPVIZ_NDJSON_WRITER* writer){
+
+    PDEEPVIZ_NDJSON_WRITER  oldWriter;
+    DEEPVIZ_RESULT_STATUS   status = DEEPVIZ_STATUS_SUCCESS;
+    char                    *retMsg;
+
+    retMsg = (char*)malloc(DEEPVIZ_ERROR_MAX_LEN);
+    if (!retMsg){
+        return deepviz_result_init(DEEPVIZ_STATUS_INTERNAL_ERROR, NULL);
+    }
+
+    if (!writer || !(*writer)){
+        deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Invalid or missing parameters. Please try again!");
+        return deepviz_result_init(DEEPVIZ_STATUS_INPUT_ERROR, retMsg);
+    }
+
+    oldWriter = (*writer);
+    (*writer) = NULL;
+
+#ifdef DEEPVIZ_HAVE_ZLIB
+    if (oldWriter->compress){
+        if (!oldWriter->failed){
+            ndjson_deflate(oldWriter, oldWriter->stage, oldWriter->staged, Z_FINISH);
+        }
+        deflateEnd(&oldWriter->zstream);
+        free(oldWriter->stage);
+    }
+#endif
+
+    ndjson_flush_buffer(oldWriter, NULL, 0);
+
+    if (oldWriter->ownFd){
+#ifdef _WIN32
+        if (_close(oldWriter->fd)){
+#else
+        if (close(oldWriter->fd)){
+#endif
+            ndjson_fail(oldWriter, "Error closing the output");
+        }
+    }
+
+    if (oldWriter->failed){
+        status = DEEPVIZ_STATUS_INTERNAL_ERROR;
+        deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "%s", oldWriter->errorMsg);
+    }
+    else{
+        deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "%llu records written", oldWriter->records);
+    }
+
+    dvz_mutex_destroy(&oldWriter->lock);
+    free(oldWriter->buffer);
+    free(oldWriter);
+
+    return deepviz_result_init(status, retMsg);
+}
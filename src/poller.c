@@ -0,0 +1,571 @@
+/*
+* Copyright (c) 2016 Saferbytes s.r.l.s.
+*
+* You can redistribute it and/or modify it under the terms of the MIT license.
+* See LICENSE for details.
+*/
+
+#include "c-deepviz.h"
+#include "c-deepviz_private.h"
+
+/*
+* Result poller.
+* Every item waiting for a result (sample MD5, bulk request ID) sits in a hierarchical timer wheel:
+* POLLER_LEVELS levels of POLLER_SLOTS slots, each level POLLER_SLOTS times coarser than the one below.
+* Scheduling is O(1) whatever the number of items; the scheduler thread advances the wheel one tick
+* at a time, moving the items of a coarse slot down a level when the finer level wraps, and hands the
+* items of the current slot to a pool of poll workers. An item answered DEEPVIZ_STATUS_PROCESSING goes
+* back into the wheel with its own delay multiplied by its backoff; any other answer is final and is
+* reported to the callback.
+*/
+
+#define     POLLER_TICK_MS              100
+#define     POLLER_SLOT_BITS            6
+#define     POLLER_SLOTS                (1 << POLLER_SLOT_BITS)
+#define     POLLER_LEVELS               4               /* 64^4 ticks: about 19 days */
+#define     POLLER_MAX_TICKS            ((1ULL << (POLLER_SLOT_BITS * POLLER_LEVELS)) - 1)
+#define     POLLER_JITTER_PERCENT       10
+
+typedef struct _POLL_ITEM{
+    struct _POLL_ITEM       *next;
+    DEEPVIZ_POLL_TYPE       type;
+    DEEPVIZ_POLL_SCHEDULE   schedule;
+    unsigned long long      expires;                /* Tick */
+    unsigned long long      deadline;               /* dvz_time_ms(), 0 = none */
+    double                  delayMs;                /* Delay before the next poll */
+    char                    *path;                  /* Bulk downloads only */
+    char                    id[DEEPVIZ_ID_REQUEST_MAX_LEN];
+}POLL_ITEM, *PPOLL_ITEM;
+
+struct _DEEPVIZ_POLLER{
+    DEEPVIZ_MUTEX           lock;
+    DEEPVIZ_COND            wakeCond;               /* Scheduler: items added to an empty wheel, or stop */
+    DEEPVIZ_COND            readyCond;              /* Workers: items due */
+    DEEPVIZ_COND            idleCond;               /* deepviz_poller_wait(): no items left */
+    PPOLL_ITEM              wheel[POLLER_LEVELS][POLLER_SLOTS];
+    unsigned long long      currentTick;
+    unsigned long long      startTime;
+    size_t                  scheduled;              /* Items in the wheel */
+    size_t                  pending;                /* Items not completed yet */
+    PPOLL_ITEM              readyHead;
+    PPOLL_ITEM              readyTail;
+    unsigned int            random;
+    deepviz_bool            stop;
+    const char              *api_key;
+    DEEPVIZ_POLL_SCHEDULE   schedule;
+    DEEPVIZ_POLL_CALLBACK   callback;
+    void                    *context;
+    PDEEPVIZ_CANCEL_TOKEN   token;                  /* Aborts the polls in progress on stop */
+    DEEPVIZ_THREAD          scheduler;
+    deepviz_bool            schedulerStarted;
+    DEEPVIZ_THREAD          *threads;
+    size_t                  threadNumber;
+};
+
+
+static unsigned long long poller_now_tick(PDEEPVIZ_POLLER poller){
+
+    return (dvz_time_ms() - poller->startTime) / POLLER_TICK_MS;
+}
+
+
+static void poller_item_free(PPOLL_ITEM item){
+
+    if (item->path) free(item->path);
+    free(item);
+}
+
+
+/* Place an item in the slot of its expiration tick. Called with the lock held. */
+static void poller_wheel_insert(PDEEPVIZ_POLLER poller, PPOLL_ITEM item){
+
+    unsigned long long  delta;
+    size_t              level;
+    size_t              slot;
+
+    if (item->expires < poller->currentTick){
+        item->expires = poller->currentTick;
+    }
+
+    delta = item->expires - poller->currentTick;
+    if (delta > POLLER_MAX_TICKS){
+        item->expires = poller->currentTick + POLLER_MAX_TICKS;
+        delta = POLLER_MAX_TICKS;
+    }
+
+    for (level = 0; level < POLLER_LEVELS - 1; level++){
+        if (delta < (1ULL << (POLLER_SLOT_BITS * (level + 1)))){
+            break;
+        }
+    }
+
+    slot = (size_t)(item->expires >> (POLLER_SLOT_BITS * level)) & (POLLER_SLOTS - 1);
+
+    item->next = poller->wheel[level][slot];
+    poller->wheel[level][slot] = item;
+}
+
+
+/* Schedule the next poll of an item, "delayMs" from now with some jitter. Called with the lock held. */
+static void poller_schedule(PDEEPVIZ_POLLER poller, PPOLL_ITEM item){
+
+    unsigned long long  now = dvz_time_ms();
+    unsigned long long  delay;
+    unsigned int        jitter;
+
+    /* Nothing in the wheel: skip the idle ticks at once */
+    if (!poller->scheduled){
+        poller->currentTick = (now - poller->startTime) / POLLER_TICK_MS;
+        dvz_cond_signal(&poller->wakeCond);
+    }
+
+    /* Spread the items added together, so that their polls do not stay in lockstep */
+    poller->random ^= poller->random << 13;
+    poller->random ^= poller->random >> 17;
+    poller->random ^= poller->random << 5;
+    jitter = poller->random % (2 * POLLER_JITTER_PERCENT + 1);
+
+    delay = (unsigned long long)(item->delayMs * (100 - POLLER_JITTER_PERCENT + jitter) / 100);
+    if (item->deadline && now + delay > item->deadline){
+        delay = item->deadline > now ? item->deadline - now : 0;
+    }
+
+    /* Rounded up: never polled before its delay */
+    item->expires = (now - poller->startTime + delay + POLLER_TICK_MS - 1) / POLLER_TICK_MS;
+    if (item->expires <= poller->currentTick){
+        item->expires = poller->currentTick + 1;
+    }
+
+    poller_wheel_insert(poller, item);
+    poller->scheduled++;
+}
+
+
+/* Advance the wheel by one tick and queue the items due. Called with the lock held. */
+static void poller_tick(PDEEPVIZ_POLLER poller){
+
+    PPOLL_ITEM  item;
+    PPOLL_ITEM  next;
+    size_t      level;
+    size_t      slot;
+
+    poller->currentTick++;
+
+    /* Every time a level wraps, the next slot of the level above is spread over the levels below */
+    for (level = 1; level < POLLER_LEVELS; level++){
+
+        if (poller->currentTick & ((1ULL << (POLLER_SLOT_BITS * level)) - 1)){
+            break;
+        }
+
+        slot = (size_t)(poller->currentTick >> (POLLER_SLOT_BITS * level)) & (POLLER_SLOTS - 1);
+        item = poller->wheel[level][slot];
+        poller->wheel[level][slot] = NULL;
+
+        for (; item; item = next){
+            next = item->next;
+            poller_wheel_insert(poller, item);
+        }
+    }
+
+    slot = (size_t)poller->currentTick & (POLLER_SLOTS - 1);
+    item = poller->wheel[0][slot];
+    poller->wheel[0][slot] = NULL;
+
+    for (; item; item = next){
+        next = item->next;
+        item->next = NULL;
+        if (poller->readyTail){
+            poller->readyTail->next = item;
+        }
+        else {
+            poller->readyHead = item;
+        }
+        poller->readyTail = item;
+        poller->scheduled--;
+    }
+}
+
+
+static void poller_scheduler_thread(void* param){
+
+    PDEEPVIZ_POLLER     poller = (PDEEPVIZ_POLLER)param;
+    unsigned long long  nowTick;
+    unsigned long long  elapsed;
+
+    dvz_mutex_lock(&poller->lock);
+
+    while (!poller->stop){
+
+        if (!poller->scheduled){
+            dvz_cond_wait(&poller->wakeCond, &poller->lock);
+            continue;
+        }
+
+        nowTick = poller_now_tick(poller);
+        while (poller->currentTick < nowTick && poller->scheduled){
+            poller_tick(poller);
+        }
+
+        if (poller->readyHead){
+            dvz_cond_broadcast(&poller->readyCond);
+        }
+
+        if (poller->scheduled){
+            elapsed = (dvz_time_ms() - poller->startTime) % POLLER_TICK_MS;
+            dvz_cond_timedwait(&poller->wakeCond, &poller->lock, (unsigned int)(POLLER_TICK_MS - elapsed));
+        }
+    }
+
+    dvz_mutex_unlock(&poller->lock);
+}
+
+
+static PDEEPVIZ_RESULT poller_poll(PDEEPVIZ_POLLER poller, PPOLL_ITEM item){
+
+    switch (item->type){
+    case DEEPVIZ_POLL_SAMPLE_RESULT:
+        return deepviz_sample_result(item->id, poller->api_key);
+    case DEEPVIZ_POLL_SAMPLE_REPORT:
+        return deepviz_sample_report(item->id, poller->api_key);
+    case DEEPVIZ_POLL_BULK_DOWNLOAD:
+        return deepviz_bulk_download_retrieve(item->id, item->path, poller->api_key);
+    default:
+        return NULL;
+    }
+}
+
+
+static void poller_worker_thread(void* param){
+
+    PDEEPVIZ_POLLER     poller = (PDEEPVIZ_POLLER)param;
+    PPOLL_ITEM          item;
+    PDEEPVIZ_RESULT     result;
+
+    deepviz_cancel_token_attach(poller->token);
+
+    dvz_mutex_lock(&poller->lock);
+
+    while (!poller->stop){
+
+        item = poller->readyHead;
+        if (!item){
+            dvz_cond_wait(&poller->readyCond, &poller->lock);
+            continue;
+        }
+
+        poller->readyHead = item->next;
+        if (!poller->readyHead){
+            poller->readyTail = NULL;
+        }
+
+        dvz_mutex_unlock(&poller->lock);
+
+        result = poller_poll(poller, item);
+
+        dvz_mutex_lock(&poller->lock);
+
+        if (poller->stop){
+            /* Dropped, like the items still waiting */
+            deepviz_result_free(&result);
+            poller_item_free(item);
+            break;
+        }
+
+        if (result && result->status == DEEPVIZ_STATUS_PROCESSING &&
+            (!item->deadline || dvz_time_ms() < item->deadline)){
+
+            deepviz_result_free(&result);
+
+            item->delayMs *= item->schedule.backoff;
+            if (item->delayMs > item->schedule.maxDelayMs){
+                item->delayMs = item->schedule.maxDelayMs;
+            }
+
+            poller_schedule(poller, item);
+            continue;
+        }
+
+        dvz_mutex_unlock(&poller->lock);
+
+        if (poller->callback){
+            poller->callback(poller->context, item->type, item->id, result);
+        }
+
+        deepviz_result_free(&result);
+        poller_item_free(item);
+
+        dvz_mutex_lock(&poller->lock);
+
+        if (!(--poller->pending)){
+            dvz_cond_broadcast(&poller->idleCond);
+        }
+    }
+
+    dvz_mutex_unlock(&poller->lock);
+}
+
+
+EXPORT void deepviz_poller_default_config(PDEEPVIZ_POLLER_CONFIG config){
+
+    if (!config){
+        return;
+    }
+
+    memset(config, 0, sizeof(DEEPVIZ_POLLER_CONFIG));
+    config->threads = DEEPVIZ_DEFAULT_THREADS;
+    config->schedule.initialDelayMs = DEEPVIZ_POLL_DEFAULT_INITIAL_MS;
+    config->schedule.maxDelayMs = DEEPVIZ_POLL_DEFAULT_MAX_MS;
+    config->schedule.backoff = DEEPVIZ_POLL_DEFAULT_BACKOFF;
+    config->schedule.timeoutMs = 0;
+}
+
+
+EXPORT PDEEPVIZ_RESULT deepviz_poller_start(const char* api_key,
+                                            PDEEPVIZ_POLLER_CONFIG config,
+                                            PDEEPVIZ_POLLER* poller){
+
+    PDEEPVIZ_POLLER         newPoller;
+    DEEPVIZ_POLLER_CONFIG   defaultConfig;
+    char                    *retMsg;
+    size_t                  i;
+
+    retMsg = (char*)malloc(DEEPVIZ_ERROR_MAX_LEN);
+    if (!retMsg){
+        return deepviz_result_init(DEEPVIZ_STATUS_INTERNAL_ERROR, NULL);
+    }
+
+    if (!api_key || !poller){
+        deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Invalid or missing parameters. Please try again!");
+        return deepviz_result_init(DEEPVIZ_STATUS_INPUT_ERROR, retMsg);
+    }
+
+    (*poller) = NULL;
+
+    if (!config){
+        deepviz_poller_default_config(&defaultConfig);
+        config = &defaultConfig;
+    }
+
+    newPoller = (PDEEPVIZ_POLLER)malloc(sizeof(DEEPVIZ_POLLER));
+    if (!newPoller){
+        deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Memory allocation error");
+        return deepviz_result_init(DEEPVIZ_STATUS_INTERNAL_ERROR, retMsg);
+    }
+
+    memset(newPoller, 0, sizeof(DEEPVIZ_POLLER));
+    newPoller->api_key = api_key;
+    newPoller->schedule = config->schedule;
+    newPoller->callback = config->callback;
+    newPoller->context = config->context;
+    newPoller->threadNumber = config->threads ? config->threads : DEEPVIZ_DEFAULT_THREADS;
+    newPoller->startTime = dvz_time_ms();
+    newPoller->random = (unsigned int)dvz_hash(&newPoller, sizeof(newPoller)) | 1;
+
+    newPoller->threads = (DEEPVIZ_THREAD*)calloc(newPoller->threadNumber, sizeof(DEEPVIZ_THREAD));
+    newPoller->token = deepviz_cancel_token_init();
+    if (!newPoller->threads || !newPoller->token){
+        if (newPoller->threads) free(newPoller->threads);
+        deepviz_cancel_token_free(&newPoller->token);
+        free(newPoller);
+        deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Memory allocation error");
+        return deepviz_result_init(DEEPVIZ_STATUS_INTERNAL_ERROR, retMsg);
+    }
+
+    dvz_mutex_init(&newPoller->lock);
+    dvz_cond_init(&newPoller->wakeCond);
+    dvz_cond_init(&newPoller->readyCond);
+    dvz_cond_init(&newPoller->idleCond);
+
+    newPoller->schedulerStarted = dvz_thread_create(&newPoller->scheduler, poller_scheduler_thread, newPoller);
+    if (!newPoller->schedulerStarted){
+        newPoller->threadNumber = 0;
+        deepviz_poller_stop(&newPoller);
+        deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Error creating the poller threads");
+        return deepviz_result_init(DEEPVIZ_STATUS_INTERNAL_ERROR, retMsg);
+    }
+
+    for (i = 0; i < newPoller->threadNumber; i++){
+        if (!dvz_thread_create(&newPoller->threads[i], poller_worker_thread, newPoller)){
+            newPoller->threadNumber = i;
+            deepviz_poller_stop(&newPoller);
+            deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Error creating the poller threads");
+            return deepviz_result_init(DEEPVIZ_STATUS_INTERNAL_ERROR, retMsg);
+        }
+    }
+
+    (*poller) = newPoller;
+
+    deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Poller started");
+    return deepviz_result_init(DEEPVIZ_STATUS_SUCCESS, retMsg);
+}
+
+
+EXPORT deepviz_bool deepviz_poller_add(PDEEPVIZ_POLLER poller,
+                                        DEEPVIZ_POLL_TYPE type,
+                                        const char* id,
+                                        const char* path,
+                                        PDEEPVIZ_POLL_SCHEDULE schedule){
+
+    PPOLL_ITEM      item;
+
+    if (!poller || !id || strlen(id) >= DEEPVIZ_ID_REQUEST_MAX_LEN || type > DEEPVIZ_POLL_BULK_DOWNLOAD ||
+        (type == DEEPVIZ_POLL_BULK_DOWNLOAD && !path)){
+        return deepviz_false;
+    }
+
+    item = (PPOLL_ITEM)malloc(sizeof(POLL_ITEM));
+    if (!item){
+        return deepviz_false;
+    }
+
+    memset(item, 0, sizeof(POLL_ITEM));
+    item->type = type;
+    item->schedule = schedule ? (*schedule) : poller->schedule;
+    memcpy(item->id, id, strlen(id) + 1);
+
+    if (type == DEEPVIZ_POLL_BULK_DOWNLOAD){
+#ifdef _WIN32
+        item->path = _strdup(path);
+#else
+        item->path = strdup(path);
+#endif
+        if (!item->path){
+            free(item);
+            return deepviz_false;
+        }
+    }
+
+    if (item->schedule.backoff < 1.0){
+        item->schedule.backoff = 1.0;
+    }
+
+    if (item->schedule.maxDelayMs < item->schedule.initialDelayMs){
+        item->schedule.maxDelayMs = item->schedule.initialDelayMs;
+    }
+
+    item->delayMs = item->schedule.initialDelayMs;
+    if (item->schedule.timeoutMs){
+        item->deadline = dvz_time_ms() + item->schedule.timeoutMs;
+    }
+
+    dvz_mutex_lock(&poller->lock);
+
+    if (poller->stop){
+        dvz_mutex_unlock(&poller->lock);
+        poller_item_free(item);
+        return deepviz_false;
+    }
+
+    poller_schedule(poller, item);
+    poller->pending++;
+
+    dvz_mutex_unlock(&poller->lock);
+
+    return deepviz_true;
+}
+
+
+EXPORT size_t deepviz_poller_pending(PDEEPVIZ_POLLER poller){
+
+    size_t  pending;
+
+    if (!poller){
+        return 0;
+    }
+
+    dvz_mutex_lock(&poller->lock);
+    pending = poller->pending;
+    dvz_mutex_unlock(&poller->lock);
+
+    return pending;
+}
+
+
+EXPORT deepviz_bool deepviz_poller_wait(PDEEPVIZ_POLLER poller, unsigned int timeoutMs){
+
+    unsigned long long  deadline = dvz_time_ms() + timeoutMs;
+    unsigned long long  now;
+    deepviz_bool        idle;
+
+    if (!poller){
+        return deepviz_true;
+    }
+
+    dvz_mutex_lock(&poller->lock);
+
+    while (poller->pending){
+        if (!timeoutMs){
+            dvz_cond_wait(&poller->idleCond, &poller->lock);
+            continue;
+        }
+        now = dvz_time_ms();
+        if (now >= deadline){
+            break;
+        }
+        dvz_cond_timedwait(&poller->idleCond, &poller->lock, (unsigned int)(deadline - now));
+    }
+
+    idle = !poller->pending;
+
+    dvz_mutex_unlock(&poller->lock);
+
+    return idle;
+}
+
+
+EXPORT void deepviz_poller_stop(PDEEPVIZ_POLLER* poller){
+
+    PDEEPVIZ_POLLER     oldPoller;
+    PPOLL_ITEM          item;
+    PPOLL_ITEM          next;
+    size_t              level;
+    size_t              slot;
+    size_t              i;
+
+    if (!poller || !(*poller)){
+        return;
+    }
+
+    oldPoller = (*poller);
+    (*poller) = NULL;
+
+    dvz_mutex_lock(&oldPoller->lock);
+    oldPoller->stop = deepviz_true;
+    dvz_cond_broadcast(&oldPoller->wakeCond);
+    dvz_cond_broadcast(&oldPoller->readyCond);
+    dvz_mutex_unlock(&oldPoller->lock);
+
+    /* Abort the polls in progress */
+    deepviz_cancel(oldPoller->token);
+
+    if (oldPoller->schedulerStarted){
+        dvz_thread_join(oldPoller->scheduler);
+    }
+
+    for (i = 0; i < oldPoller->threadNumber; i++){
+        dvz_thread_join(oldPoller->threads[i]);
+    }
+
+    for (level = 0; level < POLLER_LEVELS; level++){
+        for (slot = 0; slot < POLLER_SLOTS; slot++){
+            for (item = oldPoller->wheel[level][slot]; item; item = next){
+                next = item->next;
+                poller_item_free(item);
+            }
+        }
+    }
+
+    for (item = oldPoller->readyHead; item; item = next){
+        next = item->next;
+        poller_item_free(item);
+    }
+
+    dvz_cond_destroy(&oldPoller->idleCond);
+    dvz_cond_destroy(&oldPoller->readyCond);
+    dvz_cond_destroy(&oldPoller->wakeCond);
+    dvz_mutex_destroy(&oldPoller->lock);
+    deepviz_cancel_token_free(&oldPoller->token);
+    free(oldPoller->threads);
+    free(oldPoller);
+}
@@ -0,0 +1,127 @@
+/*
+* Copyright (c) 2016 Saferbytes s.r.l.s.
+*
+* You can redistribute it and/or modify it under the terms of the MIT license.
+* See LICENSE for details.
+*/
+
+#include "c-deepviz.h"
+#include "c-deepviz_private.h"
+
+/*
+* Transfer progress.
+* The HTTP layer feeds every transfer's byte counters to dvz_progress_update() (curl's transfer-info
+* hook on Linux, the response read loop on Windows). Every PROGRESS_SAMPLE_MS the instantaneous rate is
+* measured over the last sample and the callback is called; a last call reports how the transfer ended.
+*/
+
+#define     PROGRESS_SAMPLE_MS      250
+
+static DEEPVIZ_PROGRESS_CALLBACK    progressCallback = NULL;
+static void                         *progressContext = NULL;
+static DEEPVIZ_MUTEX                progressLock;
+static DEEPVIZ_ONCE                 progressOnce = DEEPVIZ_ONCE_INIT;
+
+
+static void progress_init_once(void){
+
+    dvz_mutex_init(&progressLock);
+}
+
+
+EXPORT void deepviz_progress_callback_set(DEEPVIZ_PROGRESS_CALLBACK callback, void* context){
+
+    dvz_once(&progressOnce, progress_init_once);
+
+    dvz_mutex_lock(&progressLock);
+    progressCallback = callback;
+    progressContext = context;
+    dvz_mutex_unlock(&progressLock);
+}
+
+
+deepviz_bool dvz_progress_begin(PDEEPVIZ_PROGRESS_STATE state, const char* page, const char* filePath){
+
+    memset(state, 0, sizeof(DEEPVIZ_PROGRESS_STATE));
+
+    if (!progressCallback){
+        return deepviz_false;
+    }
+
+    dvz_once(&progressOnce, progress_init_once);
+
+    dvz_mutex_lock(&progressLock);
+    state->callback = progressCallback;
+    state->context = progressContext;
+    dvz_mutex_unlock(&progressLock);
+
+    if (!state->callback){
+        return deepviz_false;
+    }
+
+    state->progress.page = page;
+    state->progress.filePath = filePath;
+    state->startTime = dvz_time_ms();
+    state->lastTime = state->startTime;
+
+    return deepviz_true;
+}
+
+
+deepviz_bool dvz_progress_update(PDEEPVIZ_PROGRESS_STATE state, unsigned long long uploaded, unsigned long long uploadTotal,
+                                    unsigned long long downloaded, unsigned long long downloadTotal){
+
+    PDEEPVIZ_PROGRESS   progress = &state->progress;
+    unsigned long long  now;
+    unsigned long long  bytes;
+
+    if (!state->callback){
+        return deepviz_true;
+    }
+
+    progress->uploaded = uploaded;
+    progress->uploadTotal = uploadTotal;
+    progress->downloaded = downloaded;
+    progress->downloadTotal = downloadTotal;
+
+    now = dvz_time_ms();
+    if (now - state->lastTime < PROGRESS_SAMPLE_MS){
+        return deepviz_true;
+    }
+
+    bytes = uploaded + downloaded;
+
+    progress->elapsedMs = now - state->startTime;
+    progress->rate = (double)(bytes - state->lastBytes) * 1000.0 / (double)(now - state->lastTime);
+    progress->averageRate = (double)bytes * 1000.0 / (double)progress->elapsedMs;
+
+    state->lastTime = now;
+    state->lastBytes = bytes;
+
+    if (!state->callback(state->context, progress)){
+        state->aborted = deepviz_true;
+        return deepviz_false;
+    }
+
+    return deepviz_true;
+}
+
+
+void dvz_progress_end(PDEEPVIZ_PROGRESS_STATE state, deepviz_bool succeeded){
+
+    PDEEPVIZ_PROGRESS   progress = &state->progress;
+
+    if (!state->callback){
+        return;
+    }
+
+    progress->elapsedMs = dvz_time_ms() - state->startTime;
+    progress->averageRate = progress->elapsedMs ?
+        (double)(progress->uploaded + progress->downloaded) * 1000.0 / (double)progress->elapsedMs : 0;
+    progress->rate = progress->averageRate;
+    progress->done = deepviz_true;
+    progress->failed = !succeeded;
+    progress->cancelled = !succeeded && (state->aborted || dvz_cancel_requested());
+
+    state->callback(state->context, progress);
+}
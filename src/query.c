@@ -0,0 +1,233 @@
+/*
+* Copyright (c) 2016 Saferbytes s.r.l.s.
+*
+* You can redistribute it and/or modify it under the terms of the MIT license.
+* See LICENSE for details.
+*/
+
+#include "c-deepviz.h"
+#include "c-deepviz_private.h"
+
+/*
+* Compiled advanced search queries.
+* The filters of a query are collected once and serialized by deepviz_query_compile() into the request
+* without its closing brace. "time_delta" and the result set are kept out of it: every run appends them
+* to a copy of the request and sends it, so a saved query costs a buffer splice per page instead of
+* rebuilding and serializing the whole JSON request.
+*/
+
+struct _DEEPVIZ_QUERY{
+    json_t                  *jsonObj;               /* Until compiled */
+    char                    *request;               /* Once compiled */
+    char                    *timeDelta;
+};
+
+static const char* queryFieldNames[] = {
+    "sim_hash",
+    "created_files",
+    "imp_hash",
+    "url",
+    "strings",
+    "ip",
+    "asn",
+    "rules",
+    "country",
+    "domain",
+    "classification",
+    "never_seen",
+    "time_delta",
+    "ip_range",
+};
+
+
+static char* query_strdup(const char* str){
+
+    if (!str){
+        return NULL;
+    }
+
+#ifdef _WIN32
+    return _strdup(str);
+#else
+    return strdup(str);
+#endif
+}
+
+
+EXPORT PDEEPVIZ_QUERY deepviz_query_init(const char* api_key){
+
+    PDEEPVIZ_QUERY  query;
+
+    if (!api_key){
+        return NULL;
+    }
+
+    query = (PDEEPVIZ_QUERY)malloc(sizeof(DEEPVIZ_QUERY));
+    if (!query){
+        return NULL;
+    }
+
+    memset(query, 0, sizeof(DEEPVIZ_QUERY));
+
+    /* Same defaults as deepviz_advanced_search() */
+    query->jsonObj = json_pack("{ssss}",
+                                "api_key", api_key,
+                                "never_seen", "false");
+    if (!query->jsonObj){
+        free(query);
+        return NULL;
+    }
+
+    return query;
+}
+
+
+EXPORT deepviz_bool deepviz_query_add(PDEEPVIZ_QUERY query, DEEPVIZ_QUERY_FIELD field, const char* value){
+
+    json_t  *jsonList;
+    char    *timeDelta;
+
+    if (!query || !query->jsonObj || !value || (size_t)field >= sizeof(queryFieldNames) / sizeof(queryFieldNames[0])){
+        return deepviz_false;
+    }
+
+    if (field == DEEPVIZ_QUERY_TIME_DELTA){
+        /* Patched in at every run */
+        timeDelta = query_strdup(value);
+        if (!timeDelta){
+            return deepviz_false;
+        }
+        if (query->timeDelta) free(query->timeDelta);
+        query->timeDelta = timeDelta;
+        return deepviz_true;
+    }
+
+    if (field >= DEEPVIZ_QUERY_CLASSIFICATION){
+        return !json_object_set_new(query->jsonObj, queryFieldNames[field], json_string(value));
+    }
+
+    jsonList = json_object_get(query->jsonObj, queryFieldNames[field]);
+    if (!jsonList){
+        jsonList = json_array();
+        if (json_object_set_new(query->jsonObj, queryFieldNames[field], jsonList)){
+            return deepviz_false;
+        }
+    }
+
+    return !json_array_append_new(jsonList, json_string(value));
+}
+
+
+EXPORT deepviz_bool deepviz_query_add_list(PDEEPVIZ_QUERY query, DEEPVIZ_QUERY_FIELD field, PDEEPVIZ_LIST list){
+
+    size_t  i;
+
+    if (!list){
+        return deepviz_false;
+    }
+
+    for (i = 0; i < list->maxEntryNumber; i++){
+        if (list->entry[i][0] && !deepviz_query_add(query, field, list->entry[i])){
+            return deepviz_false;
+        }
+    }
+
+    return deepviz_true;
+}
+
+
+EXPORT deepviz_bool deepviz_query_compile(PDEEPVIZ_QUERY query){
+
+    if (!query){
+        return deepviz_false;
+    }
+
+    if (query->jsonObj){
+        query->request = dvz_search_compile(query->jsonObj);
+        json_decref(query->jsonObj);
+        query->jsonObj = NULL;
+    }
+
+    return query->request != NULL;
+}
+
+
+EXPORT PDEEPVIZ_RESULT deepviz_query_run(PDEEPVIZ_QUERY query, const char* time_delta, int start_offset, int elements){
+
+    char    *retMsg;
+
+    if (!query || !query->request){
+        retMsg = (char*)malloc(DEEPVIZ_ERROR_MAX_LEN);
+        if (!retMsg){
+            return deepviz_result_init(DEEPVIZ_STATUS_INTERNAL_ERROR, NULL);
+        }
+        deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Invalid or missing parameters. Please try again!");
+        return deepviz_result_init(DEEPVIZ_STATUS_INPUT_ERROR, retMsg);
+    }
+
+    return dvz_search_page(URL_INTEL_SEARCH_ADVANCED, query->request, time_delta ? time_delta : query->timeDelta,
+        start_offset, elements);
+}
+
+
+EXPORT PDEEPVIZ_RESULT deepviz_query_open(PDEEPVIZ_QUERY query,
+                                            const char* time_delta,
+                                            int start_offset,
+                                            int page_size,
+                                            PDEEPVIZ_SEARCH_CURSOR* cursor){
+
+    char    *retMsg;
+
+    retMsg = (char*)malloc(DEEPVIZ_ERROR_MAX_LEN);
+    if (!retMsg){
+        return deepviz_result_init(DEEPVIZ_STATUS_INTERNAL_ERROR, NULL);
+    }
+
+    if (!query || !query->request || !cursor){
+        deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Invalid or missing parameters. Please try again!");
+        return deepviz_result_init(DEEPVIZ_STATUS_INPUT_ERROR, retMsg);
+    }
+
+    (*cursor) = NULL;
+
+    /* The cursor gets its own copy: the query can be freed or run again meanwhile */
+    return dvz_search_open(URL_INTEL_SEARCH_ADVANCED, query_strdup(query->request),
+                            query_strdup(time_delta ? time_delta : query->timeDelta), start_offset, page_size, cursor, retMsg);
+}
+
+
+EXPORT PDEEPVIZ_RESULT deepviz_query_fanout(PDEEPVIZ_QUERY query,
+                                            const char* time_delta,
+                                            int start_offset,
+                                            PDEEPVIZ_SEARCH_FANOUT fanout){
+
+    char    *retMsg;
+
+    retMsg = (char*)malloc(DEEPVIZ_ERROR_MAX_LEN);
+    if (!retMsg){
+        return deepviz_result_init(DEEPVIZ_STATUS_INTERNAL_ERROR, NULL);
+    }
+
+    if (!query || !query->request || !fanout || !fanout->sink){
+        deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Invalid or missing parameters. Please try again!");
+        return deepviz_result_init(DEEPVIZ_STATUS_INPUT_ERROR, retMsg);
+    }
+
+    return dvz_search_fanout(URL_INTEL_SEARCH_ADVANCED, query_strdup(query->request),
+                                query_strdup(time_delta ? time_delta : query->timeDelta), start_offset, fanout, retMsg);
+}
+
+
+EXPORT void deepviz_query_free(PDEEPVIZ_QUERY* query){
+
+    if (!query || !(*query)){
+        return;
+    }
+
+    if ((*query)->jsonObj) json_decref((*query)->jsonObj);
+    if ((*query)->request) free((*query)->request);
+    if ((*query)->timeDelta) free((*query)->timeDelta);
+
+    free(*query);
+    (*query) = NULL;
+}
@@ -0,0 +1,343 @@
+/*
+* Copyright (c) 2016 Saferbytes s.r.l.s.
+*
+* You can redistribute it and/or modify it under the terms of the MIT license.
+* See LICENSE for details.
+*/
+
+#include "c-deepviz.h"
+#include "c-deepviz_private.h"
+
+/*
+* Lazy sample reports.
+* Most consumers of a report read its classification and one or two sections, yet deepviz_sample_report()
+* downloads all of it. A report handle fetches sections through the output filters of deepviz_sample_info()
+* instead: a few when it is opened, any other one the first time it is read. A missing section is requested
+* together with the "lazy" sections not loaded yet, up to DEEPVIZ_MAX_FILTERS per request, and everything
+* received (sections absent from the report included) is kept by the handle.
+*/
+
+struct _DEEPVIZ_REPORT{
+    DEEPVIZ_MUTEX           lock;                   /* Held during the requests: one at a time */
+    char                    apiKey[DEEPVIZ_ENTRY_MAX_LEN];
+    char                    md5[DEEPVIZ_ENTRY_MAX_LEN];
+    json_t                  *sections;              /* Sections loaded, by name */
+    json_t                  *absent;                /* Sections requested and not in the report */
+    json_t                  *lazy;                  /* Sections likely to be read, requested along with the others */
+};
+
+
+static deepviz_bool report_known(PDEEPVIZ_REPORT report, const char* section){
+
+    return json_object_get(report->sections, section) || json_object_get(report->absent, section);
+}
+
+
+/* Request the sections of "list" and keep them. Returns the result of deepviz_sample_info() */
+static PDEEPVIZ_RESULT report_fetch(PDEEPVIZ_REPORT report, PDEEPVIZ_LIST list){
+
+    PDEEPVIZ_RESULT result;
+    json_t          *jsonData;
+    json_t          *jsonValue;
+    char            *retMsg;
+    size_t          i;
+
+    result = deepviz_sample_info(report->md5, report->apiKey, list);
+    if (!result || result->status != DEEPVIZ_STATUS_SUCCESS){
+        return result;
+    }
+
+    /* Any format: the result follows the setting of the calling thread */
+    jsonData = dvz_result_to_json(result);
+    if (!jsonData || !json_is_object(jsonData)){
+        if (jsonData) json_decref(jsonData);
+        deepviz_result_free(&result);
+
+        retMsg = (char*)malloc(DEEPVIZ_ERROR_MAX_LEN);
+        if (!retMsg){
+            return deepviz_result_init(DEEPVIZ_STATUS_INTERNAL_ERROR, NULL);
+        }
+        deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Error parsing HTTP response");
+        return deepviz_result_init(DEEPVIZ_STATUS_INTERNAL_ERROR, retMsg);
+    }
+
+    for (i = 0; i < list->maxEntryNumber; i++){
+        if (list->entry[i][0]){
+            jsonValue = json_object_get(jsonData, list->entry[i]);
+            if (jsonValue){
+                json_object_set(report->sections, list->entry[i], jsonValue);
+            }
+            else{
+                json_object_set_new(report->absent, list->entry[i], json_true());
+            }
+        }
+    }
+
+    json_decref(jsonData);
+
+    return result;
+}
+
+
+/* "section" and the lazy sections not loaded yet ("lazyNumber" of them), as many as fit in one request */
+static PDEEPVIZ_LIST report_batch(PDEEPVIZ_REPORT report, const char* section, size_t* lazyNumber){
+
+    PDEEPVIZ_LIST   list;
+    const char      *name;
+    size_t          i;
+
+    (*lazyNumber) = 0;
+
+    list = deepviz_list_init(DEEPVIZ_MAX_FILTERS);
+    if (!list){
+        return NULL;
+    }
+
+    if (!deepviz_list_add(list, section)){
+        deepviz_list_free(&list);
+        return NULL;
+    }
+
+    for (i = 0; i < json_array_size(report->lazy); i++){
+        name = json_string_value(json_array_get(report->lazy, i));
+        if (strcmp(name, section) && !report_known(report, name)){
+            if (!deepviz_list_add(list, name)){
+                /* Full */
+                break;
+            }
+            (*lazyNumber)++;
+        }
+    }
+
+    return list;
+}
+
+
+EXPORT PDEEPVIZ_RESULT deepviz_report_open( const char* api_key,
+                                            const char* md5,
+                                            PDEEPVIZ_LIST sections,
+                                            PDEEPVIZ_LIST lazy,
+                                            PDEEPVIZ_REPORT* report){
+
+    PDEEPVIZ_REPORT newReport;
+    PDEEPVIZ_LIST   defaultSections = NULL;
+    PDEEPVIZ_RESULT result;
+    char            *retMsg;
+    size_t          i;
+
+    retMsg = (char*)malloc(DEEPVIZ_ERROR_MAX_LEN);
+    if (!retMsg){
+        return deepviz_result_init(DEEPVIZ_STATUS_INTERNAL_ERROR, NULL);
+    }
+
+    if (!api_key || !md5 || !report || strlen(api_key) >= DEEPVIZ_ENTRY_MAX_LEN || strlen(md5) >= DEEPVIZ_ENTRY_MAX_LEN){
+        deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Invalid or missing parameters. Please try again!");
+        return deepviz_result_init(DEEPVIZ_STATUS_INPUT_ERROR, retMsg);
+    }
+
+    (*report) = NULL;
+
+    newReport = (PDEEPVIZ_REPORT)malloc(sizeof(DEEPVIZ_REPORT));
+    if (!newReport){
+        deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Memory allocation error");
+        return deepviz_result_init(DEEPVIZ_STATUS_INTERNAL_ERROR, retMsg);
+    }
+
+    memset(newReport, 0, sizeof(DEEPVIZ_REPORT));
+    deepviz_sprintf(newReport->apiKey, DEEPVIZ_ENTRY_MAX_LEN, "%s", api_key);
+    deepviz_sprintf(newReport->md5, DEEPVIZ_ENTRY_MAX_LEN, "%s", md5);
+    dvz_mutex_init(&newReport->lock);
+
+    newReport->sections = json_object();
+    newReport->absent = json_object();
+    newReport->lazy = json_array();
+
+    if (!sections){
+        defaultSections = deepviz_list_init(1);
+        if (defaultSections) deepviz_list_add(defaultSections, DEEPVIZ_REPORT_DEFAULT_SECTION);
+        sections = defaultSections;
+    }
+
+    if (!newReport->sections || !newReport->absent || !newReport->lazy || !sections){
+        if (defaultSections) deepviz_list_free(&defaultSections);
+        deepviz_report_close(&newReport);
+        deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Memory allocation error");
+        return deepviz_result_init(DEEPVIZ_STATUS_INTERNAL_ERROR, retMsg);
+    }
+
+    if (lazy){
+        for (i = 0; i < lazy->maxEntryNumber; i++){
+            if (lazy->entry[i][0]){
+                json_array_append_new(newReport->lazy, json_string(lazy->entry[i]));
+            }
+        }
+    }
+
+    result = report_fetch(newReport, sections);
+
+    if (defaultSections) deepviz_list_free(&defaultSections);
+
+    if (!result || result->status != DEEPVIZ_STATUS_SUCCESS){
+        /* Unknown sample, analysis still running... */
+        deepviz_report_close(&newReport);
+        free(retMsg);
+        return result;
+    }
+
+    deepviz_result_free(&result);
+
+    (*report) = newReport;
+
+    deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "%u sections loaded", (unsigned int)json_object_size(newReport->sections));
+    return deepviz_result_init(DEEPVIZ_STATUS_SUCCESS, retMsg);
+}
+
+
+EXPORT PDEEPVIZ_RESULT deepviz_report_section(PDEEPVIZ_REPORT report, const char* section){
+
+    PDEEPVIZ_LIST   list;
+    PDEEPVIZ_RESULT result = NULL;
+    json_t          *jsonValue;
+    char            *retMsg;
+    size_t          lazyNumber;
+
+    if (!report || !section || !section[0]){
+        retMsg = (char*)malloc(DEEPVIZ_ERROR_MAX_LEN);
+        if (!retMsg){
+            return deepviz_result_init(DEEPVIZ_STATUS_INTERNAL_ERROR, NULL);
+        }
+        deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Invalid or missing parameters. Please try again!");
+        return deepviz_result_init(DEEPVIZ_STATUS_INPUT_ERROR, retMsg);
+    }
+
+    dvz_mutex_lock(&report->lock);
+
+    if (!report_known(report, section)){
+
+        list = report_batch(report, section, &lazyNumber);
+        if (list){
+            result = report_fetch(report, list);
+            deepviz_list_free(&list);
+
+            if (result && result->status == DEEPVIZ_STATUS_CLIENT_ERROR && lazyNumber){
+                /* A lazy section may be the one refused: ask for this one alone, and stop batching them */
+                deepviz_result_free(&result);
+                json_array_clear(report->lazy);
+
+                list = report_batch(report, section, &lazyNumber);
+                if (list){
+                    result = report_fetch(report, list);
+                    deepviz_list_free(&list);
+                }
+            }
+        }
+
+        if (!result || result->status != DEEPVIZ_STATUS_SUCCESS){
+            dvz_mutex_unlock(&report->lock);
+
+            if (result){
+                return result;
+            }
+
+            retMsg = (char*)malloc(DEEPVIZ_ERROR_MAX_LEN);
+            if (!retMsg){
+                return deepviz_result_init(DEEPVIZ_STATUS_INTERNAL_ERROR, NULL);
+            }
+            deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Invalid section name");
+            return deepviz_result_init(DEEPVIZ_STATUS_INPUT_ERROR, retMsg);
+        }
+
+        deepviz_result_free(&result);
+    }
+
+    jsonValue = json_object_get(report->sections, section);
+    if (jsonValue){
+        /* Encoded in the format of the calling thread */
+        result = dvz_result_from_json(jsonValue, JSON_ENCODE_ANY);
+    }
+
+    dvz_mutex_unlock(&report->lock);
+
+    if (!jsonValue){
+        retMsg = (char*)malloc(DEEPVIZ_ERROR_MAX_LEN);
+        if (!retMsg){
+            return deepviz_result_init(DEEPVIZ_STATUS_INTERNAL_ERROR, NULL);
+        }
+        deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Section \"%s\" not in the report", section);
+        return deepviz_result_init(DEEPVIZ_STATUS_CLIENT_ERROR, retMsg);
+    }
+
+    return result;
+}
+
+
+EXPORT PDEEPVIZ_RESULT deepviz_report_prefetch(PDEEPVIZ_REPORT report, PDEEPVIZ_LIST sections){
+
+    PDEEPVIZ_LIST   list;
+    PDEEPVIZ_RESULT result;
+    char            *retMsg;
+    size_t          missing = 0;
+    size_t          i;
+
+    retMsg = (char*)malloc(DEEPVIZ_ERROR_MAX_LEN);
+    if (!retMsg){
+        return deepviz_result_init(DEEPVIZ_STATUS_INTERNAL_ERROR, NULL);
+    }
+
+    if (!report || !sections){
+        deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Invalid or missing parameters. Please try again!");
+        return deepviz_result_init(DEEPVIZ_STATUS_INPUT_ERROR, retMsg);
+    }
+
+    list = deepviz_list_init(sections->maxEntryNumber);
+    if (!list){
+        deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Memory allocation error");
+        return deepviz_result_init(DEEPVIZ_STATUS_INTERNAL_ERROR, retMsg);
+    }
+
+    dvz_mutex_lock(&report->lock);
+
+    for (i = 0; i < sections->maxEntryNumber; i++){
+        if (sections->entry[i][0] && !report_known(report, sections->entry[i]) && deepviz_list_add(list, sections->entry[i])){
+            missing++;
+        }
+    }
+
+    /* More than DEEPVIZ_MAX_FILTERS sections are split by deepviz_sample_info() in concurrent requests */
+    result = missing ? report_fetch(report, list) : NULL;
+
+    dvz_mutex_unlock(&report->lock);
+
+    deepviz_list_free(&list);
+
+    if (missing && (!result || result->status != DEEPVIZ_STATUS_SUCCESS)){
+        if (result){
+            free(retMsg);
+            return result;
+        }
+        deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Memory allocation error");
+        return deepviz_result_init(DEEPVIZ_STATUS_INTERNAL_ERROR, retMsg);
+    }
+
+    if (result) deepviz_result_free(&result);
+
+    deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "%u sections fetched", (unsigned int)missing);
+    return deepviz_result_init(DEEPVIZ_STATUS_SUCCESS, retMsg);
+}
+
+
+EXPORT void deepviz_report_close(PDEEPVIZ_REPORT* report){
+
+    if (!report || !(*report)){
+        return;
+    }
+
+    if ((*report)->sections) json_decref((*report)->sections);
+    if ((*report)->absent) json_decref((*report)->absent);
+    if ((*report)->lazy) json_decref((*report)->lazy);
+
+    dvz_mutex_destroy(&(*report)->lock);
+
+    free(*report);
+    (*report) = NULL;
+}
@@ -93,7 +93,7 @@ EXPORT PDEEPVIZ_RESULT deepviz_sample_report(	const char* md5,
     if (bRet == deepviz_false){
         /* Network Error */
         if (responseOut) free(responseOut);
-        return deepviz_result_init(DEEPVIZ_STATUS_NETWORK_ERROR, retMsg);
+        return deepviz_result_init(dvz_transfer_error_status(), retMsg);
     }
 
     free(retMsg);
@@ -111,6 +111,19 @@ EXPORT PDEEPVIZ_RESULT deepviz_sample_report(	const char* md5,
 EXPORT PDEEPVIZ_RESULT deepviz_upload_sample(	const char* api_key,
                                                 const char* path){
 
+    /* Skip the samples already known to Deepviz, if enabled */
+    if (api_key && path && dvz_upload_dedup_enabled()){
+        return dvz_dedup_upload_sample(api_key, path);
+    }
+
+    return dvz_upload_sample(api_key, path);
+
+}
+
+
+PDEEPVIZ_RESULT dvz_upload_sample(  const char* api_key,
+                                    const char* path){
+
     PDEEPVIZ_RESULT     result = NULL;
     void*               responseOut = NULL;
     size_t              responseOutLen = 0;
@@ -286,7 +299,7 @@ EXPORT PDEEPVIZ_RESULT deepviz_upload_sample(	const char* api_key,
     if (bRet == deepviz_false){
         /* Network Error */
         if (responseOut) free(responseOut);
-        return deepviz_result_init(DEEPVIZ_STATUS_NETWORK_ERROR, retMsg);
+        return deepviz_result_init(dvz_transfer_error_status(), retMsg);
     }
 
     free(retMsg);
@@ -304,166 +317,47 @@ EXPORT PDEEPVIZ_RESULT deepviz_upload_sample(	const char* api_key,
 EXPORT PDEEPVIZ_RESULT deepviz_upload_folder(	const char* api_key,
                                                 const char* folder){
 
-    char				*retMsg = NULL;
-    PDEEPVIZ_RESULT		result = NULL;
-    char                currPath[DEEPVIZ_FILEPATH_MAX_LEN] = { 0 };
-#ifdef _WIN32
-/* Windows */
-    HANDLE				hFile;
-    WIN32_FIND_DATAA	data;
-    char*				tmpFolder = NULL;
-#elif defined(__linux__)
-/* Linux */
-    DIR                 *dir;
-    struct dirent       *entry;
-    int                 len;
-#endif
+    DEEPVIZ_UPLOAD_CONFIG   config;
 
-    retMsg = (char*)malloc(DEEPVIZ_ERROR_MAX_LEN);
-    if (!retMsg){
-        return deepviz_result_init(DEEPVIZ_STATUS_INTERNAL_ERROR, NULL);
-    }
+    /* One file at a time, stopping at the first error */
+    deepviz_upload_default_config(&config);
+    config.threads = 1;
+    config.stopOnError = deepviz_true;
 
-#if !defined(_WIN32) && !defined(__linux__)
-    /* TODO */
-    sprintf(retMsg, "Platform not supported");
-    return deepviz_result_init(DEEPVIZ_STATUS_INTERNAL_ERROR, retMsg);
-#endif
-
-    if (!api_key || !folder){
-        deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Invalid or missing parameters. Please try again!");
-        return deepviz_result_init(DEEPVIZ_STATUS_INPUT_ERROR, retMsg);
-    }
+    return deepviz_upload_folder_parallel(api_key, folder, &config, NULL);
 
-#ifdef _WIN32
-    /* Windows */
-
-    memset(&data, 0, sizeof(WIN32_FIND_DATAA));
-
-    tmpFolder = malloc(strlen(folder) + 10);
-    if (!tmpFolder){
-        sprintf_s(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Memory allocation error");
-        return deepviz_result_init(DEEPVIZ_STATUS_INTERNAL_ERROR, retMsg);
-    }
-
-    memset(tmpFolder, 0, strlen(folder) + 10);
-
-    /* Add "\*" */
-    sprintf_s(tmpFolder, strlen(folder) + 10, "%s\\*", folder);
-
-    hFile = FindFirstFileA(tmpFolder, &data);
-    if (hFile == INVALID_HANDLE_VALUE) {
-        sprintf_s(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Invalid folder. Error %d", GetLastError());
-        return deepviz_result_init(DEEPVIZ_STATUS_INTERNAL_ERROR, retMsg);
-    }
-
-    /* Remove "\*" */
-    tmpFolder[strlen(tmpFolder) - 2] = 0;
-
-    /* First file is always "." */
-    while (FindNextFileA(hFile, &data)){
-
-        if (strcmp("..", data.cFileName) && strcmp(".", data.cFileName)){
-
-            if (strlen(tmpFolder) + strlen(data.cFileName) >= DEEPVIZ_FILEPATH_MAX_LEN){
-                FindClose(hFile);
-                free(tmpFolder);
-                sprintf_s(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Invalid folder");
-                return deepviz_result_init(DEEPVIZ_STATUS_INTERNAL_ERROR, retMsg);
-            }
-
-            sprintf_s(currPath, DEEPVIZ_FILEPATH_MAX_LEN, "%s\\%s", tmpFolder, data.cFileName);
-
-            if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY){
-                /* Go to next folder */
-                deepviz_upload_folder(api_key, currPath);
-            }
-            else {
+}
 
-                result = deepviz_upload_sample(api_key, currPath);
-                if (result){
 
-                    /*printf("FILE: %s - STATUS: %d - MSG: %s\n", currPath, result->status, result->msg); */
+EXPORT PDEEPVIZ_RESULT deepviz_sample_download(	const char* md5,
+                                                const char* api_key, 
+                                                const char* path){
 
-                    if (result->status != DEEPVIZ_STATUS_SUCCESS){
-                        sprintf_s(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Error uploading file \"%s\": %d - %s", currPath, result->status, result->msg);
-                        deepviz_result_free(&result);
-                        FindClose(hFile);
-                        free(tmpFolder);
-                        return deepviz_result_init(DEEPVIZ_STATUS_INPUT_ERROR, retMsg);
-                    }
+    PDEEPVIZ_RESULT     result;
 
-                    deepviz_result_free(&result);
-                }
-            }
+    /* Already in the sample store */
+    if (md5 && api_key && path && dvz_sample_store_enabled()){
+        result = dvz_sample_store_fetch(md5, path);
+        if (result){
+            return result;
         }
     }
 
-    FindClose(hFile);
-    free(tmpFolder);
-
-#elif defined(__linux__)
-    /* Linux */
-
-    if (!(dir = opendir(folder))) {
-        snprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Invalid folder");
-        return deepviz_result_init(DEEPVIZ_STATUS_INPUT_ERROR, retMsg);
+    /* Group concurrent downloads into bulk requests, if enabled */
+    if (md5 && api_key && path && dvz_download_batching_enabled()){
+        return dvz_batch_sample_download(md5, api_key, path);
     }
 
-    do {
-
-        entry = readdir(dir);
-        if (entry) {
-
-            if (entry->d_type == DT_DIR) {
-
-                len = snprintf(currPath, DEEPVIZ_FILEPATH_MAX_LEN, "%s/%s", folder, entry->d_name);
-                currPath[len] = 0;
-
-                if (strcmp(entry->d_name, ".") && strcmp(entry->d_name, "..")) {
-                    /* Recursive call */
-                    deepviz_upload_folder(api_key, currPath);
-                }
-
-            }
-            else {
-
-                snprintf(currPath, DEEPVIZ_FILEPATH_MAX_LEN, "%s/%s", folder, entry->d_name);
-
-                result = deepviz_upload_sample(api_key, currPath);
-                if (result){
-
-                    /* printf("FILE: %s - STATUS: %d - MSG: %s\n", currPath, result->status, result->msg); */
-
-                    if (result->status != DEEPVIZ_STATUS_SUCCESS){
-                        snprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Error uploading file \"%s\": %d - %s", currPath, result->status, result->msg);
-                        deepviz_result_free(&result);
-                        closedir(dir);
-                        return deepviz_result_init(DEEPVIZ_STATUS_INPUT_ERROR, retMsg);
-                    }
-
-                    deepviz_result_free(&result);
-                }
-            }
-        }
-
-    } while (entry);
-
-    closedir(dir);
-
-#endif
-
-    deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Folder uploaded to Deepviz successfully");
-    return deepviz_result_init(DEEPVIZ_STATUS_SUCCESS, retMsg);
+    return dvz_sample_download(md5, api_key, path);
 
 }
 
 
-EXPORT PDEEPVIZ_RESULT deepviz_sample_download(	const char* md5,
-                                                const char* api_key, 
-                                                const char* path){
+PDEEPVIZ_RESULT dvz_sample_download(const char* md5,
+                                    const char* api_key,
+                                    const char* path){
 
-    void*               responseOut;
+    void*               responseOut = NULL;
     char                statusCode[DEEPVIZ_STATUS_CODE_MAX_LEN] = { 0 };
     size_t              responseOutLen = 0;
     char                *retMsg = NULL;
@@ -571,7 +465,7 @@ EXPORT PDEEPVIZ_RESULT deepviz_sample_download(	const char* md5,
         free(filePath);
         fclose(file);
         if (responseOut) free(responseOut);
-        return deepviz_result_init(DEEPVIZ_STATUS_NETWORK_ERROR, retMsg);
+        return deepviz_result_init(dvz_transfer_error_status(), retMsg);
     }
 
     if (responseOutLen == 0){
@@ -613,8 +507,9 @@ EXPORT PDEEPVIZ_RESULT deepviz_sample_download(	const char* md5,
         return deepviz_result_init(DEEPVIZ_STATUS_NETWORK_ERROR, retMsg);
     }
 
-    /* Write sample file */
-    if (!fwrite(responseOut, responseOutLen, 1, file)){
+    /* Write sample file, through the sample store if enabled */
+    if ((!dvz_sample_store_enabled() || !dvz_sample_store_write(md5, responseOut, responseOutLen, filePath)) &&
+        !fwrite(responseOut, responseOutLen, 1, file)){
         free(filePath);
         fclose(file);
         if (responseOut) free(responseOut);
@@ -738,7 +633,7 @@ EXPORT PDEEPVIZ_RESULT deepviz_bulk_download_request(   PDEEPVIZ_LIST md5_list,
     if (bRet == deepviz_false){
         /* Network Error */
         if (responseOut) free(responseOut);
-        return deepviz_result_init(DEEPVIZ_STATUS_NETWORK_ERROR, retMsg);
+        return deepviz_result_init(dvz_transfer_error_status(), retMsg);
     }
 
     if (responseOutLen == 0){
@@ -948,14 +843,13 @@ EXPORT PDEEPVIZ_RESULT deepviz_bulk_download_retrieve(  const char* id_request,
         free(filePath);
         fclose(file);
         if (responseOut) free(responseOut);
-        return deepviz_result_init(DEEPVIZ_STATUS_NETWORK_ERROR, retMsg);
+        return deepviz_result_init(dvz_transfer_error_status(), retMsg);
     }
 
     /* Check for processing requests */
     if (!strcmp(statusCode, "428")){
         /* Processing */
         deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Status: %s - Your request is being processed. Please try again in a few minutes", statusCode);
-        json_decref(jsonObj);
         free(filePath);
         fclose(file);
         if (responseOut) free(responseOut);
@@ -1033,3 +927,260 @@ EXPORT PDEEPVIZ_RESULT deepviz_bulk_download_retrieve(  const char* id_request,
 
 }
 
+
+/* ============================ bulk download jobs ============================ */
+
+typedef struct _DEEPVIZ_BULK_JOB_CONTEXT{
+    PDEEPVIZ_BULK_JOB   job;
+    const char*         api_key;
+    const char*         path;
+}DEEPVIZ_BULK_JOB_CONTEXT, *PDEEPVIZ_BULK_JOB_CONTEXT;
+
+
+static void bulk_chunk_set_result(PDEEPVIZ_BULK_CHUNK chunk, PDEEPVIZ_RESULT result){
+
+    if (!result){
+        chunk->status = DEEPVIZ_STATUS_INTERNAL_ERROR;
+        deepviz_sprintf(chunk->msg, DEEPVIZ_ENTRY_MAX_LEN, "Memory allocation error");
+        return;
+    }
+
+    chunk->status = result->status;
+    deepviz_sprintf(chunk->msg, DEEPVIZ_ENTRY_MAX_LEN, "%s", result->msg ? result->msg : "");
+}
+
+
+static void bulk_chunk_submit(void* context, size_t taskIndex){
+
+    PDEEPVIZ_BULK_JOB_CONTEXT   ctx = (PDEEPVIZ_BULK_JOB_CONTEXT)context;
+    PDEEPVIZ_BULK_CHUNK         chunk = &ctx->job->chunk[taskIndex];
+    PDEEPVIZ_RESULT             result;
+
+    if (chunk->state != DEEPVIZ_BULK_CHUNK_NEW){
+        return;
+    }
+
+    result = deepviz_bulk_download_request(chunk->md5_list, ctx->api_key);
+    bulk_chunk_set_result(chunk, result);
+
+    if (result && result->status == DEEPVIZ_STATUS_SUCCESS){
+        /* "msg" contains request ID on success */
+        deepviz_sprintf(chunk->id_request, DEEPVIZ_ID_REQUEST_MAX_LEN, "%s", result->msg);
+        chunk->state = DEEPVIZ_BULK_CHUNK_REQUESTED;
+    }
+
+    if (result) deepviz_result_free(&result);
+}
+
+
+static void bulk_chunk_retrieve(void* context, size_t taskIndex){
+
+    PDEEPVIZ_BULK_JOB_CONTEXT   ctx = (PDEEPVIZ_BULK_JOB_CONTEXT)context;
+    PDEEPVIZ_BULK_CHUNK         chunk = &ctx->job->chunk[taskIndex];
+    PDEEPVIZ_RESULT             result;
+
+    if (chunk->state != DEEPVIZ_BULK_CHUNK_REQUESTED){
+        return;
+    }
+
+    result = deepviz_bulk_download_retrieve(chunk->id_request, ctx->path, ctx->api_key);
+    bulk_chunk_set_result(chunk, result);
+
+    if (result && result->status == DEEPVIZ_STATUS_SUCCESS){
+        chunk->state = DEEPVIZ_BULK_CHUNK_DOWNLOADED;
+    }
+
+    if (result) deepviz_result_free(&result);
+}
+
+
+/* Build the overall job result according to the status of every chunk in the given state */
+static PDEEPVIZ_RESULT bulk_job_result(PDEEPVIZ_BULK_JOB job, DEEPVIZ_BULK_CHUNK_STATE pendingState, const char* operation){
+
+    char                    *retMsg = NULL;
+    DEEPVIZ_RESULT_STATUS   status = DEEPVIZ_STATUS_SUCCESS;
+    size_t                  failed = 0;
+    size_t                  processing = 0;
+    size_t                  i;
+
+    retMsg = (char*)malloc(DEEPVIZ_ERROR_MAX_LEN);
+    if (!retMsg){
+        return deepviz_result_init(DEEPVIZ_STATUS_INTERNAL_ERROR, NULL);
+    }
+
+    for (i = 0; i < job->chunkNumber; i++){
+        if (job->chunk[i].state != pendingState){
+            continue;
+        }
+
+        if (job->chunk[i].status == DEEPVIZ_STATUS_PROCESSING){
+            processing++;
+        }
+        else{
+            if (failed == 0){
+                /* Report the first failure */
+                status = job->chunk[i].status;
+            }
+            failed++;
+        }
+    }
+
+    if (failed == 0 && processing > 0){
+        status = DEEPVIZ_STATUS_PROCESSING;
+    }
+
+    deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Bulk job %s: %d chunk(s), %d failed, %d processing",
+                    operation, (int)job->chunkNumber, (int)failed, (int)processing);
+
+    return deepviz_result_init(status, retMsg);
+}
+
+
+EXPORT PDEEPVIZ_BULK_JOB deepviz_bulk_job_init(     PDEEPVIZ_LIST md5_list,
+                                                    size_t chunk_size){
+
+    PDEEPVIZ_BULK_JOB   job = NULL;
+    size_t              md5Number = 0;
+    size_t              chunkNumber;
+    size_t              currChunk = 0;
+    size_t              i;
+
+    if (!md5_list){
+        return NULL;
+    }
+
+    if (chunk_size == 0){
+        chunk_size = DEEPVIZ_BULK_DEFAULT_CHUNK_SIZE;
+    }
+
+    for (i = 0; i < md5_list->maxEntryNumber; i++){
+        if (md5_list->entry[i][0]){
+            md5Number++;
+        }
+    }
+
+    if (md5Number == 0){
+        return NULL;
+    }
+
+    chunkNumber = (md5Number + chunk_size - 1) / chunk_size;
+
+    job = (PDEEPVIZ_BULK_JOB)malloc(sizeof(DEEPVIZ_BULK_JOB) + (chunkNumber * sizeof(DEEPVIZ_BULK_CHUNK)));
+    if (!job){
+        return NULL;
+    }
+
+    memset(job, 0, sizeof(DEEPVIZ_BULK_JOB) + (chunkNumber * sizeof(DEEPVIZ_BULK_CHUNK)));
+    job->chunkNumber = chunkNumber;
+
+    for (i = 0; i < md5_list->maxEntryNumber; i++){
+
+        if (!md5_list->entry[i][0]){
+            continue;
+        }
+
+        if (!job->chunk[currChunk].md5_list){
+            /* Last chunk takes the remaining MD5 only */
+            job->chunk[currChunk].md5_list = deepviz_list_init(md5Number - currChunk * chunk_size < chunk_size ? md5Number - currChunk * chunk_size : chunk_size);
+            if (!job->chunk[currChunk].md5_list){
+                deepviz_bulk_job_free(&job);
+                return NULL;
+            }
+        }
+
+        if (!deepviz_list_add(job->chunk[currChunk].md5_list, md5_list->entry[i])){
+            /* Chunk full, move to the next one */
+            currChunk++;
+            i--;
+        }
+    }
+
+    return job;
+
+}
+
+
+EXPORT PDEEPVIZ_RESULT deepviz_bulk_job_submit(     PDEEPVIZ_BULK_JOB job,
+                                                    const char* api_key,
+                                                    size_t max_threads){
+
+    DEEPVIZ_BULK_JOB_CONTEXT    ctx;
+    char                        *retMsg = NULL;
+
+    if (!job || !api_key){
+        retMsg = (char*)malloc(DEEPVIZ_ERROR_MAX_LEN);
+        if (!retMsg){
+            return deepviz_result_init(DEEPVIZ_STATUS_INTERNAL_ERROR, NULL);
+        }
+        deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Invalid or missing parameters. Please try again!");
+        return deepviz_result_init(DEEPVIZ_STATUS_INPUT_ERROR, retMsg);
+    }
+
+    ctx.job = job;
+    ctx.api_key = api_key;
+    ctx.path = NULL;
+
+    dvz_parallel_run(job->chunkNumber, max_threads ? max_threads : DEEPVIZ_DEFAULT_THREADS, bulk_chunk_submit, &ctx);
+
+    return bulk_job_result(job, DEEPVIZ_BULK_CHUNK_NEW, "submit");
+
+}
+
+
+EXPORT PDEEPVIZ_RESULT deepviz_bulk_job_retrieve(   PDEEPVIZ_BULK_JOB job,
+                                                    const char* path,
+                                                    const char* api_key,
+                                                    size_t max_threads){
+
+    DEEPVIZ_BULK_JOB_CONTEXT    ctx;
+    char                        *retMsg = NULL;
+    size_t                      i;
+
+    retMsg = (char*)malloc(DEEPVIZ_ERROR_MAX_LEN);
+    if (!retMsg){
+        return deepviz_result_init(DEEPVIZ_STATUS_INTERNAL_ERROR, NULL);
+    }
+
+    if (!job || !path || !api_key){
+        deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Invalid or missing parameters. Please try again!");
+        return deepviz_result_init(DEEPVIZ_STATUS_INPUT_ERROR, retMsg);
+    }
+
+    for (i = 0; i < job->chunkNumber; i++){
+        if (job->chunk[i].state == DEEPVIZ_BULK_CHUNK_NEW){
+            deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "One or more chunks have not been submitted. Please use deepviz_bulk_job_submit() API before");
+            return deepviz_result_init(DEEPVIZ_STATUS_INPUT_ERROR, retMsg);
+        }
+    }
+
+    free(retMsg);
+
+    ctx.job = job;
+    ctx.api_key = api_key;
+    ctx.path = path;
+
+    dvz_parallel_run(job->chunkNumber, max_threads ? max_threads : DEEPVIZ_DEFAULT_THREADS, bulk_chunk_retrieve, &ctx);
+
+    return bulk_job_result(job, DEEPVIZ_BULK_CHUNK_REQUESTED, "retrieve");
+
+}
+
+
+EXPORT void deepviz_bulk_job_free(PDEEPVIZ_BULK_JOB *job){
+
+    size_t i;
+
+    if (!job || !(*job)){
+        return;
+    }
+
+    for (i = 0; i < (*job)->chunkNumber; i++){
+        if ((*job)->chunk[i].md5_list){
+            deepviz_list_free(&(*job)->chunk[i].md5_list);
+        }
+    }
+
+    free(*job);
+    (*job) = NULL;
+
+}
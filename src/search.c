@@ -0,0 +1,951 @@
+/*
+* Copyright (c) 2016 Saferbytes s.r.l.s.
+*
+* You can redistribute it and/or modify it under the terms of the MIT license.
+* See LICENSE for details.
+*/
+
+#include "c-deepviz.h"
+#include "c-deepviz_private.h"
+#include <limits.h>
+
+/*
+* Search cursors.
+* A cursor walks the pages of a search query. Each cursor owns a prefetch thread: as soon as a page is
+* handed to the caller, the request of the following one is sent, so that it is usually ready by the
+* time deepviz_search_next() is called again. The page size adapts to what the server does: it doubles
+* while pages come back fast and small, and halves when a page is slow or too big.
+*/
+
+#ifdef _WIN32
+#define     SEARCH_THREAD_LOCAL         __declspec(thread)
+#else
+#define     SEARCH_THREAD_LOCAL         __thread
+#endif
+
+#define     SEARCH_MIN_PAGE_SIZE        10
+#define     SEARCH_TARGET_LATENCY_MS    1000
+#define     SEARCH_MAX_PAGE_BYTES       (8 * 1024 * 1024)
+
+struct _DEEPVIZ_SEARCH_CURSOR{
+    DEEPVIZ_MUTEX           lock;
+    DEEPVIZ_COND            cond;
+    const char              *httpPage;
+    char                    *request;               /* Compiled query */
+    char                    *timeDelta;
+    DEEPVIZ_RESULT_FORMAT   format;                 /* Of the thread that opened the cursor */
+    int                     offset;                 /* Start of the next page returned */
+    int                     pageSize;               /* Rows of the next request */
+    int                     maxPageSize;
+    deepviz_bool            requested;              /* A request of "fetchRows" rows at "fetchOffset" is pending */
+    deepviz_bool            ready;                  /* ... and its result is in "fetched" */
+    int                     fetchOffset;
+    int                     fetchRows;
+    PDEEPVIZ_RESULT         fetched;
+    unsigned long long      fetchMs;
+    deepviz_bool            exhausted;
+    deepviz_bool            stop;
+    PDEEPVIZ_CANCEL_TOKEN   token;                  /* Aborts the request in progress on close */
+    DEEPVIZ_THREAD          thread;
+    deepviz_bool            threadStarted;
+};
+
+
+static void search_prefetch_thread(void* param){
+
+    PDEEPVIZ_SEARCH_CURSOR  cursor = (PDEEPVIZ_SEARCH_CURSOR)param;
+    PDEEPVIZ_RESULT         result;
+    unsigned long long      startTime;
+    int                     offset;
+    int                     rows;
+
+    deepviz_cancel_token_attach(cursor->token);
+    deepviz_result_format_set(cursor->format);
+
+    dvz_mutex_lock(&cursor->lock);
+
+    while (!cursor->stop){
+
+        if (!cursor->requested || cursor->ready){
+            dvz_cond_wait(&cursor->cond, &cursor->lock);
+            continue;
+        }
+
+        offset = cursor->fetchOffset;
+        rows = cursor->fetchRows;
+        dvz_mutex_unlock(&cursor->lock);
+
+        startTime = dvz_time_ms();
+        result = dvz_search_page(cursor->httpPage, cursor->request, cursor->timeDelta, offset, rows);
+
+        dvz_mutex_lock(&cursor->lock);
+        cursor->fetched = result;
+        cursor->fetchMs = dvz_time_ms() - startTime;
+        cursor->ready = deepviz_true;
+        dvz_cond_broadcast(&cursor->cond);
+    }
+
+    dvz_mutex_unlock(&cursor->lock);
+}
+
+
+/* Must be called with the cursor locked */
+static void search_request(PDEEPVIZ_SEARCH_CURSOR cursor){
+
+    cursor->fetchOffset = cursor->offset;
+    cursor->fetchRows = cursor->pageSize;
+    cursor->requested = deepviz_true;
+    cursor->ready = deepviz_false;
+    dvz_cond_broadcast(&cursor->cond);
+}
+
+
+/* Rows of a result page: the "data" array, or the sum of the arrays of a "data" object (IPs, domains, samples...) */
+static size_t search_data_rows(json_t* jsonData){
+
+    json_t      *jsonValue;
+    const char  *key;
+    size_t      rows = 0;
+
+    if (json_is_array(jsonData)){
+        rows = json_array_size(jsonData);
+    }
+    else if (json_is_object(jsonData)){
+        json_object_foreach(jsonData, key, jsonValue){
+            rows += json_array_size(jsonValue);
+        }
+    }
+
+    return rows;
+}
+
+
+static size_t search_page_rows(PDEEPVIZ_RESULT result){
+
+    json_t      *jsonData;
+    size_t      rows;
+
+    jsonData = dvz_result_to_json(result);
+    if (!jsonData){
+        return 0;
+    }
+
+    rows = search_data_rows(jsonData);
+
+    json_decref(jsonData);
+
+    return rows;
+}
+
+
+/* Next page size, from the latency and the size of the last page */
+static void search_adapt(PDEEPVIZ_SEARCH_CURSOR cursor, unsigned long long fetchMs, size_t bytes){
+
+    if (fetchMs > 2 * SEARCH_TARGET_LATENCY_MS || bytes > SEARCH_MAX_PAGE_BYTES){
+        cursor->pageSize /= 2;
+    }
+    else if (fetchMs < SEARCH_TARGET_LATENCY_MS / 2 && bytes < SEARCH_MAX_PAGE_BYTES / 2){
+        cursor->pageSize *= 2;
+    }
+
+    if (cursor->pageSize > cursor->maxPageSize){
+        cursor->pageSize = cursor->maxPageSize;
+    }
+    if (cursor->pageSize < SEARCH_MIN_PAGE_SIZE){
+        cursor->pageSize = SEARCH_MIN_PAGE_SIZE;
+    }
+}
+
+
+/* Compile and free a search query */
+static char* search_compile(json_t* query){
+
+    char    *request;
+
+    if (!query){
+        return NULL;
+    }
+
+    request = dvz_search_compile(query);
+    json_decref(query);
+
+    return request;
+}
+
+
+static void search_cancel_wakeup(void* param){
+
+    PDEEPVIZ_SEARCH_CURSOR  cursor = (PDEEPVIZ_SEARCH_CURSOR)param;
+
+    dvz_mutex_lock(&cursor->lock);
+    dvz_cond_broadcast(&cursor->cond);
+    dvz_mutex_unlock(&cursor->lock);
+}
+
+
+PDEEPVIZ_RESULT dvz_search_open(const char* httpPage, char* request, char* timeDelta, int start_offset, int page_size,
+                                PDEEPVIZ_SEARCH_CURSOR* cursor, char* retMsg){
+
+    PDEEPVIZ_SEARCH_CURSOR  newCursor;
+
+    if (!request){
+        if (timeDelta) free(timeDelta);
+        deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Error creating HTTP request");
+        return deepviz_result_init(DEEPVIZ_STATUS_INTERNAL_ERROR, retMsg);
+    }
+
+    newCursor = (PDEEPVIZ_SEARCH_CURSOR)malloc(sizeof(DEEPVIZ_SEARCH_CURSOR));
+    if (!newCursor){
+        free(request);
+        if (timeDelta) free(timeDelta);
+        deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Memory allocation error");
+        return deepviz_result_init(DEEPVIZ_STATUS_INTERNAL_ERROR, retMsg);
+    }
+
+    memset(newCursor, 0, sizeof(DEEPVIZ_SEARCH_CURSOR));
+    newCursor->httpPage = httpPage;
+    newCursor->request = request;
+    newCursor->timeDelta = timeDelta;
+    newCursor->format = dvz_result_format_current();
+    newCursor->offset = start_offset > 0 ? start_offset : 0;
+    newCursor->pageSize = page_size > 0 ? page_size : DEEPVIZ_SEARCH_DEFAULT_PAGE_SIZE;
+    newCursor->maxPageSize = DEEPVIZ_SEARCH_MAX_PAGE_SIZE;
+    if (newCursor->pageSize > newCursor->maxPageSize){
+        newCursor->maxPageSize = newCursor->pageSize;
+    }
+
+    newCursor->token = deepviz_cancel_token_init();
+    if (!newCursor->token){
+        free(request);
+        if (timeDelta) free(timeDelta);
+        free(newCursor);
+        deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Memory allocation error");
+        return deepviz_result_init(DEEPVIZ_STATUS_INTERNAL_ERROR, retMsg);
+    }
+
+    dvz_mutex_init(&newCursor->lock);
+    dvz_cond_init(&newCursor->cond);
+
+    /* The first page is fetched right away */
+    search_request(newCursor);
+
+    newCursor->threadStarted = dvz_thread_create(&newCursor->thread, search_prefetch_thread, newCursor);
+    if (!newCursor->threadStarted){
+        deepviz_search_close(&newCursor);
+        deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Error creating the prefetch thread");
+        return deepviz_result_init(DEEPVIZ_STATUS_INTERNAL_ERROR, retMsg);
+    }
+
+    (*cursor) = newCursor;
+
+    deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Search cursor opened");
+    return deepviz_result_init(DEEPVIZ_STATUS_SUCCESS, retMsg);
+}
+
+
+EXPORT PDEEPVIZ_RESULT deepviz_search_open(const char* api_key,
+                                            const char* search_string,
+                                            int start_offset,
+                                            int page_size,
+                                            PDEEPVIZ_SEARCH_CURSOR* cursor){
+
+    char    *retMsg;
+
+    retMsg = (char*)malloc(DEEPVIZ_ERROR_MAX_LEN);
+    if (!retMsg){
+        return deepviz_result_init(DEEPVIZ_STATUS_INTERNAL_ERROR, NULL);
+    }
+
+    if (!api_key || !search_string || !cursor){
+        deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Invalid or missing parameters. Please try again!");
+        return deepviz_result_init(DEEPVIZ_STATUS_INPUT_ERROR, retMsg);
+    }
+
+    (*cursor) = NULL;
+
+    return dvz_search_open(URL_INTEL_SEARCH, search_compile(dvz_search_query(api_key, search_string)), NULL,
+                            start_offset, page_size, cursor, retMsg);
+}
+
+
+EXPORT PDEEPVIZ_RESULT deepviz_advanced_search_open(const char* api_key,
+                                                    PDEEPVIZ_LIST sim_hash,
+                                                    PDEEPVIZ_LIST created_files,
+                                                    PDEEPVIZ_LIST imp_hash,
+                                                    PDEEPVIZ_LIST url,
+                                                    PDEEPVIZ_LIST strings,
+                                                    PDEEPVIZ_LIST ip,
+                                                    PDEEPVIZ_LIST asn,
+                                                    const char* classification,
+                                                    PDEEPVIZ_LIST rules,
+                                                    PDEEPVIZ_LIST country,
+                                                    deepviz_bool never_seen,
+                                                    const char* time_delta,
+                                                    const char* ip_range,
+                                                    PDEEPVIZ_LIST domain,
+                                                    int start_offset,
+                                                    int page_size,
+                                                    PDEEPVIZ_SEARCH_CURSOR* cursor){
+
+    char    *retMsg;
+
+    retMsg = (char*)malloc(DEEPVIZ_ERROR_MAX_LEN);
+    if (!retMsg){
+        return deepviz_result_init(DEEPVIZ_STATUS_INTERNAL_ERROR, NULL);
+    }
+
+    if (!api_key || !cursor){
+        deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Invalid or missing parameters. Please try again!");
+        return deepviz_result_init(DEEPVIZ_STATUS_INPUT_ERROR, retMsg);
+    }
+
+    (*cursor) = NULL;
+
+    return dvz_search_open(URL_INTEL_SEARCH_ADVANCED,
+                            search_compile(dvz_advanced_search_query(api_key, sim_hash, created_files, imp_hash, url, strings,
+                                ip, asn, classification, rules, country, never_seen, time_delta, ip_range, domain)),
+                            NULL, start_offset, page_size, cursor, retMsg);
+}
+
+
+EXPORT PDEEPVIZ_RESULT deepviz_search_next(PDEEPVIZ_SEARCH_CURSOR cursor){
+
+    PDEEPVIZ_CANCEL_TOKEN   token = dvz_cancel_token_current();
+    DEEPVIZ_CANCEL_WAITER   waiter;
+    PDEEPVIZ_RESULT         result;
+    char                    *retMsg;
+    size_t                  rows;
+
+    if (!cursor){
+        return NULL;
+    }
+
+    if (token && !dvz_cancel_register(token, &waiter, search_cancel_wakeup, cursor)){
+        token = NULL;
+    }
+
+    dvz_mutex_lock(&cursor->lock);
+
+    if (!cursor->requested){
+        if (cursor->exhausted){
+            dvz_mutex_unlock(&cursor->lock);
+            if (token) dvz_cancel_unregister(token, &waiter);
+            return NULL;
+        }
+
+        /* The last page failed: try it again */
+        search_request(cursor);
+    }
+
+    while (!cursor->ready && !dvz_cancel_requested()){
+        dvz_cond_wait(&cursor->cond, &cursor->lock);
+    }
+
+    if (!cursor->ready){
+        /* The page keeps loading: it is returned by the next call */
+        dvz_mutex_unlock(&cursor->lock);
+        if (token) dvz_cancel_unregister(token, &waiter);
+
+        retMsg = (char*)malloc(DEEPVIZ_ERROR_MAX_LEN);
+        if (!retMsg){
+            return deepviz_result_init(DEEPVIZ_STATUS_INTERNAL_ERROR, NULL);
+        }
+        deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Request cancelled");
+        return deepviz_result_init(DEEPVIZ_STATUS_CANCELLED, retMsg);
+    }
+
+    result = cursor->fetched;
+    cursor->fetched = NULL;
+    cursor->requested = deepviz_false;
+    cursor->ready = deepviz_false;
+
+    if (result && result->status == DEEPVIZ_STATUS_SUCCESS && result->msg){
+        rows = search_page_rows(result);
+
+        cursor->exhausted = rows < (size_t)cursor->fetchRows;
+        cursor->offset = cursor->fetchOffset + (cursor->exhausted ? (int)rows : cursor->fetchRows);
+
+        if (!cursor->exhausted){
+            search_adapt(cursor, cursor->fetchMs, result->msgLen);
+            search_request(cursor);
+        }
+    }
+
+    dvz_mutex_unlock(&cursor->lock);
+    if (token) dvz_cancel_unregister(token, &waiter);
+
+    return result;
+}
+
+
+EXPORT int deepviz_search_offset(PDEEPVIZ_SEARCH_CURSOR cursor){
+
+    int     offset;
+
+    if (!cursor){
+        return 0;
+    }
+
+    dvz_mutex_lock(&cursor->lock);
+    offset = cursor->offset;
+    dvz_mutex_unlock(&cursor->lock);
+
+    return offset;
+}
+
+
+EXPORT void deepviz_search_close(PDEEPVIZ_SEARCH_CURSOR* cursor){
+
+    PDEEPVIZ_SEARCH_CURSOR  oldCursor;
+
+    if (!cursor || !(*cursor)){
+        return;
+    }
+
+    oldCursor = (*cursor);
+    (*cursor) = NULL;
+
+    dvz_mutex_lock(&oldCursor->lock);
+    oldCursor->stop = deepviz_true;
+    dvz_cond_broadcast(&oldCursor->cond);
+    dvz_mutex_unlock(&oldCursor->lock);
+
+    /* Abort the prefetch in progress */
+    deepviz_cancel(oldCursor->token);
+
+    if (oldCursor->threadStarted){
+        dvz_thread_join(oldCursor->thread);
+    }
+
+    if (oldCursor->fetched){
+        deepviz_result_free(&oldCursor->fetched);
+    }
+    free(oldCursor->request);
+    if (oldCursor->timeDelta) free(oldCursor->timeDelta);
+
+    dvz_cond_destroy(&oldCursor->cond);
+    dvz_mutex_destroy(&oldCursor->lock);
+    deepviz_cancel_token_free(&oldCursor->token);
+    free(oldCursor);
+}
+
+
+/*
+* Parallel fan-out.
+* The pages of a search are requested by a pool of workers, each taking the next window of rows: up to
+* "threads" windows are in flight at once. The pages are parsed by the worker that fetched them and parked
+* in a reorder ring of SEARCH_FANOUT_RING_FACTOR * threads slots; the calling thread takes them out in
+* offset order and feeds their hits to the sink, skipping the hits already seen (results shift between
+* two requests, so the same hit can come back at the edge of two pages). The first short page marks the
+* end of the results: the windows past it are dropped.
+*/
+
+#define     SEARCH_FANOUT_RING_FACTOR   2
+#define     SEARCH_FANOUT_RETRIES       2
+
+typedef struct _SEARCH_PAGE{
+    deepviz_bool            ready;
+    json_t                  *data;
+}SEARCH_PAGE, *PSEARCH_PAGE;
+
+typedef struct _SEARCH_HIT_SET{
+    char                    **keys;
+    unsigned long long      *hashes;
+    size_t                  size;                   /* Power of 2 */
+    size_t                  used;
+}SEARCH_HIT_SET, *PSEARCH_HIT_SET;
+
+typedef struct _SEARCH_FANOUT_RUN{
+    DEEPVIZ_MUTEX           lock;
+    DEEPVIZ_COND            cond;
+    const char              *httpPage;
+    const char              *request;               /* Compiled query */
+    const char              *timeDelta;
+    int                     startOffset;
+    int                     pageSize;
+    int                     nextOffset;             /* Next window to request */
+    int                     emitOffset;             /* Next window to hand to the sink */
+    int                     endOffset;              /* End of the results, once known */
+    PSEARCH_PAGE            ring;
+    size_t                  ringSize;
+    PDEEPVIZ_RESULT         failure;                /* First failed page */
+    deepviz_bool            failed;
+    deepviz_bool            stop;
+    PDEEPVIZ_CANCEL_TOKEN   token;                  /* Aborts the requests in progress on stop */
+}SEARCH_FANOUT_RUN, *PSEARCH_FANOUT_RUN;
+
+
+static deepviz_bool search_hit_set_grow(PSEARCH_HIT_SET set){
+
+    SEARCH_HIT_SET  newSet;
+    size_t          i;
+    size_t          j;
+
+    newSet.size = set->size ? set->size * 2 : 1024;
+    newSet.used = set->used;
+    newSet.keys = (char**)calloc(newSet.size, sizeof(char*));
+    newSet.hashes = (unsigned long long*)calloc(newSet.size, sizeof(unsigned long long));
+    if (!newSet.keys || !newSet.hashes){
+        if (newSet.keys) free(newSet.keys);
+        if (newSet.hashes) free(newSet.hashes);
+        return deepviz_false;
+    }
+
+    for (i = 0; i < set->size; i++){
+        if (set->keys[i]){
+            for (j = set->hashes[i] & (newSet.size - 1); newSet.keys[j]; j = (j + 1) & (newSet.size - 1));
+            newSet.keys[j] = set->keys[i];
+            newSet.hashes[j] = set->hashes[i];
+        }
+    }
+
+    if (set->keys) free(set->keys);
+    if (set->hashes) free(set->hashes);
+    (*set) = newSet;
+
+    return deepviz_true;
+}
+
+
+/* deepviz_true if "key" (of "keyLen" bytes) was not in the set yet */
+static deepviz_bool search_hit_set_add(PSEARCH_HIT_SET set, const char* key, size_t keyLen){
+
+    unsigned long long  hash;
+    size_t              i;
+
+    if (set->used * 10 >= set->size * 7 && !search_hit_set_grow(set)){
+        /* Out of memory: let the hit through */
+        return deepviz_true;
+    }
+
+    hash = dvz_hash(key, keyLen);
+
+    for (i = hash & (set->size - 1); set->keys[i]; i = (i + 1) & (set->size - 1)){
+        if (set->hashes[i] == hash && !memcmp(set->keys[i], key, keyLen + 1)){
+            return deepviz_false;
+        }
+    }
+
+    set->keys[i] = (char*)malloc(keyLen + 1);
+    if (set->keys[i]){
+        memcpy(set->keys[i], key, keyLen + 1);
+        set->hashes[i] = hash;
+        set->used++;
+    }
+
+    return deepviz_true;
+}
+
+
+static void search_hit_set_free(PSEARCH_HIT_SET set){
+
+    size_t  i;
+
+    for (i = 0; i < set->size; i++){
+        if (set->keys[i]) free(set->keys[i]);
+    }
+
+    if (set->keys) free(set->keys);
+    if (set->hashes) free(set->hashes);
+}
+
+
+static void search_fanout_worker(void* param){
+
+    PSEARCH_FANOUT_RUN  run = (PSEARCH_FANOUT_RUN)param;
+    PDEEPVIZ_RESULT     result;
+    PSEARCH_PAGE        page;
+    json_t              *jsonData;
+    char                *retMsg;
+    size_t              found;
+    int                 offset;
+    int                 rows;
+    int                 retry;
+
+    deepviz_cancel_token_attach(run->token);
+
+    dvz_mutex_lock(&run->lock);
+
+    while (!run->stop && run->nextOffset < run->endOffset){
+
+        /* Wait for a free slot of the ring */
+        if ((size_t)((run->nextOffset - run->emitOffset) / run->pageSize) >= run->ringSize){
+            dvz_cond_wait(&run->cond, &run->lock);
+            continue;
+        }
+
+        offset = run->nextOffset;
+        rows = run->endOffset - offset < run->pageSize ? run->endOffset - offset : run->pageSize;
+        run->nextOffset += run->pageSize;
+        dvz_mutex_unlock(&run->lock);
+
+        for (retry = 0; ; retry++){
+            result = dvz_search_page(run->httpPage, run->request, run->timeDelta, offset, rows);
+            if (!result || retry == SEARCH_FANOUT_RETRIES || dvz_cancel_requested() ||
+                (result->status != DEEPVIZ_STATUS_NETWORK_ERROR && result->status != DEEPVIZ_STATUS_SERVER_ERROR)){
+                break;
+            }
+            deepviz_result_free(&result);
+        }
+
+        jsonData = NULL;
+        if (result && result->status == DEEPVIZ_STATUS_SUCCESS && result->msg){
+            jsonData = json_loads(result->msg, 0, NULL);
+            if (!jsonData){
+                deepviz_result_free(&result);
+                retMsg = (char*)malloc(DEEPVIZ_ERROR_MAX_LEN);
+                if (retMsg){
+                    deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Error loading Deepviz response");
+                }
+                result = deepviz_result_init(DEEPVIZ_STATUS_INTERNAL_ERROR, retMsg);
+            }
+        }
+
+        dvz_mutex_lock(&run->lock);
+
+        if (!jsonData){
+            /* The results end at the first failed page: the pages before it are still delivered */
+            if (offset < run->endOffset){
+                if (run->failure) deepviz_result_free(&run->failure);
+                run->failure = result;
+                result = NULL;
+                run->failed = deepviz_true;
+                run->endOffset = offset;
+            }
+            dvz_cond_broadcast(&run->cond);
+            if (result) deepviz_result_free(&result);
+            continue;
+        }
+
+        deepviz_result_free(&result);
+
+        /* Store the page into the ring */
+        page = &run->ring[((offset - run->startOffset) / run->pageSize) % run->ringSize];
+        page->data = jsonData;
+        page->ready = deepviz_true;
+
+        /* A short page is the last one */
+        found = search_data_rows(jsonData);
+        if (found < (size_t)rows && offset + (int)found < run->endOffset){
+            run->endOffset = offset + (int)found;
+        }
+
+        dvz_cond_broadcast(&run->cond);
+    }
+
+    dvz_mutex_unlock(&run->lock);
+}
+
+
+/* Hit being handed to a sink by this thread, see dvz_search_sink_json() */
+static SEARCH_THREAD_LOCAL json_t        *sinkJsonHit = NULL;
+static SEARCH_THREAD_LOCAL const char    *sinkHit = NULL;
+
+
+json_t* dvz_search_sink_json(const char* hit){
+
+    return hit && hit == sinkHit ? sinkJsonHit : NULL;
+}
+
+
+/* Hand a hit to the sink unless already seen (same "category" and text). Returns the answer of the sink */
+static deepviz_bool search_fanout_hit(PDEEPVIZ_SEARCH_FANOUT fanout, PSEARCH_HIT_SET hits, const char* category,
+                                        json_t* jsonHit, char** key, size_t* keySize, unsigned long long* delivered){
+
+    const char      *hit;
+    char            *hitDump = NULL;
+    size_t          categoryLen;
+    size_t          hitLen;
+    deepviz_bool    ret = deepviz_true;
+
+    if (json_is_string(jsonHit)){
+        hit = json_string_value(jsonHit);
+    }
+    else{
+        hitDump = json_dumps(jsonHit, JSON_ENCODE_ANY | JSON_COMPACT | JSON_SORT_KEYS);
+        if (!hitDump){
+            return deepviz_true;
+        }
+        hit = hitDump;
+    }
+
+    categoryLen = category ? strlen(category) : 0;
+    hitLen = strlen(hit);
+
+    if (categoryLen + hitLen + 2 > (*keySize)){
+        free(*key);
+        (*keySize) = (categoryLen + hitLen + 2) * 2;
+        (*key) = (char*)malloc(*keySize);
+        if (!(*key)){
+            (*keySize) = 0;
+        }
+    }
+
+    if (*key){
+        if (categoryLen) memcpy((*key), category, categoryLen);
+        (*key)[categoryLen] = '\n';
+        memcpy((*key) + categoryLen + 1, hit, hitLen + 1);
+    }
+
+    if (!(*key) || search_hit_set_add(hits, (*key), categoryLen + hitLen + 1)){
+        sinkJsonHit = jsonHit;
+        sinkHit = hit;
+        ret = fanout->sink(fanout->context, category, hit);
+        sinkJsonHit = NULL;
+        sinkHit = NULL;
+        (*delivered)++;
+    }
+
+    if (hitDump) free(hitDump);
+
+    return ret;
+}
+
+
+static void search_fanout_cancel_wakeup(void* param){
+
+    PSEARCH_FANOUT_RUN  run = (PSEARCH_FANOUT_RUN)param;
+
+    /* Abort the requests of the workers too */
+    deepviz_cancel(run->token);
+
+    dvz_mutex_lock(&run->lock);
+    dvz_cond_broadcast(&run->cond);
+    dvz_mutex_unlock(&run->lock);
+}
+
+
+PDEEPVIZ_RESULT dvz_search_fanout(const char* httpPage, char* request, char* timeDelta, int start_offset,
+                                    PDEEPVIZ_SEARCH_FANOUT fanout, char* retMsg){
+
+    SEARCH_FANOUT_RUN       run;
+    SEARCH_HIT_SET          hits;
+    PDEEPVIZ_CANCEL_TOKEN   token = dvz_cancel_token_current();
+    DEEPVIZ_CANCEL_WAITER   waiter;
+    DEEPVIZ_THREAD          *threads;
+    PSEARCH_PAGE            page;
+    json_t                  *jsonData;
+    json_t                  *jsonHits;
+    json_t                  *jsonHit;
+    const char              *category;
+    char                    *key = NULL;
+    size_t                  keySize = 0;
+    size_t                  threadNumber;
+    size_t                  startedThreads;
+    size_t                  i;
+    unsigned long long      delivered = 0;
+    unsigned long long      received = 0;
+    DEEPVIZ_RESULT_STATUS   status = DEEPVIZ_STATUS_SUCCESS;
+    deepviz_bool            sinkStop = deepviz_false;
+
+    if (!request){
+        if (timeDelta) free(timeDelta);
+        deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Error creating HTTP request");
+        return deepviz_result_init(DEEPVIZ_STATUS_INTERNAL_ERROR, retMsg);
+    }
+
+    memset(&run, 0, sizeof(SEARCH_FANOUT_RUN));
+    memset(&hits, 0, sizeof(SEARCH_HIT_SET));
+    threadNumber = fanout->threads ? fanout->threads : DEEPVIZ_DEFAULT_THREADS;
+    run.httpPage = httpPage;
+    run.request = request;
+    run.timeDelta = timeDelta;
+    run.startOffset = start_offset > 0 ? start_offset : 0;
+    run.pageSize = fanout->pageSize > 0 ? fanout->pageSize : DEEPVIZ_SEARCH_MAX_PAGE_SIZE;
+    run.nextOffset = run.startOffset;
+    run.emitOffset = run.startOffset;
+    run.endOffset = fanout->maxRows > 0 && fanout->maxRows < INT_MAX - run.startOffset ?
+        run.startOffset + fanout->maxRows : INT_MAX - run.pageSize;
+    run.ringSize = threadNumber * SEARCH_FANOUT_RING_FACTOR;
+    run.ring = (PSEARCH_PAGE)calloc(run.ringSize, sizeof(SEARCH_PAGE));
+    run.token = deepviz_cancel_token_init();
+    threads = (DEEPVIZ_THREAD*)calloc(threadNumber, sizeof(DEEPVIZ_THREAD));
+    if (!run.ring || !run.token || !threads || !search_hit_set_grow(&hits)){
+        if (run.ring) free(run.ring);
+        if (threads) free(threads);
+        deepviz_cancel_token_free(&run.token);
+        search_hit_set_free(&hits);
+        free(request);
+        if (timeDelta) free(timeDelta);
+        deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Memory allocation error");
+        return deepviz_result_init(DEEPVIZ_STATUS_INTERNAL_ERROR, retMsg);
+    }
+
+    dvz_mutex_init(&run.lock);
+    dvz_cond_init(&run.cond);
+
+    if (token && !dvz_cancel_register(token, &waiter, search_fanout_cancel_wakeup, &run)){
+        token = NULL;
+        run.stop = deepviz_true;
+    }
+
+    for (startedThreads = 0; startedThreads < threadNumber && !run.stop; startedThreads++){
+        if (!dvz_thread_create(&threads[startedThreads], search_fanout_worker, &run)){
+            break;
+        }
+    }
+
+    dvz_mutex_lock(&run.lock);
+
+    if (!startedThreads && !run.stop){
+        status = DEEPVIZ_STATUS_INTERNAL_ERROR;
+        deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Error creating the search threads");
+    }
+
+    /* Hand the pages to the sink in offset order */
+    while (startedThreads && run.emitOffset < run.endOffset && !run.stop && !dvz_cancel_requested()){
+
+        page = &run.ring[((run.emitOffset - run.startOffset) / run.pageSize) % run.ringSize];
+        if (!page->ready){
+            dvz_cond_wait(&run.cond, &run.lock);
+            continue;
+        }
+
+        jsonData = page->data;
+        page->data = NULL;
+        page->ready = deepviz_false;
+        run.emitOffset += run.pageSize;
+        dvz_cond_broadcast(&run.cond);
+        dvz_mutex_unlock(&run.lock);
+
+        received += search_data_rows(jsonData);
+
+        if (json_is_array(jsonData)){
+            json_array_foreach(jsonData, i, jsonHit){
+                if (!search_fanout_hit(fanout, &hits, NULL, jsonHit, &key, &keySize, &delivered)){
+                    sinkStop = deepviz_true;
+                    break;
+                }
+            }
+        }
+        else{
+            json_object_foreach(jsonData, category, jsonHits){
+                json_array_foreach(jsonHits, i, jsonHit){
+                    if (!search_fanout_hit(fanout, &hits, category, jsonHit, &key, &keySize, &delivered)){
+                        sinkStop = deepviz_true;
+                        break;
+                    }
+                }
+                if (sinkStop){
+                    break;
+                }
+            }
+        }
+
+        json_decref(jsonData);
+
+        dvz_mutex_lock(&run.lock);
+
+        if (sinkStop){
+            break;
+        }
+    }
+
+    run.stop = deepviz_true;
+    dvz_cond_broadcast(&run.cond);
+    dvz_mutex_unlock(&run.lock);
+
+    if (token) dvz_cancel_unregister(token, &waiter);
+
+    /* Abort the windows still in flight */
+    deepviz_cancel(run.token);
+
+    for (i = 0; i < startedThreads; i++){
+        dvz_thread_join(threads[i]);
+    }
+
+    if (status != DEEPVIZ_STATUS_SUCCESS){
+        /* Message already set */
+    }
+    else if (dvz_cancel_requested() || sinkStop){
+        status = DEEPVIZ_STATUS_CANCELLED;
+        deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Search stopped after %llu hits", delivered);
+    }
+    else if (run.failure){
+        status = run.failure->status;
+        deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "%s", run.failure->msg ? run.failure->msg : "Search failed");
+    }
+    else if (run.failed || run.emitOffset < run.endOffset){
+        status = DEEPVIZ_STATUS_INTERNAL_ERROR;
+        deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Search failed");
+    }
+    else{
+        deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "%llu hits (%llu duplicates dropped)", delivered, received - delivered);
+    }
+
+    for (i = 0; i < run.ringSize; i++){
+        if (run.ring[i].data) json_decref(run.ring[i].data);
+    }
+
+    if (run.failure) deepviz_result_free(&run.failure);
+    free(run.ring);
+    free(threads);
+    if (key) free(key);
+    search_hit_set_free(&hits);
+    free(request);
+    if (timeDelta) free(timeDelta);
+    dvz_cond_destroy(&run.cond);
+    dvz_mutex_destroy(&run.lock);
+    deepviz_cancel_token_free(&run.token);
+
+    return deepviz_result_init(status, retMsg);
+}
+
+
+EXPORT PDEEPVIZ_RESULT deepviz_search_fanout(const char* api_key,
+                                            const char* search_string,
+                                            int start_offset,
+                                            PDEEPVIZ_SEARCH_FANOUT fanout){
+
+    char    *retMsg;
+
+    retMsg = (char*)malloc(DEEPVIZ_ERROR_MAX_LEN);
+    if (!retMsg){
+        return deepviz_result_init(DEEPVIZ_STATUS_INTERNAL_ERROR, NULL);
+    }
+
+    if (!api_key || !search_string || !fanout || !fanout->sink){
+        deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Invalid or missing parameters. Please try again!");
+        return deepviz_result_init(DEEPVIZ_STATUS_INPUT_ERROR, retMsg);
+    }
+
+    return dvz_search_fanout(URL_INTEL_SEARCH, search_compile(dvz_search_query(api_key, search_string)), NULL,
+                            start_offset, fanout, retMsg);
+}
+
+
+EXPORT PDEEPVIZ_RESULT deepviz_advanced_search_fanout(const char* api_key,
+                                                    PDEEPVIZ_LIST sim_hash,
+                                                    PDEEPVIZ_LIST created_files,
+                                                    PDEEPVIZ_LIST imp_hash,
+                                                    PDEEPVIZ_LIST url,
+                                                    PDEEPVIZ_LIST strings,
+                                                    PDEEPVIZ_LIST ip,
+                                                    PDEEPVIZ_LIST asn,
+                                                    const char* classification,
+                                                    PDEEPVIZ_LIST rules,
+                                                    PDEEPVIZ_LIST country,
+                                                    deepviz_bool never_seen,
+                                                    const char* time_delta,
+                                                    const char* ip_range,
+                                                    PDEEPVIZ_LIST domain,
+                                                    int start_offset,
+                                                    PDEEPVIZ_SEARCH_FANOUT fanout){
+
+    char    *retMsg;
+
+    retMsg = (char*)malloc(DEEPVIZ_ERROR_MAX_LEN);
+    if (!retMsg){
+        return deepviz_result_init(DEEPVIZ_STATUS_INTERNAL_ERROR, NULL);
+    }
+
+    if (!api_key || !fanout || !fanout->sink){
+        deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Invalid or missing parameters. Please try again!");
+        return deepviz_result_init(DEEPVIZ_STATUS_INPUT_ERROR, retMsg);
+    }
+
+    return dvz_search_fanout(URL_INTEL_SEARCH_ADVANCED,
+                            search_compile(dvz_advanced_search_query(api_key, sim_hash, created_files, imp_hash, url, strings,
+                                ip, asn, classification, rules, country, never_seen, time_delta, ip_range, domain)),
+                            NULL, start_offset, fanout, retMsg);
+}
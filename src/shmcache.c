@@ -0,0 +1,773 @@
+/*
+* Copyright (c) 2016 Saferbytes s.r.l.s.
+*
+* You can redistribute it and/or modify it under the terms of the MIT license.
+* See LICENSE for details.
+*/
+
+#include "c-deepviz.h"
+#include "c-deepviz_private.h"
+
+/*
+* Shared memory result cache.
+* A single shm_open() segment holds an open addressing table and a slab allocator, so that every
+* process attached to the same name (e.g. pre-forked workers) shares the same entries within a
+* fixed amount of memory.
+* Readers never lock: every slot is protected by a sequence counter, a reader copies the entry and
+* retries if the counter changed meanwhile. Writers serialize on a robust process-shared mutex.
+* Values live in slab chunks (64 bytes to 1 MB, power of two classes); when a class runs out of
+* chunks, a CLOCK hand evicts the entries not read since its last pass.
+* Within a process, lookups and stores hold shmCacheLock for reading, so that closing the cache (which
+* takes it for writing) waits for them before unmapping the segment.
+*/
+
+#ifdef __linux__
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define     SHM_CACHE_MAGIC             0x43535a56      /* "VZSC" */
+#define     SHM_CACHE_VERSION           1
+#define     SHM_CACHE_HEADER_LEN        4096
+#define     SHM_CACHE_MIN_MEMORY        (4 * 1024 * 1024)
+
+#define     SHM_CACHE_UNIT_SHIFT        6               /* 64 bytes allocation unit */
+#define     SHM_CACHE_PAGE_LEN          (1024 * 1024)
+#define     SHM_CACHE_PAGE_UNITS        (SHM_CACHE_PAGE_LEN >> SHM_CACHE_UNIT_SHIFT)
+#define     SHM_CACHE_CLASS_NUMBER      15              /* 64 bytes .. 1 MB */
+
+#define     SHM_CACHE_BYTES_PER_SLOT    1024            /* Table sizing: one slot every 1 KB of memory */
+#define     SHM_CACHE_MAX_LOAD(n)       (((n) * 7) / 10)
+#define     SHM_CACHE_FREE_CHUNK        0xffffffff
+#define     SHM_CACHE_MAX_SPIN          1000
+
+typedef struct _SHM_CACHE_HEADER{
+    unsigned int        magic;
+    unsigned int        version;
+    unsigned int        ready;
+    unsigned int        reserved;
+    unsigned long long  totalLen;
+    unsigned long long  slotNumber;
+    unsigned long long  pageNumber;
+    unsigned long long  pageClassOffset;
+    unsigned long long  pagesOffset;
+    unsigned long long  usedPages;
+    unsigned long long  maxEntries;
+    unsigned int        freeHead[SHM_CACHE_CLASS_NUMBER];      /* First free chunk unit + 1, 0 = none */
+    unsigned long long  clockHand[SHM_CACHE_CLASS_NUMBER];
+    DEEPVIZ_CACHE_STATS stats;
+    pthread_mutex_t     lock;
+}SHM_CACHE_HEADER, *PSHM_CACHE_HEADER;
+
+typedef struct _SHM_CACHE_SLOT{
+    unsigned int        seq;                /* Odd while the slot is being written */
+    unsigned int        chunk;              /* Chunk position in allocation units */
+    unsigned long long  hash;               /* 0 = empty */
+}SHM_CACHE_SLOT, *PSHM_CACHE_SLOT;
+
+typedef struct _SHM_CACHE_CHUNK{
+    unsigned int        slot;               /* Owner slot, SHM_CACHE_FREE_CHUNK if free */
+    unsigned int        next;               /* Next free chunk unit + 1 */
+    unsigned long long  expireTime;         /* dvz_time_ms() based, monotonic clock is system wide */
+    unsigned int        status;
+    unsigned int        keyLen;
+    unsigned int        msgLen;
+    unsigned int        ref;                /* Set on every hit, cleared by the CLOCK hand */
+}SHM_CACHE_CHUNK, *PSHM_CACHE_CHUNK;
+
+typedef struct _SHM_CACHE{
+    void                *map;
+    size_t              mapLen;
+    PSHM_CACHE_HEADER   header;
+    PSHM_CACHE_SLOT     slot;
+    unsigned char       *pageClass;         /* Class + 1 of every page, 0 = unassigned */
+    char                *pages;
+}SHM_CACHE, *PSHM_CACHE;
+
+static PSHM_CACHE           shmCache = NULL;
+static pthread_rwlock_t     shmCacheLock = PTHREAD_RWLOCK_INITIALIZER;
+
+
+static unsigned long long shm_cache_slot_hash(const char* key, size_t keyLen){
+
+    unsigned long long  hash = dvz_hash(key, keyLen);
+
+    /* 0 marks empty slots */
+    return hash ? hash : 1;
+}
+
+
+static PSHM_CACHE_CHUNK shm_cache_chunk(PSHM_CACHE sc, unsigned long long unit){
+
+    return (PSHM_CACHE_CHUNK)(sc->pages + (unit << SHM_CACHE_UNIT_SHIFT));
+}
+
+
+static int shm_cache_class(size_t len){
+
+    int     c = 0;
+
+    while (c < SHM_CACHE_CLASS_NUMBER && ((size_t)1 << (c + SHM_CACHE_UNIT_SHIFT)) < len){
+        c++;
+    }
+
+    return c;
+}
+
+
+static void shm_cache_write_begin(PSHM_CACHE_SLOT slot){
+
+    __atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+
+static void shm_cache_write_end(PSHM_CACHE_SLOT slot){
+
+    __atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELEASE);
+}
+
+
+static void shm_cache_free_chunk(PSHM_CACHE sc, unsigned int unit){
+
+    PSHM_CACHE_CHUNK    chunk = shm_cache_chunk(sc, unit);
+    int                 c = sc->pageClass[unit / SHM_CACHE_PAGE_UNITS] - 1;
+
+    chunk->slot = SHM_CACHE_FREE_CHUNK;
+    chunk->next = sc->header->freeHead[c];
+    sc->header->freeHead[c] = unit + 1;
+    sc->header->stats.memory -= (unsigned long long)1 << (c + SHM_CACHE_UNIT_SHIFT);
+}
+
+
+/* Remove the entry in slot "i", shifting back the following entries of the cluster. The caller holds the lock. */
+static void shm_cache_remove_slot(PSHM_CACHE sc, unsigned long long i){
+
+    PSHM_CACHE_HEADER   header = sc->header;
+    unsigned long long  mask = header->slotNumber - 1;
+    unsigned long long  j;
+    unsigned long long  home;
+    unsigned int        unit = sc->slot[i].chunk;
+
+    shm_cache_write_begin(&sc->slot[i]);
+
+    for (j = (i + 1) & mask; ; j = (j + 1) & mask){
+
+        if (sc->slot[j].hash == 0){
+            break;
+        }
+
+        home = sc->slot[j].hash & mask;
+
+        /* Move "j" back into the hole only if its home is not between the hole and "j" */
+        if (((j - home) & mask) >= ((j - i) & mask)){
+
+            shm_cache_write_begin(&sc->slot[j]);
+
+            sc->slot[i].hash = sc->slot[j].hash;
+            sc->slot[i].chunk = sc->slot[j].chunk;
+            shm_cache_chunk(sc, sc->slot[i].chunk)->slot = (unsigned int)i;
+
+            shm_cache_write_end(&sc->slot[i]);
+            i = j;
+        }
+    }
+
+    sc->slot[i].hash = 0;
+    sc->slot[i].chunk = 0;
+    shm_cache_write_end(&sc->slot[i]);
+
+    shm_cache_free_chunk(sc, unit);
+    header->stats.entries--;
+}
+
+
+/* Evict one entry of class "c" with the CLOCK algorithm. The caller holds the lock. */
+static deepviz_bool shm_cache_evict(PSHM_CACHE sc, int c){
+
+    PSHM_CACHE_HEADER   header = sc->header;
+    PSHM_CACHE_CHUNK    chunk;
+    unsigned long long  units = (unsigned long long)1 << c;
+    unsigned long long  totalUnits = header->pageNumber * SHM_CACHE_PAGE_UNITS;
+    unsigned long long  pos = header->clockHand[c];
+    unsigned long long  steps;
+
+    /* Two full turns at most: the first one may only clear the reference bits */
+    for (steps = 0; steps < 2 * totalUnits / units + 2; steps++){
+
+        if (pos >= totalUnits){
+            pos = 0;
+        }
+
+        if (sc->pageClass[pos / SHM_CACHE_PAGE_UNITS] != c + 1){
+            /* Skip the whole page */
+            pos = (pos / SHM_CACHE_PAGE_UNITS + 1) * SHM_CACHE_PAGE_UNITS;
+            continue;
+        }
+
+        chunk = shm_cache_chunk(sc, pos);
+        if (chunk->slot != SHM_CACHE_FREE_CHUNK){
+            if (__atomic_exchange_n(&chunk->ref, 0, __ATOMIC_RELAXED) == 0){
+                header->clockHand[c] = pos + units;
+                shm_cache_remove_slot(sc, chunk->slot);
+                header->stats.evictions++;
+                return deepviz_true;
+            }
+        }
+
+        pos += units;
+    }
+
+    header->clockHand[c] = pos;
+
+    return deepviz_false;
+}
+
+
+/* Allocate a chunk of class "c", returns its unit + 1 (0 on failure). The caller holds the lock. */
+static unsigned int shm_cache_alloc_chunk(PSHM_CACHE sc, int c){
+
+    PSHM_CACHE_HEADER   header = sc->header;
+    PSHM_CACHE_CHUNK    chunk;
+    unsigned long long  units = (unsigned long long)1 << c;
+    unsigned long long  page;
+    unsigned long long  pos;
+    unsigned int        unit;
+
+    if (!header->freeHead[c]){
+
+        if (header->usedPages < header->pageNumber){
+            /* Carve a new page */
+            page = header->usedPages++;
+            sc->pageClass[page] = (unsigned char)(c + 1);
+            for (pos = (page + 1) * SHM_CACHE_PAGE_UNITS; pos > page * SHM_CACHE_PAGE_UNITS; ){
+                pos -= units;
+                chunk = shm_cache_chunk(sc, pos);
+                chunk->slot = SHM_CACHE_FREE_CHUNK;
+                chunk->next = header->freeHead[c];
+                header->freeHead[c] = (unsigned int)pos + 1;
+            }
+        }
+        else if (!shm_cache_evict(sc, c)){
+            return 0;
+        }
+    }
+
+    unit = header->freeHead[c];
+    if (unit){
+        chunk = shm_cache_chunk(sc, unit - 1);
+        header->freeHead[c] = chunk->next;
+        header->stats.memory += (unsigned long long)1 << (c + SHM_CACHE_UNIT_SHIFT);
+    }
+
+    return unit;
+}
+
+
+/* Find the slot holding "key". The caller holds the lock. */
+static PSHM_CACHE_SLOT shm_cache_find_slot(PSHM_CACHE sc, unsigned long long hash, const char* key, size_t keyLen, deepviz_bool* found){
+
+    PSHM_CACHE_SLOT     slot;
+    PSHM_CACHE_CHUNK    chunk;
+    unsigned long long  mask = sc->header->slotNumber - 1;
+    unsigned long long  i;
+
+    for (i = hash & mask; ; i = (i + 1) & mask){
+
+        slot = &sc->slot[i];
+        if (slot->hash == 0){
+            (*found) = deepviz_false;
+            return slot;
+        }
+
+        if (slot->hash == hash){
+            chunk = shm_cache_chunk(sc, slot->chunk);
+            if (chunk->keyLen == keyLen && !memcmp(chunk + 1, key, keyLen)){
+                (*found) = deepviz_true;
+                return slot;
+            }
+        }
+    }
+}
+
+
+/* Reset the whole cache, used when a process died holding the lock. The caller holds the lock. */
+static void shm_cache_reset(PSHM_CACHE sc){
+
+    PSHM_CACHE_HEADER   header = sc->header;
+    unsigned long long  i;
+
+    for (i = 0; i < header->slotNumber; i++){
+        shm_cache_write_begin(&sc->slot[i]);
+        sc->slot[i].hash = 0;
+        sc->slot[i].chunk = 0;
+        shm_cache_write_end(&sc->slot[i]);
+    }
+
+    memset(sc->pageClass, 0, (size_t)header->pageNumber);
+    memset(header->freeHead, 0, sizeof(header->freeHead));
+    memset(header->clockHand, 0, sizeof(header->clockHand));
+    memset(&header->stats, 0, sizeof(header->stats));
+    header->usedPages = 0;
+}
+
+
+static deepviz_bool shm_cache_lock(PSHM_CACHE sc){
+
+    int     err;
+
+    err = pthread_mutex_lock(&sc->header->lock);
+    if (err == EOWNERDEAD){
+        shm_cache_reset(sc);
+        pthread_mutex_consistent(&sc->header->lock);
+        return deepviz_true;
+    }
+
+    return err == 0;
+}
+
+
+static void shm_cache_layout(PSHM_CACHE_HEADER header, size_t totalLen){
+
+    unsigned long long  slotNumber = 1024;
+    unsigned long long  used;
+
+    while (slotNumber * SHM_CACHE_BYTES_PER_SLOT < totalLen){
+        slotNumber *= 2;
+    }
+
+    header->totalLen = totalLen;
+    header->slotNumber = slotNumber;
+    header->maxEntries = SHM_CACHE_MAX_LOAD(slotNumber);
+    header->pageClassOffset = SHM_CACHE_HEADER_LEN + slotNumber * sizeof(SHM_CACHE_SLOT);
+
+    used = header->pageClassOffset + totalLen / SHM_CACHE_PAGE_LEN;
+    header->pagesOffset = (used + 4095) & ~4095ULL;
+    header->pageNumber = (totalLen - header->pagesOffset) / SHM_CACHE_PAGE_LEN;
+}
+
+
+static void shm_cache_attach(PSHM_CACHE sc){
+
+    sc->header = (PSHM_CACHE_HEADER)sc->map;
+    sc->slot = (PSHM_CACHE_SLOT)((char*)sc->map + SHM_CACHE_HEADER_LEN);
+    sc->pageClass = (unsigned char*)sc->map + sc->header->pageClassOffset;
+    sc->pages = (char*)sc->map + sc->header->pagesOffset;
+}
+
+
+deepviz_bool dvz_shm_cache_enabled(void){
+
+    return shmCache != NULL;
+}
+
+
+static PDEEPVIZ_RESULT shm_cache_lookup(PSHM_CACHE sc, const char* key, size_t keyLen, unsigned int* ttlLeft){
+
+    PSHM_CACHE_SLOT     slot;
+    PSHM_CACHE_CHUNK    chunk;
+    SHM_CACHE_CHUNK     entry;
+    unsigned long long  hash;
+    unsigned long long  mask;
+    unsigned long long  chunkLen;
+    unsigned long long  now;
+    unsigned long long  i;
+    unsigned int        seq;
+    unsigned int        spin = 0;
+    char                *msg = NULL;
+    char                *keyCopy = NULL;
+
+    hash = shm_cache_slot_hash(key, keyLen);
+    mask = sc->header->slotNumber - 1;
+
+    keyCopy = (char*)malloc(keyLen);
+    if (!keyCopy){
+        return NULL;
+    }
+
+    for (i = hash & mask; ; ){
+
+        slot = &sc->slot[i];
+
+        seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1){
+            if (++spin > SHM_CACHE_MAX_SPIN) break;
+            continue;
+        }
+
+        if (__atomic_load_n(&slot->hash, __ATOMIC_RELAXED) == 0){
+            break;
+        }
+
+        if (__atomic_load_n(&slot->hash, __ATOMIC_RELAXED) == hash){
+
+            chunk = shm_cache_chunk(sc, __atomic_load_n(&slot->chunk, __ATOMIC_RELAXED));
+            memcpy(&entry, chunk, sizeof(entry));
+
+            chunkLen = (unsigned long long)1 << (sc->pageClass[((char*)chunk - sc->pages) / SHM_CACHE_PAGE_LEN] - 1 + SHM_CACHE_UNIT_SHIFT);
+            if (entry.keyLen == keyLen && sizeof(entry) + (unsigned long long)entry.keyLen + entry.msgLen <= chunkLen){
+
+                memcpy(keyCopy, chunk + 1, keyLen);
+                msg = (char*)malloc((size_t)entry.msgLen + 1);
+                if (msg){
+                    memcpy(msg, (char*)(chunk + 1) + keyLen, entry.msgLen);
+                    msg[entry.msgLen] = 0;
+                }
+            }
+
+            /* Make sure the copy is consistent */
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq){
+                if (msg) free(msg);
+                msg = NULL;
+                if (++spin > SHM_CACHE_MAX_SPIN) break;
+                continue;
+            }
+
+            if (msg && !memcmp(keyCopy, key, keyLen)){
+                __atomic_store_n(&chunk->ref, 1, __ATOMIC_RELAXED);
+                break;
+            }
+
+            if (msg) free(msg);
+            msg = NULL;
+        }
+
+        i = (i + 1) & mask;
+        if (i == (hash & mask)){
+            break;
+        }
+    }
+
+    free(keyCopy);
+
+    now = dvz_time_ms();
+    if (msg && entry.expireTime <= now){
+        free(msg);
+        msg = NULL;
+        __atomic_fetch_add(&sc->header->stats.expirations, 1, __ATOMIC_RELAXED);
+    }
+
+    if (!msg){
+        __atomic_fetch_add(&sc->header->stats.misses, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+
+    __atomic_fetch_add(&sc->header->stats.hits, 1, __ATOMIC_RELAXED);
+
+    if (ttlLeft){
+        (*ttlLeft) = (unsigned int)((entry.expireTime - now + 999) / 1000);
+    }
+
+    return deepviz_result_init((DEEPVIZ_RESULT_STATUS)entry.status, msg);
+}
+
+
+static void shm_cache_store(PSHM_CACHE sc, const char* key, size_t keyLen, PDEEPVIZ_RESULT result, unsigned int ttl){
+
+    PSHM_CACHE_HEADER   header;
+    PSHM_CACHE_SLOT     slot;
+    PSHM_CACHE_CHUNK    chunk;
+    unsigned long long  hash;
+    size_t              msgLen;
+    unsigned int        unit;
+    unsigned int        oldUnit;
+    deepviz_bool        found;
+    int                 c;
+    int                 i;
+
+    header = sc->header;
+    msgLen = strlen(result->msg);
+    c = shm_cache_class(sizeof(SHM_CACHE_CHUNK) + keyLen + msgLen);
+    if (c >= SHM_CACHE_CLASS_NUMBER){
+        return;
+    }
+
+    hash = shm_cache_slot_hash(key, keyLen);
+
+    if (!shm_cache_lock(sc)){
+        return;
+    }
+
+    unit = shm_cache_alloc_chunk(sc, c);
+    if (!unit){
+        goto unlock;
+    }
+    unit--;
+
+    chunk = shm_cache_chunk(sc, unit);
+    chunk->expireTime = dvz_time_ms() + (unsigned long long)ttl * 1000ULL;
+    chunk->status = (unsigned int)result->status;
+    chunk->keyLen = (unsigned int)keyLen;
+    chunk->msgLen = (unsigned int)msgLen;
+    chunk->ref = 0;
+    memcpy(chunk + 1, key, keyLen);
+    memcpy((char*)(chunk + 1) + keyLen, result->msg, msgLen);
+
+    slot = shm_cache_find_slot(sc, hash, key, keyLen, &found);
+
+    if (!found){
+        /* Keep the table load under the limit */
+        for (i = 0; header->stats.entries >= header->maxEntries && i < SHM_CACHE_CLASS_NUMBER; ){
+            if (!shm_cache_evict(sc, (c + i) % SHM_CACHE_CLASS_NUMBER)){
+                i++;
+            }
+        }
+        if (header->stats.entries >= header->maxEntries){
+            shm_cache_free_chunk(sc, unit);
+            goto unlock;
+        }
+        slot = shm_cache_find_slot(sc, hash, key, keyLen, &found);
+    }
+
+    chunk->slot = (unsigned int)(slot - sc->slot);
+
+    shm_cache_write_begin(slot);
+    oldUnit = slot->chunk;
+    slot->chunk = unit;
+    slot->hash = hash;
+    shm_cache_write_end(slot);
+
+    if (found){
+        shm_cache_free_chunk(sc, oldUnit);
+    }
+    else{
+        header->stats.entries++;
+    }
+
+unlock:
+    pthread_mutex_unlock(&header->lock);
+}
+
+
+PDEEPVIZ_RESULT dvz_shm_cache_lookup(const char* key, size_t keyLen, unsigned int* ttlLeft){
+
+    PDEEPVIZ_RESULT     result = NULL;
+
+    pthread_rwlock_rdlock(&shmCacheLock);
+    if (shmCache){
+        result = shm_cache_lookup(shmCache, key, keyLen, ttlLeft);
+    }
+    pthread_rwlock_unlock(&shmCacheLock);
+
+    return result;
+}
+
+
+void dvz_shm_cache_store(const char* key, size_t keyLen, PDEEPVIZ_RESULT result, unsigned int ttl){
+
+    pthread_rwlock_rdlock(&shmCacheLock);
+    if (shmCache){
+        shm_cache_store(shmCache, key, keyLen, result, ttl);
+    }
+    pthread_rwlock_unlock(&shmCacheLock);
+}
+
+
+EXPORT deepviz_bool deepviz_cache_shared_open(const char* name, size_t max_memory){
+
+    PSHM_CACHE          sc;
+    PSHM_CACHE          oldCache;
+    PSHM_CACHE_HEADER   header;
+    pthread_mutexattr_t attr;
+    struct stat         st;
+    char                shmName[256];
+    int                 fd;
+    int                 i;
+
+    if (!name){
+        return deepviz_false;
+    }
+
+    if (max_memory == 0){
+        max_memory = DEEPVIZ_CACHE_DEFAULT_MEMORY;
+    }
+    if (max_memory < SHM_CACHE_MIN_MEMORY){
+        max_memory = SHM_CACHE_MIN_MEMORY;
+    }
+
+    deepviz_sprintf(shmName, sizeof(shmName), "%s%s", name[0] == '/' ? "" : "/", name);
+
+    sc = (PSHM_CACHE)malloc(sizeof(SHM_CACHE));
+    if (!sc){
+        return deepviz_false;
+    }
+    memset(sc, 0, sizeof(SHM_CACHE));
+
+    fd = shm_open(shmName, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd >= 0){
+
+        /* First process: create the segment */
+        if (ftruncate(fd, max_memory)){
+            close(fd);
+            shm_unlink(shmName);
+            free(sc);
+            return deepviz_false;
+        }
+
+        sc->mapLen = max_memory;
+        sc->map = mmap(NULL, sc->mapLen, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (sc->map == MAP_FAILED){
+            shm_unlink(shmName);
+            free(sc);
+            return deepviz_false;
+        }
+
+        header = (PSHM_CACHE_HEADER)sc->map;
+        header->magic = SHM_CACHE_MAGIC;
+        header->version = SHM_CACHE_VERSION;
+        shm_cache_layout(header, max_memory);
+
+        pthread_mutexattr_init(&attr);
+        pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+        pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+        pthread_mutex_init(&header->lock, &attr);
+        pthread_mutexattr_destroy(&attr);
+
+        __atomic_store_n(&header->ready, 1, __ATOMIC_RELEASE);
+    }
+    else{
+
+        if (errno != EEXIST){
+            free(sc);
+            return deepviz_false;
+        }
+
+        fd = shm_open(shmName, O_RDWR, 0600);
+        if (fd < 0){
+            free(sc);
+            return deepviz_false;
+        }
+
+        /* Wait for the creator to size the segment */
+        for (i = 0; i < 100 && (fstat(fd, &st) || st.st_size < SHM_CACHE_HEADER_LEN); i++){
+            dvz_sleep(10);
+        }
+
+        sc->mapLen = (size_t)st.st_size;
+        sc->map = (sc->mapLen >= SHM_CACHE_HEADER_LEN) ? mmap(NULL, sc->mapLen, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+        close(fd);
+        if (sc->map == MAP_FAILED){
+            free(sc);
+            return deepviz_false;
+        }
+
+        header = (PSHM_CACHE_HEADER)sc->map;
+        for (i = 0; i < 100 && !__atomic_load_n(&header->ready, __ATOMIC_ACQUIRE); i++){
+            dvz_sleep(10);
+        }
+
+        if (!header->ready || header->magic != SHM_CACHE_MAGIC || header->version != SHM_CACHE_VERSION || header->totalLen != sc->mapLen){
+            munmap(sc->map, sc->mapLen);
+            free(sc);
+            return deepviz_false;
+        }
+    }
+
+    shm_cache_attach(sc);
+
+    /* Swap in the new segment once the lookups using the old one are over */
+    pthread_rwlock_wrlock(&shmCacheLock);
+    oldCache = shmCache;
+    shmCache = sc;
+    pthread_rwlock_unlock(&shmCacheLock);
+
+    if (oldCache){
+        munmap(oldCache->map, oldCache->mapLen);
+        free(oldCache);
+    }
+
+    return deepviz_true;
+}
+
+
+EXPORT void deepviz_cache_shared_close(void){
+
+    PSHM_CACHE  sc;
+
+    /* Wait for the lookups and stores in progress */
+    pthread_rwlock_wrlock(&shmCacheLock);
+    sc = shmCache;
+    shmCache = NULL;
+    pthread_rwlock_unlock(&shmCacheLock);
+
+    if (sc){
+        munmap(sc->map, sc->mapLen);
+        free(sc);
+    }
+}
+
+
+EXPORT void deepviz_cache_shared_unlink(const char* name){
+
+    char    shmName[256];
+
+    if (!name){
+        return;
+    }
+
+    deepviz_sprintf(shmName, sizeof(shmName), "%s%s", name[0] == '/' ? "" : "/", name);
+    shm_unlink(shmName);
+}
+
+
+EXPORT void deepviz_cache_shared_get_stats(PDEEPVIZ_CACHE_STATS stats){
+
+    if (!stats){
+        return;
+    }
+
+    memset(stats, 0, sizeof(DEEPVIZ_CACHE_STATS));
+
+    pthread_rwlock_rdlock(&shmCacheLock);
+    if (shmCache){
+        memcpy(stats, &shmCache->header->stats, sizeof(DEEPVIZ_CACHE_STATS));
+    }
+    pthread_rwlock_unlock(&shmCacheLock);
+}
+
+#else
+
+deepviz_bool dvz_shm_cache_enabled(void){
+
+    return deepviz_false;
+}
+
+
+PDEEPVIZ_RESULT dvz_shm_cache_lookup(const char* key, size_t keyLen, unsigned int* ttlLeft){
+
+    return NULL;
+}
+
+
+void dvz_shm_cache_store(const char* key, size_t keyLen, PDEEPVIZ_RESULT result, unsigned int ttl){
+}
+
+
+EXPORT deepviz_bool deepviz_cache_shared_open(const char* name, size_t max_memory){
+
+    /* Not supported */
+    return deepviz_false;
+}
+
+
+EXPORT void deepviz_cache_shared_close(void){
+}
+
+
+EXPORT void deepviz_cache_shared_unlink(const char* name){
+}
+
+
+EXPORT void deepviz_cache_shared_get_stats(PDEEPVIZ_CACHE_STATS stats){
+
+    if (stats){
+        memset(stats, 0, sizeof(DEEPVIZ_CACHE_STATS));
+    }
+}
+
+#endif
@@ -0,0 +1,539 @@
+/*
+* Copyright (c) 2016 Saferbytes s.r.l.s.
+*
+* You can redistribute it and/or modify it under the terms of the MIT license.
+* See LICENSE for details.
+*/
+
+#include "c-deepviz.h"
+#include "c-deepviz_private.h"
+
+#include <ctype.h>
+
+/*
+* Content-addressed sample store.
+* Samples are kept as "<store>/<md5[0:2]>/<md5[2:4]>/<md5>". Downloads are looked up in the store
+* first and linked (or cloned) into the requested path; new downloads are written into the store
+* atomically and then linked to the requested path, so a sample is never fetched twice.
+*/
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
+#endif
+
+#define     STORE_COPY_BUFFER_LEN       65536
+
+#ifdef _WIN32
+#define     STORE_PATH_SEPARATOR        '\\'
+#else
+#define     STORE_PATH_SEPARATOR        '/'
+#endif
+
+static char                         *storeDir = NULL;
+static DEEPVIZ_SAMPLE_STORE_MODE    storeMode = DEEPVIZ_SAMPLE_STORE_HARDLINK;
+static unsigned long                storeCounter = 0;
+static DEEPVIZ_MUTEX                storeLock;                  /* Guards "storeDir" against enable/disable */
+static DEEPVIZ_ONCE                 storeOnce = DEEPVIZ_ONCE_INIT;
+
+/* "/xx/yy/<md5>" after the store directory */
+#define     STORE_SHARD_LEN             (3 + 3 + 1 + 32)
+
+
+static void store_init_once(void){
+
+    dvz_mutex_init(&storeLock);
+}
+
+
+/* Build the store path of "md5" (lowercase, sharded by prefix). Returns NULL if "md5" is not valid or the store
+is disabled meanwhile. */
+static char* store_sample_path(const char* md5){
+
+    size_t  len;
+    size_t  i;
+    char    lowerMd5[33];
+    char    *path;
+
+    if (strlen(md5) != 32){
+        return NULL;
+    }
+
+    for (i = 0; i < 32; i++){
+        if (!isxdigit((unsigned char)md5[i])){
+            return NULL;
+        }
+        lowerMd5[i] = (char)tolower((unsigned char)md5[i]);
+    }
+    lowerMd5[32] = 0;
+
+    dvz_once(&storeOnce, store_init_once);
+    dvz_mutex_lock(&storeLock);
+
+    if (!storeDir){
+        dvz_mutex_unlock(&storeLock);
+        return NULL;
+    }
+
+    len = strlen(storeDir) + STORE_SHARD_LEN + 1;
+    path = (char*)malloc(len);
+    if (path){
+#ifdef _WIN32
+        sprintf_s(path, len, "%s\\%.2s\\%.2s\\%s", storeDir, lowerMd5, lowerMd5 + 2, lowerMd5);
+#else
+        snprintf(path, len, "%s/%.2s/%.2s/%s", storeDir, lowerMd5, lowerMd5 + 2, lowerMd5);
+#endif
+    }
+
+    dvz_mutex_unlock(&storeLock);
+
+    return path;
+}
+
+
+/* Create the shard directories of a store path */
+static void store_make_dirs(char* samplePath){
+
+    size_t  len = strlen(samplePath);
+    size_t  storeLen = len - STORE_SHARD_LEN;
+    size_t  i;
+
+    for (i = storeLen + 1; i < len; i++){
+        if (samplePath[i] == '/' || samplePath[i] == '\\'){
+            samplePath[i] = 0;
+#ifdef _WIN32
+            CreateDirectoryA(samplePath, NULL);
+#else
+            mkdir(samplePath, 0755);
+#endif
+            samplePath[i] = STORE_PATH_SEPARATOR;
+        }
+    }
+}
+
+
+/* Unique temporary name next to "path" */
+static char* store_temp_path(const char* path){
+
+    size_t          len = strlen(path) + 48;
+    char            *tempPath;
+    unsigned long   counter;
+
+    tempPath = (char*)malloc(len);
+    if (!tempPath){
+        return NULL;
+    }
+
+#ifdef _WIN32
+    counter = (unsigned long)InterlockedIncrement((LONG volatile*)&storeCounter);
+    sprintf_s(tempPath, len, "%s.%lu.%lu.tmp", path, (unsigned long)GetCurrentProcessId(), counter);
+#else
+    counter = __sync_add_and_fetch(&storeCounter, 1);
+    snprintf(tempPath, len, "%s.%lu.%lu.tmp", path, (unsigned long)getpid(), counter);
+#endif
+
+    return tempPath;
+}
+
+
+#ifndef _WIN32
+
+static deepviz_bool store_copy_fd(int srcFd, int dstFd){
+
+    char        buffer[STORE_COPY_BUFFER_LEN];
+    ssize_t     readLen;
+
+#ifdef FICLONE
+    /* Copy on write clone, when the filesystem supports it */
+    if (!ioctl(dstFd, FICLONE, srcFd)){
+        return deepviz_true;
+    }
+#endif
+
+    while ((readLen = read(srcFd, buffer, sizeof(buffer))) > 0){
+        if (write(dstFd, buffer, (size_t)readLen) != readLen){
+            return deepviz_false;
+        }
+    }
+
+    return readLen == 0;
+}
+
+#endif
+
+
+/* Create "dstPath" as a clone of "srcPath": hard link, reflink or plain copy, in the configured order */
+static deepviz_bool store_clone(const char* srcPath, const char* dstPath){
+
+    deepviz_bool    ret = deepviz_false;
+    char            *tempPath;
+#ifndef _WIN32
+    int             srcFd;
+    int             dstFd;
+#endif
+
+    tempPath = store_temp_path(dstPath);
+    if (!tempPath){
+        return deepviz_false;
+    }
+
+#ifdef _WIN32
+    if (storeMode == DEEPVIZ_SAMPLE_STORE_HARDLINK && CreateHardLinkA(tempPath, srcPath, NULL)){
+        ret = deepviz_true;
+    }
+    else if (CopyFileA(srcPath, tempPath, FALSE)){
+        ret = deepviz_true;
+    }
+
+    /* Replace the destination atomically */
+    if (ret && !MoveFileExA(tempPath, dstPath, MOVEFILE_REPLACE_EXISTING)){
+        DeleteFileA(tempPath);
+        ret = deepviz_false;
+    }
+#else
+    if (storeMode == DEEPVIZ_SAMPLE_STORE_HARDLINK && !link(srcPath, tempPath)){
+        ret = deepviz_true;
+    }
+    else{
+        srcFd = open(srcPath, O_RDONLY);
+        dstFd = open(tempPath, O_WRONLY | O_CREAT | O_EXCL, 0644);
+        if (srcFd >= 0 && dstFd >= 0){
+            ret = store_copy_fd(srcFd, dstFd);
+        }
+        if (srcFd >= 0) close(srcFd);
+        if (dstFd >= 0) close(dstFd);
+        if (!ret) unlink(tempPath);
+    }
+
+    /* Replace the destination atomically */
+    if (ret && rename(tempPath, dstPath)){
+        unlink(tempPath);
+        ret = deepviz_false;
+    }
+#endif
+
+    free(tempPath);
+
+    return ret;
+}
+
+
+/* Build "<path>/<md5>" */
+static char* store_destination_path(const char* md5, const char* path){
+
+    size_t  len = strlen(path) + strlen(md5) + 2;
+    char    *filePath;
+
+    filePath = (char*)malloc(len);
+    if (filePath){
+#ifdef _WIN32
+        sprintf_s(filePath, len, "%s\\%s", path, md5);
+#else
+        snprintf(filePath, len, "%s/%s", path, md5);
+#endif
+    }
+
+    return filePath;
+}
+
+
+deepviz_bool dvz_sample_store_enabled(void){
+
+    return storeDir != NULL;
+}
+
+
+PDEEPVIZ_RESULT dvz_sample_store_fetch(const char* md5, const char* path){
+
+    char            *samplePath;
+    char            *filePath;
+    char            *retMsg = NULL;
+    deepviz_bool    found = deepviz_false;
+
+    samplePath = store_sample_path(md5);
+    if (!samplePath){
+        return NULL;
+    }
+
+    filePath = store_destination_path(md5, path);
+    if (filePath){
+        found = store_clone(samplePath, filePath);
+    }
+
+    if (found){
+        retMsg = (char*)malloc(DEEPVIZ_ERROR_MAX_LEN);
+        if (retMsg){
+            deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "File retrieved from the sample store to: %s", filePath);
+        }
+    }
+
+    free(samplePath);
+    if (filePath) free(filePath);
+
+    return retMsg ? deepviz_result_init(DEEPVIZ_STATUS_SUCCESS, retMsg) : NULL;
+}
+
+
+deepviz_bool dvz_sample_store_write(const char* md5, const void* data, size_t dataLen, const char* filePath){
+
+    deepviz_bool    ret = deepviz_false;
+    char            *samplePath;
+    char            *tempPath = NULL;
+#ifdef _WIN32
+    FILE            *file;
+#else
+    char            procPath[64];
+    char            *shardDir;
+    char            *sep;
+    int             fd = -1;
+#endif
+
+    samplePath = store_sample_path(md5);
+    if (!samplePath){
+        return deepviz_false;
+    }
+
+    store_make_dirs(samplePath);
+
+#ifdef _WIN32
+    tempPath = store_temp_path(samplePath);
+    if (tempPath){
+        file = fopen(tempPath, "wb");
+        if (file){
+            ret = dataLen == 0 || fwrite(data, dataLen, 1, file) == 1;
+            ret = !fclose(file) && ret;
+            if (ret && !MoveFileExA(tempPath, samplePath, MOVEFILE_REPLACE_EXISTING)){
+                ret = deepviz_false;
+            }
+            if (!ret) DeleteFileA(tempPath);
+        }
+    }
+#else
+    shardDir = (char*)malloc(strlen(samplePath) + 1);
+    if (shardDir){
+        memcpy(shardDir, samplePath, strlen(samplePath) + 1);
+        sep = strrchr(shardDir, '/');
+        if (sep) *sep = 0;
+
+#ifdef O_TMPFILE
+        /* Anonymous file, it appears in the store only once complete */
+        fd = open(shardDir, O_TMPFILE | O_WRONLY, 0644);
+#endif
+        free(shardDir);
+    }
+
+    if (fd >= 0){
+        if (write(fd, data, dataLen) == (ssize_t)dataLen){
+            snprintf(procPath, sizeof(procPath), "/proc/self/fd/%d", fd);
+            ret = !linkat(AT_FDCWD, procPath, AT_FDCWD, samplePath, AT_SYMLINK_FOLLOW) || errno == EEXIST;
+        }
+        close(fd);
+    }
+    else{
+        /* O_TMPFILE not supported: temporary file renamed into place */
+        tempPath = store_temp_path(samplePath);
+        if (tempPath){
+            fd = open(tempPath, O_WRONLY | O_CREAT | O_EXCL, 0644);
+            if (fd >= 0){
+                ret = write(fd, data, dataLen) == (ssize_t)dataLen;
+                ret = !close(fd) && ret;
+                ret = ret && !rename(tempPath, samplePath);
+                if (!ret) unlink(tempPath);
+            }
+        }
+    }
+#endif
+
+    /* Link the stored sample to the requested path */
+    if (ret){
+        ret = store_clone(samplePath, filePath);
+    }
+
+    if (tempPath) free(tempPath);
+    free(samplePath);
+
+    return ret;
+}
+
+
+void dvz_sample_store_import(const char* md5, const char* filePath){
+
+    char            *samplePath;
+    char            *tempPath;
+#ifndef _WIN32
+    int             srcFd;
+    int             dstFd;
+    deepviz_bool    copied;
+#endif
+
+    samplePath = store_sample_path(md5);
+    if (!samplePath){
+        return;
+    }
+
+    store_make_dirs(samplePath);
+
+#ifdef _WIN32
+    if (GetFileAttributesA(samplePath) == INVALID_FILE_ATTRIBUTES &&
+        (storeMode != DEEPVIZ_SAMPLE_STORE_HARDLINK || !CreateHardLinkA(samplePath, filePath, NULL))){
+        tempPath = store_temp_path(samplePath);
+        if (tempPath){
+            if (!CopyFileA(filePath, tempPath, FALSE) || !MoveFileExA(tempPath, samplePath, MOVEFILE_REPLACE_EXISTING)){
+                DeleteFileA(tempPath);
+            }
+            free(tempPath);
+        }
+    }
+#else
+    if (access(samplePath, F_OK)){
+        /* Hard link mode on the same filesystem: just another name for the downloaded file. Otherwise the
+        store gets its own copy (a clone where supported), so that writes to the download path do not reach it */
+        if (storeMode != DEEPVIZ_SAMPLE_STORE_HARDLINK || (link(filePath, samplePath) && errno != EEXIST)){
+            tempPath = store_temp_path(samplePath);
+            if (tempPath){
+                srcFd = open(filePath, O_RDONLY);
+                dstFd = open(tempPath, O_WRONLY | O_CREAT | O_EXCL, 0644);
+                copied = srcFd >= 0 && dstFd >= 0 && store_copy_fd(srcFd, dstFd);
+
+                if (srcFd >= 0) close(srcFd);
+                if (dstFd >= 0 && close(dstFd)) copied = deepviz_false;
+                if (!copied || rename(tempPath, samplePath)){
+                    unlink(tempPath);
+                }
+                free(tempPath);
+            }
+        }
+    }
+#endif
+
+    free(samplePath);
+}
+
+
+/* Streamed write: the sample is written into a temporary file of the store by the caller */
+FILE* dvz_sample_store_create(const char* md5, char** tempPath){
+
+    char    *samplePath;
+    FILE    *file = NULL;
+
+    samplePath = store_sample_path(md5);
+    if (!samplePath){
+        return NULL;
+    }
+
+    store_make_dirs(samplePath);
+
+    (*tempPath) = store_temp_path(samplePath);
+    if ((*tempPath)){
+        file = fopen((*tempPath), "wb");
+        if (!file){
+            free((*tempPath));
+            (*tempPath) = NULL;
+        }
+    }
+
+    free(samplePath);
+
+    return file;
+}
+
+
+/* Close a file from dvz_sample_store_create() and, if "success", move it into place. Frees "tempPath" */
+deepviz_bool dvz_sample_store_commit(const char* md5, FILE* file, char* tempPath, deepviz_bool success){
+
+    char            *samplePath;
+    deepviz_bool    ret;
+
+    ret = !fclose(file) && success;
+
+    samplePath = ret ? store_sample_path(md5) : NULL;
+    if (samplePath){
+#ifdef _WIN32
+        ret = MoveFileExA(tempPath, samplePath, MOVEFILE_REPLACE_EXISTING) ? deepviz_true : deepviz_false;
+#else
+        ret = !rename(tempPath, samplePath);
+#endif
+        free(samplePath);
+    }
+    else{
+        ret = deepviz_false;
+    }
+
+    if (!ret){
+        remove(tempPath);
+    }
+
+    free(tempPath);
+
+    return ret;
+}
+
+
+EXPORT deepviz_bool deepviz_sample_store_enable(const char* directory, DEEPVIZ_SAMPLE_STORE_MODE mode){
+
+    size_t  len;
+    char    *newDir;
+    char    *oldDir;
+
+    if (!directory){
+        return deepviz_false;
+    }
+
+#ifdef _WIN32
+    CreateDirectoryA(directory, NULL);
+    if (GetFileAttributesA(directory) == INVALID_FILE_ATTRIBUTES){
+        return deepviz_false;
+    }
+#else
+    mkdir(directory, 0755);
+    if (access(directory, W_OK)){
+        return deepviz_false;
+    }
+#endif
+
+    len = strlen(directory);
+    while (len > 1 && (directory[len - 1] == '/' || directory[len - 1] == '\\')){
+        len--;
+    }
+
+    newDir = (char*)malloc(len + 1);
+    if (!newDir){
+        return deepviz_false;
+    }
+
+    memcpy(newDir, directory, len);
+    newDir[len] = 0;
+
+    dvz_once(&storeOnce, store_init_once);
+
+    /* Downloads in progress copied the previous path */
+    dvz_mutex_lock(&storeLock);
+    oldDir = storeDir;
+    storeMode = mode;
+    storeDir = newDir;
+    dvz_mutex_unlock(&storeLock);
+
+    if (oldDir) free(oldDir);
+
+    return deepviz_true;
+}
+
+
+EXPORT void deepviz_sample_store_disable(void){
+
+    char    *oldDir;
+
+    dvz_once(&storeOnce, store_init_once);
+
+    dvz_mutex_lock(&storeLock);
+    oldDir = storeDir;
+    storeDir = NULL;
+    dvz_mutex_unlock(&storeLock);
+
+    if (oldDir) free(oldDir);
+}
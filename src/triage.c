@@ -0,0 +1,224 @@
+/*
+* Copyright (c) 2016 Saferbytes s.r.l.s.
+*
+* You can redistribute it and/or modify it under the terms of the MIT license.
+* See LICENSE for details.
+*/
+
+#include "c-deepviz.h"
+#include "c-deepviz_private.h"
+
+/*
+* Upload triage.
+* Before a folder upload spends a multipart transfer on a file, the file name is matched against the
+* include/exclude globs, then the file is opened once: its size comes from the open handle and its type
+* from the first TRIAGE_HEADER_LEN bytes, read with a single positioned read.
+*/
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+
+#define     TRIAGE_HEADER_LEN           512
+
+#ifdef _WIN32
+#define     TRIAGE_SEPARATORS           "\\/"
+#define     TRIAGE_CHAR(c)              ((c) >= 'A' && (c) <= 'Z' ? (c) - 'A' + 'a' : (c))
+#else
+#define     TRIAGE_SEPARATORS           "/"
+#define     TRIAGE_CHAR(c)              (c)
+#endif
+
+
+/* "*" and "?" wildcards, case insensitive on Windows */
+static deepviz_bool triage_glob_match(const char* pattern, const char* name){
+
+    const char  *star = NULL;
+    const char  *starName = NULL;
+
+    while (*name){
+
+        if (*pattern == '*'){
+            star = pattern++;
+            starName = name;
+        }
+        else if (*pattern == '?' || (*pattern && TRIAGE_CHAR(*pattern) == TRIAGE_CHAR(*name))){
+            pattern++;
+            name++;
+        }
+        else if (star){
+            /* Backtrack: the last "*" takes one more character */
+            pattern = star + 1;
+            name = ++starName;
+        }
+        else {
+            return deepviz_false;
+        }
+    }
+
+    while (*pattern == '*') pattern++;
+
+    return !(*pattern);
+}
+
+
+/* Patterns with a path separator match the whole path, the others the file name */
+static deepviz_bool triage_glob_list_match(const char** patterns, const char* path, const char* name){
+
+    for (; *patterns; patterns++){
+        if (triage_glob_match(*patterns, strpbrk(*patterns, TRIAGE_SEPARATORS) ? path : name)){
+            return deepviz_true;
+        }
+    }
+
+    return deepviz_false;
+}
+
+
+static unsigned int triage_file_type(const unsigned char* header, size_t headerLen){
+
+    static const char   pdf[] = "%PDF-";
+    size_t              i;
+
+    if (headerLen >= 4 && !memcmp(header, "\x7f" "ELF", 4)){
+        return DEEPVIZ_FILETYPE_ELF;
+    }
+
+    if (headerLen >= 4 && (!memcmp(header, "\xfe\xed\xfa\xce", 4) || !memcmp(header, "\xfe\xed\xfa\xcf", 4) ||
+        !memcmp(header, "\xce\xfa\xed\xfe", 4) || !memcmp(header, "\xcf\xfa\xed\xfe", 4) ||
+        !memcmp(header, "\xca\xfe\xba\xbe", 4))){
+        return DEEPVIZ_FILETYPE_MACHO;
+    }
+
+    if (headerLen >= 2 && !memcmp(header, "MZ", 2)){
+        return DEEPVIZ_FILETYPE_PE;
+    }
+
+    /* OLE compound file (doc, xls, ppt, msi), or an OOXML zip: "[Content_Types].xml" is its first entry */
+    if (headerLen >= 8 && !memcmp(header, "\xd0\xcf\x11\xe0\xa1\xb1\x1a\xe1", 8)){
+        return DEEPVIZ_FILETYPE_OFFICE;
+    }
+
+    if (headerLen >= 49 && !memcmp(header, "PK\x03\x04", 4) && !memcmp(header + 30, "[Content_Types].xml", 19)){
+        return DEEPVIZ_FILETYPE_OFFICE;
+    }
+
+    /* zip (and jar, apk), rar, 7z, gzip, bzip2, xz, cab, tar */
+    if ((headerLen >= 4 && (!memcmp(header, "PK\x03\x04", 4) || !memcmp(header, "PK\x05\x06", 4) ||
+        !memcmp(header, "MSCF", 4))) ||
+        (headerLen >= 6 && (!memcmp(header, "Rar!\x1a\x07", 6) || !memcmp(header, "7z\xbc\xaf\x27\x1c", 6) ||
+        !memcmp(header, "\xfd" "7zXZ\x00", 6))) ||
+        (headerLen >= 3 && (!memcmp(header, "\x1f\x8b\x08", 3) || !memcmp(header, "BZh", 3))) ||
+        (headerLen >= 262 && !memcmp(header + 257, "ustar", 5))){
+        return DEEPVIZ_FILETYPE_ARCHIVE;
+    }
+
+    /* Readers accept the header after some leading bytes too */
+    for (i = 0; i + sizeof(pdf) - 1 <= headerLen; i++){
+        if (header[i] == '%' && !memcmp(header + i, pdf, sizeof(pdf) - 1)){
+            return DEEPVIZ_FILETYPE_PDF;
+        }
+    }
+
+    return 0;
+}
+
+
+/* Size and header of a file, from a single open */
+static deepviz_bool triage_read_header(const char* path, unsigned long long* size, unsigned char* header, size_t* headerLen){
+
+#ifdef _WIN32
+    HANDLE          hFile;
+    LARGE_INTEGER   fileSize;
+    OVERLAPPED      overlapped;
+    DWORD           readLen = 0;
+
+    hFile = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE){
+        return deepviz_false;
+    }
+
+    if (!GetFileSizeEx(hFile, &fileSize)){
+        CloseHandle(hFile);
+        return deepviz_false;
+    }
+
+    memset(&overlapped, 0, sizeof(OVERLAPPED));
+    if (fileSize.QuadPart && !ReadFile(hFile, header, TRIAGE_HEADER_LEN, &readLen, &overlapped)){
+        readLen = 0;
+    }
+
+    CloseHandle(hFile);
+
+    (*size) = (unsigned long long)fileSize.QuadPart;
+    (*headerLen) = readLen;
+#else
+    struct stat     st;
+    ssize_t         readLen = 0;
+    int             fd;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0){
+        return deepviz_false;
+    }
+
+    if (fstat(fd, &st)){
+        close(fd);
+        return deepviz_false;
+    }
+
+    if (st.st_size){
+        readLen = pread(fd, header, TRIAGE_HEADER_LEN, 0);
+        if (readLen < 0) readLen = 0;
+    }
+
+    close(fd);
+
+    (*size) = (unsigned long long)st.st_size;
+    (*headerLen) = (size_t)readLen;
+#endif
+
+    return deepviz_true;
+}
+
+
+deepviz_bool dvz_triage_file(PDEEPVIZ_UPLOAD_CONFIG config, const char* path){
+
+    unsigned char       header[TRIAGE_HEADER_LEN];
+    unsigned long long  size;
+    size_t              headerLen;
+    const char          *name;
+    const char          *separator;
+
+    /* Globs first: no I/O */
+    if (config->include || config->exclude){
+
+        for (name = path; (separator = strpbrk(name, TRIAGE_SEPARATORS)); name = separator + 1);
+
+        if (config->include && !triage_glob_list_match(config->include, path, name)){
+            return deepviz_false;
+        }
+
+        if (config->exclude && triage_glob_list_match(config->exclude, path, name)){
+            return deepviz_false;
+        }
+    }
+
+    if (!config->minSize && !config->maxSize && !config->fileTypes){
+        return deepviz_true;
+    }
+
+    /* Unreadable files are left to the upload, which reports the error */
+    if (!triage_read_header(path, &size, header, &headerLen)){
+        return deepviz_true;
+    }
+
+    if (size < config->minSize || (config->maxSize && size > config->maxSize)){
+        return deepviz_false;
+    }
+
+    return !config->fileTypes || (triage_file_type(header, headerLen) & config->fileTypes);
+}
@@ -0,0 +1,406 @@
+/*
+* Copyright (c) 2016 Saferbytes s.r.l.s.
+*
+* You can redistribute it and/or modify it under the terms of the MIT license.
+* See LICENSE for details.
+*/
+
+#include "c-deepviz.h"
+#include "c-deepviz_private.h"
+
+/*
+* Folder upload.
+* The calling thread walks the folder (or, in watch mode, the watcher thread) and queues the files found;
+* a pool of uploader threads drains the queue. The queue is bounded, so the walk never gets far ahead of
+* the uploads on large trees. Every uploader reuses its own connection (see curl_handle_acquire()).
+* The files rejected by the triage filters (see dvz_triage_file()) are not uploaded. With a journal, the
+* files uploaded by a previous run and not modified since are skipped, so an interrupted upload resumes
+* where it stopped.
+*/
+
+struct _DEEPVIZ_UPLOAD_JOB{
+    const char                  *api_key;
+    DEEPVIZ_UPLOAD_CONFIG       config;
+    PDEEPVIZ_JOURNAL            journal;
+    DEEPVIZ_MUTEX               lock;
+    DEEPVIZ_COND                notEmpty;
+    DEEPVIZ_COND                notFull;
+    DEEPVIZ_THREAD              *threads;
+    size_t                      threadNumber;
+    char                        **queue;
+    size_t                      queueHead;
+    size_t                      queueCount;
+    deepviz_bool                walkDone;
+    deepviz_bool                stop;
+    deepviz_bool                cancelled;
+    DEEPVIZ_UPLOAD_SUMMARY      summary;
+    DEEPVIZ_RESULT_STATUS       firstErrorStatus;
+    char                        firstError[DEEPVIZ_ERROR_MAX_LEN];
+};
+
+
+/* Queue a file, waiting for room if "wait" (otherwise "full" is set when there is none). deepviz_false once the job is stopped */
+static deepviz_bool upload_job_push(PDEEPVIZ_UPLOAD_JOB job, const char* path, deepviz_bool wait, deepviz_bool* full){
+
+    char            *entry;
+    size_t          len = strlen(path) + 1;
+    deepviz_bool    ret;
+
+    if (full){
+        (*full) = deepviz_false;
+    }
+
+    entry = (char*)malloc(len);
+    if (!entry){
+        /* Counted as a failed file, the walk goes on unless the job stops on errors */
+        dvz_mutex_lock(&job->lock);
+        job->summary.files++;
+        if (!job->summary.failed){
+            job->firstErrorStatus = DEEPVIZ_STATUS_INTERNAL_ERROR;
+            deepviz_sprintf(job->firstError, DEEPVIZ_ERROR_MAX_LEN, "\"%s\": %d - Memory allocation error", path, job->firstErrorStatus);
+        }
+        job->summary.failed++;
+        if (job->config.stopOnError){
+            job->stop = deepviz_true;
+            dvz_cond_broadcast(&job->notEmpty);
+            dvz_cond_broadcast(&job->notFull);
+        }
+        ret = !job->stop;
+        dvz_mutex_unlock(&job->lock);
+        return ret;
+    }
+    memcpy(entry, path, len);
+
+    dvz_mutex_lock(&job->lock);
+
+    while (wait && job->queueCount == job->config.queueSize && !job->stop){
+        dvz_cond_wait(&job->notFull, &job->lock);
+    }
+
+    ret = !job->stop;
+    if (ret && job->queueCount == job->config.queueSize){
+        (*full) = deepviz_true;
+        dvz_mutex_unlock(&job->lock);
+        free(entry);
+        return deepviz_true;
+    }
+
+    if (ret){
+        job->queue[(job->queueHead + job->queueCount) % job->config.queueSize] = entry;
+        job->queueCount++;
+        job->summary.files++;
+        dvz_cond_signal(&job->notEmpty);
+    }
+
+    dvz_mutex_unlock(&job->lock);
+
+    if (!ret){
+        free(entry);
+    }
+
+    return ret;
+}
+
+
+deepviz_bool dvz_upload_job_push(PDEEPVIZ_UPLOAD_JOB job, const char* path){
+
+    return upload_job_push(job, path, deepviz_true, NULL);
+}
+
+
+deepviz_bool dvz_upload_job_try_push(PDEEPVIZ_UPLOAD_JOB job, const char* path, deepviz_bool* full){
+
+    return upload_job_push(job, path, deepviz_false, full);
+}
+
+
+static deepviz_bool upload_walk_routine(void* context, const char* path){
+
+    return dvz_upload_job_push((PDEEPVIZ_UPLOAD_JOB)context, path);
+}
+
+
+static void upload_worker(void* param){
+
+    PDEEPVIZ_UPLOAD_JOB     job = (PDEEPVIZ_UPLOAD_JOB)param;
+    PDEEPVIZ_RESULT         result;
+    DEEPVIZ_JOURNAL_FILE    journalFile;
+    deepviz_bool            filtered;
+    deepviz_bool            skipped = deepviz_false;
+    char                    *path;
+    char                    *msg;
+
+    for (;;){
+
+        dvz_mutex_lock(&job->lock);
+
+        while (!job->queueCount && !job->walkDone && !job->stop){
+            dvz_cond_wait(&job->notEmpty, &job->lock);
+        }
+
+        if (!job->queueCount || job->stop){
+            dvz_mutex_unlock(&job->lock);
+            break;
+        }
+
+        /* Cancelled between two files: the rest of the queue is dropped */
+        if (dvz_cancel_requested()){
+            job->cancelled = deepviz_true;
+            job->stop = deepviz_true;
+            dvz_cond_broadcast(&job->notEmpty);
+            dvz_cond_broadcast(&job->notFull);
+            dvz_mutex_unlock(&job->lock);
+            break;
+        }
+
+        path = job->queue[job->queueHead];
+        job->queueHead = (job->queueHead + 1) % job->config.queueSize;
+        job->queueCount--;
+        dvz_cond_signal(&job->notFull);
+
+        dvz_mutex_unlock(&job->lock);
+
+        filtered = !dvz_triage_file(&job->config, path);
+        if (!filtered){
+            skipped = job->journal && dvz_journal_check(job->journal, path, &journalFile);
+        }
+
+        if (filtered || skipped){
+            msg = (char*)malloc(DEEPVIZ_ERROR_MAX_LEN);
+            if (msg) deepviz_sprintf(msg, DEEPVIZ_ERROR_MAX_LEN, filtered ? "File skipped (triage filters)" : "File already uploaded (journal)");
+            result = deepviz_result_init(DEEPVIZ_STATUS_SUCCESS, msg);
+        }
+        else {
+            result = deepviz_upload_sample(job->api_key, path);
+            if (job->journal && result && result->status == DEEPVIZ_STATUS_SUCCESS){
+                dvz_journal_record(job->journal, path, &journalFile);
+            }
+        }
+
+        if (job->config.callback){
+            job->config.callback(job->config.context, path, result);
+        }
+
+        dvz_mutex_lock(&job->lock);
+
+        if (filtered){
+            job->summary.filtered++;
+        }
+        else if (skipped){
+            job->summary.skipped++;
+        }
+        else if (result && result->status == DEEPVIZ_STATUS_SUCCESS){
+            job->summary.uploaded++;
+        }
+        else {
+            if (!job->summary.failed){
+                job->firstErrorStatus = result ? result->status : DEEPVIZ_STATUS_INTERNAL_ERROR;
+                deepviz_sprintf(job->firstError, DEEPVIZ_ERROR_MAX_LEN, "\"%s\": %d - %s", path, job->firstErrorStatus,
+                    result && result->msg ? result->msg : "Memory allocation error");
+            }
+            job->summary.failed++;
+
+            if (result && result->status == DEEPVIZ_STATUS_CANCELLED){
+                job->cancelled = deepviz_true;
+            }
+
+            if (job->config.stopOnError || job->cancelled){
+                job->stop = deepviz_true;
+                dvz_cond_broadcast(&job->notEmpty);
+                dvz_cond_broadcast(&job->notFull);
+            }
+        }
+
+        dvz_mutex_unlock(&job->lock);
+
+        if (result) deepviz_result_free(&result);
+        free(path);
+    }
+}
+
+
+EXPORT void deepviz_upload_default_config(PDEEPVIZ_UPLOAD_CONFIG config){
+
+    if (!config){
+        return;
+    }
+
+    config->threads = DEEPVIZ_DEFAULT_THREADS;
+    config->queueSize = DEEPVIZ_UPLOAD_DEFAULT_QUEUE;
+    config->stopOnError = deepviz_false;
+    config->symlinks = DEEPVIZ_SYMLINK_FILES;
+    config->crossDevice = deepviz_true;
+    config->journalPath = NULL;
+    config->minSize = 0;
+    config->maxSize = 0;
+    config->include = NULL;
+    config->exclude = NULL;
+    config->fileTypes = 0;
+    config->callback = NULL;
+    config->context = NULL;
+}
+
+
+PDEEPVIZ_UPLOAD_JOB dvz_upload_job_start(const char* api_key, PDEEPVIZ_UPLOAD_CONFIG config, DEEPVIZ_RESULT_STATUS* status, char* errorMsg){
+
+    PDEEPVIZ_UPLOAD_JOB job;
+    size_t              i;
+
+    job = (PDEEPVIZ_UPLOAD_JOB)malloc(sizeof(DEEPVIZ_UPLOAD_JOB));
+    if (!job){
+        (*status) = DEEPVIZ_STATUS_INTERNAL_ERROR;
+        deepviz_sprintf(errorMsg, DEEPVIZ_ERROR_MAX_LEN, "Memory allocation error");
+        return NULL;
+    }
+
+    memset(job, 0, sizeof(DEEPVIZ_UPLOAD_JOB));
+
+    if (config){
+        job->config = (*config);
+    }
+    else {
+        deepviz_upload_default_config(&job->config);
+    }
+
+    if (!job->config.threads) job->config.threads = DEEPVIZ_DEFAULT_THREADS;
+    if (!job->config.queueSize) job->config.queueSize = DEEPVIZ_UPLOAD_DEFAULT_QUEUE;
+
+    if (job->config.journalPath){
+        job->journal = dvz_journal_open(job->config.journalPath);
+        if (!job->journal){
+            free(job);
+            (*status) = DEEPVIZ_STATUS_INPUT_ERROR;
+            deepviz_sprintf(errorMsg, DEEPVIZ_ERROR_MAX_LEN, "Error opening the upload journal %s", config->journalPath);
+            return NULL;
+        }
+    }
+
+    job->api_key = api_key;
+    job->queue = (char**)malloc(job->config.queueSize * sizeof(char*));
+    job->threads = (DEEPVIZ_THREAD*)malloc(job->config.threads * sizeof(DEEPVIZ_THREAD));
+    if (!job->queue || !job->threads){
+        if (job->queue) free(job->queue);
+        if (job->threads) free(job->threads);
+        if (job->journal) dvz_journal_close(job->journal);
+        free(job);
+        (*status) = DEEPVIZ_STATUS_INTERNAL_ERROR;
+        deepviz_sprintf(errorMsg, DEEPVIZ_ERROR_MAX_LEN, "Memory allocation error");
+        return NULL;
+    }
+
+    dvz_mutex_init(&job->lock);
+    dvz_cond_init(&job->notEmpty);
+    dvz_cond_init(&job->notFull);
+
+    for (i = 0; i < job->config.threads; i++){
+        if (dvz_thread_create(&job->threads[job->threadNumber], upload_worker, job)){
+            job->threadNumber++;
+        }
+    }
+
+    if (!job->threadNumber){
+        dvz_upload_job_finish(job, NULL, errorMsg);
+        (*status) = DEEPVIZ_STATUS_INTERNAL_ERROR;
+        deepviz_sprintf(errorMsg, DEEPVIZ_ERROR_MAX_LEN, "Error creating the upload threads");
+        return NULL;
+    }
+
+    return job;
+}
+
+
+/* Wait for the queued files to be uploaded and free the job. Returns the status of the job; on failure "errorMsg"
+describes it */
+DEEPVIZ_RESULT_STATUS dvz_upload_job_finish(PDEEPVIZ_UPLOAD_JOB job, PDEEPVIZ_UPLOAD_SUMMARY summary, char* errorMsg){
+
+    DEEPVIZ_RESULT_STATUS   status = DEEPVIZ_STATUS_SUCCESS;
+    size_t                  i;
+
+    dvz_mutex_lock(&job->lock);
+    job->walkDone = deepviz_true;
+    dvz_cond_broadcast(&job->notEmpty);
+    dvz_mutex_unlock(&job->lock);
+
+    for (i = 0; i < job->threadNumber; i++){
+        dvz_thread_join(job->threads[i]);
+    }
+
+    /* Left in the queue when stopped */
+    for (i = 0; i < job->queueCount; i++){
+        free(job->queue[(job->queueHead + i) % job->config.queueSize]);
+    }
+
+    if (job->journal){
+        dvz_journal_close(job->journal);
+    }
+
+    dvz_cond_destroy(&job->notFull);
+    dvz_cond_destroy(&job->notEmpty);
+    dvz_mutex_destroy(&job->lock);
+
+    if (summary){
+        (*summary) = job->summary;
+    }
+
+    if (job->cancelled){
+        status = DEEPVIZ_STATUS_CANCELLED;
+        deepviz_sprintf(errorMsg, DEEPVIZ_ERROR_MAX_LEN, "Upload cancelled: %u of %u files uploaded",
+            (unsigned int)job->summary.uploaded, (unsigned int)job->summary.files);
+    }
+    else if (job->summary.failed && job->config.stopOnError){
+        status = DEEPVIZ_STATUS_INPUT_ERROR;
+        deepviz_sprintf(errorMsg, DEEPVIZ_ERROR_MAX_LEN, "Error uploading file %s", job->firstError);
+    }
+    else if (job->summary.failed){
+        status = DEEPVIZ_STATUS_INPUT_ERROR;
+        deepviz_sprintf(errorMsg, DEEPVIZ_ERROR_MAX_LEN, "%u of %u files not uploaded. First error: %s",
+            (unsigned int)job->summary.failed, (unsigned int)job->summary.files, job->firstError);
+    }
+
+    free(job->threads);
+    free(job->queue);
+    free(job);
+
+    return status;
+}
+
+
+EXPORT PDEEPVIZ_RESULT deepviz_upload_folder_parallel(  const char* api_key,
+                                                        const char* folder,
+                                                        PDEEPVIZ_UPLOAD_CONFIG config,
+                                                        PDEEPVIZ_UPLOAD_SUMMARY summary){
+
+    PDEEPVIZ_UPLOAD_JOB     job;
+    char                    *retMsg;
+    deepviz_bool            folderFound;
+    DEEPVIZ_RESULT_STATUS   status;
+
+    retMsg = (char*)malloc(DEEPVIZ_ERROR_MAX_LEN);
+    if (!retMsg){
+        return deepviz_result_init(DEEPVIZ_STATUS_INTERNAL_ERROR, NULL);
+    }
+
+    if (!api_key || !folder){
+        deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Invalid or missing parameters. Please try again!");
+        return deepviz_result_init(DEEPVIZ_STATUS_INPUT_ERROR, retMsg);
+    }
+
+    job = dvz_upload_job_start(api_key, config, &status, retMsg);
+    if (!job){
+        return deepviz_result_init(status, retMsg);
+    }
+
+    folderFound = dvz_walk_folder(folder, job->config.symlinks, job->config.crossDevice, upload_walk_routine, job);
+
+    status = dvz_upload_job_finish(job, summary, retMsg);
+
+    if (!folderFound){
+        status = DEEPVIZ_STATUS_INPUT_ERROR;
+        deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Invalid folder");
+    }
+    else if (status == DEEPVIZ_STATUS_SUCCESS){
+        deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Folder uploaded to Deepviz successfully");
+    }
+
+    return deepviz_result_init(status, retMsg);
+}
@@ -0,0 +1,431 @@
+/*
+* Copyright (c) 2016 Saferbytes s.r.l.s.
+*
+* You can redistribute it and/or modify it under the terms of the MIT license.
+* See LICENSE for details.
+*/
+
+#include "c-deepviz.h"
+#include "c-deepviz_private.h"
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#endif
+
+/* Folder walk: "routine" is called for every file in a folder and its subfolders */
+
+
+#ifdef _WIN32
+/* Windows */
+
+/* "crossDevice" is not supported: mounted volumes are reparse points, handled as links */
+static deepviz_bool walk_folder(const char* folder, DEEPVIZ_SYMLINK_POLICY symlinks, deepviz_bool crossDevice,
+                                DEEPVIZ_WALK_ROUTINE routine, void* context, deepviz_bool* stopped){
+
+    HANDLE				hFile;
+    WIN32_FIND_DATAA	data;
+    char                currPath[DEEPVIZ_FILEPATH_MAX_LEN] = { 0 };
+
+    if (strlen(folder) + 3 > DEEPVIZ_FILEPATH_MAX_LEN){
+        return deepviz_false;
+    }
+
+    /* Add "\*" */
+    sprintf_s(currPath, DEEPVIZ_FILEPATH_MAX_LEN, "%s\\*", folder);
+
+    memset(&data, 0, sizeof(WIN32_FIND_DATAA));
+
+    hFile = FindFirstFileA(currPath, &data);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        return deepviz_false;
+    }
+
+    do {
+
+        if (!strcmp("..", data.cFileName) || !strcmp(".", data.cFileName)){
+            continue;
+        }
+
+        /* Too long for the Win32 API, skipped */
+        if (strlen(folder) + strlen(data.cFileName) + 2 > DEEPVIZ_FILEPATH_MAX_LEN){
+            continue;
+        }
+
+        sprintf_s(currPath, DEEPVIZ_FILEPATH_MAX_LEN, "%s\\%s", folder, data.cFileName);
+
+        /* Symbolic links and junctions. Loops end at DEEPVIZ_FILEPATH_MAX_LEN */
+        if (data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT){
+            if (symlinks == DEEPVIZ_SYMLINK_SKIP ||
+                ((data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) && symlinks != DEEPVIZ_SYMLINK_FOLLOW)){
+                continue;
+            }
+        }
+
+        if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY){
+            /* Go to next folder */
+            walk_folder(currPath, symlinks, crossDevice, routine, context, stopped);
+        }
+        else if (!routine(context, currPath)){
+            (*stopped) = deepviz_true;
+        }
+
+    } while (!(*stopped) && FindNextFileA(hFile, &data));
+
+    FindClose(hFile);
+
+    return deepviz_true;
+}
+
+#elif defined(__linux__)
+/* Linux */
+
+/*
+* Iterative walk: every directory is opened relative to its parent with openat() and read with large
+* getdents64() calls, so the kernel never resolves a full path and no path length limit applies. A
+* file with several names (hard links, followed links) is reported once, and a directory is never
+* walked twice (bind mounts, followed links).
+*/
+
+#define     WALK_DENTS_BUFFER_LEN       (64 * 1024)
+#define     WALK_SET_INITIAL_SIZE       1024
+
+typedef struct _WALK_DIRENT64{
+    unsigned long long  d_ino;
+    long long           d_off;
+    unsigned short      d_reclen;
+    unsigned char       d_type;
+    char                d_name[1];
+}WALK_DIRENT64, *PWALK_DIRENT64;
+
+typedef struct _WALK_INODE{
+    unsigned long long  dev;
+    unsigned long long  ino;
+}WALK_INODE, *PWALK_INODE;
+
+/* Open addressing set of (dev, inode). Inode 0 marks the free slots. */
+typedef struct _WALK_INODE_SET{
+    PWALK_INODE         slot;
+    size_t              size;
+    size_t              count;
+}WALK_INODE_SET, *PWALK_INODE_SET;
+
+typedef struct _WALK_FRAME{
+    int                 fd;
+    char                *buffer;
+    long                bufferLen;
+    long                bufferPos;
+    size_t              pathLen;        /* Length of the directory path */
+}WALK_FRAME, *PWALK_FRAME;
+
+typedef struct _WALK_STATE{
+    DEEPVIZ_SYMLINK_POLICY  symlinks;
+    deepviz_bool            crossDevice;
+    dev_t                   rootDev;
+    char                    *path;
+    size_t                  pathSize;
+    PWALK_FRAME             frame;
+    size_t                  frameNumber;
+    size_t                  frameSize;
+    WALK_INODE_SET          files;
+    WALK_INODE_SET          folders;
+}WALK_STATE, *PWALK_STATE;
+
+
+/* Returns deepviz_false if already in the set */
+static deepviz_bool walk_set_insert(PWALK_INODE_SET set, unsigned long long dev, unsigned long long ino){
+
+    WALK_INODE          inode;
+    PWALK_INODE         slot;
+    size_t              size;
+    size_t              i;
+    size_t              j;
+
+    if ((set->count + 1) * 2 > set->size){
+
+        size = set->size ? set->size * 2 : WALK_SET_INITIAL_SIZE;
+        slot = (PWALK_INODE)calloc(size, sizeof(WALK_INODE));
+        if (!slot){
+            /* Not collapsed, rather than not walked */
+            return deepviz_true;
+        }
+
+        for (i = 0; i < set->size; i++){
+            if (set->slot[i].ino){
+                j = dvz_hash(&set->slot[i], sizeof(WALK_INODE)) & (size - 1);
+                while (slot[j].ino){
+                    j = (j + 1) & (size - 1);
+                }
+                slot[j] = set->slot[i];
+            }
+        }
+
+        if (set->slot) free(set->slot);
+        set->slot = slot;
+        set->size = size;
+    }
+
+    inode.dev = dev;
+    inode.ino = ino;
+
+    i = dvz_hash(&inode, sizeof(WALK_INODE)) & (set->size - 1);
+    while (set->slot[i].ino){
+        if (set->slot[i].ino == ino && set->slot[i].dev == dev){
+            return deepviz_false;
+        }
+        i = (i + 1) & (set->size - 1);
+    }
+
+    set->slot[i] = inode;
+    set->count++;
+
+    return deepviz_true;
+}
+
+
+/* Replace the last path component with "name" */
+static deepviz_bool walk_set_path(PWALK_STATE state, size_t pathLen, const char* name){
+
+    size_t  nameLen = strlen(name);
+    size_t  size;
+    char    *path;
+
+    if (pathLen + nameLen + 2 > state->pathSize){
+
+        size = (pathLen + nameLen + 2) * 2;
+        path = (char*)realloc(state->path, size);
+        if (!path){
+            return deepviz_false;
+        }
+
+        state->path = path;
+        state->pathSize = size;
+    }
+
+    state->path[pathLen] = '/';
+    memcpy(state->path + pathLen + 1, name, nameLen + 1);
+
+    return deepviz_true;
+}
+
+
+static deepviz_bool walk_push(PWALK_STATE state, int fd, size_t pathLen){
+
+    PWALK_FRAME     frame;
+    size_t          size;
+
+    if (state->frameNumber == state->frameSize){
+
+        size = state->frameSize ? state->frameSize * 2 : 16;
+        frame = (PWALK_FRAME)realloc(state->frame, size * sizeof(WALK_FRAME));
+        if (!frame){
+            return deepviz_false;
+        }
+
+        state->frame = frame;
+        state->frameSize = size;
+    }
+
+    frame = &state->frame[state->frameNumber];
+    frame->buffer = (char*)malloc(WALK_DENTS_BUFFER_LEN);
+    if (!frame->buffer){
+        return deepviz_false;
+    }
+
+    frame->fd = fd;
+    frame->bufferLen = 0;
+    frame->bufferPos = 0;
+    frame->pathLen = pathLen;
+
+    state->frameNumber++;
+
+    return deepviz_true;
+}
+
+
+static void walk_pop(PWALK_STATE state){
+
+    PWALK_FRAME     frame = &state->frame[--state->frameNumber];
+
+    close(frame->fd);
+    free(frame->buffer);
+}
+
+
+/* Open the subfolder "name" of "frame" and push it, unless excluded by the policies or already walked */
+static void walk_enter(PWALK_STATE state, PWALK_FRAME frame, const char* name, deepviz_bool link){
+
+    struct stat     st;
+    size_t          pathLen = strlen(state->path);
+    int             fd;
+
+    fd = openat(frame->fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC | (link ? 0 : O_NOFOLLOW));
+    if (fd < 0){
+        return;
+    }
+
+    if (fstat(fd, &st) ||
+        (!state->crossDevice && st.st_dev != state->rootDev) ||
+        !walk_set_insert(&state->folders, (unsigned long long)st.st_dev, (unsigned long long)st.st_ino) ||
+        !walk_push(state, fd, pathLen)){
+        close(fd);
+    }
+}
+
+
+static deepviz_bool walk_folder(const char* folder, DEEPVIZ_SYMLINK_POLICY symlinks, deepviz_bool crossDevice,
+                                DEEPVIZ_WALK_ROUTINE routine, void* context, deepviz_bool* stopped){
+
+    WALK_STATE      state;
+    PWALK_FRAME     frame;
+    PWALK_DIRENT64  entry;
+    struct stat     st;
+    size_t          pathLen;
+    unsigned char   type;
+    deepviz_bool    link;
+    deepviz_bool    statDone;
+    int             fd;
+    long            len;
+
+    fd = open(folder, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0){
+        return deepviz_false;
+    }
+
+    memset(&state, 0, sizeof(WALK_STATE));
+    state.symlinks = symlinks;
+    state.crossDevice = crossDevice;
+
+    /* Without the trailing '/' */
+    pathLen = strlen(folder);
+    while (pathLen > 1 && folder[pathLen - 1] == '/'){
+        pathLen--;
+    }
+
+    state.pathSize = pathLen + 256;
+    state.path = (char*)malloc(state.pathSize);
+
+    if (!state.path || fstat(fd, &st) || !walk_push(&state, fd, pathLen == 1 && folder[0] == '/' ? 0 : pathLen)){
+        if (state.path) free(state.path);
+        if (state.frame) free(state.frame);
+        close(fd);
+        return deepviz_false;
+    }
+
+    memcpy(state.path, folder, pathLen);
+    state.path[pathLen] = 0;
+    state.rootDev = st.st_dev;
+    walk_set_insert(&state.folders, (unsigned long long)st.st_dev, (unsigned long long)st.st_ino);
+
+    while (state.frameNumber && !(*stopped)){
+
+        frame = &state.frame[state.frameNumber - 1];
+
+        if (frame->bufferPos >= frame->bufferLen){
+            len = syscall(SYS_getdents64, frame->fd, frame->buffer, WALK_DENTS_BUFFER_LEN);
+            if (len <= 0){
+                walk_pop(&state);
+                continue;
+            }
+            frame->bufferLen = len;
+            frame->bufferPos = 0;
+        }
+
+        entry = (PWALK_DIRENT64)(frame->buffer + frame->bufferPos);
+        frame->bufferPos += entry->d_reclen;
+
+        if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, "..")){
+            continue;
+        }
+
+        if (!walk_set_path(&state, frame->pathLen, entry->d_name)){
+            continue;
+        }
+
+        type = entry->d_type;
+        link = deepviz_false;
+        statDone = deepviz_false;
+
+        /* Some filesystems (XFS, NFS...) do not report the type */
+        if (type == DT_UNKNOWN){
+            if (fstatat(frame->fd, entry->d_name, &st, AT_SYMLINK_NOFOLLOW)){
+                continue;
+            }
+            type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : S_ISLNK(st.st_mode) ? DT_LNK : DT_UNKNOWN;
+            statDone = deepviz_true;
+        }
+
+        if (type == DT_LNK){
+
+            if (state.symlinks == DEEPVIZ_SYMLINK_SKIP || fstatat(frame->fd, entry->d_name, &st, 0)){
+                continue;
+            }
+
+            type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+            link = deepviz_true;
+            statDone = deepviz_true;
+
+            if (type == DT_DIR && state.symlinks != DEEPVIZ_SYMLINK_FOLLOW){
+                continue;
+            }
+        }
+
+        if (type == DT_DIR){
+            walk_enter(&state, frame, entry->d_name, link);
+            continue;
+        }
+
+        /* Devices, pipes and sockets are not samples */
+        if (type != DT_REG){
+            continue;
+        }
+
+        if (!statDone && fstatat(frame->fd, entry->d_name, &st, AT_SYMLINK_NOFOLLOW)){
+            continue;
+        }
+
+        /* Report every file once, whatever the number of names. A file reached directly may be reached again
+        through a link later on, so all of them are recorded while links are followed */
+        if ((state.symlinks != DEEPVIZ_SYMLINK_SKIP || st.st_nlink > 1) &&
+            !walk_set_insert(&state.files, (unsigned long long)st.st_dev, (unsigned long long)st.st_ino)){
+            continue;
+        }
+
+        if (!routine(context, state.path)){
+            (*stopped) = deepviz_true;
+        }
+    }
+
+    while (state.frameNumber){
+        walk_pop(&state);
+    }
+
+    if (state.files.slot) free(state.files.slot);
+    if (state.folders.slot) free(state.folders.slot);
+    free(state.frame);
+    free(state.path);
+
+    return deepviz_true;
+}
+
+#else
+
+static deepviz_bool walk_folder(const char* folder, DEEPVIZ_SYMLINK_POLICY symlinks, deepviz_bool crossDevice,
+                                DEEPVIZ_WALK_ROUTINE routine, void* context, deepviz_bool* stopped){
+
+    /* TODO */
+    return deepviz_false;
+}
+
+#endif
+
+
+deepviz_bool dvz_walk_folder(const char* folder, DEEPVIZ_SYMLINK_POLICY symlinks, deepviz_bool crossDevice,
+                             DEEPVIZ_WALK_ROUTINE routine, void* context){
+
+    deepviz_bool    stopped = deepviz_false;
+
+    return walk_folder(folder, symlinks, crossDevice, routine, context, &stopped);
+}
@@ -0,0 +1,902 @@
+/*
+* Copyright (c) 2016 Saferbytes s.r.l.s.
+*
+* You can redistribute it and/or modify it under the terms of the MIT license.
+* See LICENSE for details.
+*/
+
+#include "c-deepviz.h"
+#include "c-deepviz_private.h"
+
+/*
+* Folder watch.
+* A watcher thread receives the change notifications of the folder tree (inotify, or fanotify for a
+* whole mount or filesystem, on Linux; ReadDirectoryChangesW on Windows) and keeps the files being written in a
+* pending table. A file is pushed into the upload pipeline (see dvz_upload_job_start()) once it has
+* been closed after writing and left untouched for the settle window; all the files settled since the
+* last wakeup are pushed together. The watcher thread never waits for the uploaders: when their queue
+* is full, the settled files stay pending until the next wakeup. When notifications are lost (queue
+* overflow) the tree is walked again and its files go through the same settle window.
+*/
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <sys/fanotify.h>
+#include <sys/syscall.h>
+
+/* Linux 5.9+: fanotify reports directory entry events, with the folder file handle and the entry name */
+#if defined(FAN_REPORT_DFID_NAME) && defined(SYS_open_by_handle_at)
+#define     WATCH_FANOTIFY_NAMES
+#endif
+#endif
+
+#define     WATCH_BUCKETS               4096
+#define     WATCH_MIN_WAKEUP_MS         10
+#define     WATCH_BUFFER_SIZE           (64 * 1024)
+
+typedef struct _WATCH_PENDING{
+    struct _WATCH_PENDING   *next;
+    unsigned long long      hash;
+    unsigned long long      lastEvent;              /* dvz_time_ms() */
+    deepviz_bool            closed;                 /* Closed after writing (or no close notification) */
+    char                    path[1];
+}WATCH_PENDING, *PWATCH_PENDING;
+
+struct _DEEPVIZ_WATCH{
+    PDEEPVIZ_UPLOAD_JOB     job;
+    DEEPVIZ_THREAD          thread;
+    unsigned int            settleMs;
+    deepviz_bool            crossDevice;
+    deepviz_bool            jobStopped;
+    char                    *folder;
+    size_t                  folderLen;
+    PWATCH_PENDING          pending[WATCH_BUCKETS];
+    size_t                  pendingNumber;
+#ifdef _WIN32
+    HANDLE                  dir;
+    HANDLE                  stopEvent;
+#else
+    int                     fd;
+    int                     stopPipe[2];
+    deepviz_bool            fanotify;
+    deepviz_bool            fanotifyNames;          /* FAN_REPORT_DFID_NAME events, resolved from "rootFd" */
+    int                     rootFd;
+    char                    **dirs;                 /* inotify watch descriptor -> folder path */
+    size_t                  dirNumber;
+    dev_t                   rootDev;
+#endif
+};
+
+
+/* Pending files */
+
+static PWATCH_PENDING* watch_pending_find(PDEEPVIZ_WATCH watch, const char* path, unsigned long long hash){
+
+    PWATCH_PENDING  *link;
+
+    for (link = &watch->pending[hash & (WATCH_BUCKETS - 1)]; *link; link = &(*link)->next){
+        if ((*link)->hash == hash && !strcmp((*link)->path, path)){
+            return link;
+        }
+    }
+
+    return NULL;
+}
+
+
+static void watch_pending_touch(PDEEPVIZ_WATCH watch, const char* path, deepviz_bool closed){
+
+    PWATCH_PENDING      *link;
+    PWATCH_PENDING      entry;
+    unsigned long long  hash = dvz_hash(path, strlen(path));
+
+    link = watch_pending_find(watch, path, hash);
+    if (link){
+        entry = (*link);
+    }
+    else {
+        entry = (PWATCH_PENDING)malloc(sizeof(WATCH_PENDING) + strlen(path));
+        if (!entry){
+            return;
+        }
+
+        memcpy(entry->path, path, strlen(path) + 1);
+        entry->hash = hash;
+        entry->next = watch->pending[hash & (WATCH_BUCKETS - 1)];
+        watch->pending[hash & (WATCH_BUCKETS - 1)] = entry;
+        watch->pendingNumber++;
+    }
+
+    entry->lastEvent = dvz_time_ms();
+    entry->closed = closed;
+}
+
+
+static void watch_pending_remove(PDEEPVIZ_WATCH watch, const char* path){
+
+    PWATCH_PENDING  *link;
+    PWATCH_PENDING  entry;
+
+    link = watch_pending_find(watch, path, dvz_hash(path, strlen(path)));
+    if (link){
+        entry = (*link);
+        (*link) = entry->next;
+        free(entry);
+        watch->pendingNumber--;
+    }
+}
+
+
+static deepviz_bool watch_is_file(const char* path){
+
+#ifdef _WIN32
+    DWORD   attributes = GetFileAttributesA(path);
+
+    return attributes != INVALID_FILE_ATTRIBUTES &&
+        !(attributes & (FILE_ATTRIBUTE_DIRECTORY | FILE_ATTRIBUTE_REPARSE_POINT)) ? deepviz_true : deepviz_false;
+#else
+    struct stat st;
+
+    return !lstat(path, &st) && S_ISREG(st.st_mode) ? deepviz_true : deepviz_false;
+#endif
+}
+
+
+/* Push the settled files into the upload pipeline, as long as it has room. With "all", every closed file is pushed,
+waiting for room if needed */
+static void watch_flush(PDEEPVIZ_WATCH watch, deepviz_bool all){
+
+    PWATCH_PENDING      *link;
+    PWATCH_PENDING      entry;
+    unsigned long long  now = dvz_time_ms();
+    deepviz_bool        full = deepviz_false;
+    size_t              i;
+
+    for (i = 0; i < WATCH_BUCKETS && watch->pendingNumber; i++){
+
+        link = &watch->pending[i];
+        while (*link){
+
+            entry = (*link);
+            if (!entry->closed || (!all && now - entry->lastEvent < watch->settleMs)){
+                link = &entry->next;
+                continue;
+            }
+
+            if (!watch->jobStopped && watch_is_file(entry->path)){
+                watch->jobStopped = all ? !dvz_upload_job_push(watch->job, entry->path) :
+                                          !dvz_upload_job_try_push(watch->job, entry->path, &full);
+                if (full){
+                    /* Retried at the next wakeup */
+                    return;
+                }
+            }
+
+            (*link) = entry->next;
+            watch->pendingNumber--;
+            free(entry);
+        }
+    }
+}
+
+
+/* Walk routine: files found by a rescan wait for the settle window as well */
+static deepviz_bool watch_rescan_routine(void* context, const char* path){
+
+    watch_pending_touch((PDEEPVIZ_WATCH)context, path, deepviz_true);
+
+    return deepviz_true;
+}
+
+
+static void watch_pending_free(PDEEPVIZ_WATCH watch){
+
+    PWATCH_PENDING  entry;
+    PWATCH_PENDING  next;
+    size_t          i;
+
+    for (i = 0; i < WATCH_BUCKETS; i++){
+        for (entry = watch->pending[i]; entry; entry = next){
+            next = entry->next;
+            free(entry);
+        }
+        watch->pending[i] = NULL;
+    }
+
+    watch->pendingNumber = 0;
+}
+
+
+static char* watch_join(const char* folder, const char* name, size_t nameLen){
+
+    size_t  folderLen = strlen(folder);
+    char    *path;
+
+    path = (char*)malloc(folderLen + nameLen + 2);
+    if (!path){
+        return NULL;
+    }
+
+    memcpy(path, folder, folderLen);
+#ifdef _WIN32
+    path[folderLen] = '\\';
+#else
+    path[folderLen] = '/';
+#endif
+    memcpy(path + folderLen + 1, name, nameLen);
+    path[folderLen + nameLen + 1] = 0;
+
+    return path;
+}
+
+
+static unsigned int watch_wakeup(PDEEPVIZ_WATCH watch){
+
+    unsigned int    wakeup = watch->settleMs / 4;
+
+    return wakeup < WATCH_MIN_WAKEUP_MS ? WATCH_MIN_WAKEUP_MS : wakeup;
+}
+
+
+#ifdef _WIN32
+/* Windows: there is no close notification, the settle window alone tells when a file is complete */
+
+static void watch_read_changes(PDEEPVIZ_WATCH watch, const unsigned char* buffer, DWORD bufferLen){
+
+    PFILE_NOTIFY_INFORMATION    info;
+    char                        name[DEEPVIZ_FILEPATH_MAX_LEN];
+    char                        *path;
+    DWORD                       offset = 0;
+    int                         nameLen;
+
+    /* Overflow: changes lost */
+    if (!bufferLen){
+        dvz_walk_folder(watch->folder, DEEPVIZ_SYMLINK_SKIP, watch->crossDevice, watch_rescan_routine, watch);
+        return;
+    }
+
+    do {
+        info = (PFILE_NOTIFY_INFORMATION)(buffer + offset);
+
+        nameLen = WideCharToMultiByte(CP_ACP, 0, info->FileName, info->FileNameLength / sizeof(WCHAR), name,
+            sizeof(name) - 1, NULL, NULL);
+
+        if (nameLen > 0){
+
+            path = watch_join(watch->folder, name, nameLen);
+            if (path){
+                switch (info->Action){
+                case FILE_ACTION_ADDED:
+                case FILE_ACTION_MODIFIED:
+                case FILE_ACTION_RENAMED_NEW_NAME:
+                    watch_pending_touch(watch, path, deepviz_true);
+                    break;
+                case FILE_ACTION_REMOVED:
+                case FILE_ACTION_RENAMED_OLD_NAME:
+                    watch_pending_remove(watch, path);
+                    break;
+                }
+                free(path);
+            }
+        }
+
+        offset += info->NextEntryOffset;
+
+    } while (info->NextEntryOffset);
+}
+
+
+static void watch_thread(void* param){
+
+    PDEEPVIZ_WATCH  watch = (PDEEPVIZ_WATCH)param;
+    unsigned char   *buffer;
+    OVERLAPPED      overlapped;
+    HANDLE          events[2];
+    DWORD           bufferLen;
+    DWORD           wait;
+
+    buffer = (unsigned char*)malloc(WATCH_BUFFER_SIZE);
+    if (!buffer){
+        return;
+    }
+
+    memset(&overlapped, 0, sizeof(OVERLAPPED));
+    overlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (!overlapped.hEvent){
+        free(buffer);
+        return;
+    }
+
+    events[0] = overlapped.hEvent;
+    events[1] = watch->stopEvent;
+
+    while (!watch->jobStopped){
+
+        ResetEvent(overlapped.hEvent);
+        if (!ReadDirectoryChangesW(watch->dir, buffer, WATCH_BUFFER_SIZE, TRUE,
+            FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE,
+            NULL, &overlapped, NULL)){
+            break;
+        }
+
+        for (;;){
+
+            wait = WaitForMultipleObjects(2, events, FALSE, watch->pendingNumber ? watch_wakeup(watch) : INFINITE);
+
+            if (wait == WAIT_OBJECT_0){
+                if (GetOverlappedResult(watch->dir, &overlapped, &bufferLen, FALSE)){
+                    watch_read_changes(watch, buffer, bufferLen);
+                }
+                watch_flush(watch, deepviz_false);
+                break;
+            }
+
+            if (wait != WAIT_TIMEOUT){
+                CancelIo(watch->dir);
+                GetOverlappedResult(watch->dir, &overlapped, &bufferLen, TRUE);
+                CloseHandle(overlapped.hEvent);
+                free(buffer);
+                return;
+            }
+
+            watch_flush(watch, deepviz_false);
+        }
+    }
+
+    CancelIo(watch->dir);
+    GetOverlappedResult(watch->dir, &overlapped, &bufferLen, TRUE);
+    CloseHandle(overlapped.hEvent);
+    free(buffer);
+}
+
+
+static deepviz_bool watch_open(PDEEPVIZ_WATCH watch, deepviz_bool wholeMount){
+
+    watch->dir = CreateFileA(watch->folder, FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+        NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, NULL);
+    if (watch->dir == INVALID_HANDLE_VALUE){
+        return deepviz_false;
+    }
+
+    watch->stopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (!watch->stopEvent){
+        CloseHandle(watch->dir);
+        return deepviz_false;
+    }
+
+    return deepviz_true;
+}
+
+
+static void watch_wake(PDEEPVIZ_WATCH watch){
+
+    SetEvent(watch->stopEvent);
+}
+
+
+static void watch_close(PDEEPVIZ_WATCH watch){
+
+    CloseHandle(watch->stopEvent);
+    CloseHandle(watch->dir);
+}
+
+#else
+/* Linux */
+
+#define     WATCH_INOTIFY_MASK  (IN_CREATE | IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | \
+                                IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK)
+
+/* Watch a folder and its subfolders. With "queueFiles" the files already there are pending too: they were
+created before the watch was in place, or the folder was moved in */
+static void watch_add_tree(PDEEPVIZ_WATCH watch, const char* folder, deepviz_bool queueFiles){
+
+    DIR             *dir;
+    struct dirent   *dirent;
+    struct stat     st;
+    char            *path;
+    char            **dirs;
+    size_t          dirNumber;
+    int             wd;
+
+    if (lstat(folder, &st) || !S_ISDIR(st.st_mode) || (!watch->crossDevice && st.st_dev != watch->rootDev)){
+        return;
+    }
+
+    wd = inotify_add_watch(watch->fd, folder, WATCH_INOTIFY_MASK);
+    if (wd < 0){
+        return;
+    }
+
+    if ((size_t)wd >= watch->dirNumber){
+        dirNumber = watch->dirNumber ? watch->dirNumber : 64;
+        while (dirNumber <= (size_t)wd) dirNumber *= 2;
+        dirs = (char**)realloc(watch->dirs, dirNumber * sizeof(char*));
+        if (!dirs){
+            inotify_rm_watch(watch->fd, wd);
+            return;
+        }
+        memset(dirs + watch->dirNumber, 0, (dirNumber - watch->dirNumber) * sizeof(char*));
+        watch->dirs = dirs;
+        watch->dirNumber = dirNumber;
+    }
+
+    /* Already watched when moved inside the tree: the path changes */
+    if (watch->dirs[wd]) free(watch->dirs[wd]);
+    watch->dirs[wd] = strdup(folder);
+
+    dir = opendir(folder);
+    if (!dir){
+        return;
+    }
+
+    while ((dirent = readdir(dir))){
+
+        if (!strcmp(dirent->d_name, ".") || !strcmp(dirent->d_name, "..")){
+            continue;
+        }
+
+        path = watch_join(folder, dirent->d_name, strlen(dirent->d_name));
+        if (!path){
+            continue;
+        }
+
+        if (dirent->d_type == DT_DIR || (dirent->d_type == DT_UNKNOWN && !lstat(path, &st) && S_ISDIR(st.st_mode))){
+            watch_add_tree(watch, path, queueFiles);
+        }
+        else if (queueFiles){
+            watch_pending_touch(watch, path, deepviz_true);
+        }
+
+        free(path);
+    }
+
+    closedir(dir);
+}
+
+
+static void watch_read_inotify(PDEEPVIZ_WATCH watch, const unsigned char* buffer, size_t bufferLen){
+
+    const struct inotify_event  *event;
+    size_t                      offset;
+    char                        *path;
+
+    for (offset = 0; offset < bufferLen; offset += sizeof(struct inotify_event) + event->len){
+
+        event = (const struct inotify_event*)(buffer + offset);
+
+        if (event->mask & IN_Q_OVERFLOW){
+            dvz_walk_folder(watch->folder, DEEPVIZ_SYMLINK_SKIP, watch->crossDevice, watch_rescan_routine, watch);
+            continue;
+        }
+
+        if (event->wd < 0 || (size_t)event->wd >= watch->dirNumber || !watch->dirs[event->wd]){
+            continue;
+        }
+
+        if (event->mask & IN_IGNORED){
+            free(watch->dirs[event->wd]);
+            watch->dirs[event->wd] = NULL;
+            continue;
+        }
+
+        if (!event->len){
+            continue;
+        }
+
+        path = watch_join(watch->dirs[event->wd], event->name, strlen(event->name));
+        if (!path){
+            continue;
+        }
+
+        if (event->mask & IN_ISDIR){
+            if (event->mask & (IN_CREATE | IN_MOVED_TO)){
+                watch_add_tree(watch, path, deepviz_true);
+            }
+        }
+        else if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)){
+            watch_pending_touch(watch, path, deepviz_true);
+        }
+        else if (event->mask & (IN_CREATE | IN_MODIFY)){
+            watch_pending_touch(watch, path, deepviz_false);
+        }
+        else if (event->mask & (IN_DELETE | IN_MOVED_FROM)){
+            watch_pending_remove(watch, path);
+        }
+
+        free(path);
+    }
+}
+
+
+#ifdef WATCH_FANOTIFY_NAMES
+/* Same layout as the "struct file_handle" of open_by_handle_at(), declared only with _GNU_SOURCE */
+typedef struct _WATCH_FILE_HANDLE{
+    unsigned int    handleBytes;
+    int             handleType;
+    unsigned char   handle[1];
+}WATCH_FILE_HANDLE, *PWATCH_FILE_HANDLE;
+
+
+/* Path of a FAN_REPORT_DFID_NAME event: its folder, opened from the file handle, and the entry name */
+static deepviz_bool watch_fanotify_name(PDEEPVIZ_WATCH watch, const struct fanotify_event_metadata* event, char* path, size_t pathSize){
+
+    const struct fanotify_event_info_fid    *info;
+    PWATCH_FILE_HANDLE                      handle;
+    const char                              *name;
+    char                                    link[64];
+    size_t                                  offset;
+    ssize_t                                 pathLen;
+    int                                     dirFd;
+
+    for (offset = event->metadata_len; offset + sizeof(*info) <= event->event_len; offset += info->hdr.len){
+
+        info = (const struct fanotify_event_info_fid*)((const char*)event + offset);
+        if (!info->hdr.len){
+            break;
+        }
+
+        if (info->hdr.info_type != FAN_EVENT_INFO_TYPE_DFID_NAME){
+            continue;
+        }
+
+        handle = (PWATCH_FILE_HANDLE)info->handle;
+        name = (const char*)handle->handle + handle->handleBytes;
+
+        dirFd = (int)syscall(SYS_open_by_handle_at, watch->rootFd, handle, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dirFd < 0){
+            return deepviz_false;
+        }
+
+        snprintf(link, sizeof(link), "/proc/self/fd/%d", dirFd);
+        pathLen = readlink(link, path, pathSize - 1);
+        close(dirFd);
+
+        if (pathLen < 0 || (size_t)pathLen + strlen(name) + 2 > pathSize){
+            return deepviz_false;
+        }
+
+        path[pathLen] = '/';
+        memcpy(path + pathLen + 1, name, strlen(name) + 1);
+
+        return deepviz_true;
+    }
+
+    return deepviz_false;
+}
+#endif
+
+
+/* fanotify reports the files closed after writing (and, where supported, the entries moved in) anywhere in the
+mount: keep the ones in the folder */
+static void watch_read_fanotify(PDEEPVIZ_WATCH watch, const unsigned char* buffer, size_t bufferLen){
+
+    const struct fanotify_event_metadata    *event = (const struct fanotify_event_metadata*)buffer;
+    int                                     len = (int)bufferLen;
+    char                                    link[64];
+    char                                    path[DEEPVIZ_FILEPATH_MAX_LEN];
+    ssize_t                                 pathLen;
+
+    for (; FAN_EVENT_OK(event, len); event = FAN_EVENT_NEXT(event, len)){
+
+        if (event->mask & FAN_Q_OVERFLOW){
+            dvz_walk_folder(watch->folder, DEEPVIZ_SYMLINK_SKIP, watch->crossDevice, watch_rescan_routine, watch);
+            continue;
+        }
+
+        if (event->fd >= 0){
+            snprintf(link, sizeof(link), "/proc/self/fd/%d", event->fd);
+            pathLen = readlink(link, path, sizeof(path) - 1);
+            close(event->fd);
+
+            if (pathLen < 0){
+                continue;
+            }
+            path[pathLen] = 0;
+        }
+#ifdef WATCH_FANOTIFY_NAMES
+        else if (!watch->fanotifyNames || !watch_fanotify_name(watch, event, path, sizeof(path))){
+            continue;
+        }
+#else
+        else {
+            continue;
+        }
+#endif
+
+        if (strlen(path) <= watch->folderLen || memcmp(path, watch->folder, watch->folderLen) || path[watch->folderLen] != '/'){
+            continue;
+        }
+
+        if (event->mask & FAN_ONDIR){
+            /* Folder moved in: its files are pending too */
+            dvz_walk_folder(path, DEEPVIZ_SYMLINK_SKIP, watch->crossDevice, watch_rescan_routine, watch);
+        }
+        else {
+            watch_pending_touch(watch, path, deepviz_true);
+        }
+    }
+}
+
+
+static void watch_thread(void* param){
+
+    PDEEPVIZ_WATCH  watch = (PDEEPVIZ_WATCH)param;
+    unsigned char   *buffer;
+    struct pollfd   fds[2];
+    ssize_t         bufferLen;
+
+    /* Aligned for the event structures */
+    buffer = (unsigned char*)malloc(WATCH_BUFFER_SIZE);
+    if (!buffer){
+        return;
+    }
+
+    fds[0].fd = watch->fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = watch->stopPipe[0];
+    fds[1].events = POLLIN;
+
+    while (!watch->jobStopped){
+
+        if (poll(fds, 2, watch->pendingNumber ? (int)watch_wakeup(watch) : -1) < 0){
+            continue;
+        }
+
+        if (fds[1].revents){
+            break;
+        }
+
+        if (fds[0].revents & POLLIN){
+            while ((bufferLen = read(watch->fd, buffer, WATCH_BUFFER_SIZE)) > 0){
+                if (watch->fanotify){
+                    watch_read_fanotify(watch, buffer, (size_t)bufferLen);
+                }
+                else {
+                    watch_read_inotify(watch, buffer, (size_t)bufferLen);
+                }
+            }
+        }
+
+        watch_flush(watch, deepviz_false);
+    }
+
+    free(buffer);
+}
+
+
+static deepviz_bool watch_open(PDEEPVIZ_WATCH watch, deepviz_bool wholeMount){
+
+    struct stat st;
+
+    if (stat(watch->folder, &st) || !S_ISDIR(st.st_mode)){
+        return deepviz_false;
+    }
+
+    watch->rootDev = st.st_dev;
+
+    if (pipe(watch->stopPipe)){
+        return deepviz_false;
+    }
+
+    /* fanotify needs CAP_SYS_ADMIN: fall back to inotify */
+    if (wholeMount){
+
+#ifdef WATCH_FANOTIFY_NAMES
+        /* Directory entry events need a filesystem mark: the files moved into the folder are seen too */
+        watch->fd = fanotify_init(FAN_CLASS_NOTIF | FAN_CLOEXEC | FAN_NONBLOCK | FAN_REPORT_DFID_NAME, O_RDONLY | O_CLOEXEC);
+        if (watch->fd >= 0){
+            watch->rootFd = open(watch->folder, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if (watch->rootFd >= 0){
+                if (!fanotify_mark(watch->fd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM, FAN_CLOSE_WRITE | FAN_MOVED_TO | FAN_ONDIR,
+                    AT_FDCWD, watch->folder)){
+                    watch->fanotify = deepviz_true;
+                    watch->fanotifyNames = deepviz_true;
+                    return deepviz_true;
+                }
+                close(watch->rootFd);
+            }
+            close(watch->fd);
+        }
+#endif
+
+        watch->fd = fanotify_init(FAN_CLASS_NOTIF | FAN_CLOEXEC | FAN_NONBLOCK, O_RDONLY | O_CLOEXEC);
+        if (watch->fd >= 0){
+            if (!fanotify_mark(watch->fd, FAN_MARK_ADD | FAN_MARK_MOUNT, FAN_CLOSE_WRITE, AT_FDCWD, watch->folder)){
+                watch->fanotify = deepviz_true;
+                return deepviz_true;
+            }
+            close(watch->fd);
+        }
+    }
+
+    watch->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watch->fd < 0){
+        close(watch->stopPipe[0]);
+        close(watch->stopPipe[1]);
+        return deepviz_false;
+    }
+
+    watch_add_tree(watch, watch->folder, deepviz_false);
+
+    return deepviz_true;
+}
+
+
+static void watch_wake(PDEEPVIZ_WATCH watch){
+
+    char    stop = 0;
+
+    if (write(watch->stopPipe[1], &stop, 1) < 0){
+        /* Nothing else to do */
+    }
+}
+
+
+static void watch_close(PDEEPVIZ_WATCH watch){
+
+    size_t  i;
+
+    close(watch->fd);
+    close(watch->stopPipe[0]);
+    close(watch->stopPipe[1]);
+
+    if (watch->fanotifyNames){
+        close(watch->rootFd);
+    }
+
+    for (i = 0; i < watch->dirNumber; i++){
+        if (watch->dirs[i]) free(watch->dirs[i]);
+    }
+
+    if (watch->dirs) free(watch->dirs);
+}
+
+#endif
+
+
+EXPORT void deepviz_watch_default_config(PDEEPVIZ_WATCH_CONFIG config){
+
+    if (!config){
+        return;
+    }
+
+    deepviz_upload_default_config(&config->upload);
+    config->settleMs = DEEPVIZ_WATCH_DEFAULT_SETTLE_MS;
+    config->wholeMount = deepviz_false;
+}
+
+
+EXPORT PDEEPVIZ_RESULT deepviz_watch_start( const char* api_key,
+                                            const char* folder,
+                                            PDEEPVIZ_WATCH_CONFIG config,
+                                            PDEEPVIZ_WATCH* watch){
+
+    PDEEPVIZ_WATCH          newWatch;
+    DEEPVIZ_WATCH_CONFIG    defaultConfig;
+    char                    *retMsg;
+    DEEPVIZ_RESULT_STATUS   status;
+    PDEEPVIZ_CANCEL_TOKEN   previousToken;
+    deepviz_bool            started;
+
+    retMsg = (char*)malloc(DEEPVIZ_ERROR_MAX_LEN);
+    if (!retMsg){
+        return deepviz_result_init(DEEPVIZ_STATUS_INTERNAL_ERROR, NULL);
+    }
+
+    if (!api_key || !folder || !watch){
+        deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Invalid or missing parameters. Please try again!");
+        return deepviz_result_init(DEEPVIZ_STATUS_INPUT_ERROR, retMsg);
+    }
+
+    (*watch) = NULL;
+
+    if (!config){
+        deepviz_watch_default_config(&defaultConfig);
+        config = &defaultConfig;
+    }
+
+    newWatch = (PDEEPVIZ_WATCH)malloc(sizeof(DEEPVIZ_WATCH));
+    if (!newWatch){
+        deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Memory allocation error");
+        return deepviz_result_init(DEEPVIZ_STATUS_INTERNAL_ERROR, retMsg);
+    }
+
+    memset(newWatch, 0, sizeof(DEEPVIZ_WATCH));
+    newWatch->settleMs = config->settleMs;
+    newWatch->crossDevice = config->upload.crossDevice;
+
+#ifdef _WIN32
+    newWatch->folder = _strdup(folder);
+#else
+    /* fanotify reports canonical paths */
+    newWatch->folder = realpath(folder, NULL);
+#endif
+    if (!newWatch->folder){
+        free(newWatch);
+        deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Invalid folder");
+        return deepviz_result_init(DEEPVIZ_STATUS_INPUT_ERROR, retMsg);
+    }
+
+    newWatch->folderLen = strlen(newWatch->folder);
+
+    if (!watch_open(newWatch, config->wholeMount)){
+        free(newWatch->folder);
+        free(newWatch);
+        deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Error watching folder %s", folder);
+        return deepviz_result_init(DEEPVIZ_STATUS_INPUT_ERROR, retMsg);
+    }
+
+    /* The watch outlives the call: its threads must not inherit the caller's token */
+    previousToken = deepviz_cancel_token_attach(NULL);
+
+    newWatch->job = dvz_upload_job_start(api_key, &config->upload, &status, retMsg);
+    if (!newWatch->job){
+        deepviz_cancel_token_attach(previousToken);
+        watch_close(newWatch);
+        free(newWatch->folder);
+        free(newWatch);
+        return deepviz_result_init(status, retMsg);
+    }
+
+    started = dvz_thread_create(&newWatch->thread, watch_thread, newWatch);
+    deepviz_cancel_token_attach(previousToken);
+
+    if (!started){
+        dvz_upload_job_finish(newWatch->job, NULL, retMsg);
+        watch_close(newWatch);
+        watch_pending_free(newWatch);
+        free(newWatch->folder);
+        free(newWatch);
+        deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Error creating the watch thread");
+        return deepviz_result_init(DEEPVIZ_STATUS_INTERNAL_ERROR, retMsg);
+    }
+
+    (*watch) = newWatch;
+
+    deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Watching folder %s", folder);
+    return deepviz_result_init(DEEPVIZ_STATUS_SUCCESS, retMsg);
+}
+
+
+EXPORT PDEEPVIZ_RESULT deepviz_watch_stop(PDEEPVIZ_WATCH* watch, PDEEPVIZ_UPLOAD_SUMMARY summary){
+
+    PDEEPVIZ_WATCH          oldWatch;
+    char                    *retMsg;
+    DEEPVIZ_RESULT_STATUS   status;
+
+    retMsg = (char*)malloc(DEEPVIZ_ERROR_MAX_LEN);
+    if (!retMsg){
+        return deepviz_result_init(DEEPVIZ_STATUS_INTERNAL_ERROR, NULL);
+    }
+
+    if (!watch || !(*watch)){
+        deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Invalid or missing parameters. Please try again!");
+        return deepviz_result_init(DEEPVIZ_STATUS_INPUT_ERROR, retMsg);
+    }
+
+    oldWatch = (*watch);
+    (*watch) = NULL;
+
+    watch_wake(oldWatch);
+    dvz_thread_join(oldWatch->thread);
+
+    /* The files completely written are uploaded without waiting; the ones still open are dropped */
+    watch_flush(oldWatch, deepviz_true);
+    watch_pending_free(oldWatch);
+
+    status = dvz_upload_job_finish(oldWatch->job, summary, retMsg);
+    if (status == DEEPVIZ_STATUS_SUCCESS){
+        deepviz_sprintf(retMsg, DEEPVIZ_ERROR_MAX_LEN, "Watched files uploaded to Deepviz successfully");
+    }
+
+    watch_close(oldWatch);
+    free(oldWatch->folder);
+    free(oldWatch);
+
+    return deepviz_result_init(status, retMsg);
+}
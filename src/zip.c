@@ -0,0 +1,568 @@
+/*
+* Copyright (c) 2016 Saferbytes s.r.l.s.
+*
+* You can redistribute it and/or modify it under the terms of the MIT license.
+* See LICENSE for details.
+*/
+
+#include "c-deepviz.h"
+#include "c-deepviz_private.h"
+
+#ifdef DEEPVIZ_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#define     ZIP_LOCAL_HEADER_SIG        0x04034b50
+#define     ZIP_DESCRIPTOR_SIG          0x08074b50
+#define     ZIP_CENTRAL_HEADER_SIG      0x02014b50
+#define     ZIP_END_SIG                 0x06054b50
+#define     ZIP_LOCAL_HEADER_LEN        30
+#define     ZIP_ZIP64_EXTRA_ID          0x0001
+
+#define     ZIP_FLAG_ENCRYPTED          0x0001
+#define     ZIP_FLAG_DESCRIPTOR         0x0008
+
+#define     ZIP_METHOD_STORED           0
+#define     ZIP_METHOD_DEFLATE          8
+
+#define     ZIP_OUTPUT_CHUNK            65536
+
+typedef enum _ZIP_READER_STATE {
+    ZIP_STATE_HEADER,
+    ZIP_STATE_NAME,
+    ZIP_STATE_DATA,
+    ZIP_STATE_DESCRIPTOR,
+    ZIP_STATE_END,
+    ZIP_STATE_ERROR,
+} ZIP_READER_STATE;
+
+struct _DEEPVIZ_ZIP_READER{
+    DEEPVIZ_ZIP_HANDLER     handler;
+    ZIP_READER_STATE        state;
+
+    /* Header, name and descriptor bytes are accumulated here */
+    unsigned char           *buffer;
+    size_t                  bufferLen;
+    size_t                  bufferSize;
+    size_t                  need;
+
+    /* Current entry */
+    unsigned int            flags;
+    unsigned int            method;
+    unsigned int            expectedCrc;
+    unsigned int            crc;
+    unsigned long long      compSize;
+    unsigned long long      consumed;
+    deepviz_bool            zip64;
+    deepviz_bool            wanted;
+    deepviz_bool            inEntry;
+
+#ifdef DEEPVIZ_HAVE_ZLIB
+    z_stream                inflater;
+    deepviz_bool            inflaterInit;
+    unsigned char           *output;
+#endif
+};
+
+
+static unsigned int crcTable[256];
+static DEEPVIZ_ONCE crcTableOnce = DEEPVIZ_ONCE_INIT;
+
+static void crc32_init_table(void){
+
+    unsigned int    c;
+    unsigned int    n;
+    int             k;
+
+    for (n = 0; n < 256; n++){
+        c = n;
+        for (k = 0; k < 8; k++){
+            c = (c & 1) ? (0xEDB88320U ^ (c >> 1)) : (c >> 1);
+        }
+        crcTable[n] = c;
+    }
+}
+
+
+static unsigned int crc32_update(unsigned int crc, const unsigned char* data, size_t dataLen){
+
+#ifdef DEEPVIZ_HAVE_ZLIB
+    /* zlib CRC is much faster than the byte-wise table below */
+    while (dataLen > 0){
+        uInt len = dataLen > 0x40000000 ? 0x40000000 : (uInt)dataLen;
+        crc = (unsigned int)crc32(crc, data, len);
+        data += len;
+        dataLen -= len;
+    }
+    return crc;
+#else
+    size_t i;
+
+    crc = ~crc;
+    for (i = 0; i < dataLen; i++){
+        crc = crcTable[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+#endif
+}
+
+
+static unsigned int read_le16(const unsigned char* p){
+    return (unsigned int)p[0] | ((unsigned int)p[1] << 8);
+}
+
+static unsigned int read_le32(const unsigned char* p){
+    return (unsigned int)p[0] | ((unsigned int)p[1] << 8) | ((unsigned int)p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+static unsigned long long read_le64(const unsigned char* p){
+    return (unsigned long long)read_le32(p) | ((unsigned long long)read_le32(p + 4) << 32);
+}
+
+
+/* Accumulate bytes in the reader buffer until "reader->need" bytes are available */
+static deepviz_bool zip_accumulate(PDEEPVIZ_ZIP_READER reader, const unsigned char** data, size_t* dataLen){
+
+    size_t          copyLen;
+    unsigned char   *tmp;
+
+    if (reader->bufferSize < reader->need){
+        tmp = (unsigned char*)realloc(reader->buffer, reader->need);
+        if (!tmp){
+            return deepviz_false;
+        }
+        reader->buffer = tmp;
+        reader->bufferSize = reader->need;
+    }
+
+    copyLen = reader->need - reader->bufferLen;
+    if (copyLen > (*dataLen)){
+        copyLen = (*dataLen);
+    }
+
+    memcpy(reader->buffer + reader->bufferLen, (*data), copyLen);
+    reader->bufferLen += copyLen;
+    (*data) += copyLen;
+    (*dataLen) -= copyLen;
+
+    return deepviz_true;
+}
+
+
+static void zip_entry_end(PDEEPVIZ_ZIP_READER reader, deepviz_bool success){
+
+    if (reader->inEntry && reader->wanted && reader->handler.entryEnd){
+        reader->handler.entryEnd(reader->handler.context, success);
+    }
+
+    reader->inEntry = deepviz_false;
+
+#ifdef DEEPVIZ_HAVE_ZLIB
+    if (reader->inflaterInit){
+        inflateEnd(&reader->inflater);
+        reader->inflaterInit = deepviz_false;
+    }
+#endif
+}
+
+
+static deepviz_bool zip_fail(PDEEPVIZ_ZIP_READER reader, char* errorMsg, const char* msg){
+
+    zip_entry_end(reader, deepviz_false);
+    reader->state = ZIP_STATE_ERROR;
+    if (errorMsg){
+        deepviz_sprintf(errorMsg, DEEPVIZ_ERROR_MAX_LEN, "ZIP archive error: %s", msg);
+    }
+    return deepviz_false;
+}
+
+
+static deepviz_bool zip_emit(PDEEPVIZ_ZIP_READER reader, const unsigned char* data, size_t dataLen){
+
+    reader->crc = crc32_update(reader->crc, data, dataLen);
+
+    if (reader->wanted && reader->handler.entryData){
+        return reader->handler.entryData(reader->handler.context, data, dataLen);
+    }
+
+    return deepviz_true;
+}
+
+
+/* Local header and name have been read: set up the current entry */
+static deepviz_bool zip_begin_entry(PDEEPVIZ_ZIP_READER reader, char* errorMsg){
+
+    unsigned int        nameLen;
+    unsigned int        extraLen;
+    unsigned int        fieldId;
+    unsigned int        fieldLen;
+    unsigned char       *extra;
+    char                *name;
+
+    nameLen = read_le16(reader->buffer + 26);
+    extraLen = read_le16(reader->buffer + 28);
+
+    reader->flags = read_le16(reader->buffer + 6);
+    reader->method = read_le16(reader->buffer + 8);
+    reader->expectedCrc = read_le32(reader->buffer + 14);
+    reader->compSize = read_le32(reader->buffer + 18);
+    reader->consumed = 0;
+    reader->crc = 0;
+    reader->zip64 = deepviz_false;
+
+    /* Look for ZIP64 sizes */
+    extra = reader->buffer + ZIP_LOCAL_HEADER_LEN + nameLen;
+    while (extraLen >= 4){
+        fieldId = read_le16(extra);
+        fieldLen = read_le16(extra + 2);
+        if (fieldLen + 4 > extraLen){
+            break;
+        }
+        if (fieldId == ZIP_ZIP64_EXTRA_ID){
+            reader->zip64 = deepviz_true;
+            if (fieldLen >= 16){
+                reader->compSize = read_le64(extra + 12);
+            }
+        }
+        extra += fieldLen + 4;
+        extraLen -= fieldLen + 4;
+    }
+
+    if (reader->flags & ZIP_FLAG_ENCRYPTED){
+        return zip_fail(reader, errorMsg, "encrypted entries are not supported");
+    }
+
+    if (reader->method == ZIP_METHOD_STORED && (reader->flags & ZIP_FLAG_DESCRIPTOR)){
+        return zip_fail(reader, errorMsg, "stored entries of unknown size are not supported");
+    }
+
+    if (reader->method == ZIP_METHOD_DEFLATE){
+#ifdef DEEPVIZ_HAVE_ZLIB
+        memset(&reader->inflater, 0, sizeof(z_stream));
+        if (inflateInit2(&reader->inflater, -MAX_WBITS) != Z_OK){
+            return zip_fail(reader, errorMsg, "unable to initialize the inflater");
+        }
+        reader->inflaterInit = deepviz_true;
+#else
+        return zip_fail(reader, errorMsg, "deflated entries are not supported on this platform");
+#endif
+    }
+    else if (reader->method != ZIP_METHOD_STORED){
+        return zip_fail(reader, errorMsg, "unsupported compression method");
+    }
+
+    /* Zero terminated copy of the entry name */
+    name = (char*)malloc(nameLen + 1);
+    if (!name){
+        return zip_fail(reader, errorMsg, "memory allocation error");
+    }
+    memcpy(name, reader->buffer + ZIP_LOCAL_HEADER_LEN, nameLen);
+    name[nameLen] = 0;
+
+    reader->inEntry = deepviz_true;
+    reader->wanted = reader->handler.entryBegin ? reader->handler.entryBegin(reader->handler.context, name) : deepviz_false;
+
+    free(name);
+
+    return deepviz_true;
+}
+
+
+static deepviz_bool zip_data_done(PDEEPVIZ_ZIP_READER reader, char* errorMsg){
+
+    reader->bufferLen = 0;
+
+    if (reader->flags & ZIP_FLAG_DESCRIPTOR){
+        /* Optional signature + CRC + sizes, check the signature first */
+        reader->need = 4;
+        reader->state = ZIP_STATE_DESCRIPTOR;
+        return deepviz_true;
+    }
+
+    if (reader->crc != reader->expectedCrc){
+        return zip_fail(reader, errorMsg, "CRC mismatch");
+    }
+
+    zip_entry_end(reader, deepviz_true);
+
+    reader->need = 4;
+    reader->state = ZIP_STATE_HEADER;
+    return deepviz_true;
+}
+
+
+PDEEPVIZ_ZIP_READER dvz_zip_reader_init(PDEEPVIZ_ZIP_HANDLER handler){
+
+    PDEEPVIZ_ZIP_READER reader;
+
+    dvz_once(&crcTableOnce, crc32_init_table);
+
+    reader = (PDEEPVIZ_ZIP_READER)malloc(sizeof(DEEPVIZ_ZIP_READER));
+    if (!reader){
+        return NULL;
+    }
+
+    memset(reader, 0, sizeof(DEEPVIZ_ZIP_READER));
+
+    if (handler){
+        reader->handler = *handler;
+    }
+
+#ifdef DEEPVIZ_HAVE_ZLIB
+    reader->output = (unsigned char*)malloc(ZIP_OUTPUT_CHUNK);
+    if (!reader->output){
+        free(reader);
+        return NULL;
+    }
+#endif
+
+    reader->state = ZIP_STATE_HEADER;
+    reader->need = 4;
+
+    return reader;
+}
+
+
+deepviz_bool dvz_zip_reader_feed(PDEEPVIZ_ZIP_READER reader, const void* data, size_t dataLen, char* errorMsg){
+
+    const unsigned char     *p = (const unsigned char*)data;
+    unsigned int            signature;
+    unsigned long long      remaining;
+    size_t                  chunkLen;
+#ifdef DEEPVIZ_HAVE_ZLIB
+    int                     ret;
+    size_t                  inputLen;
+#endif
+
+    while (dataLen > 0){
+
+        switch (reader->state){
+
+        case ZIP_STATE_HEADER:
+
+            if (!zip_accumulate(reader, &p, &dataLen)){
+                return zip_fail(reader, errorMsg, "memory allocation error");
+            }
+            if (reader->bufferLen < reader->need){
+                break;
+            }
+
+            if (reader->need == 4){
+                signature = read_le32(reader->buffer);
+                if (signature == ZIP_CENTRAL_HEADER_SIG || signature == ZIP_END_SIG){
+                    /* No more entries, the central directory is not needed */
+                    reader->state = ZIP_STATE_END;
+                    break;
+                }
+                if (signature != ZIP_LOCAL_HEADER_SIG){
+                    return zip_fail(reader, errorMsg, "invalid local header");
+                }
+                reader->need = ZIP_LOCAL_HEADER_LEN;
+                break;
+            }
+
+            /* Local header complete, read name and extra field */
+            reader->need = ZIP_LOCAL_HEADER_LEN + read_le16(reader->buffer + 26) + read_le16(reader->buffer + 28);
+            reader->state = ZIP_STATE_NAME;
+            break;
+
+        case ZIP_STATE_NAME:
+
+            if (!zip_accumulate(reader, &p, &dataLen)){
+                return zip_fail(reader, errorMsg, "memory allocation error");
+            }
+            if (reader->bufferLen < reader->need){
+                break;
+            }
+
+            if (!zip_begin_entry(reader, errorMsg)){
+                return deepviz_false;
+            }
+
+            reader->state = ZIP_STATE_DATA;
+
+            if (reader->method == ZIP_METHOD_STORED && reader->compSize == 0){
+                if (!zip_data_done(reader, errorMsg)){
+                    return deepviz_false;
+                }
+            }
+            break;
+
+        case ZIP_STATE_DATA:
+
+            if (reader->method == ZIP_METHOD_STORED){
+
+                remaining = reader->compSize - reader->consumed;
+                chunkLen = remaining < dataLen ? (size_t)remaining : dataLen;
+
+                if (!zip_emit(reader, p, chunkLen)){
+                    return zip_fail(reader, errorMsg, "extraction aborted");
+                }
+
+                p += chunkLen;
+                dataLen -= chunkLen;
+                reader->consumed += chunkLen;
+
+                if (reader->consumed == reader->compSize){
+                    if (!zip_data_done(reader, errorMsg)){
+                        return deepviz_false;
+                    }
+                }
+                break;
+            }
+
+#ifdef DEEPVIZ_HAVE_ZLIB
+            /* Deflate: the end of the entry is detected by the inflater itself */
+            inputLen = dataLen > 0x40000000 ? 0x40000000 : dataLen;
+            reader->inflater.next_in = (Bytef*)p;
+            reader->inflater.avail_in = (uInt)inputLen;
+
+            do{
+                reader->inflater.next_out = reader->output;
+                reader->inflater.avail_out = ZIP_OUTPUT_CHUNK;
+
+                ret = inflate(&reader->inflater, Z_NO_FLUSH);
+                if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR){
+                    return zip_fail(reader, errorMsg, "corrupted deflate stream");
+                }
+
+                if (!zip_emit(reader, reader->output, ZIP_OUTPUT_CHUNK - reader->inflater.avail_out)){
+                    return zip_fail(reader, errorMsg, "extraction aborted");
+                }
+
+            } while (ret != Z_STREAM_END && reader->inflater.avail_out == 0);
+
+            /* Skip the consumed input bytes */
+            chunkLen = inputLen - reader->inflater.avail_in;
+            p += chunkLen;
+            dataLen -= chunkLen;
+            reader->consumed += chunkLen;
+
+            if (ret == Z_STREAM_END){
+                if (!zip_data_done(reader, errorMsg)){
+                    return deepviz_false;
+                }
+            }
+#endif
+            break;
+
+        case ZIP_STATE_DESCRIPTOR:
+
+            if (!zip_accumulate(reader, &p, &dataLen)){
+                return zip_fail(reader, errorMsg, "memory allocation error");
+            }
+            if (reader->bufferLen < reader->need){
+                break;
+            }
+
+            if (reader->need == 4){
+                /* CRC + compressed and uncompressed sizes, after the optional signature */
+                reader->need = (reader->zip64 ? 20 : 12) + (read_le32(reader->buffer) == ZIP_DESCRIPTOR_SIG ? 4 : 0);
+                break;
+            }
+
+            reader->expectedCrc = read_le32(reader->buffer + (read_le32(reader->buffer) == ZIP_DESCRIPTOR_SIG ? 4 : 0));
+            if (reader->crc != reader->expectedCrc){
+                return zip_fail(reader, errorMsg, "CRC mismatch");
+            }
+
+            zip_entry_end(reader, deepviz_true);
+
+            reader->bufferLen = 0;
+            reader->need = 4;
+            reader->state = ZIP_STATE_HEADER;
+            break;
+
+        case ZIP_STATE_END:
+            /* Central directory, ignored */
+            return deepviz_true;
+
+        case ZIP_STATE_ERROR:
+        default:
+            if (errorMsg){
+                deepviz_sprintf(errorMsg, DEEPVIZ_ERROR_MAX_LEN, "ZIP archive error");
+            }
+            return deepviz_false;
+        }
+    }
+
+    return deepviz_true;
+}
+
+
+deepviz_bool dvz_zip_reader_finish(PDEEPVIZ_ZIP_READER reader, char* errorMsg){
+
+    if (reader->state == ZIP_STATE_END){
+        return deepviz_true;
+    }
+
+    if (reader->state != ZIP_STATE_ERROR){
+        return zip_fail(reader, errorMsg, "truncated archive");
+    }
+
+    if (errorMsg){
+        deepviz_sprintf(errorMsg, DEEPVIZ_ERROR_MAX_LEN, "ZIP archive error");
+    }
+    return deepviz_false;
+}
+
+
+void dvz_zip_reader_free(PDEEPVIZ_ZIP_READER *reader){
+
+    if (!reader || !(*reader)){
+        return;
+    }
+
+    zip_entry_end(*reader, deepviz_false);
+
+#ifdef DEEPVIZ_HAVE_ZLIB
+    free((*reader)->output);
+#endif
+    if ((*reader)->buffer) free((*reader)->buffer);
+
+    free(*reader);
+    (*reader) = NULL;
+}
+
+
+deepviz_bool dvz_zip_extract_file(const char* zipPath, PDEEPVIZ_ZIP_HANDLER handler, char* errorMsg){
+
+    PDEEPVIZ_ZIP_READER     reader;
+    FILE                    *file;
+    unsigned char           *buffer;
+    size_t                  readLen;
+    deepviz_bool            bRet = deepviz_true;
+
+    file = fopen(zipPath, "rb");
+    if (!file){
+        deepviz_sprintf(errorMsg, DEEPVIZ_ERROR_MAX_LEN, "Unable to open file. errno: %d", errno);
+        return deepviz_false;
+    }
+
+    buffer = (unsigned char*)malloc(ZIP_OUTPUT_CHUNK);
+    reader = dvz_zip_reader_init(handler);
+    if (!buffer || !reader){
+        if (buffer) free(buffer);
+        dvz_zip_reader_free(&reader);
+        fclose(file);
+        deepviz_sprintf(errorMsg, DEEPVIZ_ERROR_MAX_LEN, "Memory allocation error");
+        return deepviz_false;
+    }
+
+    while ((readLen = fread(buffer, 1, ZIP_OUTPUT_CHUNK, file)) > 0){
+        bRet = dvz_zip_reader_feed(reader, buffer, readLen, errorMsg);
+        if (!bRet){
+            break;
+        }
+    }
+
+    if (bRet){
+        bRet = dvz_zip_reader_finish(reader, errorMsg);
+    }
+
+    dvz_zip_reader_free(&reader);
+    free(buffer);
+    fclose(file);
+
+    return bRet;
+}